@@ -8,17 +8,198 @@
 
 #if USE_PROFILER
 // Define the placeholders for setting checkpoints.
-#define PROFILER_HOOK() ::time_profiler::TimeProfiler::tick(__FILE__, __LINE__, __FUNCTION__);
-// #define xxx ::time_profiler::TimeProfiler::tick(__FILE__, __LINE__, __FUNCTION__);
-// #define ___ ::time_profiler::TimeProfiler::tick(__FILE__, __LINE__, __FUNCTION__);
+// Every hook site registers itself once in a static descriptor, so that a hit
+// only passes the compact site ID to the profiler.
+#define PROFILER_HOOK()                                                                     \
+    {                                                                                       \
+        static const ::time_profiler::Site &time_profiler_site_ =                           \
+            ::time_profiler::SiteRegistry::register_site(__FILE__, __LINE__, __FUNCTION__); \
+        ::time_profiler::TimeProfiler::tick(time_profiler_site_.id);                         \
+    }
+// Helpers that paste the line number into the names of variables.
+#define TIME_PROFILER_CONCAT_IMPL(a, b) a##b
+#define TIME_PROFILER_CONCAT(a, b) TIME_PROFILER_CONCAT_IMPL(a, b)
+// Define the placeholder for a zone that is measured from here to the end of
+// the enclosing scope.
+#define PROFILER_SCOPE(name)                                                                         \
+    static const ::time_profiler::Site &TIME_PROFILER_CONCAT(time_profiler_zone_site_, __LINE__) =   \
+        ::time_profiler::SiteRegistry::register_site(__FILE__, __LINE__, __FUNCTION__, name);        \
+    const ::time_profiler::ScopedZone TIME_PROFILER_CONCAT(time_profiler_zone_, __LINE__)(          \
+        TIME_PROFILER_CONCAT(time_profiler_zone_site_, __LINE__).id);
+// Define the placeholder for a checkpoint of the given Category, which can be
+// switched on and off at run time. Categories outside of
+// TIME_PROFILER_CATEGORY_MASK are removed at compile time. A disabled site
+// only tests its cached switch.
+#define PROFILER_HOOK_CAT(category)                                                                      \
+    {                                                                                                    \
+        if constexpr (::time_profiler::is_compiled(category))                                            \
+        {                                                                                                \
+            static const ::time_profiler::SiteSwitch time_profiler_switch_ =                             \
+                ::time_profiler::CategoryConfig::register_site(__FILE__, __LINE__, __FUNCTION__, category); \
+            if (time_profiler_switch_.enabled->load(std::memory_order_relaxed))                          \
+                ::time_profiler::TimeProfiler::tick(time_profiler_switch_.site_id);                      \
+        }                                                                                                \
+    }
+// Define the placeholder for a checkpoint that is told apart by a label given
+// at run time, e.g. a request type or a shard. Every distinct label becomes a
+// site of its own; labels beyond the limits of NamedSite share one site.
+#define PROFILER_HOOK_NAMED(label)                                                                   \
+    {                                                                                                \
+        static ::time_profiler::NamedSite time_profiler_named_site_(__FILE__, __LINE__, __FUNCTION__); \
+        ::time_profiler::TimeProfiler::tick(time_profiler_named_site_.get_site_id(label));           \
+    }
+// Define the placeholder for a logical task, e.g. a coroutine, that is timed
+// from here to the end of the enclosing scope, across suspensions. Awaiting
+// through PROFILER_CO_AWAIT() tells the task when it is suspended. At most one
+// task per scope.
+#define PROFILER_TASK(name)                                                                          \
+    static ::time_profiler::TaskTable::Counters &TIME_PROFILER_CONCAT(time_profiler_task_site_, __LINE__) = \
+        ::time_profiler::TaskTable::register_site(__FILE__, __LINE__, __FUNCTION__, name);           \
+    ::time_profiler::TaskSpan time_profiler_task_(TIME_PROFILER_CONCAT(time_profiler_task_site_, __LINE__));
+// Define the placeholder for awaiting the given expression within the task of
+// PROFILER_TASK().
+#define PROFILER_CO_AWAIT(expression) co_await time_profiler_task_.wrap(expression)
+// Define the placeholder for a benchmark of the following statement or block,
+// which runs the given number of iterations per trial, in warmup and measured
+// trials, see BenchRun. PROFILER_BENCH_VS() compares the benchmark with the
+// one of the given name.
+#define PROFILER_BENCH(name, iterations) PROFILER_BENCH_VS(name, "", iterations)
+#define PROFILER_BENCH_VS(name, baseline, iterations)                                                  \
+    for (::time_profiler::BenchRun time_profiler_bench_(__FILE__, __LINE__, __FUNCTION__, name, baseline, \
+                                                        iterations);                                   \
+         time_profiler_bench_.next();)
+// Define the placeholder for a profiling context of the given type, e.g. a
+// kind of request, that is active from here to the end of the enclosing
+// scope. Contexts that take at least the given threshold, a
+// std::chrono::duration, keep their breakdown into pairs of checkpoints. The
+// name must be the same on every pass.
+#define PROFILER_CONTEXT(name, threshold)                                                               \
+    static ::time_profiler::ContextType &TIME_PROFILER_CONCAT(time_profiler_context_type_, __LINE__) =   \
+        ::time_profiler::ContextRegistry::register_type(name, threshold);                               \
+    ::time_profiler::ProfilingContext TIME_PROFILER_CONCAT(time_profiler_context_, __LINE__)(            \
+        TIME_PROFILER_CONCAT(time_profiler_context_type_, __LINE__), true);
+// Define the placeholder for a tag, e.g. a request ID, that the slowest
+// segments of the calling thread are recorded with until the end of the
+// enclosing scope.
+#define PROFILER_EXEMPLAR_TAG(tag) \
+    const ::time_profiler::ScopedExemplarTag TIME_PROFILER_CONCAT(time_profiler_exemplar_tag_, __LINE__)(tag);
 #else
 #define PROFILER_HOOK()
+#define PROFILER_SCOPE(name)
+#define PROFILER_HOOK_CAT(category)
+#define PROFILER_HOOK_NAMED(label)
+#define PROFILER_TASK(name)
+#define PROFILER_CO_AWAIT(expression) co_await(expression)
+#define PROFILER_EXEMPLAR_TAG(tag)
+#define PROFILER_CONTEXT(name, threshold)
+#define PROFILER_BENCH(name, iterations) for (int time_profiler_bench_ = 0; time_profiler_bench_ < 1; time_profiler_bench_++)
+#define PROFILER_BENCH_VS(name, baseline, iterations) PROFILER_BENCH(name, iterations)
+#endif
+
+// Categories of hook sites that are compiled in, as a mask of their bits.
+// Hooks of all other categories expand to nothing.
+#ifndef TIME_PROFILER_CATEGORY_MASK
+#define TIME_PROFILER_CATEGORY_MASK (~0ull)
+#endif
+
+// Maximum number of distinct labels of PROFILER_HOOK_NAMED() in the process.
+#ifndef TIME_PROFILER_MAX_LABELS
+#define TIME_PROFILER_MAX_LABELS 4096
+#endif
+
+// Number of slowest segments that every pair of checkpoints keeps as
+// exemplars, 0 to keep none.
+#ifndef TIME_PROFILER_EXEMPLARS
+#define TIME_PROFILER_EXEMPLARS 8
+#endif
+
+// Clocks that can be selected as TIME_PROFILER_CLOCK.
+#define TIME_PROFILER_STEADY_CLOCK 0
+#define TIME_PROFILER_SYSTEM_CLOCK 1
+#define TIME_PROFILER_TSC_CLOCK 2
+
+// Use the monotonic steady clock if the user did not select another clock.
+#ifndef TIME_PROFILER_CLOCK
+#define TIME_PROFILER_CLOCK TIME_PROFILER_STEADY_CLOCK
+#endif
+
+// The time stamp counter is only available on x86.
+#if TIME_PROFILER_CLOCK == TIME_PROFILER_TSC_CLOCK && !defined(__x86_64__) && !defined(__i386__)
+#undef TIME_PROFILER_CLOCK
+#define TIME_PROFILER_CLOCK TIME_PROFILER_STEADY_CLOCK
+#endif
+
+// Read performance counters at every checkpoint if the user enabled them.
+// Only available on Linux, through perf_event_open.
+#ifndef TIME_PROFILER_COUNTERS
+#define TIME_PROFILER_COUNTERS 0
+#endif
+
+#if TIME_PROFILER_COUNTERS && !defined(__linux__)
+#undef TIME_PROFILER_COUNTERS
+#define TIME_PROFILER_COUNTERS 0
+#endif
+
+// Measure the CPU time and the context switches of every segment if the user
+// enabled it. Only available on Linux, which counts them per thread.
+#ifndef TIME_PROFILER_CPU_TIME
+#define TIME_PROFILER_CPU_TIME 0
+#endif
+
+#if TIME_PROFILER_CPU_TIME && !defined(__linux__)
+#undef TIME_PROFILER_CPU_TIME
+#define TIME_PROFILER_CPU_TIME 0
+#endif
+
+// Count the heap allocations of every segment if the user enabled it. The
+// allocations are only seen if exactly one source file of the program defines
+// TIME_PROFILER_DEFINE_ALLOCATION_HOOKS before including this header, which
+// replaces the global operator new and delete, and malloc and its relatives,
+// including the aligned ones, on glibc. Without TIME_PROFILER_ALLOCATIONS the
+// hooks only count the allocations of every thread in AllocationCounter,
+// including those of the profiler itself, e.g. to benchmark it.
+#ifndef TIME_PROFILER_ALLOCATIONS
+#define TIME_PROFILER_ALLOCATIONS 0
+#endif
+
+// Track coroutines that await through PROFILER_CO_AWAIT() if the compiler
+// supports them, unless the user decided otherwise.
+#if !defined(TIME_PROFILER_COROUTINES) && defined(__has_include)
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#define TIME_PROFILER_COROUTINES 1
+#endif
+#endif
+
+#ifndef TIME_PROFILER_COROUTINES
+#define TIME_PROFILER_COROUTINES 0
+#endif
+
+#if TIME_PROFILER_COROUTINES && __cplusplus < 202002L
+#undef TIME_PROFILER_COROUTINES
+#define TIME_PROFILER_COROUTINES 0
 #endif
 
 #include <deque>
 #include <map>
+#include <set>
 #include <list>
+#include <vector>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <type_traits>
+#include <tuple>
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include <iostream>
 #include <sstream>
 #include <fstream>
@@ -28,680 +209,11214 @@
 #include <cmath>
 #include <iomanip>
 
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+#endif
+
+#if TIME_PROFILER_CLOCK == TIME_PROFILER_TSC_CLOCK
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#if TIME_PROFILER_COROUTINES
+#include <coroutine>
+#endif
+
+#if TIME_PROFILER_CPU_TIME
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+#if TIME_PROFILER_COUNTERS
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
 namespace time_profiler
 {
-    /// Checkpoint used for measuring execution time.
-    /// Objects of this class store all information necessary to identify
-    /// a checkpoint:
-    ///  * the file where the checkpoint resides,
-    ///  * the line where the checkpoint resides,
-    ///  * the point in time when the checkpoint was hit.
-    class Checkpoint
+    /// Heap allocations of a thread.
+    struct AllocationUsage
     {
-    protected:
-        /// Name of the file the checkpoint resides in.
-        std::string file_;
-
-        /// Number of the line the checkpoint resides in.
-        int line_;
+        /// Number of allocations.
+        std::int64_t allocations;
 
-        /// Name of the function the checkpoint resides in.
-        std::string function_;
+        /// Number of deallocations.
+        std::int64_t frees;
 
-        /// Time stamp of the checkpoint.
-        std::chrono::system_clock::time_point time_point_;
+        /// Number of bytes requested by the allocations.
+        std::int64_t bytes;
 
-    public:
-        /// Constructor.
-        /// Initializes the member variables.
-        Checkpoint(const std::string &file, int line, const std::string &function)
-            : file_(file),
-              line_(line),
-              function_(function),
-              time_point_(std::chrono::system_clock::now())
+        /// Returns the difference between this and an earlier usage.
+        AllocationUsage operator-(const AllocationUsage &earlier) const
         {
+            return AllocationUsage{allocations - earlier.allocations, frees - earlier.frees, bytes - earlier.bytes};
         }
+    };
 
-        /// Compares the file and line of two checkpoints.
-        bool operator==(const Checkpoint &rhs) const
+    /// Counts the heap allocations of every thread. Called by the hooks of
+    /// TIME_PROFILER_DEFINE_ALLOCATION_HOOKS, which may run before main(),
+    /// after the profiler was destroyed and in the middle of its own
+    /// allocations, so the counters are plain thread-local integers that
+    /// need neither construction, locks nor allocations.
+    class AllocationCounter
+    {
+    private:
+        /// Counters of a thread.
+        struct ThreadCounters
         {
-            return (file_ == rhs.file_ && line_ == rhs.line_);
+            /// Allocations of the thread so far.
+            AllocationUsage usage;
+
+            /// Number of AllocationSuppressor objects alive on the thread.
+            /// Allocations are not counted while it is positive.
+            int suppressed;
+        };
+
+        /// Returns the counters of the calling thread.
+        static ThreadCounters &get_counters() noexcept
+        {
+            static thread_local ThreadCounters counters;
+            return counters;
         }
 
-        /// Returns a string that contains the file and line of the checkpoint.
-        /// Format: \c <file>:<line>.
-        std::string get_file_line() const
+        friend class AllocationSuppressor;
+
+    public:
+        /// Counts an allocation of the given number of bytes.
+        static void count_allocation(std::size_t bytes) noexcept
         {
-            std::stringstream stream;
-            stream << file_ << ":" << line_;
-            return stream.str();
+            ThreadCounters &counters = get_counters();
+            if (counters.suppressed > 0)
+                return;
+
+            counters.usage.allocations++;
+            counters.usage.bytes += static_cast<std::int64_t>(bytes);
         }
 
-        /// Get the time the checkpoint was captured.
-        std::chrono::system_clock::time_point get_time_point() const
+        /// Counts a deallocation.
+        static void count_free() noexcept
         {
-            return time_point_;
+            ThreadCounters &counters = get_counters();
+            if (counters.suppressed == 0)
+                counters.usage.frees++;
         }
 
-        /// Get the file the checkpoint resides in.
-        std::string get_file() const
+        /// Returns the allocations of the calling thread so far.
+        static AllocationUsage now() noexcept
         {
-            return file_;
+            return get_counters().usage;
         }
+    };
 
-        /// Get the line the checkpoint resides in.
-        int get_line() const
+    /// Excludes the heap allocations of the calling thread from the
+    /// statistics as long as it exists, e.g. those of the profiler itself.
+    /// Does nothing unless TIME_PROFILER_ALLOCATIONS is set.
+    class AllocationSuppressor
+    {
+    public:
+        /// Constructor.
+        AllocationSuppressor() noexcept
         {
-            return line_;
+#if TIME_PROFILER_ALLOCATIONS
+            AllocationCounter::get_counters().suppressed++;
+#endif
         }
 
-        /// Get the function the checkpoint resides in.
-        std::string get_function() const
+        /// Destructor.
+        ~AllocationSuppressor()
         {
-            return function_;
+#if TIME_PROFILER_ALLOCATIONS
+            AllocationCounter::get_counters().suppressed--;
+#endif
         }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        AllocationSuppressor(const AllocationSuppressor &suppressor) = delete;
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        AllocationSuppressor &operator=(const AllocationSuppressor &suppressor) = delete;
     };
 
-    /// Measurement of the execution time that passed between two checkpoints.
-    class SingleMeasurement
+    /// Arena of strings that never move and are never freed, so that they
+    /// can be referred to by std::string_view for the lifetime of the
+    /// process. Every distinct string is stored once, null-terminated, in
+    /// blocks of fixed size. Not thread-safe; its owner guards it.
+    class StringArena
     {
-    protected:
-        /// Start of the measurement.
-        Checkpoint start_checkpoint_;
+    private:
+        /// Blocks of the arena, the current one last.
+        std::vector<std::unique_ptr<char[]>> blocks_;
 
-        /// End of the measurement.
-        Checkpoint end_checkpoint_;
+        /// Number of bytes used in the current block.
+        std::size_t used_;
+
+        /// Strings stored in the arena.
+        std::set<std::string_view> strings_;
+
+        /// Number of bytes of a block. Longer strings get a block of their
+        /// own, which is full afterwards.
+        static const std::size_t block_size = 16384;
 
     public:
         /// Constructor.
-        SingleMeasurement(const Checkpoint &start_checkpoint,
-                          const Checkpoint &end_checkpoint)
-            : start_checkpoint_(start_checkpoint),
-              end_checkpoint_(end_checkpoint)
+        /// Creates an empty arena.
+        StringArena()
+            : used_(block_size)
         {
         }
 
-        /// Returns a hash value that is generated from the file and line values
-        /// of both the start and the end measurement.
-        /// Thus, this hash uniquely identifies every combination
-        /// of two checkpoints.
-        std::size_t get_hash() const
-        {
-            std::hash<std::string> hash;
-            return hash(start_checkpoint_.get_file_line() + end_checkpoint_.get_file_line());
-        }
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        StringArena(const StringArena &arena) = delete;
 
-        /// Get the time that expired between the start checkpoint and the
-        /// end checkpoint.
-        /// Unit: [us].
-        std::chrono::microseconds get_duration() const
-        {
-            return std::chrono::duration_cast<std::chrono::microseconds>(
-                end_checkpoint_.get_time_point() - start_checkpoint_.get_time_point());
-        }
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        StringArena &operator=(const StringArena &arena) = delete;
 
-        /// Returns the checkpoint where the measurement of execution time started.
-        Checkpoint get_start_checkpoint() const
+        /// Returns whether the given string is stored.
+        bool contains(std::string_view text) const
         {
-            return start_checkpoint_;
+            return strings_.find(text) != strings_.end();
         }
 
-        /// Returns the checkpoint where the measurement of execution time ended.
-        Checkpoint get_end_checkpoint() const
+        /// Returns the stored copy of the given string, storing it if it is
+        /// not stored yet.
+        std::string_view intern(std::string_view text)
         {
-            return end_checkpoint_;
+            const auto it = strings_.find(text);
+            if (it != strings_.end())
+                return *it;
+
+            if (used_ + text.size() + 1 > block_size)
+            {
+                blocks_.emplace_back(new char[text.size() + 1 > block_size ? text.size() + 1 : block_size]);
+                used_ = 0;
+            }
+
+            char *copy = blocks_.back().get() + used_;
+            used_ += text.size() + 1;
+            if (!text.empty())
+                std::memcpy(copy, text.data(), text.size());
+            copy[text.size()] = '\0';
+            return *strings_.insert(std::string_view(copy, text.size())).first;
         }
     };
 
-    /// Saves the statistics of multiple execution time measurements that have the
-    /// same start checkpoint and the same end checkpoint.
-    class MultiMeasurement
+    /// Static descriptor of a hook site.
+    /// Each site is registered once and afterwards referred to by its ID only.
+    /// The names refer to null-terminated strings in the arena of the
+    /// SiteRegistry, which live as long as the process.
+    struct Site
     {
-    protected:
-        /// Hash that uniquely identifies the combination of start checkpoint and
-        /// end checkpoint.
-        std::size_t hash_;
+        /// Name of the file the site resides in.
+        std::string_view file;
 
-        /// Name of the file where the start checkpoint resides.
-        std::string start_file_;
+        /// Number of the line the site resides in.
+        int line;
 
-        /// Name of the function where the start checkpoint resides.
-        std::string start_function_;
+        /// Name of the function the site resides in.
+        std::string_view function;
 
-        /// Number of the line where the start checkpoint resides.
-        int start_line_;
+        /// Name of the zone, if the site opens a zone. Empty otherwise.
+        std::string_view name;
 
-        /// Name of the file where the end checkpoint resides.
-        std::string end_file_;
-
-        /// Name of the function where the end checkpoint resides.
-        std::string end_function_;
+        /// Compact ID of the site, equal to its index in the SiteRegistry.
+        std::uint32_t id;
+    };
 
-        /// Number of the line where the end checkpoint resides.
-        int end_line_;
+    /// Registry of all hook sites.
+    /// Sites are identified by their file, line and zone name, i.e.
+    /// registering the same location twice returns the same descriptor.
+    /// Their names are stored once in an arena, which the sites and the
+    /// lookup table refer to, and which the LabelRegistry shares.
+    /// Registration and lookup are thread-safe. Both happen once per site or
+    /// when printing, never on the hot path.
+    class SiteRegistry
+    {
+    private:
+        /// Guards the containers below.
+        mutable std::mutex mutex_;
 
-        /// Number of single measurements collected by this object.
-        int count_;
+        /// Names of the sites and labels of named checkpoints.
+        StringArena strings_;
 
-        /// Sum of the durations of all measurements collected by this object.
-        std::chrono::microseconds overall_duration_;
+        /// Registered sites, indexed by their ID.
+        /// A deque keeps the references handed out to the hook sites valid.
+        std::deque<Site> sites_;
 
-        /// Percentage of consumed time, need to be populated before print
-        double percent_;
+        /// Maps file, line and zone name to the ID of the registered site.
+        std::map<std::tuple<std::string_view, int, std::string_view>, std::uint32_t> site_ids_;
 
-    public:
         /// Default constructor.
-        /// Initializes the member variables to 0.
-        MultiMeasurement()
-            : hash_(0),
-              start_line_(0),
-              end_line_(0),
-              count_(0),
-              overall_duration_(0),
-              percent_(0.0)
+        /// Inaccessible from outside the class.
+        SiteRegistry()
         {
         }
 
-        /// Collects a measurement.
-        /// \return \c true if the hash of the measurement matches the hash of
-        /// the measurements collected so far.
-        bool add(const SingleMeasurement &measurement)
-        {
-            // If no measurement has been collected so far, define the member
-            // variables.
-            if (hash_ == 0)
-            {
-                hash_ = measurement.get_hash();
-                start_file_ = measurement.get_start_checkpoint().get_file();
-                start_function_ = measurement.get_start_checkpoint().get_function();
-                start_line_ = measurement.get_start_checkpoint().get_line();
-                end_file_ = measurement.get_end_checkpoint().get_file();
-                end_function_ = measurement.get_end_checkpoint().get_function();
-                end_line_ = measurement.get_end_checkpoint().get_line();
-            }
-
-            // Check if the measurement starts and ends at the same checkpoints
-            // as the other measurements that have been collected.
-            if (hash_ != measurement.get_hash())
-                return false;
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        SiteRegistry(const SiteRegistry &registry);
 
-            // Update the statistics.
-            count_++;
-            overall_duration_ += measurement.get_duration();
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        SiteRegistry &operator=(const SiteRegistry &registry);
 
-            return true;
+    public:
+        /// Returns the singleton instance of the registry.
+        static SiteRegistry &get_instance()
+        {
+            static SiteRegistry registry;
+            return registry;
         }
 
-        /// Returns the number of measurements.
-        int count() const
+        /// Registers the site at the given location, if it is not known yet,
+        /// and returns its descriptor.
+        /// Called once per hook site, not on every hit.
+        static const Site &register_site(std::string_view file, int line, std::string_view function,
+                                         std::string_view name = std::string_view())
         {
-            return count_;
+            const AllocationSuppressor suppressor;
+            SiteRegistry &registry = get_instance();
+            std::lock_guard<std::mutex> lock(registry.mutex_);
+            const auto it = registry.site_ids_.find(std::make_tuple(file, line, name));
+            if (it != registry.site_ids_.end())
+                return registry.sites_[it->second];
+
+            const std::uint32_t id = static_cast<std::uint32_t>(registry.sites_.size());
+            registry.sites_.push_back(Site{registry.strings_.intern(file), line, registry.strings_.intern(function),
+                                           registry.strings_.intern(name), id});
+            const Site &site = registry.sites_.back();
+            registry.site_ids_.emplace(std::make_tuple(site.file, line, site.name), id);
+            return site;
         }
 
-        /// Returns the overall duration of all measurements.
-        /// Unit: [us].
-        std::chrono::microseconds get_overall_duration() const
+        /// Returns the copy of the given string in the arena of the
+        /// registry, which lives as long as the process.
+        static std::string_view intern(std::string_view text)
         {
-            return overall_duration_;
+            const AllocationSuppressor suppressor;
+            SiteRegistry &registry = get_instance();
+            std::lock_guard<std::mutex> lock(registry.mutex_);
+            return registry.strings_.intern(text);
         }
 
-        /// Computes the average duration of all measurements.
-        /// Unit: [us].
-        std::chrono::microseconds get_average_duration() const
+        /// Returns the descriptor of the site with the given ID.
+        static const Site &get_site(std::uint32_t id)
         {
-            std::chrono::microseconds average_duration(overall_duration_);
-
-            if (count_ > 0)
-                average_duration /= count_;
+            SiteRegistry &registry = get_instance();
+            std::lock_guard<std::mutex> lock(registry.mutex_);
+            return registry.sites_[id];
+        }
 
-            return average_duration;
+        /// Returns a copy of all registered sites, ordered by ID.
+        static std::vector<Site> get_sites()
+        {
+            SiteRegistry &registry = get_instance();
+            std::lock_guard<std::mutex> lock(registry.mutex_);
+            return std::vector<Site>(registry.sites_.begin(), registry.sites_.end());
         }
 
-        /// Compares measurements based on their overall time consumption.
-        bool operator<(const MultiMeasurement &rhs) const
+        /// Locks the registry while the process forks, so that the child
+        /// does not inherit it locked.
+        static void lock()
         {
-            return get_overall_duration() < rhs.get_overall_duration();
+            get_instance().mutex_.lock();
         }
 
-        /// Returns the hash of the measurements collected so far.
-        /// If no measurements have been collected, 0 is returned.
-        std::size_t get_hash() const
+        /// Unlocks the registry after a fork.
+        static void unlock()
         {
-            return hash_;
+            get_instance().mutex_.unlock();
         }
+    };
 
-        /// Returns the file where the start checkpoint resides.
-        std::string get_start_file() const
+    /// Registry of the labels of named checkpoints, see
+    /// PROFILER_HOOK_NAMED(). Every distinct label is copied once into the
+    /// arena of the SiteRegistry and never moves or is freed afterwards, so
+    /// named sites and the sites the labels create refer to that copy.
+    /// Labels are cut to max_label_length, and at most max_labels distinct
+    /// labels are stored in the whole process, which bounds the memory of
+    /// the registry and of the sites the labels create.
+    class LabelRegistry
+    {
+    private:
+        /// Guards the members below and the insertions into all NamedSite
+        /// objects.
+        std::mutex mutex_;
+
+        /// Interned labels, which point into the arena of the SiteRegistry.
+        std::set<std::string_view> labels_;
+
+        /// Default constructor.
+        /// Inaccessible from outside the class.
+        LabelRegistry()
         {
-            return start_file_;
         }
 
-        /// Returns the function where the start checkpoint resides.
-        std::string get_start_function() const
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        LabelRegistry(const LabelRegistry &registry);
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        LabelRegistry &operator=(const LabelRegistry &registry);
+
+    public:
+        /// Maximum number of distinct labels in the process.
+        static const std::size_t max_labels = TIME_PROFILER_MAX_LABELS;
+
+        /// Maximum length of a label in bytes. Longer labels are cut.
+        static const std::size_t max_label_length = 64;
+
+        /// Returns the singleton instance of the registry.
+        static LabelRegistry &get_instance()
         {
-            return start_function_;
+            static LabelRegistry registry;
+            return registry;
         }
 
-        /// Returns the number of the line where the start checkpoint resides.
-        int get_start_line() const
+        /// Returns the given label cut to max_label_length.
+        static std::string_view cut(std::string_view label)
         {
-            return start_line_;
+            return label.substr(0, max_label_length);
         }
 
-        /// Returns the file where the end checkpoint resides.
-        std::string get_end_file() const
+        /// Returns the mutex that guards the registry. Held by NamedSite
+        /// while it adds a label, and while the process forks.
+        static std::mutex &get_mutex()
         {
-            return end_file_;
+            return get_instance().mutex_;
         }
 
-        /// Returns the function where the end checkpoint resides.
-        std::string get_end_function() const
+        /// Returns the interned copy of the given label, which lives as long
+        /// as the process, or an empty view if the registry is full.
+        /// Called once per distinct label and site, not on every hit, with
+        /// get_mutex() locked.
+        static std::string_view intern(std::string_view label)
         {
-            return end_function_;
+            const AllocationSuppressor suppressor;
+            LabelRegistry &registry = get_instance();
+            label = cut(label);
+
+            const auto it = registry.labels_.find(label);
+            if (it != registry.labels_.end())
+                return *it;
+            if (registry.labels_.size() >= max_labels)
+                return std::string_view();
+
+            return *registry.labels_.insert(SiteRegistry::intern(label)).first;
         }
 
-        /// Returns the number of the line where the end checkpoint resides.
-        int get_end_line() const
+        /// Returns the number of distinct labels.
+        static std::size_t size()
         {
-            return end_line_;
+            LabelRegistry &registry = get_instance();
+            std::lock_guard<std::mutex> lock(registry.mutex_);
+            return registry.labels_.size();
         }
 
-        double get_percent() const
+        /// Locks the registry while the process forks, so that the child
+        /// does not inherit it locked.
+        static void lock()
         {
-            return percent_;
+            get_instance().mutex_.lock();
         }
 
-        void set_percent(double p)
+        /// Unlocks the registry after a fork.
+        static void unlock()
         {
-            percent_ = p;
+            get_instance().mutex_.unlock();
         }
     };
 
-    /// Prints the statistics of the given measurements to the console.
-    class Printer
+    /// Hook site of PROFILER_HOOK_NAMED(), whose checkpoints are told apart
+    /// by a label given at run time, e.g. a request type or a shard.
+    /// Every distinct label becomes a site of its own, with the label as its
+    /// name. The sites of the labels seen so far are found in a hash table
+    /// of fixed size that is read without locks, so a hit neither locks nor
+    /// allocates once its label is known.
+    /// At most max_labels_per_site labels get a site of their own. Further
+    /// labels, and labels that do not fit into the LabelRegistry, share the
+    /// overflow site named overflow_label.
+    class NamedSite
     {
     private:
-        /// Measurements whose statistics to print.
-        std::vector<MultiMeasurement> measurements_;
+        /// Slot of the hash table.
+        struct Slot
+        {
+            /// ID of the site of the label, or no_site while the slot is
+            /// empty. Written last, so the other fields are valid once it is
+            /// set.
+            std::atomic<std::uint32_t> site_id;
 
-        /// Width of the output lines.
-        static const int line_width = 131;
+            /// Hash of the label.
+            std::uint64_t hash;
 
-        /// Width of the column indicating the file of a checkpoint.
-        static const int file_col_width = 30;
+            /// Interned label.
+            std::string_view label;
+        };
 
-        /// Width of the column indicating the function of a checkpoint.
-        static const int function_col_width = 40;
+        /// Number of slots, twice the maximum number of labels.
+        static const std::size_t slot_count = 256;
 
-        /// Width of the column indicating the line of a checkpoint.
-        static const int line_col_width = 5;
+        /// Marks an empty slot.
+        static const std::uint32_t no_site = std::numeric_limits<std::uint32_t>::max();
 
-        /// Width of the column indicating the count of a measurement.
-        static const int count_col_width = 10;
+        /// Location of the hook.
+        const char *file_;
+        int line_;
+        const char *function_;
 
-        /// Width of the column indicating the average duration of a measurement.
-        static const int avg_duration_col_width = 15;
+        /// Hash table of the labels seen so far.
+        std::array<Slot, slot_count> slots_;
 
-        /// Width of the column indicating the overall duration of a measurement.
-        static const int ovr_duration_col_width = 15;
+        /// Number of labels with a site of their own.
+        std::size_t label_count_;
 
-        /// Width of the column indicating the overall duration of a measurement.
-        static const int ovr_percentage_col_width = 10;
+        /// Whether no further label gets a site of its own, because this
+        /// hook or the LabelRegistry reached its limit.
+        std::atomic<bool> full_;
 
-    public:
-        /// Adds a measurement whose statistics will be printed when print()
-        /// is called.
-        void add(const MultiMeasurement &measurement)
-        {
-            measurements_.push_back(measurement);
-        }
+        /// ID of the overflow site, or no_site until it is needed.
+        std::atomic<std::uint32_t> overflow_site_id_;
 
-        /// Adds a list of measurements whose statistics will be printed when
-        /// print() is called.
-        void add(const std::list<MultiMeasurement> &measurements)
+        /// Returns the 64-bit FNV-1a hash of the given label.
+        static std::uint64_t hash(std::string_view label)
         {
-            std::list<MultiMeasurement>::const_iterator lit;
-            for (lit = measurements.begin(); lit != measurements.end(); lit++)
-                add(*lit);
+            std::uint64_t value = 14695981039346656037ull;
+            for (const char c : label)
+            {
+                value ^= static_cast<unsigned char>(c);
+                value *= 1099511628211ull;
+            }
+
+            return value;
         }
 
-        /// Prints the statistics of the given measurements.
-        void print() const
+        /// Returns the slot of the given label, or the empty slot where it
+        /// belongs.
+        const Slot &find(std::string_view label, std::uint64_t label_hash) const
         {
-            std::cerr << create_table();
+            std::size_t index = static_cast<std::size_t>(label_hash) & (slot_count - 1);
+            while (true)
+            {
+                const Slot &slot = slots_[index];
+                if (slot.site_id.load(std::memory_order_acquire) == no_site ||
+                    (slot.hash == label_hash && slot.label == label))
+                    return slot;
+
+                index = (index + 1) & (slot_count - 1);
+            }
         }
 
-        /// Creates a table that shows the statistics of the given measurements.
-        std::string create_table() const
+        /// Registers the site of a label that was not seen yet.
+        std::uint32_t add(std::string_view label, std::uint64_t label_hash)
         {
-            // If no measurements are given, return an empty string.
-            if (measurements_.size() <= 0)
-                return std::string();
-
-            // Create the header of the table.
-            std::stringstream stream;
-            // stream << create_title();
-            stream << create_header();
+            const AllocationSuppressor suppressor;
+            std::lock_guard<std::mutex> lock(LabelRegistry::get_mutex());
+            Slot &slot = const_cast<Slot &>(find(label, label_hash));
+            const std::uint32_t site_id = slot.site_id.load(std::memory_order_acquire);
+            if (site_id != no_site)
+                return site_id;
 
-            // Add each measurement to the table.
-            for (int i = 0; i < (int)measurements_.size(); i++)
+            const std::string_view interned =
+                label_count_ < max_labels_per_site ? LabelRegistry::intern(label) : std::string_view();
+            if (interned.data() == nullptr)
             {
-                stream << create_entry(measurements_[i]);
-                stream << create_hline((i < (int)measurements_.size() - 1) ? '-' : '=');
+                full_.store(true, std::memory_order_relaxed);
+                return get_overflow_site_id();
             }
 
-            return stream.str();
+            slot.hash = label_hash;
+            slot.label = interned;
+            label_count_++;
+            const std::uint32_t new_site_id =
+                SiteRegistry::register_site(file_, line_, function_, interned).id;
+            slot.site_id.store(new_site_id, std::memory_order_release);
+            return new_site_id;
         }
 
-        /// Saves the current profiling information to \c $HOME/.TimeProfiler/log.
-        void save_log() const
+        /// Returns the ID of the overflow site, registering it on the first
+        /// call.
+        std::uint32_t get_overflow_site_id()
         {
-            // If no measurements are given, abort.
-            if (measurements_.size() <= 0)
-                return;
+            std::uint32_t site_id = overflow_site_id_.load(std::memory_order_acquire);
+            if (site_id == no_site)
+            {
+                const AllocationSuppressor suppressor;
+                site_id = SiteRegistry::register_site(file_, line_, function_, overflow_label).id;
+                overflow_site_id_.store(site_id, std::memory_order_release);
+            }
 
-            // Create the folder name.
-            std::stringstream folder_name;
-            folder_name << getenv("HOME") << "/.TimeProfiler/log";
-            std::filesystem::path folder_path(folder_name.str());
+            return site_id;
+        }
 
-            // Create the folder.
-            std::filesystem::create_directories(folder_path);
+    public:
+        /// Maximum number of labels with a site of their own per hook.
+        static const std::size_t max_labels_per_site = slot_count / 2;
 
-            // Create the name of the log file from the current date and time.
-            std::stringstream file_name;
-            auto now = std::chrono::system_clock::now();
-            auto in_time_t = std::chrono::system_clock::to_time_t(now);
-            file_name << std::put_time(std::localtime(&in_time_t), "%Y%m%d_%H%M%S");
-            file_name << ".log";
+        /// Name of the site shared by the labels beyond the limits.
+        static constexpr const char *overflow_label = "(other labels)";
 
-            // Save the log file.
-            std::ofstream logfile;
-            logfile.open(std::string(
-                             std::filesystem::canonical(folder_path).string() + "/" + file_name.str())
-                             .c_str());
-            logfile << create_table();
-            logfile.close();
+        /// Constructor.
+        /// Creates the site of the hook at the given location. No sites are
+        /// registered until a label is hit.
+        NamedSite(const char *file, int line, const char *function)
+            : file_(file),
+              line_(line),
+              function_(function),
+              label_count_(0),
+              full_(false),
+              overflow_site_id_(no_site)
+        {
+            for (Slot &slot : slots_)
+                slot.site_id.store(no_site, std::memory_order_relaxed);
         }
 
-    protected:
-        /// Generates a string containing a horizontal line
-        /// consisting of the given character.
-        static std::string create_hline(char fill = '#')
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        NamedSite(const NamedSite &site) = delete;
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        NamedSite &operator=(const NamedSite &site) = delete;
+
+        /// Returns the ID of the site of the given label, registering it
+        /// when the label is hit for the first time.
+        std::uint32_t get_site_id(std::string_view label)
         {
-            std::stringstream stream;
-            stream << std::setfill(fill) << std::setw(line_width) << fill
-                   << std::endl;
-            return stream.str();
+            label = LabelRegistry::cut(label);
+            const std::uint64_t label_hash = hash(label);
+            const std::uint32_t site_id = find(label, label_hash).site_id.load(std::memory_order_acquire);
+            if (site_id != no_site)
+                return site_id;
+
+            if (full_.load(std::memory_order_relaxed))
+                return get_overflow_site_id();
+
+            return add(label, label_hash);
         }
+    };
 
-        /// Generates a string containing the profiler's heading.
-        static std::string create_title()
+    /// Value that is written by a single thread and may be read by other
+    /// threads at any time, e.g. while the statistics are printed.
+    /// All accesses are relaxed, so an update costs the same as a plain one.
+    template <typename T>
+    class RelaxedValue
+    {
+    private:
+        std::atomic<T> value_;
+
+    public:
+        /// Constructor.
+        RelaxedValue(T value = T())
+            : value_(value)
         {
-            const std::string title(" PROFILED WITH TimeProfiler ");
+        }
 
-            const char fill = '#';
-            std::stringstream stream;
-            stream << std::setfill(fill)
-                   << std::setw(line_width) << fill
-                   << std::endl
-                   << std::setw((line_width - title.length()) / 2) << fill << title
-                   << (title.length() % 2 > 0 ? std::string(1, fill) : "")
-                   << std::setw((line_width - title.length()) / 2) << fill
-                   << std::endl
-                   << std::setw(line_width) << fill
-                   << std::endl;
+        /// Copy constructor.
+        RelaxedValue(const RelaxedValue &rhs)
+            : value_(rhs.load())
+        {
+        }
 
-            return stream.str();
+        /// Assignment operator.
+        RelaxedValue &operator=(const RelaxedValue &rhs)
+        {
+            store(rhs.load());
+            return *this;
         }
 
-        /// Generates a string with the headers of all columns.
-        static std::string create_header()
+        /// Returns the current value.
+        T load() const
         {
-            std::stringstream stream;
-            stream << create_hline('=')
-                   << std::setfill(' ')
-                   << std::setw(file_col_width) << std::left << "File"
-                   << "|" << std::setw(function_col_width) << std::left << "Function"
-                   << "|" << std::setw(line_col_width) << std::right << "Line "
-                   << "|" << std::setw(count_col_width) << std::right << "Count "
-                   << "|" << std::setw(avg_duration_col_width) << std::right << "Average [us] "
-                   << "|" << std::setw(ovr_duration_col_width) << std::right << "Overall [us]"
-                   << "|" << std::setw(ovr_percentage_col_width) << std::right << "Percent %"
-                   << std::endl
-                   << create_hline('=');
+            return value_.load(std::memory_order_relaxed);
+        }
 
-            return stream.str();
+        /// Sets the value.
+        void store(T value)
+        {
+            value_.store(value, std::memory_order_relaxed);
         }
 
-        /// Generates a table entry for the given measurement.
-        static std::string create_entry(const MultiMeasurement &measurement)
+        /// Adds to the value.
+        /// Only valid for the single writing thread.
+        void add(T value)
         {
-            // Create a line indicating where the measurement started.
-            const std::string file_start(crop_path(measurement.get_start_file()));
-            std::stringstream stream;
-            stream << std::setfill(' ')
-                   << std::setw(file_col_width) << std::left << file_start
-                   << "|" << std::setw(function_col_width) << std::left << measurement.get_start_function()
-                   << "|" << std::setw(line_col_width) << std::right << measurement.get_start_line()
-                   << "|" << std::setw(count_col_width) << std::right << " "
-                   << "|" << std::setw(avg_duration_col_width) << std::right << " "
-                   << "|" << std::endl;
+            store(load() + value);
+        }
+    };
 
-            // Show the file name in the second line only if it
-            // is a different file.
-            std::string file_end(crop_path(measurement.get_end_file()));
-            if (file_start == file_end)
-                file_end.clear();
+    /// Clock policy based on \c std::chrono::steady_clock.
+    /// Monotonic, so segments can never become negative.
+    struct SteadyClock
+    {
+        /// Returns the current time in clock ticks.
+        static std::int64_t now()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
 
-            // Create a line indicating where the measurement ended
-            // and how long it took.
-            stream << std::setfill(' ')
-                   << std::setw(file_col_width) << std::left
-                   << file_end << "|"
-                   << std::setw(function_col_width) << std::left
-                   << measurement.get_end_function() << "|"
-                   << std::setw(line_col_width) << std::right
-                   << measurement.get_end_line() << "|"
-                   << std::setw(count_col_width) << std::right
-                   << insert_separators(measurement.count()) << "|"
-                   << std::setw(avg_duration_col_width) << std::right
-                   << insert_separators(measurement.get_average_duration().count()) << "|"
-                   << std::setw(ovr_duration_col_width) << std::right
-                   << insert_separators(measurement.get_overall_duration().count()) << "|"
-                   << std::setw(ovr_percentage_col_width) << std::right
-                   << std::setprecision(5) << ((measurement.get_percent() > 0.000001) ? (measurement.get_percent() * 100) : 0.0)
-                   << std::endl;
+        /// Converts a number of clock ticks into nanoseconds.
+        static std::int64_t to_nanoseconds(std::int64_t ticks)
+        {
+            return ticks;
+        }
 
-            return stream.str();
+        /// Returns the name of the clock.
+        static const char *name()
+        {
+            return "steady_clock";
         }
+    };
 
-        /// Cuts the given file path after the last slash and returns the file name.
-        static std::string crop_path(const std::string &file_name)
+    /// Clock policy based on \c std::chrono::system_clock.
+    /// Wall-clock time, which can jump when the system time is adjusted.
+    struct SystemClock
+    {
+        /// Returns the current time in clock ticks.
+        static std::int64_t now()
         {
-            std::size_t slash_position = file_name.find_last_of("/\\");
-            return file_name.substr(slash_position + 1);
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                .count();
         }
 
-        /// Inserts thousands separators into the given number.
-        static std::string insert_separators(long int n)
+        /// Converts a number of clock ticks into nanoseconds.
+        static std::int64_t to_nanoseconds(std::int64_t ticks)
         {
-            std::stringstream stream;
-            stream << n;
-            const std::string n_str = stream.str();
+            return ticks;
+        }
+
+        /// Returns the name of the clock.
+        static const char *name()
+        {
+            return "system_clock";
+        }
+    };
+
+#if TIME_PROFILER_CLOCK == TIME_PROFILER_TSC_CLOCK
+    /// Clock policy based on the invariant time stamp counter, read by \c rdtscp.
+    /// The tick rate is calibrated against the steady clock on first use.
+    /// Falls back to the steady clock if the CPU has no invariant TSC or no
+    /// \c rdtscp instruction.
+    class TscClock
+    {
+    private:
+        /// Result of the calibration.
+        struct Calibration
+        {
+            /// Whether the time stamp counter is used.
+            bool use_tsc;
 
-            stream.str("");
-            for (int pos = 0; pos < (int)n_str.length(); pos++)
+            /// Nanoseconds per tick.
+            double nanoseconds_per_tick;
+
+            /// Calibrates the time stamp counter against the steady clock.
+            Calibration()
+                : use_tsc(is_supported()),
+                  nanoseconds_per_tick(1.0)
             {
-                stream << n_str.at(pos);
+                if (!use_tsc)
+                    return;
+
+                // Measure both clocks over the same interval of about 10 ms.
+                unsigned int aux;
+                const auto steady_start = std::chrono::steady_clock::now();
+                const std::uint64_t tsc_start = __rdtscp(&aux);
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                const auto steady_end = std::chrono::steady_clock::now();
+                const std::uint64_t tsc_end = __rdtscp(&aux);
 
-                if ((n_str.length() - 1 - pos) >= 3 && (n_str.length() - 1 - pos) % 3 == 0)
-                    stream << ",";
+                const double nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                               steady_end - steady_start)
+                                               .count();
+                nanoseconds_per_tick = nanoseconds / static_cast<double>(tsc_end - tsc_start);
             }
 
-            return stream.str();
+            /// Checks the CPU for an invariant time stamp counter and \c rdtscp.
+            static bool is_supported()
+            {
+                unsigned int eax, ebx, ecx, edx;
+                if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 27)))
+                    return false;
+                if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8)))
+                    return false;
+                return true;
+            }
+        };
+
+        /// Returns the calibration, which is computed on the first call.
+        static const Calibration &get_calibration()
+        {
+            static const Calibration calibration;
+            return calibration;
         }
 
-        /// If the given number would exceed the given number of digits to display,
-        /// crop it.
-        /// Example: crop_number(12345, 4) returns ">999".
-        static std::string crop_number(long int number, int n_digits)
+    public:
+        /// Returns the current time in clock ticks.
+        static std::int64_t now()
         {
-            // Make sure n_digits is in the valid range.
-            n_digits = std::max(2, n_digits);
+            if (!get_calibration().use_tsc)
+                return SteadyClock::now();
 
-            // Compute the minimum and maximum numbers which can be displayed
-            // with the given number of digits.
-            long int max_number = std::pow(10, n_digits - 1) - 1;
-            long int min_number = -max_number;
+            unsigned int aux;
+            return static_cast<std::int64_t>(__rdtscp(&aux));
+        }
 
-            // Crop the number, if necessary.
-            std::stringstream stream;
-            if (number <= max_number && number >= min_number)
-                stream << number;
-            if (number > max_number)
-                stream << ">" << max_number;
-            if (number < min_number)
-                stream << "<" << min_number;
+        /// Converts a number of clock ticks into nanoseconds.
+        static std::int64_t to_nanoseconds(std::int64_t ticks)
+        {
+            return static_cast<std::int64_t>(ticks * get_calibration().nanoseconds_per_tick);
+        }
 
-            return stream.str();
+        /// Returns the name of the clock.
+        static const char *name()
+        {
+            return get_calibration().use_tsc ? "tsc" : "steady_clock";
+        }
+
+        /// Performs the calibration, unless done before.
+        static void calibrate()
+        {
+            get_calibration();
         }
     };
+#endif
 
-    /// Simple CPU execution time profiler.
-    ///
-    /// Measurement points are added by inserting three underscores \c ___ or three X \c xxx in the code.
-    /// The profiler prints its statistics on the console when being destroyed.
-    /// The statistics can also be printed by calling TimeProfiler::print_statistics().
-    ///
-    /// \note Profiling is enabled by default. It can be globally disabled
-    /// by simply adding
-    /// \code
-    /// #define USE_PROFILER 0
-    /// \endcode
-    /// to the source file before including \c TimeProfiler.h.
-    /// \code
-    /// #define USE_PROFILER 1
-    /// \endcode enables profiling again.
-    ///
-    /// \note This class is not thread-safe. It is designed to be used with
-    /// single-threaded programs.
-    class TimeProfiler
+    /// Clock used by the profiler, selected by \c TIME_PROFILER_CLOCK.
+#if TIME_PROFILER_CLOCK == TIME_PROFILER_TSC_CLOCK
+    using Clock = TscClock;
+#elif TIME_PROFILER_CLOCK == TIME_PROFILER_SYSTEM_CLOCK
+    using Clock = SystemClock;
+#else
+    using Clock = SteadyClock;
+#endif
+
+    /// CPU time and context switches of a thread.
+    struct CpuUsage
     {
-    private:
-        std::deque<Checkpoint> checkpoints_;
-        std::map<std::size_t, MultiMeasurement> measurement_map_;
+        /// Time the thread ran on a CPU.
+        /// Unit: [ns].
+        std::int64_t cpu_time;
+
+        /// Number of times the thread gave up the CPU, e.g. to wait for I/O
+        /// or a lock.
+        std::int64_t voluntary_switches;
+
+        /// Number of times the thread was preempted.
+        std::int64_t involuntary_switches;
+
+        /// Returns the difference between this and an earlier usage.
+        CpuUsage operator-(const CpuUsage &earlier) const
+        {
+            return CpuUsage{cpu_time - earlier.cpu_time, voluntary_switches - earlier.voluntary_switches,
+                            involuntary_switches - earlier.involuntary_switches};
+        }
+
+#if TIME_PROFILER_CPU_TIME
+        /// Returns the usage of the calling thread since it started.
+        static CpuUsage now()
+        {
+            timespec time;
+            ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+
+            rusage usage;
+            ::getrusage(RUSAGE_THREAD, &usage);
+
+            return CpuUsage{static_cast<std::int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec,
+                            static_cast<std::int64_t>(usage.ru_nvcsw), static_cast<std::int64_t>(usage.ru_nivcsw)};
+        }
+#endif
+    };
+
+    /// Source of the counters read at every checkpoint.
+    enum class CounterSource : std::uint8_t
+    {
+        /// No counters, timing only.
+        none,
+
+        /// CPU cycles, instructions, last level cache misses and branch
+        /// misses, counted by the CPU.
+        hardware,
+
+        /// Task clock in [ns], page faults, context switches and CPU
+        /// migrations, counted by the kernel.
+        software
+    };
 
+    /// Number of counters read at every checkpoint.
+    constexpr int counter_count = 4;
+
+    /// Values of the counters of a CounterSource.
+    using CounterValues = std::array<std::uint64_t, counter_count>;
+
+#if TIME_PROFILER_COUNTERS
+    /// Group of performance counters of the calling thread, opened with
+    /// perf_event_open.
+    /// Tries the hardware counters first and falls back to the software
+    /// counters, e.g. in virtual machines or if \c perf_event_paranoid
+    /// forbids hardware counters, and to none at all. The source that works
+    /// for the first thread is used by all threads.
+    /// The counters are read with \c rdpmc where the kernel permits it and
+    /// with a single read() of the whole group otherwise.
+    class PerfCounters
+    {
     private:
-        /// Default constructor.
-        /// Inaccessible from outside the class.
-        TimeProfiler()
+        /// File descriptors of the counters, the group leader first.
+        std::array<int, counter_count> fds_;
+
+        /// Pages mapped from the counters, which permit reading them with
+        /// \c rdpmc, or \c nullptr.
+        std::array<perf_event_mmap_page *, counter_count> pages_;
+
+        /// Size of the mapped pages.
+        std::size_t page_size_;
+
+        /// Source of the open counters.
+        CounterSource source_;
+
+        /// Result of reading the group with read().
+        struct GroupValues
+        {
+            std::uint64_t count;
+            std::uint64_t time_enabled;
+            std::uint64_t time_running;
+            std::uint64_t values[counter_count];
+        };
+
+    public:
+        /// Constructor.
+        /// Opens the counters of the calling thread.
+        PerfCounters()
+            : page_size_(static_cast<std::size_t>(::sysconf(_SC_PAGESIZE))),
+              source_(CounterSource::none)
         {
+            fds_.fill(-1);
+            pages_.fill(nullptr);
+            open_process_source();
         }
 
         /// Destructor.
-        /// Computes and prints the collected statistics and saves them to a
-        /// log file: \c $HOME/.TimeProfiler/log.
-        ~TimeProfiler()
+        ~PerfCounters()
         {
-            print_statistics();
-            save_log();
+            close();
         }
 
         /// Copy constructor.
         /// Inaccessible from outside the class.
-        TimeProfiler(const TimeProfiler &TimeProfiler);
+        PerfCounters(const PerfCounters &counters) = delete;
 
         /// Assignment operator.
         /// Inaccessible from outside the class.
-        TimeProfiler &operator=(const TimeProfiler &TimeProfiler);
+        PerfCounters &operator=(const PerfCounters &counters) = delete;
 
-        /// Returns the singleton instance of the profiler.
-        static TimeProfiler &get_instance()
+        /// Closes the counters and opens those of the calling thread, e.g.
+        /// in the child process after a fork, which inherits the counters of
+        /// the parent's thread.
+        void reopen()
         {
-            // Create the single instance of this class.
-            static TimeProfiler TimeProfiler;
-            return TimeProfiler;
+            close();
+            open_process_source();
         }
 
-        /// Returns a sorted list of the measurements that were made.
-        /// The measurements are sorted with respect to the overall execution time
-        /// in descending order.
-        static std::list<MultiMeasurement> sort_measurements()
+        /// Returns the source of the open counters.
+        CounterSource get_source() const
         {
-            // Copy the elements of the measurement map into a list
-            // that can be sorted.
-            std::list<MultiMeasurement> measurement_list;
-            std::map<std::size_t, MultiMeasurement> &measurement_map = get_instance().measurement_map_;
-            std::map<std::size_t, MultiMeasurement>::const_iterator mit;
-            std::chrono::microseconds total_duration(0);
-            for (mit = measurement_map.begin();
-                 mit != measurement_map.end();
-                 mit++)
-            {
-                measurement_list.push_back(mit->second);
-                total_duration += +mit->second.get_overall_duration();
-            }
+            return source_;
+        }
 
-            // Update execution time percentage
-            double total_microseconds = total_duration.count();
-            for (auto &measurement : measurement_list)
+        /// Reads the current values of the counters.
+        void read(CounterValues &values) const
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            bool complete = pages_[0] != nullptr;
+            for (int i = 0; i < counter_count && complete; i++)
+                complete = pages_[i] != nullptr && read_rdpmc(*pages_[i], values[i]);
+            if (complete)
+                return;
+#endif
+            GroupValues group;
+            if (::read(fds_[0], &group, sizeof(group)) == static_cast<ssize_t>(sizeof(group)))
             {
-                measurement.set_percent(measurement.get_overall_duration().count() / total_microseconds);
+                for (int i = 0; i < counter_count; i++)
+                    values[i] = group.values[i];
             }
+        }
 
-            // Sort the measurements based on their overall execution times,
-            // starting with the largest value.
-            measurement_list.sort();
-            measurement_list.reverse();
+    private:
+        /// Returns the source that works for the process, or -1 if it was
+        /// not determined yet.
+        static std::atomic<int> &get_process_source()
+        {
+            static std::atomic<int> source(-1);
+            return source;
+        }
 
-            return measurement_list;
+        /// Opens the counters of the source that works in this process,
+        /// which is found out by the first thread.
+        void open_process_source()
+        {
+            std::atomic<int> &process_source = get_process_source();
+            const int source = process_source.load();
+            if (source < 0)
+            {
+                if (!open(CounterSource::hardware))
+                    open(CounterSource::software);
+                process_source.store(static_cast<int>(source_));
+            }
+            else if (source != static_cast<int>(CounterSource::none))
+            {
+                open(static_cast<CounterSource>(source));
+            }
         }
 
-    public:
-        /// Adds a measurement.
-        static void tick(
-            const std::string &file, int line, const std::string &function)
+        /// Opens and enables the group of counters of the given source.
+        /// \return \c true on success.
+        bool open(CounterSource source)
         {
+            static const std::uint64_t hardware_configs[counter_count] = {
+                PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+            static const std::uint64_t software_configs[counter_count] = {
+                PERF_COUNT_SW_TASK_CLOCK, PERF_COUNT_SW_PAGE_FAULTS,
+                PERF_COUNT_SW_CONTEXT_SWITCHES, PERF_COUNT_SW_CPU_MIGRATIONS};
 
-#if USE_PROFILER
-            // Add the measurement point.
-            std::deque<Checkpoint> &checkpoints = get_instance().checkpoints_;
-            checkpoints.push_back(Checkpoint(file, line, function));
+            const bool hardware = source == CounterSource::hardware;
+            for (int i = 0; i < counter_count; i++)
+            {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = hardware ? PERF_TYPE_HARDWARE : PERF_TYPE_SOFTWARE;
+                attr.config = hardware ? hardware_configs[i] : software_configs[i];
+                attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                attr.disabled = i == 0 ? 1 : 0;
+                attr.exclude_hv = 1;
+
+                // Context switches happen in the kernel, so the software
+                // counters include it where permitted.
+                attr.exclude_kernel = hardware ? 1 : 0;
+                fds_[i] = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, fds_[0], 0));
+                if (fds_[i] < 0 && !hardware)
+                {
+                    attr.exclude_kernel = 1;
+                    fds_[i] = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, fds_[0], 0));
+                }
+
+                if (fds_[i] < 0)
+                {
+                    close();
+                    return false;
+                }
+
+                if (hardware)
+                {
+                    void *page = ::mmap(nullptr, page_size_, PROT_READ, MAP_SHARED, fds_[i], 0);
+                    if (page != MAP_FAILED)
+                        pages_[i] = static_cast<perf_event_mmap_page *>(page);
+                }
+            }
+
+            ::ioctl(fds_[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ::ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
 
-            if (checkpoints.size() >= 2)
+            // Some hypervisors accept the counters but never schedule them.
+            volatile std::uint64_t work = 0;
+            for (int i = 0; i < 10000; i++)
+                work = work + i;
+
+            GroupValues group;
+            if (::read(fds_[0], &group, sizeof(group)) != static_cast<ssize_t>(sizeof(group)) ||
+                group.time_running == 0)
             {
-                SingleMeasurement measurement(checkpoints[0], checkpoints[1]);
-                get_instance().measurement_map_[measurement.get_hash()].add(
-                    measurement);
-                checkpoints.pop_front();
+                close();
+                return false;
             }
-#endif
+
+            source_ = source;
+            return true;
         }
 
-        /// Prints the statistics.
-        static void print_statistics()
+        /// Closes all counters.
+        void close()
         {
-#if USE_PROFILER
-            // Print the sorted list of all measurements.
-            Printer printer;
-            printer.add(sort_measurements());
+            for (int i = counter_count - 1; i >= 0; i--)
+            {
+                if (pages_[i] != nullptr)
+                    ::munmap(pages_[i], page_size_);
+                if (fds_[i] >= 0)
+                    ::close(fds_[i]);
 
-            printer.print();
-#endif
+                pages_[i] = nullptr;
+                fds_[i] = -1;
+            }
+
+            source_ = CounterSource::none;
         }
 
-        /// Saves a log file with the statistics under \c $HOME/.TimeProfiler/log.
-        static void save_log()
+#if defined(__x86_64__) || defined(__i386__)
+        /// Reads a counter from user space with \c rdpmc, following the
+        /// protocol documented in linux/perf_event.h.
+        /// \return \c false if the counter is not scheduled on this CPU
+        /// right now or the kernel does not permit \c rdpmc.
+        static bool read_rdpmc(const perf_event_mmap_page &page, std::uint64_t &value)
         {
-#if USE_PROFILER
-            Printer printer;
-            printer.add(sort_measurements());
+            std::uint32_t sequence;
+            do
+            {
+                sequence = page.lock;
+                std::atomic_signal_fence(std::memory_order_seq_cst);
 
-            printer.save_log();
-#endif
+                const std::uint32_t index = page.index;
+                if (!page.cap_user_rdpmc || index == 0)
+                    return false;
+
+                const int width = page.pmc_width;
+                std::int64_t count = static_cast<std::int64_t>(__builtin_ia32_rdpmc(static_cast<int>(index - 1)));
+                count = static_cast<std::int64_t>(static_cast<std::uint64_t>(count) << (64 - width)) >> (64 - width);
+                value = static_cast<std::uint64_t>(page.offset + count);
+
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+            } while (page.lock != sequence);
+
+            return true;
         }
+#endif
     };
+#endif
 
+    /// Checkpoint used for measuring execution time.
+    /// Objects of this class store all information necessary to identify
+    /// a checkpoint:
+    ///  * the ID of the site where the checkpoint resides,
+    ///  * the point in time when the checkpoint was hit.
+    /// File, line and function are looked up in the SiteRegistry on demand.
+    class Checkpoint
+    {
+    protected:
+        /// ID of the site the checkpoint resides in.
+        std::uint32_t site_id_;
+
+        /// Time stamp of the checkpoint in ticks of the profiler's Clock.
+        std::int64_t time_point_;
+
+    public:
+        /// Default constructor.
+        /// Creates a checkpoint that does not belong to any site.
+        Checkpoint()
+            : site_id_(0),
+              time_point_(0)
+        {
+        }
+
+        /// Constructor.
+        /// Stamps the checkpoint with the current time.
+        explicit Checkpoint(std::uint32_t site_id)
+            : site_id_(site_id),
+              time_point_(Clock::now())
+        {
+        }
+
+        /// Constructor.
+        /// Stamps the checkpoint with the given time.
+        /// Unit of time_point: ticks of the profiler's Clock.
+        Checkpoint(std::uint32_t site_id, std::int64_t time_point)
+            : site_id_(site_id),
+              time_point_(time_point)
+        {
+        }
+
+        /// Compares the sites of two checkpoints.
+        bool operator==(const Checkpoint &rhs) const
+        {
+            return site_id_ == rhs.site_id_;
+        }
+
+        /// Get the ID of the site the checkpoint resides in.
+        std::uint32_t get_site_id() const
+        {
+            return site_id_;
+        }
+
+        /// Get the time the checkpoint was captured.
+        /// Unit: ticks of the profiler's Clock.
+        std::int64_t get_time_point() const
+        {
+            return time_point_;
+        }
+
+        /// Get the file the checkpoint resides in.
+        std::string get_file() const
+        {
+            return std::string(SiteRegistry::get_site(site_id_).file);
+        }
+
+        /// Get the line the checkpoint resides in.
+        int get_line() const
+        {
+            return SiteRegistry::get_site(site_id_).line;
+        }
+
+        /// Get the function the checkpoint resides in.
+        std::string get_function() const
+        {
+            return std::string(SiteRegistry::get_site(site_id_).function);
+        }
+    };
+
+    /// Measurement of the execution time that passed between two checkpoints.
+    class SingleMeasurement
+    {
+    protected:
+        /// Start of the measurement.
+        Checkpoint start_checkpoint_;
+
+        /// End of the measurement.
+        Checkpoint end_checkpoint_;
+
+    public:
+        /// Constructor.
+        SingleMeasurement(const Checkpoint &start_checkpoint,
+                          const Checkpoint &end_checkpoint)
+            : start_checkpoint_(start_checkpoint),
+              end_checkpoint_(end_checkpoint)
+        {
+        }
+
+        /// Returns a key that is composed of the site IDs of both the start
+        /// and the end checkpoint.
+        /// Thus, this key uniquely identifies every combination
+        /// of two checkpoints.
+        std::uint64_t get_key() const
+        {
+            return (static_cast<std::uint64_t>(start_checkpoint_.get_site_id()) << 32) |
+                   end_checkpoint_.get_site_id();
+        }
+
+        /// Get the time that expired between the start checkpoint and the
+        /// end checkpoint.
+        /// Unit: [ns].
+        std::chrono::nanoseconds get_duration() const
+        {
+            return std::chrono::nanoseconds(Clock::to_nanoseconds(
+                end_checkpoint_.get_time_point() - start_checkpoint_.get_time_point()));
+        }
+
+        /// Returns the checkpoint where the measurement of execution time started.
+        const Checkpoint &get_start_checkpoint() const
+        {
+            return start_checkpoint_;
+        }
+
+        /// Returns the checkpoint where the measurement of execution time ended.
+        const Checkpoint &get_end_checkpoint() const
+        {
+            return end_checkpoint_;
+        }
+    };
+
+    /// Log-linear histogram of durations with bounded relative error.
+    /// Durations below 2^sub_bucket_bits ns get a bucket each. Above, every
+    /// power of two is split into 2^sub_bucket_bits buckets of equal width,
+    /// so a bucket is at most 1/16 as wide as its lower bound. The buckets
+    /// are a fixed array, so recording never allocates, and two histograms
+    /// are merged by adding their buckets. The range of buckets in use is
+    /// tracked, so that copies and merges skip the empty ones.
+    class LatencyHistogram
+    {
+    public:
+        /// Number of bits that select the bucket within a power of two.
+        static const int sub_bucket_bits = 4;
+
+        /// Number of buckets per power of two.
+        static const int sub_bucket_count = 1 << sub_bucket_bits;
+
+        /// Durations of 2^max_bit ns (about 18 minutes) and more are counted
+        /// in the last bucket.
+        static const int max_bit = 40;
+
+        /// Number of buckets.
+        static const int bucket_count = (max_bit - sub_bucket_bits + 1) * sub_bucket_count;
+
+    private:
+        /// Number of durations per bucket.
+        std::array<RelaxedValue<std::uint64_t>, bucket_count> buckets_;
+
+        /// First bucket that may be in use. All buckets before are empty.
+        RelaxedValue<int> first_used_;
+
+        /// Last bucket that may be in use. All buckets after are empty.
+        RelaxedValue<int> last_used_;
+
+        /// Extends the range of buckets in use by the given bucket.
+        void use(int bucket)
+        {
+            if (bucket < first_used_.load())
+                first_used_.store(bucket);
+            if (bucket > last_used_.load())
+                last_used_.store(bucket);
+        }
+
+    public:
+        /// Constructor.
+        /// Creates an empty histogram.
+        LatencyHistogram()
+            : first_used_(bucket_count),
+              last_used_(-1)
+        {
+        }
+
+        /// Copy constructor.
+        /// Only copies the buckets in use.
+        LatencyHistogram(const LatencyHistogram &other)
+            : LatencyHistogram()
+        {
+            *this = other;
+        }
+
+        /// Assignment operator.
+        /// Only touches the buckets in use by either histogram.
+        LatencyHistogram &operator=(const LatencyHistogram &other)
+        {
+            for (int i = first_used_.load(); i <= last_used_.load(); i++)
+                buckets_[i].store(0);
+
+            const int first_used = other.first_used_.load();
+            const int last_used = other.last_used_.load();
+            for (int i = first_used; i <= last_used; i++)
+                buckets_[i].store(other.buckets_[i].load());
+            first_used_.store(first_used);
+            last_used_.store(last_used);
+            return *this;
+        }
+
+        /// Counts the given duration.
+        /// Unit: [ns]. Negative durations are counted as 0.
+        void add(std::int64_t duration)
+        {
+            const int bucket = get_bucket(duration);
+            buckets_[bucket].add(1);
+            use(bucket);
+        }
+
+        /// Adds the buckets of another histogram.
+        void merge(const LatencyHistogram &other)
+        {
+            const int last_used = other.last_used_.load();
+            for (int i = other.first_used_.load(); i <= last_used; i++)
+            {
+                const std::uint64_t count = other.buckets_[i].load();
+                if (count != 0)
+                {
+                    buckets_[i].add(count);
+                    use(i);
+                }
+            }
+        }
+
+        /// Subtracts the buckets of an earlier state of this histogram.
+        void subtract(const LatencyHistogram &earlier)
+        {
+            const int last_used = earlier.last_used_.load();
+            for (int i = earlier.first_used_.load(); i <= last_used; i++)
+            {
+                const std::uint64_t count = earlier.buckets_[i].load();
+                if (count != 0)
+                {
+                    buckets_[i].store(buckets_[i].load() - count);
+                    use(i);
+                }
+            }
+        }
+
+        /// Returns the index of the first bucket that is not empty, or
+        /// bucket_count if the histogram is empty.
+        int get_first_bucket() const
+        {
+            const int last_used = last_used_.load();
+            for (int bucket = first_used_.load(); bucket <= last_used; bucket++)
+            {
+                if (buckets_[bucket].load() != 0)
+                    return bucket;
+            }
+
+            return bucket_count;
+        }
+
+        /// Returns the index of the last bucket that is not empty, or -1 if
+        /// the histogram is empty.
+        int get_last_bucket() const
+        {
+            const int first_used = first_used_.load();
+            for (int bucket = last_used_.load(); bucket >= first_used; bucket--)
+            {
+                if (buckets_[bucket].load() != 0)
+                    return bucket;
+            }
+
+            return -1;
+        }
+
+        /// Returns the number of durations in the given bucket.
+        std::uint64_t get_count(int bucket) const
+        {
+            return buckets_[bucket].load();
+        }
+
+        /// Sets the number of durations in the given bucket.
+        void set_count(int bucket, std::uint64_t count)
+        {
+            buckets_[bucket].store(count);
+            if (count != 0)
+                use(bucket);
+        }
+
+        /// Returns the number of durations counted.
+        std::uint64_t get_total_count() const
+        {
+            std::uint64_t total_count = 0;
+            const int last_used = last_used_.load();
+            for (int i = first_used_.load(); i <= last_used; i++)
+                total_count += buckets_[i].load();
+
+            return total_count;
+        }
+
+        /// Estimates the duration below which the given fraction of the
+        /// durations lies, e.g. 0.99 for the 99th percentile.
+        /// Returns the middle of the bucket containing that duration, or 0
+        /// if the histogram is empty.
+        /// Unit: [ns].
+        std::int64_t get_percentile(double fraction) const
+        {
+            const std::uint64_t total_count = get_total_count();
+            if (total_count == 0)
+                return 0;
+
+            const std::uint64_t rank = std::max<std::uint64_t>(
+                1, static_cast<std::uint64_t>(std::ceil(fraction * total_count)));
+            std::uint64_t count = 0;
+            for (int i = 0; i < bucket_count; i++)
+            {
+                count += buckets_[i].load();
+                if (count >= rank)
+                    return get_lower_bound(i) + get_width(i) / 2;
+            }
+
+            return get_lower_bound(bucket_count - 1);
+        }
+
+        /// Estimates several percentiles in a single pass over the buckets,
+        /// see get_percentile(). The fractions must be in ascending order.
+        /// Unit: [ns].
+        template <std::size_t N>
+        std::array<std::int64_t, N> get_percentiles(const std::array<double, N> &fractions) const
+        {
+            std::array<std::int64_t, N> percentiles{};
+            const std::uint64_t total_count = get_total_count();
+            if (total_count == 0)
+                return percentiles;
+
+            std::array<std::uint64_t, N> ranks;
+            for (std::size_t i = 0; i < N; i++)
+                ranks[i] = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(fractions[i] * total_count)));
+
+            std::size_t index = 0;
+            std::uint64_t count = 0;
+            for (int i = 0; i < bucket_count && index < N; i++)
+            {
+                count += buckets_[i].load();
+                for (; index < N && count >= ranks[index]; index++)
+                    percentiles[index] = get_lower_bound(i) + get_width(i) / 2;
+            }
+            for (; index < N; index++)
+                percentiles[index] = get_lower_bound(bucket_count - 1);
+
+            return percentiles;
+        }
+
+        /// Returns the index of the bucket that counts the given duration.
+        static int get_bucket(std::int64_t duration)
+        {
+            if (duration <= 0)
+                return 0;
+
+            const std::uint64_t value = static_cast<std::uint64_t>(duration);
+            if (value >= (std::uint64_t(1) << max_bit))
+                return bucket_count - 1;
+
+            const int msb = 63 - __builtin_clzll(value);
+            if (msb < sub_bucket_bits)
+                return static_cast<int>(value);
+
+            const int shift = msb - sub_bucket_bits;
+            return (shift + 1) * sub_bucket_count + static_cast<int>(value >> shift) - sub_bucket_count;
+        }
+
+        /// Returns the smallest duration counted by the given bucket.
+        /// Unit: [ns].
+        static std::int64_t get_lower_bound(int bucket)
+        {
+            const int octave = bucket / sub_bucket_count;
+            if (octave == 0)
+                return bucket;
+
+            return static_cast<std::int64_t>(bucket - (octave - 1) * sub_bucket_count) << (octave - 1);
+        }
+
+        /// Returns the width of the given bucket.
+        /// Unit: [ns].
+        static std::int64_t get_width(int bucket)
+        {
+            const int octave = bucket / sub_bucket_count;
+            return octave == 0 ? 1 : std::int64_t(1) << (octave - 1);
+        }
+    };
+
+    /// Segment kept as an example of the slowest segments of a pair.
+    struct Exemplar
+    {
+        /// Duration of the segment.
+        /// Unit: [ns].
+        std::int64_t duration;
+
+        /// System time the segment ended, since the epoch.
+        /// Unit: [ns].
+        std::int64_t time;
+
+        /// Index of the thread that measured the segment.
+        std::uint32_t thread_index;
+
+        /// Tag of the thread when the segment ended, see
+        /// PROFILER_EXEMPLAR_TAG(). 0 if none was set.
+        std::uint64_t tag;
+    };
+
+    /// Slowest segments of a pair, kept in a min-heap of a fixed size. A
+    /// segment that is not slower than the fastest one kept costs a single
+    /// comparison.
+    class ExemplarHeap
+    {
+    public:
+        /// Number of segments kept.
+        static const int capacity = TIME_PROFILER_EXEMPLARS;
+
+    private:
+        /// Exemplar that may be read while its thread replaces it.
+        struct Slot
+        {
+            RelaxedValue<std::int64_t> duration;
+            RelaxedValue<std::int64_t> time;
+            RelaxedValue<std::uint32_t> thread_index;
+            RelaxedValue<std::uint64_t> tag;
+        };
+
+        /// Segments kept, as a min-heap by duration. One unused slot if
+        /// none are kept, so that the accesses stay within bounds.
+        std::array<Slot, (capacity > 0 ? capacity : 1)> slots_;
+
+        /// Number of slots in use.
+        RelaxedValue<int> size_;
+
+        /// Duration a segment must exceed to be kept: the shortest one kept
+        /// once the heap is full, the smallest duration before.
+        /// Unit: [ns].
+        RelaxedValue<std::int64_t> threshold_;
+
+        /// Generation the segments kept belong to.
+        RelaxedValue<std::uint32_t> generation_;
+
+        /// Returns the current generation. Every reset of the printed
+        /// statistics and every window boundary of the background reporter
+        /// starts a new one.
+        static std::atomic<std::uint32_t> &get_current_generation()
+        {
+            static std::atomic<std::uint32_t> generation(0);
+            return generation;
+        }
+
+        /// Returns the threshold of an empty heap.
+        static std::int64_t get_initial_threshold()
+        {
+            return capacity > 0 ? std::numeric_limits<std::int64_t>::min()
+                                : std::numeric_limits<std::int64_t>::max();
+        }
+
+        /// Writes the given exemplar into the given slot.
+        static void store(Slot &slot, const Exemplar &exemplar)
+        {
+            slot.duration.store(exemplar.duration);
+            slot.time.store(exemplar.time);
+            slot.thread_index.store(exemplar.thread_index);
+            slot.tag.store(exemplar.tag);
+        }
+
+    public:
+        /// Constructor.
+        /// Creates an empty heap.
+        ExemplarHeap()
+            : size_(0),
+              threshold_(get_initial_threshold()),
+              generation_(get_current_generation().load(std::memory_order_relaxed))
+        {
+        }
+
+        /// Starts a new generation, so that every heap recording from now
+        /// on starts empty.
+        static void start_generation()
+        {
+            get_current_generation().fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// Empties the heap if a new generation started since it kept its
+        /// segments. Otherwise the slowest segments of all time would keep
+        /// the threshold up and hide the slowest ones since the reset.
+        /// Only valid for the single writing thread.
+        void renew()
+        {
+            const std::uint32_t generation = get_current_generation().load(std::memory_order_relaxed);
+            if (generation == generation_.load())
+                return;
+
+            generation_.store(generation);
+            size_.store(0);
+            threshold_.store(get_initial_threshold());
+        }
+
+        /// Returns whether a segment of the given duration would be kept.
+        /// Unit: [ns].
+        bool accepts(std::int64_t duration) const
+        {
+            return duration > threshold_.load();
+        }
+
+        /// Keeps the given segment if it is slower than the fastest one
+        /// kept, which it replaces if the heap is full.
+        /// Only valid for the single writing thread.
+        void add(const Exemplar &exemplar)
+        {
+            if (!accepts(exemplar.duration))
+                return;
+
+            int size = size_.load();
+            int i = 0;
+            if (size < capacity)
+            {
+                // Sift the new slot up from the end.
+                i = size;
+                while (i > 0 && slots_[(i - 1) / 2].duration.load() > exemplar.duration)
+                {
+                    slots_[i] = slots_[(i - 1) / 2];
+                    i = (i - 1) / 2;
+                }
+                size_.store(++size);
+            }
+            else
+            {
+                // Replace the fastest segment and sift it down.
+                for (int child = 1; child < size; child = 2 * i + 1)
+                {
+                    if (child + 1 < size && slots_[child + 1].duration.load() < slots_[child].duration.load())
+                        child++;
+                    if (slots_[child].duration.load() >= exemplar.duration)
+                        break;
+                    slots_[i] = slots_[child];
+                    i = child;
+                }
+            }
+            store(slots_[i], exemplar);
+
+            if (size == capacity)
+                threshold_.store(slots_[0].duration.load());
+        }
+
+        /// Returns the segments kept, slowest first.
+        std::vector<Exemplar> get() const
+        {
+            std::vector<Exemplar> exemplars;
+            const int size = size_.load();
+            exemplars.reserve(size);
+            for (int i = 0; i < size; i++)
+            {
+                exemplars.push_back(Exemplar{slots_[i].duration.load(), slots_[i].time.load(),
+                                             slots_[i].thread_index.load(), slots_[i].tag.load()});
+            }
+
+            std::sort(exemplars.begin(), exemplars.end(), [](const Exemplar &lhs, const Exemplar &rhs)
+                      { return lhs.duration > rhs.duration; });
+            return exemplars;
+        }
+
+        /// Returns the number of segments kept.
+        int size() const
+        {
+            return size_.load();
+        }
+
+        /// Keeps the slowest segments of both heaps.
+        void merge(const ExemplarHeap &other)
+        {
+            for (const Exemplar &exemplar : other.get())
+                add(exemplar);
+        }
+
+        /// Drops the segments an earlier state of this heap kept as well,
+        /// so that only segments since then remain. Fewer segments than the
+        /// capacity may remain, since those the earlier ones pushed out
+        /// are lost.
+        void subtract(const ExemplarHeap &earlier)
+        {
+            const std::vector<Exemplar> earlier_exemplars = earlier.get();
+            const std::vector<Exemplar> exemplars = get();
+            size_.store(0);
+            threshold_.store(get_initial_threshold());
+            for (const Exemplar &exemplar : exemplars)
+            {
+                const bool kept_before = std::any_of(
+                    earlier_exemplars.begin(), earlier_exemplars.end(), [&](const Exemplar &earlier_exemplar)
+                    { return earlier_exemplar.time == exemplar.time && earlier_exemplar.duration == exemplar.duration &&
+                             earlier_exemplar.thread_index == exemplar.thread_index; });
+                if (!kept_before)
+                    add(exemplar);
+            }
+        }
+    };
+
+    /// Saves the statistics of multiple execution time measurements that have the
+    /// same start checkpoint and the same end checkpoint.
+    class MultiMeasurement
+    {
+    protected:
+        /// Key that uniquely identifies the combination of start checkpoint and
+        /// end checkpoint.
+        std::uint64_t key_;
+
+        /// ID of the site where the start checkpoint resides.
+        std::uint32_t start_site_id_;
+
+        /// ID of the site where the end checkpoint resides.
+        std::uint32_t end_site_id_;
+
+        /// Number of single measurements collected by this object.
+        RelaxedValue<std::int64_t> count_;
+
+        /// Number of single measurements whose duration was measured.
+        /// Smaller than count_ if the start site is sampled.
+        RelaxedValue<std::int64_t> timed_count_;
+
+        /// Sum of the measured durations.
+        /// Unit: [ns].
+        RelaxedValue<std::int64_t> overall_duration_;
+
+        /// Shortest duration of all measurements.
+        /// Unit: [ns].
+        RelaxedValue<std::int64_t> min_duration_;
+
+        /// Longest duration of all measurements.
+        /// Unit: [ns].
+        RelaxedValue<std::int64_t> max_duration_;
+
+        /// Duration of the first measurement. The squares below are summed
+        /// relative to it to avoid cancellation when computing the variance.
+        /// Unit: [ns].
+        RelaxedValue<std::int64_t> shift_;
+
+        /// Sum of the squared differences between the durations and shift_.
+        /// Unit: [ns^2].
+        RelaxedValue<double> shifted_squares_;
+
+        /// Distribution of the durations.
+        LatencyHistogram histogram_;
+
+        /// Sums of the differences of the counters over the timed
+        /// measurements.
+        std::array<RelaxedValue<std::uint64_t>, counter_count> counters_;
+
+        /// Source of the counters, none if no counters were read. Read by
+        /// other threads while the owner thread records.
+        RelaxedValue<CounterSource> counter_source_;
+
+        /// Sum of the CPU times of the timed measurements.
+        /// Unit: [ns].
+        RelaxedValue<std::int64_t> cpu_duration_;
+
+        /// Sum of the voluntary context switches during the timed measurements.
+        RelaxedValue<std::int64_t> voluntary_switches_;
+
+        /// Sum of the involuntary context switches during the timed
+        /// measurements.
+        RelaxedValue<std::int64_t> involuntary_switches_;
+
+        /// Whether the CPU usage was measured.
+        RelaxedValue<bool> has_cpu_usage_;
+
+        /// Sum of the heap allocations during the timed measurements.
+        RelaxedValue<std::int64_t> allocations_;
+
+        /// Sum of the heap deallocations during the timed measurements.
+        RelaxedValue<std::int64_t> frees_;
+
+        /// Sum of the bytes allocated during the timed measurements.
+        RelaxedValue<std::int64_t> allocated_bytes_;
+
+        /// Whether the heap allocations were counted.
+        RelaxedValue<bool> has_allocations_;
+
+        /// Slowest timed measurements.
+        ExemplarHeap exemplars_;
+
+        /// Percentage of consumed time, need to be populated before print
+        double percent_;
+
+        /// Overhead of the profiler per timed measurement, which the
+        /// reported durations exclude. 0 in the recorded statistics, set
+        /// before printing.
+        /// Unit: [ns].
+        std::int64_t overhead_;
+
+        /// Incremented before and after every update by the owning thread,
+        /// so that it is odd while the thread updates the measurement and
+        /// other threads can tell whether a copy overlapped an update.
+        RelaxedValue<std::uint32_t> version_;
+
+        /// Number of attempts get_copy() makes to take a copy that no
+        /// update overlapped.
+        static const int max_copy_attempts = 1000;
+
+        /// Returns the given duration minus the overhead of the profiler,
+        /// at least 0.
+        /// Unit: [ns].
+        std::int64_t compensate(std::int64_t duration) const
+        {
+            return overhead_ > 0 ? std::max<std::int64_t>(0, duration - overhead_) : duration;
+        }
+
+    public:
+        /// Default constructor.
+        /// Initializes the member variables to 0.
+        MultiMeasurement()
+            : key_(0),
+              start_site_id_(0),
+              end_site_id_(0),
+              count_(0),
+              timed_count_(0),
+              overall_duration_(0),
+              min_duration_(std::numeric_limits<std::int64_t>::max()),
+              max_duration_(std::numeric_limits<std::int64_t>::min()),
+              shift_(0),
+              shifted_squares_(0.0),
+              counter_source_(CounterSource::none),
+              cpu_duration_(0),
+              voluntary_switches_(0),
+              involuntary_switches_(0),
+              has_cpu_usage_(false),
+              allocations_(0),
+              frees_(0),
+              allocated_bytes_(0),
+              has_allocations_(false),
+              percent_(0.0),
+              overhead_(0),
+              version_(0)
+        {
+        }
+
+        /// Constructor.
+        /// Creates an empty measurement for the given pair of sites.
+        MultiMeasurement(std::uint32_t start_site_id, std::uint32_t end_site_id)
+            : key_((static_cast<std::uint64_t>(start_site_id) << 32) | end_site_id),
+              start_site_id_(start_site_id),
+              end_site_id_(end_site_id),
+              count_(0),
+              timed_count_(0),
+              overall_duration_(0),
+              min_duration_(std::numeric_limits<std::int64_t>::max()),
+              max_duration_(std::numeric_limits<std::int64_t>::min()),
+              shift_(0),
+              shifted_squares_(0.0),
+              counter_source_(CounterSource::none),
+              cpu_duration_(0),
+              voluntary_switches_(0),
+              involuntary_switches_(0),
+              has_cpu_usage_(false),
+              allocations_(0),
+              frees_(0),
+              allocated_bytes_(0),
+              has_allocations_(false),
+              percent_(0.0),
+              overhead_(0),
+              version_(0)
+        {
+        }
+
+        /// Marks the start of an update by the owning thread, see
+        /// get_copy(). Only valid for the single writing thread.
+        void begin_update()
+        {
+            version_.store(version_.load() + 1);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        /// Marks the end of an update by the owning thread.
+        /// Only valid for the single writing thread.
+        void end_update()
+        {
+            std::atomic_thread_fence(std::memory_order_release);
+            version_.store(version_.load() + 1);
+        }
+
+        /// Returns a copy of the measurement while the owning thread may
+        /// update it. A copy that overlapped an update is retried, so that
+        /// e.g. the histogram counts as many measurements as the count.
+        /// Before a retry, the calling thread yields, so that an owning
+        /// thread preempted in the middle of an update can finish it, e.g.
+        /// on a single core. If updates keep overlapping, e.g. in a loop of
+        /// empty segments, the copy of the last attempt is returned, which
+        /// may mix the values before and after a single update.
+        MultiMeasurement get_copy() const
+        {
+            MultiMeasurement copy;
+            for (int attempt = 1;; attempt++)
+            {
+                const std::uint32_t version = version_.load();
+                std::atomic_thread_fence(std::memory_order_acquire);
+                copy = *this;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (((version & 1) == 0 && version_.load() == version) || attempt == max_copy_attempts)
+                    return copy;
+
+                std::this_thread::yield();
+            }
+        }
+
+        /// Collects a measurement.
+        /// \return \c true if the key of the measurement matches the key of
+        /// the measurements collected so far.
+        bool add(const SingleMeasurement &measurement)
+        {
+            // Check if the measurement starts and ends at the same checkpoints
+            // as the other measurements that have been collected.
+            if (key_ != measurement.get_key())
+                return false;
+
+            // Update the statistics.
+            const std::int64_t duration = measurement.get_duration().count();
+            if (timed_count_.load() == 0)
+                shift_.store(duration);
+
+            count_.add(1);
+            timed_count_.add(1);
+            overall_duration_.add(duration);
+            if (duration < min_duration_.load())
+                min_duration_.store(duration);
+            if (duration > max_duration_.load())
+                max_duration_.store(duration);
+
+            const double difference = static_cast<double>(duration - shift_.load());
+            shifted_squares_.add(difference * difference);
+            histogram_.add(duration);
+
+            return true;
+        }
+
+        /// Counts a measurement whose duration was not measured, because its
+        /// start site is sampled.
+        void add_untimed()
+        {
+            count_.add(1);
+        }
+
+        /// Adds the differences of the counters over the last measurement.
+        void add_counters(CounterSource source, const CounterValues &differences)
+        {
+            // The source rarely changes, so it is only written then.
+            if (counter_source_.load() != source)
+                counter_source_.store(source);
+            for (int i = 0; i < counter_count; i++)
+                counters_[i].add(differences[i]);
+        }
+
+        /// Adds the CPU usage over the last measurement.
+        void add_cpu_usage(const CpuUsage &difference)
+        {
+            if (!has_cpu_usage_.load())
+                has_cpu_usage_.store(true);
+            cpu_duration_.add(difference.cpu_time);
+            voluntary_switches_.add(difference.voluntary_switches);
+            involuntary_switches_.add(difference.involuntary_switches);
+        }
+
+        /// Adds the heap allocations during the last measurement.
+        void add_allocations(const AllocationUsage &difference)
+        {
+            if (!has_allocations_.load())
+                has_allocations_.store(true);
+            allocations_.add(difference.allocations);
+            frees_.add(difference.frees);
+            allocated_bytes_.add(difference.bytes);
+        }
+
+        /// Keeps the last measurement as an exemplar if it is among the
+        /// slowest ones since the last reset or window boundary. Costs two
+        /// comparisons otherwise.
+        /// Unit of the duration: [ns].
+        void add_exemplar(std::int64_t duration, std::uint32_t thread_index, std::uint64_t tag)
+        {
+            exemplars_.renew();
+            if (!exemplars_.accepts(duration))
+                return;
+
+            const std::int64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                          std::chrono::system_clock::now().time_since_epoch())
+                                          .count();
+            exemplars_.add(Exemplar{duration, time, thread_index, tag});
+        }
+
+        /// Adds the statistics of another measurement with the same start
+        /// and end checkpoints, e.g. one collected by another thread.
+        /// \return \c true if the keys of both measurements match.
+        bool merge(const MultiMeasurement &other)
+        {
+            if (key_ != other.key_)
+                return false;
+
+            count_.add(other.count_.load());
+
+            if (counter_source_.load() == CounterSource::none)
+                counter_source_.store(other.counter_source_.load());
+            if (counter_source_.load() == other.counter_source_.load())
+            {
+                for (int i = 0; i < counter_count; i++)
+                    counters_[i].add(other.counters_[i].load());
+            }
+
+            if (other.has_cpu_usage_.load())
+                has_cpu_usage_.store(true);
+            cpu_duration_.add(other.cpu_duration_.load());
+            voluntary_switches_.add(other.voluntary_switches_.load());
+            involuntary_switches_.add(other.involuntary_switches_.load());
+
+            if (other.has_allocations_.load())
+                has_allocations_.store(true);
+            allocations_.add(other.allocations_.load());
+            frees_.add(other.frees_.load());
+            allocated_bytes_.add(other.allocated_bytes_.load());
+            exemplars_.merge(other.exemplars_);
+
+            const std::int64_t other_count = other.timed_count_.load();
+            if (other_count == 0)
+                return true;
+
+            if (timed_count_.load() == 0)
+                shift_.store(other.shift_.load());
+
+            // Move the other sum of squares to this shift:
+            // sum((x - a)^2) = sum((x - b)^2) + 2 (b - a) sum(x - b) + n (b - a)^2.
+            const double shift_difference = static_cast<double>(other.shift_.load() - shift_.load());
+            const double other_shifted_sum = static_cast<double>(
+                other.overall_duration_.load() - other_count * other.shift_.load());
+            shifted_squares_.add(other.shifted_squares_.load() +
+                                 2.0 * shift_difference * other_shifted_sum +
+                                 other_count * shift_difference * shift_difference);
+
+            timed_count_.add(other_count);
+            overall_duration_.add(other.overall_duration_.load());
+            min_duration_.store(std::min(min_duration_.load(), other.min_duration_.load()));
+            max_duration_.store(std::max(max_duration_.load(), other.max_duration_.load()));
+            histogram_.merge(other.histogram_);
+
+            return true;
+        }
+
+        /// Subtracts an earlier state of this measurement, so that only the
+        /// statistics of the measurements collected since then remain.
+        /// Count, sums, variance and histogram are exact. Minimum and maximum
+        /// are estimated from the histogram, unless the earlier state was
+        /// empty.
+        /// \return \c true if the keys of both measurements match.
+        bool subtract(const MultiMeasurement &earlier)
+        {
+            if (key_ != earlier.key_)
+                return false;
+
+            count_.store(count_.load() - earlier.count_.load());
+            for (int i = 0; i < counter_count; i++)
+                counters_[i].store(counters_[i].load() - earlier.counters_[i].load());
+            cpu_duration_.store(cpu_duration_.load() - earlier.cpu_duration_.load());
+            voluntary_switches_.store(voluntary_switches_.load() - earlier.voluntary_switches_.load());
+            involuntary_switches_.store(involuntary_switches_.load() - earlier.involuntary_switches_.load());
+            allocations_.store(allocations_.load() - earlier.allocations_.load());
+            frees_.store(frees_.load() - earlier.frees_.load());
+            allocated_bytes_.store(allocated_bytes_.load() - earlier.allocated_bytes_.load());
+            exemplars_.subtract(earlier.exemplars_);
+
+            // Both states share the shift, unless the earlier one did not
+            // time any measurement yet.
+            const std::int64_t earlier_count = earlier.timed_count_.load();
+            if (earlier_count == 0)
+                return true;
+
+            timed_count_.store(timed_count_.load() - earlier_count);
+            overall_duration_.store(overall_duration_.load() - earlier.overall_duration_.load());
+            shifted_squares_.store(std::max(0.0, shifted_squares_.load() - earlier.shifted_squares_.load()));
+            histogram_.subtract(earlier.histogram_);
+
+            const int first_bucket = histogram_.get_first_bucket();
+            const int last_bucket = histogram_.get_last_bucket();
+            if (timed_count_.load() > 0 && last_bucket >= 0)
+            {
+                min_duration_.store(std::max(min_duration_.load(),
+                                             LatencyHistogram::get_lower_bound(first_bucket)));
+                max_duration_.store(std::min(max_duration_.load(),
+                                             LatencyHistogram::get_lower_bound(last_bucket) +
+                                                 LatencyHistogram::get_width(last_bucket) - 1));
+            }
+
+            return true;
+        }
+
+        /// Returns the number of measurements.
+        std::int64_t count() const
+        {
+            return count_.load();
+        }
+
+        /// Returns the number of measurements whose duration was measured.
+        std::int64_t timed_count() const
+        {
+            return timed_count_.load();
+        }
+
+        /// Returns whether only some of the durations were measured.
+        bool is_sampled() const
+        {
+            return timed_count() < count();
+        }
+
+        /// Returns the sum of the measured durations.
+        /// Unit: [ns].
+        std::chrono::nanoseconds get_measured_duration() const
+        {
+            return std::chrono::nanoseconds(overall_duration_.load());
+        }
+
+        /// Returns the overall duration of all measurements.
+        /// If the start site is sampled, the measured durations are
+        /// extrapolated to all measurements.
+        /// Unit: [ns].
+        /// The overhead of the profiler is excluded, see set_overhead().
+        std::chrono::nanoseconds get_overall_duration() const
+        {
+            const std::int64_t timed = timed_count();
+            const std::int64_t measured = std::max<std::int64_t>(0, overall_duration_.load() - overhead_ * timed);
+            if (timed == count() || timed == 0)
+                return std::chrono::nanoseconds(measured);
+
+            return std::chrono::nanoseconds(std::llround(static_cast<double>(measured) * count() / timed));
+        }
+
+        /// Estimates the half-width of the 95% confidence interval of the
+        /// extrapolated overall duration, or 0 if every duration was measured.
+        /// Unit: [ns].
+        std::chrono::nanoseconds get_overall_duration_error() const
+        {
+            const std::int64_t timed = timed_count();
+            if (timed == count() || timed == 0)
+                return std::chrono::nanoseconds(0);
+
+            // Standard error of the mean of a sample without replacement,
+            // scaled to the total.
+            const double unsampled_fraction = 1.0 - static_cast<double>(timed) / static_cast<double>(count());
+            return std::chrono::nanoseconds(std::llround(
+                1.96 * get_standard_deviation() * static_cast<double>(count()) *
+                std::sqrt(unsampled_fraction / static_cast<double>(timed))));
+        }
+
+        /// Computes the average duration of all measured durations.
+        /// The overhead of the profiler is excluded, see set_overhead().
+        /// Unit: [ns].
+        std::chrono::nanoseconds get_average_duration() const
+        {
+            std::chrono::nanoseconds average_duration(get_measured_duration());
+
+            if (timed_count() > 0)
+                average_duration /= timed_count();
+
+            return std::chrono::nanoseconds(compensate(average_duration.count()));
+        }
+
+        /// Returns the shortest duration of all measurements, or 0 if there
+        /// are none. The overhead of the profiler is excluded.
+        /// Unit: [ns].
+        std::chrono::nanoseconds get_min_duration() const
+        {
+            return std::chrono::nanoseconds(timed_count() > 0 ? compensate(min_duration_.load()) : 0);
+        }
+
+        /// Returns the longest duration of all measurements, or 0 if there
+        /// are none. The overhead of the profiler is excluded.
+        /// Unit: [ns].
+        std::chrono::nanoseconds get_max_duration() const
+        {
+            return std::chrono::nanoseconds(timed_count() > 0 ? compensate(max_duration_.load()) : 0);
+        }
+
+        /// Computes the sample variance of the durations.
+        /// Unit: [ns^2].
+        double get_variance() const
+        {
+            const std::int64_t n = timed_count();
+            if (n < 2)
+                return 0.0;
+
+            const double shifted_sum = static_cast<double>(overall_duration_.load() - n * shift_.load());
+            return std::max(0.0, (shifted_squares_.load() - shifted_sum * shifted_sum / n) / (n - 1));
+        }
+
+        /// Computes the sample standard deviation of the durations.
+        /// Unit: [ns].
+        double get_standard_deviation() const
+        {
+            return std::sqrt(get_variance());
+        }
+
+        /// Estimates the duration below which the given fraction of the
+        /// measurements lies, e.g. 0.99 for the 99th percentile.
+        /// The estimate is clamped to the shortest and longest duration. The
+        /// overhead of the profiler is excluded.
+        /// Unit: [ns].
+        std::chrono::nanoseconds get_percentile(double fraction) const
+        {
+            if (timed_count() == 0)
+                return std::chrono::nanoseconds(0);
+
+            return std::chrono::nanoseconds(compensate(std::min(
+                std::max(histogram_.get_percentile(fraction), min_duration_.load()), max_duration_.load())));
+        }
+
+        /// Estimates several percentiles at once, see get_percentile().
+        /// The fractions must be in ascending order.
+        template <std::size_t N>
+        std::array<std::chrono::nanoseconds, N> get_percentiles(const std::array<double, N> &fractions) const
+        {
+            std::array<std::chrono::nanoseconds, N> percentiles{};
+            if (timed_count() == 0)
+                return percentiles;
+
+            const std::array<std::int64_t, N> estimates = histogram_.get_percentiles(fractions);
+            for (std::size_t i = 0; i < N; i++)
+                percentiles[i] = std::chrono::nanoseconds(
+                    compensate(std::min(std::max(estimates[i], min_duration_.load()), max_duration_.load())));
+
+            return percentiles;
+        }
+
+        /// Returns the distribution of the durations.
+        const LatencyHistogram &get_histogram() const
+        {
+            return histogram_;
+        }
+
+        /// Returns the distribution of the durations for modification, e.g.
+        /// when reading a profile file.
+        LatencyHistogram &get_histogram()
+        {
+            return histogram_;
+        }
+
+        /// Returns the source of the counters, none if no counters were read.
+        CounterSource get_counter_source() const
+        {
+            return counter_source_.load();
+        }
+
+        /// Returns the sum of the differences of the given counter over the
+        /// timed measurements.
+        std::uint64_t get_counter(int counter) const
+        {
+            return counters_[counter].load();
+        }
+
+        /// Returns the average difference of the given counter per timed
+        /// measurement.
+        double get_counter_average(int counter) const
+        {
+            const std::int64_t timed = timed_count();
+            return timed > 0 ? static_cast<double>(get_counter(counter)) / static_cast<double>(timed) : 0.0;
+        }
+
+        /// Sets the sums of the counters, e.g. when reading a profile file.
+        void restore_counters(CounterSource source, const CounterValues &counters)
+        {
+            counter_source_.store(source);
+            for (int i = 0; i < counter_count; i++)
+                counters_[i].store(counters[i]);
+        }
+
+        /// Returns whether the CPU usage was measured.
+        bool has_cpu_usage() const
+        {
+            return has_cpu_usage_.load();
+        }
+
+        /// Returns the sum of the measured CPU times of the timed
+        /// measurements, including the overhead of the profiler, like
+        /// get_measured_duration().
+        std::chrono::nanoseconds get_cpu_duration() const
+        {
+            return std::chrono::nanoseconds(cpu_duration_.load());
+        }
+
+        /// Returns the sum of the times the timed measurements spent off the
+        /// CPU, i.e. waiting or preempted. The profiler runs on the CPU, so
+        /// its overhead is excluded from the wall and the CPU time alike.
+        /// Wall and CPU time are read from different clocks, so the
+        /// difference is clamped at 0.
+        std::chrono::nanoseconds get_off_cpu_duration() const
+        {
+            const std::int64_t overhead = overhead_ * timed_count();
+            const std::int64_t wall = std::max<std::int64_t>(0, overall_duration_.load() - overhead);
+            const std::int64_t cpu = std::max<std::int64_t>(0, cpu_duration_.load() - overhead);
+            return std::chrono::nanoseconds(std::max<std::int64_t>(0, wall - cpu));
+        }
+
+        /// Returns the average CPU time per timed measurement.
+        /// The overhead of the profiler is excluded, see set_overhead().
+        std::chrono::nanoseconds get_average_cpu_duration() const
+        {
+            const std::int64_t timed = timed_count();
+            return std::chrono::nanoseconds(timed > 0 ? compensate(cpu_duration_.load() / timed) : 0);
+        }
+
+        /// Returns the average time off the CPU per timed measurement, i.e.
+        /// the difference of get_average_duration() and
+        /// get_average_cpu_duration(), at least 0.
+        std::chrono::nanoseconds get_average_off_cpu_duration() const
+        {
+            return std::max(std::chrono::nanoseconds(0), get_average_duration() - get_average_cpu_duration());
+        }
+
+        /// Returns the sum of the voluntary context switches during the timed
+        /// measurements.
+        std::int64_t get_voluntary_switches() const
+        {
+            return voluntary_switches_.load();
+        }
+
+        /// Returns the sum of the involuntary context switches during the
+        /// timed measurements.
+        std::int64_t get_involuntary_switches() const
+        {
+            return involuntary_switches_.load();
+        }
+
+        /// Sets the CPU usage, e.g. when reading a profile file.
+        void restore_cpu_usage(const CpuUsage &usage)
+        {
+            has_cpu_usage_.store(true);
+            cpu_duration_.store(usage.cpu_time);
+            voluntary_switches_.store(usage.voluntary_switches);
+            involuntary_switches_.store(usage.involuntary_switches);
+        }
+
+        /// Returns whether the heap allocations were counted.
+        bool has_allocations() const
+        {
+            return has_allocations_.load();
+        }
+
+        /// Returns the sums of the heap allocations, deallocations and
+        /// allocated bytes during the timed measurements.
+        AllocationUsage get_allocations() const
+        {
+            return AllocationUsage{allocations_.load(), frees_.load(), allocated_bytes_.load()};
+        }
+
+        /// Returns the average number of heap allocations per timed
+        /// measurement.
+        double get_average_allocations() const
+        {
+            const std::int64_t timed = timed_count();
+            return timed > 0 ? static_cast<double>(allocations_.load()) / static_cast<double>(timed) : 0.0;
+        }
+
+        /// Returns the average number of heap deallocations per timed
+        /// measurement.
+        double get_average_frees() const
+        {
+            const std::int64_t timed = timed_count();
+            return timed > 0 ? static_cast<double>(frees_.load()) / static_cast<double>(timed) : 0.0;
+        }
+
+        /// Returns the average number of allocated bytes per timed
+        /// measurement.
+        double get_average_allocated_bytes() const
+        {
+            const std::int64_t timed = timed_count();
+            return timed > 0 ? static_cast<double>(allocated_bytes_.load()) / static_cast<double>(timed) : 0.0;
+        }
+
+        /// Sets the heap allocations, e.g. when reading a profile file.
+        void restore_allocations(const AllocationUsage &usage)
+        {
+            has_allocations_.store(true);
+            allocations_.store(usage.allocations);
+            frees_.store(usage.frees);
+            allocated_bytes_.store(usage.bytes);
+        }
+
+        /// Returns whether any measurement was kept as an exemplar.
+        bool has_exemplars() const
+        {
+            return exemplars_.size() > 0;
+        }
+
+        /// Returns the slowest timed measurements, slowest first. The
+        /// overhead of the profiler is excluded from their durations.
+        std::vector<Exemplar> get_exemplars() const
+        {
+            std::vector<Exemplar> exemplars = exemplars_.get();
+            for (Exemplar &exemplar : exemplars)
+                exemplar.duration = compensate(exemplar.duration);
+            return exemplars;
+        }
+
+        /// Returns the duration the squares are summed relative to.
+        /// Unit: [ns].
+        std::int64_t get_shift() const
+        {
+            return shift_.load();
+        }
+
+        /// Returns the sum of the squared differences between the durations
+        /// and the shift.
+        /// Unit: [ns^2].
+        double get_shifted_squares() const
+        {
+            return shifted_squares_.load();
+        }
+
+        /// Sets the statistics, e.g. when reading a profile file. The
+        /// histogram is set separately.
+        /// Unit of the durations: [ns], of shifted_squares: [ns^2].
+        void restore(std::int64_t count, std::int64_t timed_count, std::int64_t overall_duration,
+                     std::int64_t min_duration, std::int64_t max_duration, std::int64_t shift, double shifted_squares)
+        {
+            count_.store(count);
+            timed_count_.store(timed_count);
+            overall_duration_.store(overall_duration);
+            min_duration_.store(min_duration);
+            max_duration_.store(max_duration);
+            shift_.store(shift);
+            shifted_squares_.store(shifted_squares);
+        }
+
+        /// Compares measurements based on their overall time consumption.
+        bool operator<(const MultiMeasurement &rhs) const
+        {
+            return get_overall_duration() < rhs.get_overall_duration();
+        }
+
+        /// Returns the key composed of the IDs of the start and the end site.
+        std::uint64_t get_key() const
+        {
+            return key_;
+        }
+
+        /// Returns the ID of the site where the start checkpoint resides.
+        std::uint32_t get_start_site_id() const
+        {
+            return start_site_id_;
+        }
+
+        /// Returns the ID of the site where the end checkpoint resides.
+        std::uint32_t get_end_site_id() const
+        {
+            return end_site_id_;
+        }
+
+        /// Returns the file where the start checkpoint resides.
+        std::string get_start_file() const
+        {
+            return std::string(SiteRegistry::get_site(start_site_id_).file);
+        }
+
+        /// Returns the function where the start checkpoint resides.
+        std::string get_start_function() const
+        {
+            return std::string(SiteRegistry::get_site(start_site_id_).function);
+        }
+
+        /// Returns the number of the line where the start checkpoint resides.
+        int get_start_line() const
+        {
+            return SiteRegistry::get_site(start_site_id_).line;
+        }
+
+        /// Returns the label of the start checkpoint if it has one, see
+        /// PROFILER_HOOK_NAMED(), and its function otherwise.
+        std::string get_start_name() const
+        {
+            const Site &site = SiteRegistry::get_site(start_site_id_);
+            return std::string(site.name.empty() ? site.function : site.name);
+        }
+
+        /// Returns the file where the end checkpoint resides.
+        std::string get_end_file() const
+        {
+            return std::string(SiteRegistry::get_site(end_site_id_).file);
+        }
+
+        /// Returns the function where the end checkpoint resides.
+        std::string get_end_function() const
+        {
+            return std::string(SiteRegistry::get_site(end_site_id_).function);
+        }
+
+        /// Returns the number of the line where the end checkpoint resides.
+        int get_end_line() const
+        {
+            return SiteRegistry::get_site(end_site_id_).line;
+        }
+
+        /// Returns the label of the end checkpoint if it has one, see
+        /// PROFILER_HOOK_NAMED(), and its function otherwise.
+        std::string get_end_name() const
+        {
+            const Site &site = SiteRegistry::get_site(end_site_id_);
+            return std::string(site.name.empty() ? site.function : site.name);
+        }
+
+        double get_percent() const
+        {
+            return percent_;
+        }
+
+        void set_percent(double p)
+        {
+            percent_ = p;
+        }
+
+        /// Share of the measured average duration above which the overhead
+        /// of the profiler makes the reported durations unreliable.
+        static constexpr double max_overhead_share = 0.25;
+
+        /// Sets the overhead of the profiler per timed measurement, which
+        /// the reported durations exclude from then on. The sums returned by
+        /// get_measured_duration() and the stored statistics are unchanged.
+        /// Unit: [ns].
+        void set_overhead(std::int64_t overhead)
+        {
+            overhead_ = std::max<std::int64_t>(0, overhead);
+        }
+
+        /// Returns the overhead of the profiler per timed measurement, see
+        /// set_overhead().
+        /// Unit: [ns].
+        std::int64_t get_overhead() const
+        {
+            return overhead_;
+        }
+
+        /// Returns the overhead of the profiler as a share of the measured
+        /// average duration, including the overhead.
+        double get_overhead_share() const
+        {
+            const std::int64_t timed = timed_count();
+            if (overhead_ <= 0 || timed == 0)
+                return 0.0;
+
+            const double average = static_cast<double>(overall_duration_.load()) / static_cast<double>(timed);
+            return average > 0.0 ? std::min(1.0, static_cast<double>(overhead_) / average) : 1.0;
+        }
+
+        /// Returns whether the overhead of the profiler dominates the
+        /// measured durations, so that the reported ones are unreliable.
+        bool is_overhead_dominated() const
+        {
+            return get_overhead_share() > max_overhead_share;
+        }
+    };
+
+    /// Open-addressing hash table of the statistics of pairs of checkpoints,
+    /// keyed by the exact pair of site IDs, so distinct pairs never collide.
+    /// The slots are one contiguous array probed linearly. The statistics
+    /// live in a deque, so growing the table only moves the slots and
+    /// references to the statistics stay valid.
+    class PairTable
+    {
+    private:
+        /// Slot of the table. Empty if measurement is \c nullptr.
+        struct Slot
+        {
+            std::uint64_t key;
+            MultiMeasurement *measurement;
+        };
+
+        /// Slots. The number of slots is a power of two.
+        std::vector<Slot> slots_;
+
+        /// Number of slots minus one.
+        std::size_t mask_;
+
+        /// Statistics of all pairs in the order of insertion.
+        std::deque<MultiMeasurement> measurements_;
+
+    public:
+        /// Constructor.
+        /// The capacity is rounded up to the next power of two.
+        explicit PairTable(std::size_t capacity = 64)
+            : mask_(1)
+        {
+            while (mask_ < capacity)
+                mask_ <<= 1;
+            slots_.assign(mask_, Slot{0, nullptr});
+            mask_--;
+        }
+
+        /// Copy constructor.
+        /// Inaccessible, since the slots point into the own statistics.
+        PairTable(const PairTable &table) = delete;
+
+        /// Assignment operator.
+        /// Inaccessible, since the slots point into the own statistics.
+        PairTable &operator=(const PairTable &table) = delete;
+
+        /// Returns the statistics of the pair with the given key, or
+        /// \c nullptr if the pair is not in the table.
+        MultiMeasurement *find(std::uint64_t key) const
+        {
+            for (std::size_t i = get_slot(key);; i = (i + 1) & mask_)
+            {
+                const Slot &slot = slots_[i];
+                if (slot.measurement == nullptr || slot.key == key)
+                    return slot.measurement;
+            }
+        }
+
+        /// Adds empty statistics for the given pair of sites, which must not
+        /// be in the table yet.
+        /// \return The new statistics.
+        MultiMeasurement &insert(std::uint32_t start_site_id, std::uint32_t end_site_id)
+        {
+            // Keep the load factor at or below 1/2, so probe sequences stay short.
+            if (2 * (measurements_.size() + 1) > slots_.size())
+                grow();
+
+            measurements_.emplace_back(start_site_id, end_site_id);
+            MultiMeasurement &measurement = measurements_.back();
+            place(measurement.get_key(), &measurement);
+
+            return measurement;
+        }
+
+        /// Returns the statistics of the given pair of sites, which are
+        /// added if the pair is not in the table yet.
+        MultiMeasurement &find_or_insert(std::uint32_t start_site_id, std::uint32_t end_site_id)
+        {
+            MultiMeasurement *measurement = find(
+                (static_cast<std::uint64_t>(start_site_id) << 32) | end_site_id);
+
+            return measurement != nullptr ? *measurement : insert(start_site_id, end_site_id);
+        }
+
+        /// Returns the number of pairs in the table.
+        std::size_t size() const
+        {
+            return measurements_.size();
+        }
+
+        /// Removes all pairs. Keeps the slots.
+        void clear()
+        {
+            measurements_.clear();
+            slots_.assign(slots_.size(), Slot{0, nullptr});
+        }
+
+        /// Returns the statistics of all pairs in the order of insertion.
+        const std::deque<MultiMeasurement> &get_measurements() const
+        {
+            return measurements_;
+        }
+
+    private:
+        /// Returns the first slot to probe for the given key.
+        /// Multiplicative hashing spreads consecutive site IDs.
+        std::size_t get_slot(std::uint64_t key) const
+        {
+            return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & mask_;
+        }
+
+        /// Puts the given statistics into the first free slot for the key.
+        void place(std::uint64_t key, MultiMeasurement *measurement)
+        {
+            std::size_t i = get_slot(key);
+            while (slots_[i].measurement != nullptr)
+                i = (i + 1) & mask_;
+
+            slots_[i] = Slot{key, measurement};
+        }
+
+        /// Doubles the number of slots.
+        void grow()
+        {
+            slots_.assign(2 * slots_.size(), Slot{0, nullptr});
+            mask_ = slots_.size() - 1;
+            for (MultiMeasurement &measurement : measurements_)
+                place(measurement.get_key(), &measurement);
+        }
+    };
+
+    /// Statistics of a node of a ZoneTree, flattened for printing.
+    struct ZoneStatistics
+    {
+        /// ID of the site that opens the zone.
+        std::uint32_t site_id;
+
+        /// Nesting depth, 0 for zones that are not nested in another zone.
+        int depth;
+
+        /// Number of times the zone was entered along this call path.
+        std::int64_t count;
+
+        /// Time spent in the zone including nested zones.
+        /// Unit: [ns].
+        std::int64_t inclusive_duration;
+
+        /// Time spent in the zone excluding nested zones.
+        /// Unit: [ns].
+        std::int64_t exclusive_duration;
+    };
+
+    /// Call tree of scoped zones.
+    /// Every node stands for a zone reached along a distinct path of nested
+    /// zones. The nodes live in a single array and refer to each other by
+    /// index, so entering a zone that was reached before does not allocate.
+    /// Statistics are relaxed atomics, so the tree can be read while its
+    /// owner updates it; adding nodes must be synchronized with readers.
+    class ZoneTree
+    {
+    private:
+        /// Node of the tree.
+        struct Node
+        {
+            std::uint32_t site_id;
+            std::uint32_t parent;
+            std::uint32_t first_child;
+            std::uint32_t next_sibling;
+            RelaxedValue<std::int64_t> count;
+            RelaxedValue<std::int64_t> inclusive_duration;
+        };
+
+        /// Nodes of the tree. Index 0 is the root, which is not a zone.
+        std::vector<Node> nodes_;
+
+    public:
+        /// Index that refers to no node.
+        static constexpr std::uint32_t no_node = 0xFFFFFFFF;
+
+        /// Index of the root node.
+        static constexpr std::uint32_t root = 0;
+
+        /// Constructor.
+        /// Creates a tree that only contains the root.
+        ZoneTree()
+        {
+            nodes_.reserve(64);
+            nodes_.push_back(Node{no_node, no_node, no_node, no_node, 0, 0});
+        }
+
+        /// Returns the child of the given node that belongs to the given
+        /// site, or no_node if there is none.
+        std::uint32_t find_child(std::uint32_t parent, std::uint32_t site_id) const
+        {
+            std::uint32_t child = nodes_[parent].first_child;
+            while (child != no_node && nodes_[child].site_id != site_id)
+                child = nodes_[child].next_sibling;
+
+            return child;
+        }
+
+        /// Adds a child that belongs to the given site to the given node.
+        /// \return The index of the new node.
+        std::uint32_t add_child(std::uint32_t parent, std::uint32_t site_id)
+        {
+            const std::uint32_t child = static_cast<std::uint32_t>(nodes_.size());
+            nodes_.push_back(Node{site_id, parent, no_node, nodes_[parent].first_child, 0, 0});
+            nodes_[parent].first_child = child;
+
+            return child;
+        }
+
+        /// Returns the parent of the given node.
+        std::uint32_t get_parent(std::uint32_t node) const
+        {
+            return nodes_[node].parent;
+        }
+
+        /// Adds a visit of the given node that took the given time.
+        void add(std::uint32_t node, std::int64_t duration, std::int64_t count = 1)
+        {
+            nodes_[node].count.add(count);
+            nodes_[node].inclusive_duration.add(duration);
+        }
+
+        /// Adds the flattened statistics of another tree, matching the nodes
+        /// by their path of sites.
+        void merge(const std::vector<ZoneStatistics> &zones)
+        {
+            add(zones, 1);
+        }
+
+        /// Subtracts the flattened statistics of an earlier state of this
+        /// tree, matching the nodes by their path of sites.
+        void subtract(const std::vector<ZoneStatistics> &zones)
+        {
+            add(zones, -1);
+        }
+
+        /// Returns the statistics of all zones in depth-first order.
+        /// Siblings are sorted by their inclusive time, starting with the
+        /// largest value.
+        /// \param skip_empty Whether to leave out zones that were not
+        /// exited and contain no zone that was.
+        std::vector<ZoneStatistics> flatten(bool skip_empty = false) const
+        {
+            std::vector<ZoneStatistics> zones;
+            flatten(root, -1, skip_empty, zones);
+            return zones;
+        }
+
+    private:
+        /// Adds the given flattened statistics, multiplied by the given sign.
+        void add(const std::vector<ZoneStatistics> &zones, int sign)
+        {
+            std::vector<std::uint32_t> path(1, root);
+            for (const ZoneStatistics &zone : zones)
+            {
+                path.resize(zone.depth + 1);
+
+                std::uint32_t node = find_child(path.back(), zone.site_id);
+                if (node == no_node)
+                    node = add_child(path.back(), zone.site_id);
+
+                add(node, sign * zone.inclusive_duration, sign * zone.count);
+                path.push_back(node);
+            }
+        }
+
+        /// Appends the statistics of the given node and its descendants.
+        void flatten(std::uint32_t node, int depth, bool skip_empty, std::vector<ZoneStatistics> &zones) const
+        {
+            std::vector<std::uint32_t> children;
+            std::int64_t children_duration = 0;
+            for (std::uint32_t child = nodes_[node].first_child; child != no_node; child = nodes_[child].next_sibling)
+            {
+                children.push_back(child);
+                children_duration += nodes_[child].inclusive_duration.load();
+            }
+
+            std::sort(children.begin(), children.end(),
+                      [this](std::uint32_t lhs, std::uint32_t rhs)
+                      { return nodes_[lhs].inclusive_duration.load() > nodes_[rhs].inclusive_duration.load(); });
+
+            const std::size_t position = zones.size();
+            if (node != root)
+            {
+                const std::int64_t inclusive_duration = nodes_[node].inclusive_duration.load();
+                zones.push_back(ZoneStatistics{nodes_[node].site_id, depth, nodes_[node].count.load(),
+                                               inclusive_duration, inclusive_duration - children_duration});
+            }
+
+            for (std::uint32_t child : children)
+                flatten(child, depth + 1, skip_empty, zones);
+
+            if (skip_empty && node != root && zones[position].count == 0 && zones.size() == position + 1)
+                zones.pop_back();
+        }
+    };
+
+    /// Statistics of the tasks of a site, e.g. of a coroutine, see TaskSpan.
+    struct TaskStatistics
+    {
+        /// ID of the site that starts the tasks.
+        std::uint32_t site_id;
+
+        /// Number of tasks that finished.
+        std::int64_t count;
+
+        /// Number of times the tasks were resumed after a suspension.
+        std::int64_t resume_count;
+
+        /// Time from the start to the end of the tasks.
+        /// Unit: [ns].
+        std::int64_t duration;
+
+        /// Time the tasks were running on a thread, between their start or
+        /// a resumption and the next suspension or their end.
+        /// Unit: [ns].
+        std::int64_t active_duration;
+
+        /// Time the tasks were suspended, between a suspension and the next
+        /// resumption.
+        /// Unit: [ns].
+        std::int64_t suspended_duration;
+
+        /// Longest time from the start to the end of a task.
+        /// Unit: [ns].
+        std::int64_t max_duration;
+    };
+
+    /// Table of the statistics of all task sites of the process.
+    /// Tasks may suspend on one thread and resume on another, so unlike
+    /// pairs of checkpoints, their statistics are not kept per thread but
+    /// in relaxed atomics that a finishing task adds to. Every site gets its
+    /// counters once when it registers, so finishing a task never looks
+    /// anything up.
+    class TaskTable
+    {
+    public:
+        /// Counters of the tasks of a site.
+        struct Counters
+        {
+            /// ID of the site that starts the tasks.
+            std::uint32_t site_id;
+
+            /// Number of tasks that finished.
+            std::atomic<std::int64_t> count;
+
+            /// Number of resumptions of those tasks.
+            std::atomic<std::int64_t> resume_count;
+
+            /// Time from the start to the end of those tasks.
+            /// Unit: [ns].
+            std::atomic<std::int64_t> duration;
+
+            /// Time those tasks were running.
+            /// Unit: [ns].
+            std::atomic<std::int64_t> active_duration;
+
+            /// Time those tasks were suspended.
+            /// Unit: [ns].
+            std::atomic<std::int64_t> suspended_duration;
+
+            /// Longest time from the start to the end of a task.
+            /// Unit: [ns].
+            std::atomic<std::int64_t> max_duration;
+
+            /// Constructor.
+            explicit Counters(std::uint32_t id)
+                : site_id(id), count(0), resume_count(0), duration(0), active_duration(0),
+                  suspended_duration(0), max_duration(0)
+            {
+            }
+
+            /// Adds a task that finished.
+            /// Unit: [ns].
+            void add(std::int64_t resumes, std::int64_t total, std::int64_t active, std::int64_t suspended)
+            {
+                count.fetch_add(1, std::memory_order_relaxed);
+                resume_count.fetch_add(resumes, std::memory_order_relaxed);
+                duration.fetch_add(total, std::memory_order_relaxed);
+                active_duration.fetch_add(active, std::memory_order_relaxed);
+                suspended_duration.fetch_add(suspended, std::memory_order_relaxed);
+
+                std::int64_t max = max_duration.load(std::memory_order_relaxed);
+                while (total > max && !max_duration.compare_exchange_weak(max, total, std::memory_order_relaxed))
+                {
+                }
+            }
+        };
+
+    private:
+        /// Counters of all task sites, in the order of registration.
+        /// Elements of a deque keep their address when it grows.
+        std::deque<Counters> counters_;
+
+        /// Guards counters_ against concurrent registration and reading.
+        std::mutex mutex_;
+
+        /// Default constructor.
+        /// Inaccessible from outside the class.
+        TaskTable() = default;
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        TaskTable(const TaskTable &table);
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        TaskTable &operator=(const TaskTable &table);
+
+    public:
+        /// Returns the singleton instance of the table.
+        static TaskTable &get_instance()
+        {
+            static TaskTable table;
+            return table;
+        }
+
+        /// Registers the task site in the given file, line and function
+        /// with the given name.
+        /// \return The counters of the site, which live as long as the
+        /// process.
+        static Counters &register_site(const std::string &file, int line, const std::string &function,
+                                       const std::string &name)
+        {
+            const AllocationSuppressor suppressor;
+            const std::uint32_t site_id = SiteRegistry::register_site(file, line, function, name).id;
+
+            TaskTable &table = get_instance();
+            std::lock_guard<std::mutex> lock(table.mutex_);
+            for (Counters &counters : table.counters_)
+            {
+                if (counters.site_id == site_id)
+                    return counters;
+            }
+
+            table.counters_.emplace_back(site_id);
+            return table.counters_.back();
+        }
+
+        /// Returns the statistics of all task sites that finished a task.
+        static std::vector<TaskStatistics> get_statistics()
+        {
+            TaskTable &table = get_instance();
+            std::lock_guard<std::mutex> lock(table.mutex_);
+            std::vector<TaskStatistics> statistics;
+            for (const Counters &counters : table.counters_)
+            {
+                if (counters.count.load(std::memory_order_relaxed) == 0)
+                    continue;
+
+                statistics.push_back(TaskStatistics{counters.site_id,
+                                                    counters.count.load(std::memory_order_relaxed),
+                                                    counters.resume_count.load(std::memory_order_relaxed),
+                                                    counters.duration.load(std::memory_order_relaxed),
+                                                    counters.active_duration.load(std::memory_order_relaxed),
+                                                    counters.suspended_duration.load(std::memory_order_relaxed),
+                                                    counters.max_duration.load(std::memory_order_relaxed)});
+            }
+
+            return statistics;
+        }
+
+        /// Locks the table while the process forks, so that the child does
+        /// not inherit it locked.
+        static void lock()
+        {
+            get_instance().mutex_.lock();
+        }
+
+        /// Unlocks the table after a fork. In the child, the statistics of
+        /// the parent are dropped; the sites stay registered.
+        static void unlock(bool child)
+        {
+            TaskTable &table = get_instance();
+            if (child)
+            {
+                for (Counters &counters : table.counters_)
+                {
+                    counters.count.store(0, std::memory_order_relaxed);
+                    counters.resume_count.store(0, std::memory_order_relaxed);
+                    counters.duration.store(0, std::memory_order_relaxed);
+                    counters.active_duration.store(0, std::memory_order_relaxed);
+                    counters.suspended_duration.store(0, std::memory_order_relaxed);
+                    counters.max_duration.store(0, std::memory_order_relaxed);
+                }
+            }
+            table.mutex_.unlock();
+        }
+    };
+
+    /// Returns the quantile of Student's t-distribution with the given
+    /// degrees of freedom that bounds the two-sided 95% confidence interval.
+    inline double get_t_quantile(double degrees)
+    {
+        static const double quantiles[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                           2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                           2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+        const int count = static_cast<int>(sizeof(quantiles) / sizeof(quantiles[0]));
+        if (degrees < 1.0)
+            return quantiles[0];
+        if (degrees <= count)
+            return quantiles[static_cast<int>(degrees) - 1];
+
+        // Approaches the quantile of the normal distribution.
+        return 1.96 + 2.4 / degrees;
+    }
+
+    /// Options of the benchmarks run by BenchRun.
+    struct BenchOptions
+    {
+        /// Number of trials run before the measured ones, e.g. to warm up
+        /// caches and branch predictors.
+        int warmup_trials = 3;
+
+        /// Number of measured trials, at least 1.
+        int trials = 20;
+
+        /// Trials whose duration differs from the median by more than this
+        /// many scaled median absolute deviations are rejected as outliers.
+        /// 0 keeps all trials.
+        double outlier_threshold = 3.0;
+    };
+
+    /// Result of the latest run of a benchmark, see BenchRun. The durations
+    /// are per iteration and refer to the trials that were kept.
+    struct BenchStatistics
+    {
+        /// ID of the site of the benchmark.
+        std::uint32_t site_id;
+
+        /// Name of the benchmark this one is compared with, empty if none.
+        std::string baseline;
+
+        /// Number of runs of the benchmark so far. Every run replaces the
+        /// result of the previous one.
+        std::int64_t run_count;
+
+        /// Number of iterations per trial.
+        std::int64_t iterations;
+
+        /// Number of measured trials that were kept.
+        int trial_count;
+
+        /// Number of measured trials that were rejected as outliers.
+        int rejected_count;
+
+        /// Mean duration.
+        /// Unit: [ns].
+        double mean;
+
+        /// Median duration.
+        /// Unit: [ns].
+        double median;
+
+        /// Sample standard deviation of the durations.
+        /// Unit: [ns].
+        double standard_deviation;
+
+        /// Half-width of the 95% confidence interval of the mean.
+        /// Unit: [ns].
+        double confidence;
+
+        /// Shortest duration.
+        /// Unit: [ns].
+        double min;
+
+        /// Longest duration.
+        /// Unit: [ns].
+        double max;
+    };
+
+    /// Table of the results of all benchmarks of the process and of the
+    /// options they run with.
+    class BenchTable
+    {
+    private:
+        /// Latest result of every benchmark that finished a run, in the
+        /// order of their first run.
+        std::vector<BenchStatistics> statistics_;
+
+        /// Options of the benchmarks that start from now on.
+        BenchOptions options_;
+
+        /// Guards statistics_ and options_.
+        std::mutex mutex_;
+
+        /// Default constructor.
+        /// Inaccessible from outside the class.
+        BenchTable() = default;
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        BenchTable(const BenchTable &table);
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        BenchTable &operator=(const BenchTable &table);
+
+    public:
+        /// Returns the singleton instance of the table.
+        static BenchTable &get_instance()
+        {
+            static BenchTable table;
+            return table;
+        }
+
+        /// Returns the options of the benchmarks.
+        static BenchOptions get_options()
+        {
+            BenchTable &table = get_instance();
+            std::lock_guard<std::mutex> lock(table.mutex_);
+            return table.options_;
+        }
+
+        /// Sets the options of the benchmarks that start from now on.
+        static void set_options(const BenchOptions &options)
+        {
+            BenchTable &table = get_instance();
+            std::lock_guard<std::mutex> lock(table.mutex_);
+            table.options_ = options;
+            table.options_.warmup_trials = options.warmup_trials > 0 ? options.warmup_trials : 0;
+            table.options_.trials = options.trials > 1 ? options.trials : 1;
+        }
+
+        /// Replaces the result of the benchmark with the same site by the
+        /// given one and counts the run.
+        static void add(BenchStatistics statistics)
+        {
+            const AllocationSuppressor suppressor;
+            BenchTable &table = get_instance();
+            std::lock_guard<std::mutex> lock(table.mutex_);
+            for (BenchStatistics &existing : table.statistics_)
+            {
+                if (existing.site_id == statistics.site_id)
+                {
+                    statistics.run_count = existing.run_count + 1;
+                    existing = std::move(statistics);
+                    return;
+                }
+            }
+
+            statistics.run_count = 1;
+            table.statistics_.push_back(std::move(statistics));
+        }
+
+        /// Returns the latest results of all benchmarks.
+        static std::vector<BenchStatistics> get_statistics()
+        {
+            BenchTable &table = get_instance();
+            std::lock_guard<std::mutex> lock(table.mutex_);
+            return table.statistics_;
+        }
+
+        /// Locks the table while the process forks, so that the child does
+        /// not inherit it locked.
+        static void lock()
+        {
+            get_instance().mutex_.lock();
+        }
+
+        /// Unlocks the table after a fork. In the child, the results of the
+        /// parent are dropped.
+        static void unlock(bool child)
+        {
+            BenchTable &table = get_instance();
+            if (child)
+                table.statistics_.clear();
+            table.mutex_.unlock();
+        }
+    };
+
+    /// Time a profiling context spent between a pair of checkpoints, see
+    /// ProfilingContext.
+    struct ContextSegment
+    {
+        /// Site ID of both checkpoints of the segment that stands for the
+        /// pairs beyond ContextBreakdown::capacity.
+        static const std::uint32_t other_pairs = 0xFFFFFFFFu;
+
+        /// ID of the site where the start checkpoint resides.
+        std::uint32_t start_site_id;
+
+        /// ID of the site where the end checkpoint resides.
+        std::uint32_t end_site_id;
+
+        /// Number of timed segments.
+        std::int64_t count;
+
+        /// Sum of their durations.
+        /// Unit: [ns].
+        std::int64_t duration;
+    };
+
+    /// Profiling context that was kept because it took at least the
+    /// threshold of its type.
+    struct KeptContext
+    {
+        /// Duration of the context, from its start to its end.
+        /// Unit: [ns].
+        std::int64_t duration;
+
+        /// System time the context ended, since the epoch.
+        /// Unit: [ns].
+        std::int64_t time;
+
+        /// Tag of the context, e.g. a request ID, 0 if none was set.
+        std::uint64_t tag;
+
+        /// Time the context spent between the pairs of checkpoints hit
+        /// while it was active.
+        std::vector<ContextSegment> segments;
+    };
+
+    /// Statistics of the profiling contexts of a type, e.g. of the
+    /// requests of one kind.
+    struct ContextStatistics
+    {
+        /// Name of the type.
+        std::string name;
+
+        /// Contexts that take at least this long are kept.
+        /// Unit: [ns].
+        std::int64_t threshold;
+
+        /// Number of contexts that ended.
+        std::int64_t count;
+
+        /// Sum of the durations of those contexts.
+        /// Unit: [ns].
+        std::int64_t duration;
+
+        /// Longest duration of a context.
+        /// Unit: [ns].
+        std::int64_t max_duration;
+
+        /// Number of contexts that were kept.
+        std::int64_t kept_count;
+
+        /// Sum of the durations of the kept contexts.
+        /// Unit: [ns].
+        std::int64_t kept_duration;
+
+        /// Segments of the kept contexts, summed per pair of checkpoints.
+        std::vector<ContextSegment> segments;
+
+        /// Slowest kept contexts, slowest first.
+        std::vector<KeptContext> slowest;
+    };
+
+    /// Breakdown of the time of a profiling context into the pairs of
+    /// checkpoints that its threads hit while it was active. It holds a
+    /// fixed number of pairs, so recording into it never allocates; further
+    /// pairs are summed into one segment.
+    class ContextBreakdown
+    {
+    public:
+        /// Number of distinct pairs kept.
+        static const int capacity = 32;
+
+    private:
+        /// Segments of the pairs hit so far.
+        std::array<ContextSegment, capacity> segments_;
+
+        /// Number of segments in use.
+        int size_;
+
+        /// Index of the segment added to last, which is looked at first.
+        int last_index_;
+
+        /// Segments of the pairs that did not fit.
+        ContextSegment other_;
+
+    public:
+        /// Constructor.
+        /// Creates an empty breakdown.
+        ContextBreakdown()
+            : size_(0),
+              last_index_(0),
+              other_{ContextSegment::other_pairs, ContextSegment::other_pairs, 0, 0}
+        {
+        }
+
+        /// Adds a timed segment between the given sites.
+        /// Unit of the duration: [ns].
+        void add(std::uint32_t start_site_id, std::uint32_t end_site_id, std::int64_t duration)
+        {
+            ContextSegment *segment = &segments_[last_index_];
+            if (size_ == 0 || segment->start_site_id != start_site_id || segment->end_site_id != end_site_id)
+            {
+                segment = nullptr;
+                for (int i = 0; i < size_; i++)
+                {
+                    if (segments_[i].start_site_id == start_site_id && segments_[i].end_site_id == end_site_id)
+                    {
+                        segment = &segments_[i];
+                        last_index_ = i;
+                        break;
+                    }
+                }
+
+                if (segment == nullptr && size_ < capacity)
+                {
+                    last_index_ = size_++;
+                    segment = &segments_[last_index_];
+                    *segment = ContextSegment{start_site_id, end_site_id, 0, 0};
+                }
+                else if (segment == nullptr)
+                {
+                    segment = &other_;
+                }
+            }
+
+            segment->count++;
+            segment->duration += duration;
+        }
+
+        /// Returns the segments, including the one of the pairs that did
+        /// not fit if there were any.
+        std::vector<ContextSegment> get_segments() const
+        {
+            std::vector<ContextSegment> segments(segments_.begin(), segments_.begin() + size_);
+            if (other_.count > 0)
+                segments.push_back(other_);
+            return segments;
+        }
+
+        /// Adds the given segments to those with the same pairs among the
+        /// given ones, or appends them.
+        static void merge(std::vector<ContextSegment> &segments, const std::vector<ContextSegment> &other)
+        {
+            for (const ContextSegment &other_segment : other)
+            {
+                auto segment = std::find_if(segments.begin(), segments.end(), [&other_segment](const ContextSegment &lhs)
+                                            { return lhs.start_site_id == other_segment.start_site_id &&
+                                                     lhs.end_site_id == other_segment.end_site_id; });
+                if (segment == segments.end())
+                {
+                    segments.push_back(other_segment);
+                    continue;
+                }
+
+                segment->count += other_segment.count;
+                segment->duration += other_segment.duration;
+            }
+        }
+    };
+
+    /// Type of profiling contexts, e.g. a kind of request, which aggregates
+    /// the contexts that ended. All contexts are counted; the breakdowns are
+    /// only kept for those that took at least the threshold of the type.
+    class ContextType
+    {
+    public:
+        /// Threshold that keeps no context.
+        static constexpr std::int64_t keep_none = std::numeric_limits<std::int64_t>::max();
+
+        /// Maximum number of kept contexts whose breakdowns are retained
+        /// individually, the slowest ones.
+        static const int max_slowest = 8;
+
+    private:
+        /// Name of the type.
+        std::string name_;
+
+        /// Contexts that take at least this long are kept.
+        /// Unit: [ns].
+        std::atomic<std::int64_t> threshold_;
+
+        /// Number of contexts that ended.
+        std::atomic<std::int64_t> count_;
+
+        /// Sum of the durations of those contexts.
+        /// Unit: [ns].
+        std::atomic<std::int64_t> duration_;
+
+        /// Longest duration of a context.
+        /// Unit: [ns].
+        std::atomic<std::int64_t> max_duration_;
+
+        /// Number of kept contexts. Guarded by the mutex of the
+        /// ContextRegistry, as are the following members.
+        std::int64_t kept_count_;
+
+        /// Sum of the durations of the kept contexts.
+        /// Unit: [ns].
+        std::int64_t kept_duration_;
+
+        /// Segments of the kept contexts, summed per pair.
+        std::vector<ContextSegment> segments_;
+
+        /// Slowest kept contexts, slowest first.
+        std::vector<KeptContext> slowest_;
+
+    public:
+        /// Constructor.
+        /// Creates a type without contexts.
+        /// Unit of the threshold: [ns].
+        ContextType(const std::string &name, std::int64_t threshold)
+            : name_(name),
+              threshold_(threshold),
+              count_(0),
+              duration_(0),
+              max_duration_(0),
+              kept_count_(0),
+              kept_duration_(0)
+        {
+        }
+
+        /// Returns the name of the type.
+        const std::string &get_name() const
+        {
+            return name_;
+        }
+
+        /// Sets the duration from which on contexts are kept, 0 to keep all
+        /// of them.
+        /// Unit: [ns].
+        void set_threshold(std::int64_t threshold)
+        {
+            threshold_.store(std::max<std::int64_t>(0, threshold), std::memory_order_relaxed);
+        }
+
+        /// Counts a context that ended after the given duration.
+        /// Unit: [ns].
+        /// \return \c true if the context took at least the threshold and
+        /// is to be kept with keep().
+        bool add(std::int64_t duration)
+        {
+            count_.fetch_add(1, std::memory_order_relaxed);
+            duration_.fetch_add(duration, std::memory_order_relaxed);
+            std::int64_t max = max_duration_.load(std::memory_order_relaxed);
+            while (duration > max && !max_duration_.compare_exchange_weak(max, duration, std::memory_order_relaxed))
+            {
+            }
+
+            return duration >= threshold_.load(std::memory_order_relaxed);
+        }
+
+        /// Keeps the breakdown of a context that ended after the given
+        /// duration, with the given tag. The slowest kept contexts are
+        /// retained individually.
+        /// Must be called with the mutex of the ContextRegistry locked.
+        /// Unit of the duration: [ns].
+        void keep(std::int64_t duration, std::uint64_t tag, const ContextBreakdown &breakdown)
+        {
+            const std::vector<ContextSegment> segments = breakdown.get_segments();
+            kept_count_++;
+            kept_duration_ += duration;
+            ContextBreakdown::merge(segments_, segments);
+
+            if (static_cast<int>(slowest_.size()) >= max_slowest && duration <= slowest_.back().duration)
+                return;
+
+            const std::int64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                          std::chrono::system_clock::now().time_since_epoch())
+                                          .count();
+            auto position = std::find_if(slowest_.begin(), slowest_.end(), [duration](const KeptContext &kept)
+                                         { return kept.duration < duration; });
+            slowest_.insert(position, KeptContext{duration, time, tag, segments});
+            if (static_cast<int>(slowest_.size()) > max_slowest)
+                slowest_.pop_back();
+        }
+
+        /// Returns the statistics of the type.
+        /// Must be called with the mutex of the ContextRegistry locked.
+        ContextStatistics get_statistics() const
+        {
+            return ContextStatistics{name_,
+                                     threshold_.load(std::memory_order_relaxed),
+                                     count_.load(std::memory_order_relaxed),
+                                     duration_.load(std::memory_order_relaxed),
+                                     max_duration_.load(std::memory_order_relaxed),
+                                     kept_count_,
+                                     kept_duration_,
+                                     segments_,
+                                     slowest_};
+        }
+
+        /// Returns whether a context of the type ended.
+        bool has_contexts() const
+        {
+            return count_.load(std::memory_order_relaxed) > 0;
+        }
+
+        /// Drops the statistics, e.g. in the child after a fork.
+        /// Must be called with the mutex of the ContextRegistry locked.
+        void reset()
+        {
+            count_.store(0, std::memory_order_relaxed);
+            duration_.store(0, std::memory_order_relaxed);
+            max_duration_.store(0, std::memory_order_relaxed);
+            kept_count_ = 0;
+            kept_duration_ = 0;
+            segments_.clear();
+            slowest_.clear();
+        }
+    };
+
+    /// Registry of the types of profiling contexts of the process.
+    class ContextRegistry
+    {
+    private:
+        /// Registered types, in the order of registration.
+        /// Elements of a deque keep their address when it grows.
+        std::deque<ContextType> types_;
+
+        /// Guards types_ and the contexts the types keep.
+        std::mutex mutex_;
+
+        /// Default constructor.
+        /// Inaccessible from outside the class.
+        ContextRegistry() = default;
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        ContextRegistry(const ContextRegistry &registry);
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        ContextRegistry &operator=(const ContextRegistry &registry);
+
+        /// Returns the type with the given name, or \c nullptr if there is
+        /// none.
+        /// Must be called with mutex_ locked.
+        ContextType *find(const std::string &name)
+        {
+            for (ContextType &type : types_)
+            {
+                if (type.get_name() == name)
+                    return &type;
+            }
+
+            return nullptr;
+        }
+
+    public:
+        /// Returns the singleton instance of the registry.
+        static ContextRegistry &get_instance()
+        {
+            static ContextRegistry registry;
+            return registry;
+        }
+
+        /// Returns the mutex that guards the types and their kept contexts.
+        static std::mutex &get_mutex()
+        {
+            return get_instance().mutex_;
+        }
+
+        /// Registers the type of contexts with the given name, which keeps
+        /// the contexts that take at least the given duration. A type that
+        /// is already registered keeps its threshold.
+        /// \return The type, which lives as long as the process.
+        static ContextType &register_type(const std::string &name,
+                                          std::chrono::nanoseconds threshold = std::chrono::nanoseconds(ContextType::keep_none))
+        {
+            const AllocationSuppressor suppressor;
+            ContextRegistry &registry = get_instance();
+            std::lock_guard<std::mutex> lock(registry.mutex_);
+            if (ContextType *type = registry.find(name))
+                return *type;
+
+            registry.types_.emplace_back(name, std::max<std::int64_t>(0, threshold.count()));
+            return registry.types_.back();
+        }
+
+        /// Sets the threshold of the type with the given name, see
+        /// ContextType::set_threshold().
+        /// \return \c false if no such type is registered.
+        static bool set_threshold(const std::string &name, std::chrono::nanoseconds threshold)
+        {
+            ContextRegistry &registry = get_instance();
+            std::lock_guard<std::mutex> lock(registry.mutex_);
+            ContextType *type = registry.find(name);
+            if (type == nullptr)
+                return false;
+
+            type->set_threshold(threshold.count());
+            return true;
+        }
+
+        /// Returns the statistics of all types with contexts that ended.
+        static std::vector<ContextStatistics> get_statistics()
+        {
+            ContextRegistry &registry = get_instance();
+            std::lock_guard<std::mutex> lock(registry.mutex_);
+            std::vector<ContextStatistics> statistics;
+            for (const ContextType &type : registry.types_)
+            {
+                if (type.has_contexts())
+                    statistics.push_back(type.get_statistics());
+            }
+
+            return statistics;
+        }
+
+        /// Locks the registry while the process forks, so that the child
+        /// does not inherit it locked.
+        static void lock()
+        {
+            get_instance().mutex_.lock();
+        }
+
+        /// Unlocks the registry after a fork. In the child, the statistics
+        /// of the parent are dropped; the types stay registered.
+        static void unlock(bool child)
+        {
+            ContextRegistry &registry = get_instance();
+            if (child)
+            {
+                for (ContextType &type : registry.types_)
+                    type.reset();
+            }
+            registry.mutex_.unlock();
+        }
+    };
+
+    /// Returns the ID of the current process, or 0 if unknown.
+    inline long get_process_id()
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        return static_cast<long>(::getpid());
+#else
+        return 0;
+#endif
+    }
+
+    /// Role of the current process, e.g. "master" or "worker", which tags
+    /// the names of the files the profiler writes and its profiles, so that
+    /// the profiles of several processes can be told apart.
+    class ProcessRole
+    {
+    private:
+        /// Guards the roles.
+        std::mutex mutex_;
+
+        /// Role of this process. Empty unless set.
+        std::string role_;
+
+        /// Role of the child processes forked by this process.
+        std::string child_role_;
+
+        /// Default constructor.
+        /// Inaccessible from outside the class.
+        ProcessRole()
+            : child_role_("child")
+        {
+        }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        ProcessRole(const ProcessRole &role);
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        ProcessRole &operator=(const ProcessRole &role);
+
+    public:
+        /// Returns the singleton instance of the roles.
+        static ProcessRole &get_instance()
+        {
+            static ProcessRole role;
+            return role;
+        }
+
+        /// Returns the role of this process.
+        static std::string get()
+        {
+            ProcessRole &role = get_instance();
+            std::lock_guard<std::mutex> lock(role.mutex_);
+            return role.role_;
+        }
+
+        /// Sets the role of this process.
+        static void set(const std::string &role)
+        {
+            ProcessRole &instance = get_instance();
+            std::lock_guard<std::mutex> lock(instance.mutex_);
+            instance.role_ = role;
+        }
+
+        /// Sets the role that child processes take when this process forks,
+        /// "child" by default.
+        static void set_child(const std::string &role)
+        {
+            ProcessRole &instance = get_instance();
+            std::lock_guard<std::mutex> lock(instance.mutex_);
+            instance.child_role_ = role;
+        }
+
+        /// Locks the roles while the process forks, so that the child does
+        /// not inherit them locked.
+        static void lock()
+        {
+            get_instance().mutex_.lock();
+        }
+
+        /// Unlocks the roles after a fork. In the child, the role becomes
+        /// the child role.
+        static void unlock(bool child)
+        {
+            ProcessRole &instance = get_instance();
+            if (child)
+                instance.role_ = instance.child_role_;
+            instance.mutex_.unlock();
+        }
+    };
+
+    /// Format of a report of the statistics.
+    enum class ReportFormat
+    {
+        /// Tables for the console, see Printer.
+        table,
+
+        /// Comma-separated values with one row per pair of checkpoints and
+        /// table, for spreadsheets and scripts.
+        csv,
+
+        /// A JSON document with the pairs and zones of every table.
+        json
+    };
+
+    /// Selection and format of the pairs of checkpoints in a report.
+    /// The filters only apply to pairs; zones are always reported.
+    struct ReportOptions
+    {
+        /// Format of the report.
+        ReportFormat format = ReportFormat::table;
+
+        /// Maximum number of pairs per table, the ones that took the most
+        /// time. 0 for all pairs.
+        std::size_t top_n = 0;
+
+        /// If not empty, only pairs with a checkpoint in a file whose path
+        /// contains this text are reported.
+        std::string file_filter;
+
+        /// If not empty, only pairs with a checkpoint in a function whose
+        /// name contains this text are reported.
+        std::string function_filter;
+
+        /// Only pairs that took at least this share of the overall time of
+        /// their table are reported. The share always refers to all pairs
+        /// of the table, including the ones that are not reported.
+        /// Unit: [%].
+        double min_percent = 0.0;
+    };
+
+    /// Stream buffer that collects the output of a report in a buffer of a
+    /// fixed size and passes it on in large blocks. Writing the rows of a
+    /// report directly to an unbuffered stream such as std::cerr would cost
+    /// a system call per field.
+    class ReportBuffer : public std::streambuf
+    {
+    private:
+        /// Stream buffer that receives the output. The output is discarded
+        /// if it is \c nullptr.
+        std::streambuf *sink_;
+
+        /// Collected output.
+        std::vector<char> buffer_;
+
+    public:
+        /// Constructor.
+        explicit ReportBuffer(std::streambuf *sink, std::size_t capacity = 1 << 16)
+            : sink_(sink), buffer_(std::max<std::size_t>(capacity, 1))
+        {
+            setp(buffer_.data(), buffer_.data() + buffer_.size());
+        }
+
+        /// Destructor.
+        /// Passes on the remaining output.
+        ~ReportBuffer() override
+        {
+            sync();
+        }
+
+        /// Copy constructor.
+        /// Inaccessible, since the stream buffer points into the own buffer.
+        ReportBuffer(const ReportBuffer &buffer) = delete;
+
+        /// Assignment operator.
+        /// Inaccessible, since the stream buffer points into the own buffer.
+        ReportBuffer &operator=(const ReportBuffer &buffer) = delete;
+
+    protected:
+        /// Passes on the collected output to make room for the given
+        /// character.
+        int overflow(int c) override
+        {
+            if (!pass_on())
+                return traits_type::eof();
+
+            if (!traits_type::eq_int_type(c, traits_type::eof()))
+            {
+                *pptr() = traits_type::to_char_type(c);
+                pbump(1);
+            }
+
+            return traits_type::not_eof(c);
+        }
+
+        /// Passes on the collected output and flushes the receiving buffer.
+        int sync() override
+        {
+            if (!pass_on())
+                return -1;
+
+            return sink_ != nullptr ? sink_->pubsync() : 0;
+        }
+
+    private:
+        /// Passes on the collected output and empties the buffer.
+        /// \return \c false if the receiving buffer failed.
+        bool pass_on()
+        {
+            const std::streamsize size = pptr() - pbase();
+            setp(buffer_.data(), buffer_.data() + buffer_.size());
+
+            return size <= 0 || sink_ == nullptr || sink_->sputn(buffer_.data(), size) == size;
+        }
+    };
+
+    /// Prints the statistics of the given measurements to the console.
+    class Printer
+    {
+    private:
+        /// Measurements whose statistics to print.
+        std::vector<MultiMeasurement> measurements_;
+
+        /// Zones whose statistics to print, in depth-first order.
+        std::vector<ZoneStatistics> zones_;
+
+        /// Task sites whose statistics to print.
+        std::vector<TaskStatistics> tasks_;
+
+        /// Benchmarks whose results to print.
+        std::vector<BenchStatistics> benches_;
+
+        /// Types of profiling contexts whose statistics to print.
+        std::vector<ContextStatistics> contexts_;
+
+        /// Title printed above the table. No title is printed if empty.
+        std::string title_;
+
+        /// Width of the output lines.
+        static const int line_width = 236;
+
+        /// Width of the lines of the zone table.
+        static const int zone_line_width = 131;
+
+        /// Width of the lines of the task table.
+        static const int task_line_width = 175;
+
+        /// Width of the column indicating the file of a checkpoint.
+        static const int file_col_width = 30;
+
+        /// Width of the column indicating the function of a checkpoint.
+        static const int function_col_width = 40;
+
+        /// Width of the column indicating the line of a checkpoint.
+        static const int line_col_width = 5;
+
+        /// Width of the column indicating the count of a measurement.
+        static const int count_col_width = 10;
+
+        /// Width of the column indicating the average duration of a measurement.
+        static const int avg_duration_col_width = 15;
+
+        /// Width of the column indicating the overall duration of a measurement.
+        static const int ovr_duration_col_width = 15;
+
+        /// Width of the columns of the performance counters.
+        static const int counter_col_width = 14;
+
+        /// Number of the columns of the CPU usage.
+        static const int cpu_col_count = 4;
+
+        /// Width of the columns of the CPU usage.
+        static const int cpu_col_width = 14;
+
+        /// Number of the columns of the heap allocations.
+        static const int allocation_col_count = 3;
+
+        /// Width of the columns of the heap allocations.
+        static const int allocation_col_width = 12;
+
+        /// Width of the column indicating the overall duration of a measurement.
+        static const int ovr_percentage_col_width = 10;
+
+        /// Width of the columns indicating the distribution of the durations
+        /// of a measurement: minimum, percentiles, maximum and standard deviation.
+        static const int distribution_col_width = 14;
+
+        /// Width of the column indicating the name of a zone.
+        static const int zone_col_width = 40;
+
+        /// Indentation of a nested zone per level.
+        static const int zone_indent = 2;
+
+        /// Width of the column indicating the resumptions per task.
+        static const int resume_col_width = 12;
+
+        /// Width of the lines of the benchmark table.
+        static const int bench_line_width = 209;
+
+        /// Width of the column indicating the trials of a benchmark.
+        static const int trials_col_width = 8;
+
+        /// Width of the column indicating the speedup of a benchmark.
+        static const int speedup_col_width = 10;
+
+        /// Width of the column indicating the verdict of a comparison.
+        static const int verdict_col_width = 9;
+
+        /// Width of the lines of the exemplar table.
+        static const int exemplar_line_width = 184;
+
+        /// Width of the columns indicating the time an exemplar ended.
+        static const int time_col_width = 26;
+
+        /// Width of the column indicating the thread of an exemplar.
+        static const int thread_col_width = 8;
+
+        /// Width of the column indicating the tag of an exemplar.
+        static const int tag_col_width = 20;
+
+        /// Maximum number of pairs whose exemplars are listed, the ones with
+        /// the longest maximum duration.
+        static const int exemplar_pair_count = 10;
+
+        /// Width of the lines of the context table.
+        static const int context_line_width = 162;
+
+        /// Width of the column indicating a type of contexts or one of its
+        /// pairs of checkpoints.
+        static const int context_col_width = 84;
+
+        /// Maximum number of pairs listed per type of contexts, the ones
+        /// the kept contexts spent the most time in.
+        static const int context_segment_count = 10;
+
+        /// Fractions of the percentiles in the reports.
+        static constexpr std::array<double, 4> percentile_fractions = {0.5, 0.9, 0.99, 0.999};
+
+    public:
+        /// Adds a measurement whose statistics will be printed when print()
+        /// is called.
+        void add(const MultiMeasurement &measurement)
+        {
+            measurements_.push_back(measurement);
+        }
+
+        /// Adds a list of measurements whose statistics will be printed when
+        /// print() is called.
+        void add(const std::list<MultiMeasurement> &measurements)
+        {
+            std::list<MultiMeasurement>::const_iterator lit;
+            for (lit = measurements.begin(); lit != measurements.end(); lit++)
+                add(*lit);
+        }
+
+        /// Adds measurements whose statistics will be printed when print()
+        /// is called. The measurements are taken over without copying them
+        /// if the printer has none yet.
+        void add(std::vector<MultiMeasurement> &&measurements)
+        {
+            if (measurements_.empty())
+                measurements_.swap(measurements);
+            else
+                measurements_.insert(measurements_.end(), measurements.begin(), measurements.end());
+        }
+
+        /// Adds the statistics of a call tree of zones, in depth-first order.
+        void add(const std::vector<ZoneStatistics> &zones)
+        {
+            zones_.insert(zones_.end(), zones.begin(), zones.end());
+        }
+
+        /// Adds the statistics of task sites.
+        void add(const std::vector<TaskStatistics> &tasks)
+        {
+            tasks_.insert(tasks_.end(), tasks.begin(), tasks.end());
+        }
+
+        /// Adds the results of benchmarks.
+        void add(const std::vector<BenchStatistics> &benches)
+        {
+            benches_.insert(benches_.end(), benches.begin(), benches.end());
+        }
+
+        /// Adds the statistics of types of profiling contexts. The given
+        /// overhead of the profiler per segment is excluded from the
+        /// durations of their pairs of checkpoints, like from those of the
+        /// measurements.
+        /// Unit of the overhead: [ns].
+        void add(const std::vector<ContextStatistics> &contexts, std::int64_t overhead = 0)
+        {
+            const auto compensate = [overhead](std::vector<ContextSegment> &segments)
+            {
+                for (ContextSegment &segment : segments)
+                    segment.duration = std::max<std::int64_t>(0, segment.duration - overhead * segment.count);
+            };
+
+            for (const ContextStatistics &context : contexts)
+            {
+                contexts_.push_back(context);
+                if (overhead <= 0)
+                    continue;
+
+                compensate(contexts_.back().segments);
+                for (KeptContext &kept : contexts_.back().slowest)
+                    compensate(kept.segments);
+            }
+        }
+
+        /// Sets the title printed above the table.
+        void set_title(const std::string &title)
+        {
+            title_ = title;
+        }
+
+        /// Returns the title printed above the table.
+        const std::string &get_title() const
+        {
+            return title_;
+        }
+
+        /// Prints the statistics of the given measurements.
+        void print() const
+        {
+            ReportBuffer buffer(std::cerr.rdbuf());
+            std::ostream stream(&buffer);
+            write(stream);
+        }
+
+        /// Creates a table that shows the statistics of the given measurements.
+        std::string create_table() const
+        {
+            std::stringstream stream;
+            write(stream);
+            return stream.str();
+        }
+
+        /// Writes a table that shows the statistics of the given
+        /// measurements to the given stream, row by row. Nothing is written
+        /// if there are no measurements. The stream should be buffered.
+        void write(std::ostream &stream) const
+        {
+            // If no measurements are given, write nothing.
+            if (measurements_.size() <= 0 && zones_.size() <= 0 && tasks_.size() <= 0 && benches_.size() <= 0 &&
+                contexts_.size() <= 0)
+                return;
+
+            std::ios format(nullptr);
+            format.copyfmt(stream);
+            if (!title_.empty())
+                stream << create_title(title_);
+
+            if (measurements_.size() > 0)
+            {
+                // Create the header of the table. Columns of the CPU usage,
+                // of the allocations and of counters are added if any
+                // measurement has them.
+                CounterSource counter_source = CounterSource::none;
+                bool cpu_usage = false;
+                bool allocations = false;
+                for (const MultiMeasurement &measurement : measurements_)
+                {
+                    if (measurement.get_counter_source() != CounterSource::none)
+                        counter_source = measurement.get_counter_source();
+                    cpu_usage = cpu_usage || measurement.has_cpu_usage();
+                    allocations = allocations || measurement.has_allocations();
+                }
+
+                const int width = line_width +
+                                  (cpu_usage ? cpu_col_count * (cpu_col_width + 1) : 0) +
+                                  (allocations ? allocation_col_count * (allocation_col_width + 1) : 0) +
+                                  (counter_source != CounterSource::none ? counter_count * (counter_col_width + 1) : 0);
+                stream << create_header(counter_source, cpu_usage, allocations, width);
+
+                // Add each measurement to the table.
+                bool sampled = false;
+                for (int i = 0; i < (int)measurements_.size(); i++)
+                {
+                    write_entry(stream, measurements_[i], counter_source, cpu_usage, allocations);
+                    write_hline(stream, (i < (int)measurements_.size() - 1) ? '-' : '=', width);
+                    sampled = sampled || measurements_[i].is_sampled();
+                }
+
+                if (sampled)
+                    stream << "Sampled: the count in parentheses is the number of timed segments, "
+                              "the statistics of the durations refer to them. The overall duration "
+                              "is extrapolated to all segments, +- the 95% confidence interval."
+                           << std::endl;
+                if (measurements_.front().get_overhead() > 0)
+                    stream << "Overhead: the profiler's own cost of " << measurements_.front().get_overhead()
+                           << " ns per segment, measured by calibration, is subtracted from all durations. "
+                              "\"ovh\" marks pairs whose measured durations are mostly overhead; "
+                              "their durations are unreliable."
+                           << std::endl;
+
+                write_exemplars(stream);
+            }
+
+            if (zones_.size() > 0)
+            {
+                // The percentages refer to the time spent in all zones that
+                // are not nested in another zone.
+                std::int64_t total_duration = 0;
+                for (const ZoneStatistics &zone : zones_)
+                {
+                    if (zone.depth == 0)
+                        total_duration += zone.inclusive_duration;
+                }
+
+                stream << create_zone_header();
+                for (const ZoneStatistics &zone : zones_)
+                    write_zone_entry(stream, zone, total_duration);
+                write_hline(stream, '=', zone_line_width);
+            }
+
+            if (tasks_.size() > 0)
+            {
+                stream << create_task_header();
+                for (const TaskStatistics &task : tasks_)
+                    write_task_entry(stream, task);
+                write_hline(stream, '=', task_line_width);
+                stream << "Tasks are timed from start to end across suspensions. Active is the time "
+                          "running on a thread, Suspended the time waiting to be resumed, averaged per task."
+                       << std::endl;
+            }
+
+            if (benches_.size() > 0)
+            {
+                stream << create_bench_header();
+                for (const BenchStatistics &bench : benches_)
+                    write_bench_entry(stream, bench, find_bench(bench.baseline));
+                write_hline(stream, '=', bench_line_width);
+                stream << "Benchmarks: durations per iteration over the kept trials, of the latest run. Trials far "
+                          "from the median are rejected as outliers. Speedup is the mean of the baseline over the "
+                          "mean of the benchmark; verdicts are given if Welch's t-test rejects equal means at the "
+                          "95% level."
+                       << std::endl;
+            }
+
+            if (contexts_.size() > 0)
+            {
+                stream << create_context_header();
+                for (std::size_t i = 0; i < contexts_.size(); i++)
+                {
+                    write_context_entry(stream, contexts_[i]);
+                    write_hline(stream, i + 1 < contexts_.size() ? '-' : '=', context_line_width);
+                }
+                stream << "Contexts: every context is counted; only those that took at least the threshold are kept. "
+                          "Below each type, the pairs of checkpoints the kept contexts spent the most time in, at most "
+                       << context_segment_count
+                       << ", with their share of the time of the kept contexts, and the slowest kept contexts. "
+                          "Time the contexts were not active is not covered by any pair."
+                       << std::endl;
+            }
+
+            stream.copyfmt(format);
+        }
+
+        /// Writes the header row of write_csv() to the given stream.
+        static void write_csv_header(std::ostream &stream)
+        {
+            stream << "table,start_file,start_function,start_line,end_file,end_function,end_line,"
+                      "count,timed_count,overall_ns,overall_error_ns,average_ns,percent,"
+                      "min_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,stddev_ns,"
+                      "cpu_ns,off_cpu_ns,voluntary_switches,involuntary_switches,"
+                      "allocations,frees,allocated_bytes,overhead_ns,overhead_share,start_label,end_label\n";
+        }
+
+        /// Writes one row of comma-separated values per measurement to the
+        /// given stream, see write_csv_header(). The first column is the
+        /// title of the table; the files are given with their full paths.
+        /// The durations are averages per hit except for the overall
+        /// duration, the CPU and allocation columns are empty for
+        /// measurements without them. Zones, benchmarks and performance
+        /// counters are only part of the table and of write_json().
+        void write_csv(std::ostream &stream) const
+        {
+            std::ios format(nullptr);
+            format.copyfmt(stream);
+            stream << std::setprecision(10);
+            for (const MultiMeasurement &measurement : measurements_)
+            {
+                const Site &start = SiteRegistry::get_site(measurement.get_start_site_id());
+                const Site &end = SiteRegistry::get_site(measurement.get_end_site_id());
+                const auto percentiles = measurement.get_percentiles(percentile_fractions);
+                write_csv_field(stream, title_);
+                stream << ',';
+                write_csv_field(stream, start.file);
+                stream << ',';
+                write_csv_field(stream, start.function);
+                stream << ',' << start.line << ',';
+                write_csv_field(stream, end.file);
+                stream << ',';
+                write_csv_field(stream, end.function);
+                stream << ',' << end.line
+                       << ',' << measurement.count()
+                       << ',' << measurement.timed_count()
+                       << ',' << measurement.get_overall_duration().count()
+                       << ',' << measurement.get_overall_duration_error().count()
+                       << ',' << measurement.get_average_duration().count()
+                       << ',' << measurement.get_percent() * 100
+                       << ',' << measurement.get_min_duration().count()
+                       << ',' << percentiles[0].count()
+                       << ',' << percentiles[1].count()
+                       << ',' << percentiles[2].count()
+                       << ',' << percentiles[3].count()
+                       << ',' << measurement.get_max_duration().count()
+                       << ',' << measurement.get_standard_deviation();
+                if (measurement.has_cpu_usage())
+                {
+                    const double timed = static_cast<double>(std::max<std::int64_t>(1, measurement.timed_count()));
+                    stream << ',' << measurement.get_average_cpu_duration().count()
+                           << ',' << measurement.get_average_off_cpu_duration().count()
+                           << ',' << static_cast<double>(measurement.get_voluntary_switches()) / timed
+                           << ',' << static_cast<double>(measurement.get_involuntary_switches()) / timed;
+                }
+                else
+                {
+                    stream << ",,,,";
+                }
+                if (measurement.has_allocations())
+                {
+                    stream << ',' << measurement.get_average_allocations()
+                           << ',' << measurement.get_average_frees()
+                           << ',' << measurement.get_average_allocated_bytes();
+                }
+                else
+                {
+                    stream << ",,,";
+                }
+                stream << ',' << measurement.get_overhead()
+                       << ',' << measurement.get_overhead_share() << ',';
+                write_csv_field(stream, start.name);
+                stream << ',';
+                write_csv_field(stream, end.name);
+                stream << '\n';
+            }
+            stream.copyfmt(format);
+        }
+
+        /// Writes the table as a JSON object with the title, the pairs and
+        /// the zones to the given stream. The fields match the columns of
+        /// write_csv(); the averages of the performance counters per hit
+        /// are added as "counters" and the slowest segments as "exemplars"
+        /// if the measurement has them. Tasks, benchmarks and profiling
+        /// contexts follow in arrays of their own.
+        void write_json(std::ostream &stream) const
+        {
+            std::ios format(nullptr);
+            format.copyfmt(stream);
+            stream << std::setprecision(10) << "{\"title\": ";
+            write_json_string(stream, title_);
+            stream << ", \"pairs\": [";
+            for (std::size_t i = 0; i < measurements_.size(); i++)
+            {
+                const MultiMeasurement &measurement = measurements_[i];
+                const auto percentiles = measurement.get_percentiles(percentile_fractions);
+                stream << (i > 0 ? ",\n  " : "\n  ") << "{\"start\": ";
+                write_json_site(stream, SiteRegistry::get_site(measurement.get_start_site_id()));
+                stream << ", \"end\": ";
+                write_json_site(stream, SiteRegistry::get_site(measurement.get_end_site_id()));
+                stream << ", \"count\": " << measurement.count()
+                       << ", \"timed_count\": " << measurement.timed_count()
+                       << ", \"overall_ns\": " << measurement.get_overall_duration().count()
+                       << ", \"overall_error_ns\": " << measurement.get_overall_duration_error().count()
+                       << ", \"average_ns\": " << measurement.get_average_duration().count()
+                       << ", \"percent\": " << measurement.get_percent() * 100
+                       << ", \"min_ns\": " << measurement.get_min_duration().count()
+                       << ", \"p50_ns\": " << percentiles[0].count()
+                       << ", \"p90_ns\": " << percentiles[1].count()
+                       << ", \"p99_ns\": " << percentiles[2].count()
+                       << ", \"p999_ns\": " << percentiles[3].count()
+                       << ", \"max_ns\": " << measurement.get_max_duration().count()
+                       << ", \"stddev_ns\": " << measurement.get_standard_deviation()
+                       << ", \"overhead_share\": " << measurement.get_overhead_share();
+                if (measurement.is_overhead_dominated())
+                    stream << ", \"unreliable\": true";
+                if (measurement.has_cpu_usage())
+                {
+                    const double timed = static_cast<double>(std::max<std::int64_t>(1, measurement.timed_count()));
+                    stream << ", \"cpu_ns\": " << measurement.get_average_cpu_duration().count()
+                           << ", \"off_cpu_ns\": " << measurement.get_average_off_cpu_duration().count()
+                           << ", \"voluntary_switches\": "
+                           << static_cast<double>(measurement.get_voluntary_switches()) / timed
+                           << ", \"involuntary_switches\": "
+                           << static_cast<double>(measurement.get_involuntary_switches()) / timed;
+                }
+                if (measurement.has_allocations())
+                {
+                    stream << ", \"allocations\": " << measurement.get_average_allocations()
+                           << ", \"frees\": " << measurement.get_average_frees()
+                           << ", \"allocated_bytes\": " << measurement.get_average_allocated_bytes();
+                }
+                if (measurement.has_exemplars())
+                {
+                    const std::vector<Exemplar> exemplars = measurement.get_exemplars();
+                    stream << ", \"exemplars\": [";
+                    for (std::size_t e = 0; e < exemplars.size(); e++)
+                    {
+                        stream << (e > 0 ? ", " : "") << "{\"duration_ns\": " << exemplars[e].duration
+                               << ", \"time_ns\": " << exemplars[e].time
+                               << ", \"thread\": " << exemplars[e].thread_index
+                               << ", \"tag\": " << exemplars[e].tag << '}';
+                    }
+                    stream << ']';
+                }
+                if (measurement.get_counter_source() != CounterSource::none)
+                {
+                    stream << ", \"counters\": {\"source\": \""
+                           << (measurement.get_counter_source() == CounterSource::hardware ? "hardware" : "software")
+                           << "\", \"per_hit\": [";
+                    for (int c = 0; c < counter_count; c++)
+                        stream << (c > 0 ? ", " : "") << measurement.get_counter_average(c);
+                    stream << "]}";
+                }
+                stream << '}';
+            }
+
+            stream << "],\n \"zones\": [";
+            for (std::size_t i = 0; i < zones_.size(); i++)
+            {
+                const ZoneStatistics &zone = zones_[i];
+                const Site &site = SiteRegistry::get_site(zone.site_id);
+                stream << (i > 0 ? ",\n  " : "\n  ") << "{\"name\": ";
+                write_json_string(stream, site.name.empty() ? site.function : site.name);
+                stream << ", \"file\": ";
+                write_json_string(stream, site.file);
+                stream << ", \"line\": " << site.line
+                       << ", \"depth\": " << zone.depth
+                       << ", \"count\": " << zone.count
+                       << ", \"inclusive_ns\": " << zone.inclusive_duration
+                       << ", \"self_ns\": " << zone.exclusive_duration << '}';
+            }
+
+            stream << "],\n \"tasks\": [";
+            for (std::size_t i = 0; i < tasks_.size(); i++)
+            {
+                const TaskStatistics &task = tasks_[i];
+                const Site &site = SiteRegistry::get_site(task.site_id);
+                stream << (i > 0 ? ",\n  " : "\n  ") << "{\"name\": ";
+                write_json_string(stream, site.name.empty() ? site.function : site.name);
+                stream << ", \"file\": ";
+                write_json_string(stream, site.file);
+                stream << ", \"line\": " << site.line
+                       << ", \"count\": " << task.count
+                       << ", \"resume_count\": " << task.resume_count
+                       << ", \"duration_ns\": " << task.duration
+                       << ", \"active_ns\": " << task.active_duration
+                       << ", \"suspended_ns\": " << task.suspended_duration
+                       << ", \"max_ns\": " << task.max_duration << '}';
+            }
+
+            stream << "],\n \"benchmarks\": [";
+            for (std::size_t i = 0; i < benches_.size(); i++)
+            {
+                const BenchStatistics &bench = benches_[i];
+                const Site &site = SiteRegistry::get_site(bench.site_id);
+                stream << (i > 0 ? ",\n  " : "\n  ") << "{\"name\": ";
+                write_json_string(stream, site.name);
+                stream << ", \"file\": ";
+                write_json_string(stream, site.file);
+                stream << ", \"line\": " << site.line
+                       << ", \"runs\": " << bench.run_count
+                       << ", \"iterations\": " << bench.iterations
+                       << ", \"trials\": " << bench.trial_count
+                       << ", \"rejected\": " << bench.rejected_count
+                       << ", \"mean_ns\": " << bench.mean
+                       << ", \"median_ns\": " << bench.median
+                       << ", \"stddev_ns\": " << bench.standard_deviation
+                       << ", \"ci95_ns\": " << bench.confidence
+                       << ", \"min_ns\": " << bench.min
+                       << ", \"max_ns\": " << bench.max;
+                const BenchStatistics *baseline = find_bench(bench.baseline);
+                if (baseline != nullptr)
+                {
+                    stream << ", \"baseline\": ";
+                    write_json_string(stream, bench.baseline);
+                    stream << ", \"speedup\": " << get_speedup(bench, *baseline)
+                           << ", \"verdict\": \"" << get_verdict(bench, *baseline) << '"';
+                }
+                stream << '}';
+            }
+
+            stream << "],\n \"contexts\": [";
+            for (std::size_t i = 0; i < contexts_.size(); i++)
+            {
+                const ContextStatistics &context = contexts_[i];
+                stream << (i > 0 ? ",\n  " : "\n  ") << "{\"name\": ";
+                write_json_string(stream, context.name);
+                stream << ", \"threshold_ns\": ";
+                if (context.threshold == ContextType::keep_none)
+                    stream << "null";
+                else
+                    stream << context.threshold;
+                stream << ", \"count\": " << context.count
+                       << ", \"duration_ns\": " << context.duration
+                       << ", \"max_ns\": " << context.max_duration
+                       << ", \"kept_count\": " << context.kept_count
+                       << ", \"kept_ns\": " << context.kept_duration
+                       << ", \"segments\": ";
+                write_json_segments(stream, context.segments);
+                stream << ", \"slowest\": [";
+                for (std::size_t k = 0; k < context.slowest.size(); k++)
+                {
+                    const KeptContext &kept = context.slowest[k];
+                    stream << (k > 0 ? ", " : "") << "{\"duration_ns\": " << kept.duration
+                           << ", \"time_ns\": " << kept.time
+                           << ", \"tag\": " << kept.tag
+                           << ", \"segments\": ";
+                    write_json_segments(stream, kept.segments);
+                    stream << '}';
+                }
+                stream << "]}";
+            }
+            stream << "]}";
+            stream.copyfmt(format);
+        }
+
+        /// Writes the given text as a field of comma-separated values,
+        /// quoted if necessary.
+        static void write_csv_field(std::ostream &stream, std::string_view text)
+        {
+            if (text.find_first_of(",\"\r\n") == std::string_view::npos)
+            {
+                stream << text;
+                return;
+            }
+
+            stream << '"';
+            for (char c : text)
+            {
+                if (c == '"')
+                    stream << '"';
+                stream << c;
+            }
+            stream << '"';
+        }
+
+        /// Writes the given text as a JSON string.
+        static void write_json_string(std::ostream &stream, std::string_view text)
+        {
+            stream << '"';
+            for (char c : text)
+            {
+                switch (c)
+                {
+                case '"':
+                    stream << "\\\"";
+                    break;
+                case '\\':
+                    stream << "\\\\";
+                    break;
+                case '\n':
+                    stream << "\\n";
+                    break;
+                case '\t':
+                    stream << "\\t";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20)
+                    {
+                        char code[8];
+                        std::snprintf(code, sizeof(code), "\\u%04x", c);
+                        stream << code;
+                    }
+                    else
+                    {
+                        stream << c;
+                    }
+                }
+            }
+            stream << '"';
+        }
+
+        /// Saves the current profiling information to \c $HOME/.TimeProfiler/log.
+        void save_log() const
+        {
+            save_log(create_table());
+        }
+
+        /// Saves the given report to a new log file in \c $HOME/.TimeProfiler/log.
+        static void save_log(const std::string &content)
+        {
+            // If there is nothing to save, abort.
+            if (content.empty())
+                return;
+
+            // Save the log file.
+            std::ofstream logfile;
+            logfile.open(create_file_path("log", ".log").c_str());
+            logfile << content;
+            logfile.close();
+        }
+
+        /// Returns the path of a new file in \c $HOME/.TimeProfiler/<folder>.
+        /// The folder is created if necessary and the file name is made of
+        /// the current date and time and the given extension.
+        static std::string create_file_path(const std::string &folder, const std::string &extension)
+        {
+            // Create the folder name.
+            std::stringstream folder_name;
+            folder_name << getenv("HOME") << "/.TimeProfiler/" << folder;
+            std::filesystem::path folder_path(folder_name.str());
+
+            // Create the folder.
+            std::filesystem::create_directories(folder_path);
+
+            // Create the name of the file from the current date and time in
+            // milliseconds, the process ID and the role of the process, so
+            // that files of concurrent processes do not collide. Files of
+            // the same process within the same millisecond get a sequence
+            // number.
+            std::stringstream file_name;
+            auto now = std::chrono::system_clock::now();
+            auto in_time_t = std::chrono::system_clock::to_time_t(now);
+            const auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                          now.time_since_epoch())
+                                          .count() %
+                                      1000;
+            file_name << std::put_time(std::localtime(&in_time_t), "%Y%m%d_%H%M%S")
+                      << "_" << std::setfill('0') << std::setw(3) << milliseconds
+                      << "_" << get_process_id();
+
+            std::string role = ProcessRole::get();
+            for (char &c : role)
+            {
+                if (!std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_')
+                    c = '-';
+            }
+            if (!role.empty())
+                file_name << "_" << role;
+
+            const std::string path = std::filesystem::canonical(folder_path).string() + "/" + file_name.str();
+            std::string unique_path = path + extension;
+            for (int sequence = 1; std::filesystem::exists(unique_path); sequence++)
+                unique_path = path + "_" + std::to_string(sequence) + extension;
+
+            return unique_path;
+        }
+
+    protected:
+        /// Generates a string containing a horizontal line
+        /// consisting of the given character.
+        static std::string create_hline(char fill = '#', int width = line_width)
+        {
+            std::stringstream stream;
+            stream << std::setfill(fill) << std::setw(width) << fill
+                   << std::endl;
+            return stream.str();
+        }
+
+        /// Generates a string containing the given heading.
+        static std::string create_title(const std::string &text = "PROFILED WITH TimeProfiler")
+        {
+            const std::string title(" " + text + " ");
+
+            const char fill = '#';
+            std::stringstream stream;
+            stream << std::setfill(fill)
+                   << std::setw(line_width) << fill
+                   << std::endl
+                   << std::setw((line_width - title.length()) / 2) << fill << title
+                   << (title.length() % 2 > 0 ? std::string(1, fill) : "")
+                   << std::setw((line_width - title.length()) / 2) << fill
+                   << std::endl
+                   << std::setw(line_width) << fill
+                   << std::endl;
+
+            return stream.str();
+        }
+
+        /// Generates a string with the headers of all columns.
+        static std::string create_header(CounterSource counter_source = CounterSource::none, bool cpu_usage = false,
+                                         bool allocations = false, int width = line_width)
+        {
+            std::stringstream stream;
+            stream << create_hline('=', width)
+                   << std::setfill(' ')
+                   << std::setw(file_col_width) << std::left << "File"
+                   << "|" << std::setw(function_col_width) << std::left << "Function"
+                   << "|" << std::setw(line_col_width) << std::right << "Line "
+                   << "|" << std::setw(count_col_width) << std::right << "Count "
+                   << "|" << std::setw(avg_duration_col_width) << std::right << "Average [ns] "
+                   << "|" << std::setw(ovr_duration_col_width) << std::right << "Overall [us]"
+                   << "|" << std::setw(ovr_percentage_col_width) << std::right << "Percent %"
+                   << "|" << std::setw(distribution_col_width) << std::right << "Min [ns]"
+                   << "|" << std::setw(distribution_col_width) << std::right << "p50 [ns]"
+                   << "|" << std::setw(distribution_col_width) << std::right << "p90 [ns]"
+                   << "|" << std::setw(distribution_col_width) << std::right << "p99 [ns]"
+                   << "|" << std::setw(distribution_col_width) << std::right << "p99.9 [ns]"
+                   << "|" << std::setw(distribution_col_width) << std::right << "Max [ns]"
+                   << "|" << std::setw(distribution_col_width) << std::right << "Stddev [ns]";
+
+            static const char *const cpu_names[cpu_col_count] = {"CPU [ns]", "Off-CPU [ns]", "Vol cs/hit", "Invol cs/hit"};
+            for (int i = 0; i < cpu_col_count && cpu_usage; i++)
+                stream << "|" << std::setw(cpu_col_width) << std::right << cpu_names[i];
+
+            static const char *const allocation_names[allocation_col_count] = {"Allocs/hit", "Frees/hit", "Bytes/hit"};
+            for (int i = 0; i < allocation_col_count && allocations; i++)
+                stream << "|" << std::setw(allocation_col_width) << std::right << allocation_names[i];
+
+            static const char *const hardware_names[counter_count] = {"Cycles/hit", "IPC", "LLC miss/hit", "Br miss/hit"};
+            static const char *const software_names[counter_count] = {"Task [ns]/hit", "Faults/hit", "Ctx sw/hit", "Migr/hit"};
+            for (int i = 0; i < counter_count && counter_source != CounterSource::none; i++)
+            {
+                stream << "|" << std::setw(counter_col_width) << std::right
+                       << (counter_source == CounterSource::hardware ? hardware_names[i] : software_names[i]);
+            }
+
+            stream << std::endl
+                   << create_hline('=', width);
+
+            return stream.str();
+        }
+
+        /// Writes a table entry for the given measurement to the given stream.
+        static void write_entry(std::ostream &stream, const MultiMeasurement &measurement,
+                                CounterSource counter_source = CounterSource::none, bool cpu_usage = false,
+                                bool allocations = false)
+        {
+            // Create a line indicating where the measurement started.
+            // If the start site is sampled, the line also shows how many
+            // segments were timed and the error of the overall duration.
+            const Site &start = SiteRegistry::get_site(measurement.get_start_site_id());
+            const Site &end = SiteRegistry::get_site(measurement.get_end_site_id());
+            const char *file_start = get_file_name(start.file);
+            stream << std::setfill(' ')
+                   << std::setw(file_col_width) << std::left << file_start
+                   << "|" << std::setw(function_col_width) << std::left
+                   << (start.name.empty() ? start.function : start.name)
+                   << "|" << std::setw(line_col_width) << std::right << start.line;
+            if (measurement.is_sampled())
+            {
+                stream << "|" << std::setw(count_col_width) << std::right
+                       << "(" + insert_separators(measurement.timed_count()) + ")"
+                       << "|" << std::setw(avg_duration_col_width) << std::right << "sampled"
+                       << "|" << std::setw(ovr_duration_col_width) << std::right
+                       << "+-" + insert_separators(std::chrono::duration_cast<std::chrono::microseconds>(
+                                                       measurement.get_overall_duration_error())
+                                                       .count());
+            }
+            else
+            {
+                stream << "|" << std::setw(count_col_width) << std::right << " "
+                       << "|" << std::setw(avg_duration_col_width) << std::right << " ";
+            }
+
+            // Flag pairs whose measured durations are mostly overhead of the
+            // profiler with the share of the overhead.
+            if (measurement.is_overhead_dominated())
+            {
+                if (!measurement.is_sampled())
+                    stream << "|" << std::setw(ovr_duration_col_width) << std::right << " ";
+                stream << "|" << std::setw(ovr_percentage_col_width) << std::right
+                       << "ovh " + std::to_string(std::lround(measurement.get_overhead_share() * 100)) + "%";
+            }
+            stream << "|\n";
+
+            // Show the file name in the second line only if it
+            // is a different file.
+            const char *file_end = get_file_name(end.file);
+            if (std::strcmp(file_start, file_end) == 0)
+                file_end = "";
+
+            const auto percentiles = measurement.get_percentiles(percentile_fractions);
+
+            // Create a line indicating where the measurement ended
+            // and how long it took.
+            stream.unsetf(std::ios::floatfield);
+            stream << std::setfill(' ')
+                   << std::setw(file_col_width) << std::left
+                   << file_end << "|"
+                   << std::setw(function_col_width) << std::left
+                   << (end.name.empty() ? end.function : end.name) << "|"
+                   << std::setw(line_col_width) << std::right
+                   << end.line << "|"
+                   << std::setw(count_col_width) << std::right
+                   << insert_separators(measurement.count()) << "|"
+                   << std::setw(avg_duration_col_width) << std::right
+                   << insert_separators(measurement.get_average_duration().count()) << "|"
+                   << std::setw(ovr_duration_col_width) << std::right
+                   << insert_separators(std::chrono::duration_cast<std::chrono::microseconds>(
+                                            measurement.get_overall_duration())
+                                            .count())
+                   << "|"
+                   << std::setw(ovr_percentage_col_width) << std::right
+                   << std::setprecision(5) << ((measurement.get_percent() > 0.000001) ? (measurement.get_percent() * 100) : 0.0)
+                   << "|" << std::setw(distribution_col_width) << std::right
+                   << insert_separators(measurement.get_min_duration().count())
+                   << "|" << std::setw(distribution_col_width) << std::right
+                   << insert_separators(percentiles[0].count())
+                   << "|" << std::setw(distribution_col_width) << std::right
+                   << insert_separators(percentiles[1].count())
+                   << "|" << std::setw(distribution_col_width) << std::right
+                   << insert_separators(percentiles[2].count())
+                   << "|" << std::setw(distribution_col_width) << std::right
+                   << insert_separators(percentiles[3].count())
+                   << "|" << std::setw(distribution_col_width) << std::right
+                   << insert_separators(measurement.get_max_duration().count())
+                   << "|" << std::setw(distribution_col_width) << std::right
+                   << insert_separators(std::llround(measurement.get_standard_deviation()));
+
+            // Show the average CPU and off-CPU time and the average context
+            // switches per hit.
+            if (cpu_usage && !measurement.has_cpu_usage())
+            {
+                for (int i = 0; i < cpu_col_count; i++)
+                    stream << "|" << std::setw(cpu_col_width) << std::right << "-";
+            }
+            else if (cpu_usage)
+            {
+                const double timed = static_cast<double>(std::max<std::int64_t>(1, measurement.timed_count()));
+                stream << "|" << std::setw(cpu_col_width) << std::right
+                       << insert_separators(measurement.get_average_cpu_duration().count())
+                       << "|" << std::setw(cpu_col_width) << std::right
+                       << insert_separators(measurement.get_average_off_cpu_duration().count())
+                       << "|" << std::setw(cpu_col_width) << std::right << std::fixed << std::setprecision(2)
+                       << static_cast<double>(measurement.get_voluntary_switches()) / timed
+                       << "|" << std::setw(cpu_col_width) << std::right << std::fixed << std::setprecision(2)
+                       << static_cast<double>(measurement.get_involuntary_switches()) / timed;
+            }
+
+            // Show the average heap allocations, deallocations and
+            // allocated bytes per hit.
+            if (allocations && !measurement.has_allocations())
+            {
+                for (int i = 0; i < allocation_col_count; i++)
+                    stream << "|" << std::setw(allocation_col_width) << std::right << "-";
+            }
+            else if (allocations)
+            {
+                stream << "|" << std::setw(allocation_col_width) << std::right << std::fixed << std::setprecision(2)
+                       << measurement.get_average_allocations()
+                       << "|" << std::setw(allocation_col_width) << std::right << std::fixed << std::setprecision(2)
+                       << measurement.get_average_frees()
+                       << "|" << std::setw(allocation_col_width) << std::right
+                       << insert_separators(std::llround(measurement.get_average_allocated_bytes()));
+            }
+
+            // Show the averages of the counters per hit. The second
+            // hardware counter, instructions, is shown per cycle.
+            for (int i = 0; i < counter_count && counter_source != CounterSource::none; i++)
+            {
+                stream << "|" << std::setw(counter_col_width) << std::right;
+                if (measurement.get_counter_source() != counter_source)
+                    stream << "-";
+                else if (counter_source == CounterSource::hardware && i == 1)
+                    stream << std::fixed << std::setprecision(2)
+                           << (measurement.get_counter(0) > 0 ? static_cast<double>(measurement.get_counter(1)) /
+                                                                     static_cast<double>(measurement.get_counter(0))
+                                                               : 0.0);
+                else
+                    stream << std::fixed << std::setprecision(2) << measurement.get_counter_average(i);
+            }
+
+            stream << '\n';
+        }
+
+        /// Generates a string with the headers of the columns of the zone table.
+        static std::string create_zone_header()
+        {
+            std::stringstream stream;
+            stream << create_hline('=', zone_line_width)
+                   << std::setfill(' ')
+                   << std::setw(zone_col_width) << std::left << "Zone"
+                   << "|" << std::setw(file_col_width) << std::left << "File"
+                   << "|" << std::setw(line_col_width) << std::right << "Line "
+                   << "|" << std::setw(count_col_width) << std::right << "Count "
+                   << "|" << std::setw(avg_duration_col_width) << std::right << "Inclusive [us]"
+                   << "|" << std::setw(ovr_duration_col_width) << std::right << "Self [us]"
+                   << "|" << std::setw(ovr_percentage_col_width) << std::right << "Self %"
+                   << std::endl
+                   << create_hline('=', zone_line_width);
+
+            return stream.str();
+        }
+
+        /// Writes a table entry for the given zone to the given stream.
+        /// The name of the zone is indented by its depth in the call tree.
+        static void write_zone_entry(std::ostream &stream, const ZoneStatistics &zone, std::int64_t total_duration)
+        {
+            const Site &site = SiteRegistry::get_site(zone.site_id);
+            const std::string_view name = site.name.empty() ? site.function : site.name;
+            const int indent = std::min(zone.depth * zone_indent, static_cast<int>(zone_col_width));
+            const double percent = total_duration > 0
+                                       ? 100.0 * zone.exclusive_duration / total_duration
+                                       : 0.0;
+
+            stream.unsetf(std::ios::floatfield);
+            stream << std::setfill(' ')
+                   << std::setw(indent) << ""
+                   << std::setw(zone_col_width - indent) << std::left
+                   << name.substr(0, zone_col_width - indent)
+                   << "|" << std::setw(file_col_width) << std::left << get_file_name(site.file)
+                   << "|" << std::setw(line_col_width) << std::right << site.line
+                   << "|" << std::setw(count_col_width) << std::right << insert_separators(zone.count)
+                   << "|" << std::setw(avg_duration_col_width) << std::right
+                   << insert_separators(zone.inclusive_duration / 1000)
+                   << "|" << std::setw(ovr_duration_col_width) << std::right
+                   << insert_separators(zone.exclusive_duration / 1000)
+                   << "|" << std::setw(ovr_percentage_col_width) << std::right
+                   << std::setprecision(5) << percent
+                   << '\n';
+        }
+
+        /// Generates a string with the headers of the columns of the task table.
+        static std::string create_task_header()
+        {
+            std::stringstream stream;
+            stream << create_hline('=', task_line_width)
+                   << std::setfill(' ')
+                   << std::setw(zone_col_width) << std::left << "Task"
+                   << "|" << std::setw(file_col_width) << std::left << "File"
+                   << "|" << std::setw(line_col_width) << std::right << "Line "
+                   << "|" << std::setw(count_col_width) << std::right << "Count "
+                   << "|" << std::setw(resume_col_width) << std::right << "Resumes/task"
+                   << "|" << std::setw(avg_duration_col_width) << std::right << "Average [ns] "
+                   << "|" << std::setw(avg_duration_col_width) << std::right << "Active [ns] "
+                   << "|" << std::setw(avg_duration_col_width) << std::right << "Suspended [ns] "
+                   << "|" << std::setw(ovr_percentage_col_width) << std::right << "Active %"
+                   << "|" << std::setw(distribution_col_width) << std::right << "Max [ns]"
+                   << std::endl
+                   << create_hline('=', task_line_width);
+
+            return stream.str();
+        }
+
+        /// Writes a table entry for the given task site to the given stream.
+        static void write_task_entry(std::ostream &stream, const TaskStatistics &task)
+        {
+            const Site &site = SiteRegistry::get_site(task.site_id);
+            const std::string_view name = site.name.empty() ? site.function : site.name;
+            const std::int64_t count = std::max<std::int64_t>(1, task.count);
+            const double percent = task.duration > 0 ? 100.0 * task.active_duration / task.duration : 0.0;
+
+            stream.unsetf(std::ios::floatfield);
+            stream << std::setfill(' ')
+                   << std::setw(zone_col_width) << std::left << name.substr(0, zone_col_width)
+                   << "|" << std::setw(file_col_width) << std::left << get_file_name(site.file)
+                   << "|" << std::setw(line_col_width) << std::right << site.line
+                   << "|" << std::setw(count_col_width) << std::right << insert_separators(task.count)
+                   << "|" << std::setw(resume_col_width) << std::right << std::fixed << std::setprecision(2)
+                   << static_cast<double>(task.resume_count) / count
+                   << "|" << std::setw(avg_duration_col_width) << std::right
+                   << insert_separators(task.duration / count)
+                   << "|" << std::setw(avg_duration_col_width) << std::right
+                   << insert_separators(task.active_duration / count)
+                   << "|" << std::setw(avg_duration_col_width) << std::right
+                   << insert_separators(task.suspended_duration / count)
+                   << "|" << std::setw(ovr_percentage_col_width) << std::right << std::setprecision(3)
+                   << percent
+                   << "|" << std::setw(distribution_col_width) << std::right
+                   << insert_separators(task.max_duration)
+                   << '\n';
+        }
+
+        /// Generates a string with the headers of the columns of the
+        /// benchmark table.
+        static std::string create_bench_header()
+        {
+            std::stringstream stream;
+            stream << create_hline('=', bench_line_width)
+                   << std::setfill(' ')
+                   << std::setw(zone_col_width) << std::left << "Benchmark"
+                   << "|" << std::setw(file_col_width) << std::left << "File"
+                   << "|" << std::setw(line_col_width) << std::right << "Line "
+                   << "|" << std::setw(count_col_width) << std::right << "Iterations"
+                   << "|" << std::setw(trials_col_width) << std::right << "Trials"
+                   << "|" << std::setw(distribution_col_width) << std::right << "Mean [ns]"
+                   << "|" << std::setw(distribution_col_width) << std::right << "Median [ns]"
+                   << "|" << std::setw(distribution_col_width) << std::right << "Stddev [ns]"
+                   << "|" << std::setw(distribution_col_width) << std::right << "95% CI [ns]"
+                   << "|" << std::setw(file_col_width) << std::left << "Baseline"
+                   << "|" << std::setw(speedup_col_width) << std::right << "Speedup"
+                   << "|" << std::setw(verdict_col_width) << std::right << "Verdict"
+                   << std::endl
+                   << create_hline('=', bench_line_width);
+
+            return stream.str();
+        }
+
+        /// Writes a table entry for the given benchmark to the given stream,
+        /// compared with the given baseline unless it is \c nullptr.
+        static void write_bench_entry(std::ostream &stream, const BenchStatistics &bench,
+                                      const BenchStatistics *baseline)
+        {
+            const Site &site = SiteRegistry::get_site(bench.site_id);
+            std::string speedup = "-";
+            if (baseline != nullptr)
+            {
+                std::stringstream speedup_stream;
+                speedup_stream << std::fixed << std::setprecision(2) << get_speedup(bench, *baseline) << 'x';
+                speedup = speedup_stream.str();
+            }
+
+            stream << std::setfill(' ')
+                   << std::setw(zone_col_width) << std::left << site.name.substr(0, zone_col_width)
+                   << "|" << std::setw(file_col_width) << std::left << get_file_name(site.file)
+                   << "|" << std::setw(line_col_width) << std::right << site.line
+                   << "|" << std::setw(count_col_width) << std::right << insert_separators(bench.iterations)
+                   << "|" << std::setw(trials_col_width) << std::right
+                   << std::to_string(bench.trial_count) + "/" + std::to_string(bench.trial_count + bench.rejected_count)
+                   << std::fixed << std::setprecision(2)
+                   << "|" << std::setw(distribution_col_width) << std::right << bench.mean
+                   << "|" << std::setw(distribution_col_width) << std::right << bench.median
+                   << "|" << std::setw(distribution_col_width) << std::right << bench.standard_deviation
+                   << "|" << std::setw(distribution_col_width) << std::right << bench.confidence
+                   << "|" << std::setw(file_col_width) << std::left << bench.baseline.substr(0, file_col_width)
+                   << "|" << std::setw(speedup_col_width) << std::right << speedup
+                   << "|" << std::setw(verdict_col_width) << std::right
+                   << (baseline != nullptr ? get_verdict(bench, *baseline) : "")
+                   << '\n';
+            stream.unsetf(std::ios::floatfield);
+        }
+
+        /// Returns the benchmark with the given name, or \c nullptr if there
+        /// is none or the name is empty.
+        const BenchStatistics *find_bench(const std::string &name) const
+        {
+            if (name.empty())
+                return nullptr;
+
+            for (const BenchStatistics &bench : benches_)
+            {
+                if (SiteRegistry::get_site(bench.site_id).name == name)
+                    return &bench;
+            }
+
+            return nullptr;
+        }
+
+        /// Returns how many times faster the given benchmark is than its
+        /// baseline, by their means.
+        static double get_speedup(const BenchStatistics &bench, const BenchStatistics &baseline)
+        {
+            return bench.mean > 0.0 ? baseline.mean / bench.mean : 0.0;
+        }
+
+        /// Compares the means of the given benchmark and its baseline with
+        /// Welch's t-test at the 95% level.
+        static const char *get_verdict(const BenchStatistics &bench, const BenchStatistics &baseline)
+        {
+            const double bench_error = bench.standard_deviation * bench.standard_deviation /
+                                       std::max(1, bench.trial_count);
+            const double baseline_error = baseline.standard_deviation * baseline.standard_deviation /
+                                          std::max(1, baseline.trial_count);
+            const double standard_error = std::sqrt(bench_error + baseline_error);
+            const double difference = bench.mean - baseline.mean;
+
+            bool significant = difference != 0.0;
+            if (standard_error > 0.0)
+            {
+                // Welch-Satterthwaite approximation of the degrees of freedom.
+                const double degrees =
+                    std::pow(bench_error + baseline_error, 2.0) /
+                    (bench_error * bench_error / std::max(1, bench.trial_count - 1) +
+                     baseline_error * baseline_error / std::max(1, baseline.trial_count - 1));
+                significant = std::fabs(difference) > get_t_quantile(degrees) * standard_error;
+            }
+
+            if (!significant)
+                return "~";
+
+            return difference < 0.0 ? "faster" : "slower";
+        }
+
+        /// Generates a string with the headers of the columns of the context
+        /// table.
+        static std::string create_context_header()
+        {
+            std::stringstream stream;
+            stream << create_hline('=', context_line_width)
+                   << std::setfill(' ')
+                   << std::setw(context_col_width) << std::left << "Context"
+                   << "|" << std::setw(count_col_width) << std::right << "Count"
+                   << "|" << std::setw(distribution_col_width) << std::right << "Average [ns]"
+                   << "|" << std::setw(distribution_col_width) << std::right << "Max [ns]"
+                   << "|" << std::setw(count_col_width) << std::right << "Kept"
+                   << "|" << std::setw(distribution_col_width) << std::right << "Threshold [ns]"
+                   << "|" << std::setw(ovr_percentage_col_width) << std::right << "Percent %"
+                   << std::endl
+                   << create_hline('=', context_line_width);
+
+            return stream.str();
+        }
+
+        /// Writes the table entries for the given type of contexts to the
+        /// given stream: the type, the pairs its kept contexts spent the
+        /// most time in and its slowest kept contexts.
+        static void write_context_entry(std::ostream &stream, const ContextStatistics &context)
+        {
+            stream << std::setfill(' ')
+                   << std::setw(context_col_width) << std::left << context.name.substr(0, context_col_width)
+                   << "|" << std::setw(count_col_width) << std::right << insert_separators(context.count)
+                   << "|" << std::setw(distribution_col_width) << std::right
+                   << insert_separators(context.count > 0 ? context.duration / context.count : 0)
+                   << "|" << std::setw(distribution_col_width) << std::right << insert_separators(context.max_duration)
+                   << "|" << std::setw(count_col_width) << std::right << insert_separators(context.kept_count)
+                   << "|" << std::setw(distribution_col_width) << std::right
+                   << (context.threshold == ContextType::keep_none ? std::string("-")
+                                                                    : insert_separators(context.threshold))
+                   << "|" << std::setw(ovr_percentage_col_width) << std::right << ""
+                   << '\n';
+
+            std::vector<ContextSegment> segments = context.segments;
+            const std::size_t count = std::min(segments.size(), static_cast<std::size_t>(context_segment_count));
+            std::partial_sort(segments.begin(), segments.begin() + count, segments.end(),
+                              [](const ContextSegment &lhs, const ContextSegment &rhs)
+                              { return lhs.duration > rhs.duration; });
+            for (std::size_t i = 0; i < count; i++)
+            {
+                const ContextSegment &segment = segments[i];
+                stream << std::setfill(' ')
+                       << std::setw(context_col_width) << std::left
+                       << ("  " + format_context_segment(segment)).substr(0, context_col_width)
+                       << "|" << std::setw(count_col_width) << std::right << insert_separators(segment.count)
+                       << "|" << std::setw(distribution_col_width) << std::right
+                       << insert_separators(segment.count > 0 ? segment.duration / segment.count : 0)
+                       << "|" << std::setw(distribution_col_width) << std::right << ""
+                       << "|" << std::setw(count_col_width) << std::right << ""
+                       << "|" << std::setw(distribution_col_width) << std::right << ""
+                       << "|" << std::setw(ovr_percentage_col_width) << std::right << std::fixed
+                       << std::setprecision(2)
+                       << (context.kept_duration > 0 ? 100.0 * segment.duration / context.kept_duration : 0.0)
+                       << '\n';
+                stream.unsetf(std::ios::floatfield);
+            }
+
+            for (const KeptContext &kept : context.slowest)
+            {
+                std::string description = "  slowest, ended " + format_timestamp(kept.time);
+                if (kept.tag != 0)
+                    description += ", tag " + std::to_string(kept.tag);
+                std::int64_t segment_count = 0;
+                for (const ContextSegment &segment : kept.segments)
+                    segment_count += segment.count;
+
+                stream << std::setfill(' ')
+                       << std::setw(context_col_width) << std::left << description.substr(0, context_col_width)
+                       << "|" << std::setw(count_col_width) << std::right << insert_separators(segment_count)
+                       << "|" << std::setw(distribution_col_width) << std::right << ""
+                       << "|" << std::setw(distribution_col_width) << std::right << insert_separators(kept.duration)
+                       << "|" << std::setw(count_col_width) << std::right << ""
+                       << "|" << std::setw(distribution_col_width) << std::right << ""
+                       << "|" << std::setw(ovr_percentage_col_width) << std::right << ""
+                       << '\n';
+            }
+        }
+
+        /// Formats the pair of checkpoints of the given segment of a
+        /// profiling context as start -> end.
+        static std::string format_context_segment(const ContextSegment &segment)
+        {
+            if (segment.start_site_id == ContextSegment::other_pairs)
+                return "(other pairs)";
+
+            const Site &start = SiteRegistry::get_site(segment.start_site_id);
+            const Site &end = SiteRegistry::get_site(segment.end_site_id);
+            return std::string(start.name.empty() ? start.function : start.name) + ":" + std::to_string(start.line) +
+                   " -> " + std::string(end.name.empty() ? end.function : end.name) + ":" + std::to_string(end.line);
+        }
+
+        /// Writes the exemplars of the pairs with the longest maximum
+        /// duration to the given stream, one row per exemplar. Nothing is
+        /// written if no pair has exemplars.
+        void write_exemplars(std::ostream &stream) const
+        {
+            std::vector<const MultiMeasurement *> measurements;
+            for (const MultiMeasurement &measurement : measurements_)
+            {
+                if (measurement.has_exemplars())
+                    measurements.push_back(&measurement);
+            }
+            if (measurements.empty())
+                return;
+
+            const std::size_t count = std::min(measurements.size(), static_cast<std::size_t>(exemplar_pair_count));
+            std::partial_sort(measurements.begin(), measurements.begin() + count, measurements.end(),
+                              [](const MultiMeasurement *lhs, const MultiMeasurement *rhs)
+                              { return lhs->get_max_duration() > rhs->get_max_duration(); });
+
+            write_hline(stream, '=', exemplar_line_width);
+            stream << std::setfill(' ')
+                   << std::setw(file_col_width) << std::left << "File"
+                   << "|" << std::setw(function_col_width) << std::left << "Start"
+                   << "|" << std::setw(function_col_width) << std::left << "End"
+                   << "|" << std::setw(distribution_col_width) << std::right << "Duration [ns]"
+                   << "|" << std::setw(time_col_width) << std::left << "Ended at"
+                   << "|" << std::setw(thread_col_width) << std::right << "Thread"
+                   << "|" << std::setw(tag_col_width) << std::right << "Tag"
+                   << '\n';
+            write_hline(stream, '=', exemplar_line_width);
+
+            for (std::size_t i = 0; i < count; i++)
+            {
+                const Site &start = SiteRegistry::get_site(measurements[i]->get_start_site_id());
+                const Site &end = SiteRegistry::get_site(measurements[i]->get_end_site_id());
+                const std::vector<Exemplar> exemplars = measurements[i]->get_exemplars();
+                for (std::size_t e = 0; e < exemplars.size(); e++)
+                {
+                    std::string start_name;
+                    std::string end_name;
+                    if (e == 0)
+                    {
+                        start_name = std::string(start.name.empty() ? start.function : start.name) + ":" +
+                                     std::to_string(start.line);
+                        end_name = std::string(end.name.empty() ? end.function : end.name) + ":" +
+                                   std::to_string(end.line);
+                    }
+
+                    stream << std::setfill(' ')
+                           << std::setw(file_col_width) << std::left << (e == 0 ? get_file_name(start.file) : "")
+                           << "|" << std::setw(function_col_width) << std::left << start_name.substr(0, function_col_width)
+                           << "|" << std::setw(function_col_width) << std::left << end_name.substr(0, function_col_width)
+                           << "|" << std::setw(distribution_col_width) << std::right
+                           << insert_separators(exemplars[e].duration)
+                           << "|" << std::setw(time_col_width) << std::left << format_timestamp(exemplars[e].time)
+                           << "|" << std::setw(thread_col_width) << std::right << exemplars[e].thread_index
+                           << "|" << std::setw(tag_col_width) << std::right
+                           << (exemplars[e].tag != 0 ? std::to_string(exemplars[e].tag) : std::string())
+                           << '\n';
+                }
+                write_hline(stream, i + 1 < count ? '-' : '=', exemplar_line_width);
+            }
+
+            stream << "Exemplars: the slowest segments of the pairs with the longest maximum duration, at most "
+                   << exemplar_pair_count << " pairs, with the time each one ended, the thread that measured it "
+                                             "and the tag the thread had set with PROFILER_EXEMPLAR_TAG()."
+                   << std::endl;
+        }
+
+        /// Formats the given system time as local date and time with
+        /// microseconds.
+        /// Unit: [ns] since the epoch.
+        static std::string format_timestamp(std::int64_t time)
+        {
+            const std::time_t seconds = static_cast<std::time_t>(time / 1000000000);
+            char microseconds[16];
+            std::snprintf(microseconds, sizeof(microseconds), ".%06d", static_cast<int>(time % 1000000000 / 1000));
+
+            std::stringstream stream;
+            stream << std::put_time(std::localtime(&seconds), "%Y-%m-%d %H:%M:%S") << microseconds;
+            return stream.str();
+        }
+
+        /// Writes a line consisting of the given character to the given
+        /// stream.
+        static void write_hline(std::ostream &stream, char fill, int width)
+        {
+            std::fill_n(std::ostreambuf_iterator<char>(stream), width, fill);
+            stream << '\n';
+        }
+
+        /// Returns the file name at the end of the given file path, which
+        /// must be null-terminated, as the names of a Site are.
+        static const char *get_file_name(std::string_view file_path)
+        {
+            const std::size_t slash_position = file_path.find_last_of("/\\");
+            return file_path.data() + (slash_position == std::string_view::npos ? 0 : slash_position + 1);
+        }
+
+        /// Writes the given segments of a profiling context as a JSON array
+        /// to the given stream. The segment of the other pairs has no sites.
+        static void write_json_segments(std::ostream &stream, const std::vector<ContextSegment> &segments)
+        {
+            stream << '[';
+            for (std::size_t i = 0; i < segments.size(); i++)
+            {
+                const ContextSegment &segment = segments[i];
+                stream << (i > 0 ? ", " : "") << "{\"start\": ";
+                if (segment.start_site_id == ContextSegment::other_pairs)
+                {
+                    stream << "null, \"end\": null";
+                }
+                else
+                {
+                    write_json_site(stream, SiteRegistry::get_site(segment.start_site_id));
+                    stream << ", \"end\": ";
+                    write_json_site(stream, SiteRegistry::get_site(segment.end_site_id));
+                }
+                stream << ", \"count\": " << segment.count
+                       << ", \"duration_ns\": " << segment.duration << '}';
+            }
+            stream << ']';
+        }
+
+        /// Writes the file, function and line of the given site as a JSON
+        /// object.
+        static void write_json_site(std::ostream &stream, const Site &site)
+        {
+            stream << "{\"file\": ";
+            write_json_string(stream, site.file);
+            stream << ", \"function\": ";
+            write_json_string(stream, site.function);
+            stream << ", \"line\": " << site.line;
+            if (!site.name.empty())
+            {
+                stream << ", \"label\": ";
+                write_json_string(stream, site.name);
+            }
+            stream << '}';
+        }
+
+        /// Cuts the given file path after the last slash and returns the file name.
+        static std::string crop_path(const std::string &file_name)
+        {
+            std::size_t slash_position = file_name.find_last_of("/\\");
+            return file_name.substr(slash_position + 1);
+        }
+
+        /// Inserts thousands separators into the given number.
+        static std::string insert_separators(long int n)
+        {
+            char digits[24];
+            const int length = std::snprintf(digits, sizeof(digits), "%ld", n);
+            const int sign = n < 0 ? 1 : 0;
+
+            std::string separated;
+            separated.reserve(length + (length - sign) / 3);
+            for (int pos = 0; pos < length; pos++)
+            {
+                separated += digits[pos];
+
+                const int remaining = length - 1 - pos;
+                if (pos >= sign && remaining >= 3 && remaining % 3 == 0)
+                    separated += ',';
+            }
+
+            return separated;
+        }
+
+        /// If the given number would exceed the given number of digits to display,
+        /// crop it.
+        /// Example: crop_number(12345, 4) returns ">999".
+        static std::string crop_number(long int number, int n_digits)
+        {
+            // Make sure n_digits is in the valid range.
+            n_digits = std::max(2, n_digits);
+
+            // Compute the minimum and maximum numbers which can be displayed
+            // with the given number of digits.
+            long int max_number = std::pow(10, n_digits - 1) - 1;
+            long int min_number = -max_number;
+
+            // Crop the number, if necessary.
+            std::stringstream stream;
+            if (number <= max_number && number >= min_number)
+                stream << number;
+            if (number > max_number)
+                stream << ">" << max_number;
+            if (number < min_number)
+                stream << "<" << min_number;
+
+            return stream.str();
+        }
+    };
+
+    /// Raw hit of a checkpoint, as recorded while tracing.
+    struct TraceRecord
+    {
+        /// Time stamp of the hit.
+        /// Unit: ticks of the profiler's Clock in a TraceRing, [ns] in a trace file.
+        std::int64_t time_point;
+
+        /// ID of the site that was hit.
+        std::uint32_t site_id;
+
+        /// Index of the thread that hit the site.
+        std::uint32_t thread_index;
+
+        /// Site ID of a record that marks where records of its thread were
+        /// lost, so that no segment is formed across the gap.
+        static constexpr std::uint32_t gap_site_id = 0xFFFFFFFF;
+    };
+
+    /// Behavior of a TraceRing that is full when a record is pushed.
+    enum class RingFullPolicy
+    {
+        /// Discard the new record and count it as dropped.
+        drop,
+
+        /// Overwrite the oldest record, which the drain thread then counts
+        /// as overwritten.
+        overwrite
+    };
+
+    /// Preallocated lock-free single-producer single-consumer ring of trace
+    /// records.
+    /// The thread owning the ring pushes records, the drain thread of the
+    /// Tracer pops them. Pushing never allocates and never blocks.
+    class TraceRing
+    {
+    private:
+        /// Storage of one record. The thread index is implied by the ring.
+        struct Slot
+        {
+            std::atomic<std::int64_t> time_point;
+            std::atomic<std::uint32_t> site_id;
+
+            /// Whether records were dropped right before this one.
+            std::atomic<bool> follows_gap;
+        };
+
+        /// Preallocated slots. The number of slots is a power of two.
+        std::unique_ptr<Slot[]> slots_;
+
+        /// Number of slots minus one.
+        std::uint64_t mask_;
+
+        /// What to do when the ring is full.
+        RingFullPolicy policy_;
+
+        /// Index of the thread owning the ring.
+        std::uint32_t thread_index_;
+
+        /// Number of records the producer started to write.
+        /// Lets the consumer detect records that were overwritten while it
+        /// copied them.
+        alignas(64) std::atomic<std::uint64_t> reserved_;
+
+        /// Number of records the producer finished writing.
+        std::atomic<std::uint64_t> committed_;
+
+        /// Producer's copy of consumed_, refreshed only when the ring looks full.
+        std::uint64_t cached_consumed_;
+
+        /// Number of records discarded because the ring was full.
+        RelaxedValue<std::uint64_t> dropped_;
+
+        /// Whether records were dropped since the last record was pushed.
+        bool dropped_since_push_;
+
+        /// Number of records the consumer popped or skipped.
+        alignas(64) std::atomic<std::uint64_t> consumed_;
+
+        /// Number of records lost because the producer overwrote them.
+        RelaxedValue<std::uint64_t> overwritten_;
+
+        /// Whether records were overwritten since the last record was
+        /// drained.
+        bool overwritten_since_drain_;
+
+        /// Value of dropped_ when the current session started.
+        std::uint64_t dropped_at_start_;
+
+        /// Time point when the current session started. Older records were
+        /// pushed for an earlier session.
+        std::int64_t session_start_;
+
+    public:
+        /// Constructor.
+        /// The capacity is rounded up to the next power of two.
+        TraceRing(std::size_t capacity, RingFullPolicy policy, std::uint32_t thread_index)
+            : mask_(1),
+              policy_(policy),
+              thread_index_(thread_index),
+              reserved_(0),
+              committed_(0),
+              cached_consumed_(0),
+              dropped_(0),
+              dropped_since_push_(false),
+              consumed_(0),
+              overwritten_(0),
+              overwritten_since_drain_(false),
+              dropped_at_start_(0),
+              session_start_(std::numeric_limits<std::int64_t>::min())
+        {
+            while (mask_ < capacity)
+                mask_ <<= 1;
+            slots_.reset(new Slot[mask_]);
+            mask_--;
+        }
+
+        /// Starts a new tracing session, so that the ring can be reused.
+        /// Discards the records of earlier sessions and restarts the counts
+        /// of lost records. Records the owning thread still pushes because
+        /// it read the ring before the last session stopped are discarded
+        /// by their time point when they are drained.
+        /// Must only be called by the consumer while no drain is running.
+        void start_session()
+        {
+            session_start_ = Clock::now();
+            consumed_.store(committed_.load(std::memory_order_acquire), std::memory_order_release);
+            dropped_at_start_ = dropped_.load();
+            overwritten_.store(0);
+            overwritten_since_drain_ = false;
+        }
+
+        /// Appends a record. Must only be called by the owning thread.
+        /// \return \c false if the record was dropped.
+        bool push(std::int64_t time_point, std::uint32_t site_id)
+        {
+            const std::uint64_t index = committed_.load(std::memory_order_relaxed);
+
+            if (policy_ == RingFullPolicy::drop)
+            {
+                if (index - cached_consumed_ > mask_)
+                {
+                    cached_consumed_ = consumed_.load(std::memory_order_acquire);
+                    if (index - cached_consumed_ > mask_)
+                    {
+                        dropped_.add(1);
+                        dropped_since_push_ = true;
+                        return false;
+                    }
+                }
+            }
+            else
+            {
+                // Announce the write before touching the slot, which may
+                // still be read by the consumer.
+                reserved_.store(index + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+            }
+
+            Slot &slot = slots_[index & mask_];
+            slot.time_point.store(time_point, std::memory_order_relaxed);
+            slot.site_id.store(site_id, std::memory_order_relaxed);
+            slot.follows_gap.store(dropped_since_push_, std::memory_order_relaxed);
+            dropped_since_push_ = false;
+            committed_.store(index + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        /// Appends all records pushed since the last call to the given vector.
+        /// Where records were lost, a record with TraceRecord::gap_site_id
+        /// is inserted. Must only be called by the single consumer.
+        /// \return The number of records appended.
+        std::size_t drain(std::vector<TraceRecord> &records)
+        {
+            const std::uint64_t committed = committed_.load(std::memory_order_acquire);
+            std::uint64_t begin = consumed_.load(std::memory_order_relaxed);
+            const std::uint64_t capacity = mask_ + 1;
+
+            // Skip the records that were already overwritten.
+            if (committed - begin > capacity)
+            {
+                overwritten_.add(committed - capacity - begin);
+                overwritten_since_drain_ = true;
+                begin = committed - capacity;
+            }
+
+            // Only dropped records mark slots, so the records copied here
+            // correspond to the slots one to one if they are overwritten.
+            const std::size_t first = records.size();
+            for (std::uint64_t index = begin; index < committed; index++)
+            {
+                const Slot &slot = slots_[index & mask_];
+                const std::int64_t time_point = slot.time_point.load(std::memory_order_relaxed);
+                if (slot.follows_gap.load(std::memory_order_relaxed))
+                    records.push_back(TraceRecord{time_point, TraceRecord::gap_site_id, thread_index_});
+                records.push_back(TraceRecord{time_point, slot.site_id.load(std::memory_order_relaxed),
+                                              thread_index_});
+            }
+
+            // Discard the records the producer may have overwritten while
+            // they were copied.
+            if (policy_ == RingFullPolicy::overwrite)
+            {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                const std::uint64_t reserved = reserved_.load(std::memory_order_relaxed);
+                if (reserved > capacity && reserved - capacity > begin)
+                {
+                    const std::uint64_t torn = std::min(committed, reserved - capacity) - begin;
+                    records.erase(records.begin() + first, records.begin() + first + torn);
+                    overwritten_.add(torn);
+                    overwritten_since_drain_ = true;
+                }
+            }
+
+            // Discard the records that were late for an earlier session.
+            const std::int64_t session_start = session_start_;
+            records.erase(std::remove_if(records.begin() + first, records.end(),
+                                         [session_start](const TraceRecord &record)
+                                         { return record.time_point < session_start; }),
+                          records.end());
+
+            if (overwritten_since_drain_ && records.size() > first)
+            {
+                records.insert(records.begin() + first,
+                               TraceRecord{records[first].time_point, TraceRecord::gap_site_id, thread_index_});
+                overwritten_since_drain_ = false;
+            }
+
+            consumed_.store(committed, std::memory_order_release);
+
+            return records.size() - first;
+        }
+
+        /// Returns the index of the thread owning the ring.
+        std::uint32_t get_thread_index() const
+        {
+            return thread_index_;
+        }
+
+        /// Returns the number of records dropped in the current session
+        /// because the ring was full.
+        std::uint64_t get_dropped() const
+        {
+            return dropped_.load() - dropped_at_start_;
+        }
+
+        /// Returns the number of records lost in the current session
+        /// because they were overwritten.
+        std::uint64_t get_overwritten() const
+        {
+            return overwritten_.load();
+        }
+    };
+
+    /// Format of a trace file.
+    enum class TraceFormat
+    {
+        /// Compact binary records, see Tracer.
+        binary,
+
+        /// Chrome Trace Event JSON, see ChromeTraceWriter.
+        chrome_json
+    };
+
+    /// Configuration of the event tracing.
+    struct TraceOptions
+    {
+        /// Path of the trace file. If empty, a new file is created in
+        /// \c $HOME/.TimeProfiler/trace.
+        std::string file_path;
+
+        /// Number of records each thread can buffer before the drain thread
+        /// writes them.
+        std::size_t ring_capacity = 1 << 16;
+
+        /// What to do when the ring of a thread is full.
+        RingFullPolicy ring_full_policy = RingFullPolicy::drop;
+
+        /// Format of the trace file.
+        TraceFormat format = TraceFormat::binary;
+
+        /// Interval in which the drain thread empties the rings.
+        std::chrono::milliseconds flush_interval = std::chrono::milliseconds(10);
+    };
+
+    /// Streams measured segments into a file in the Chrome Trace Event JSON
+    /// format, which \c chrome://tracing and the Perfetto UI can load.
+    ///
+    /// Every segment between two consecutive checkpoints of a thread is
+    /// written as a complete event ("ph": "X") as soon as its end is known.
+    /// The start and end site are given as args. Memory use only depends on
+    /// the number of sites and threads, not on the number of events.
+    class ChromeTraceWriter
+    {
+    private:
+        /// Names of a site, already escaped for JSON.
+        struct SiteNames
+        {
+            std::string file;
+            std::string function;
+            int line;
+        };
+
+        /// Output file.
+        std::ofstream file_;
+
+        /// Buffer of the output file.
+        std::vector<char> buffer_;
+
+        /// Whether no event has been written yet.
+        bool first_event_;
+
+        /// Names of the sites, indexed by site ID.
+        std::vector<SiteNames> sites_;
+
+        /// Whether sites_ was given by set_sites() instead of being read
+        /// from the SiteRegistry.
+        bool fixed_sites_;
+
+        /// Last record of each thread, indexed by thread index.
+        std::vector<TraceRecord> last_records_;
+
+        /// Whether the thread with the given index has a last record.
+        std::vector<bool> has_last_record_;
+
+        /// Total numbers of dropped and overwritten records.
+        std::uint64_t dropped_records_;
+        std::uint64_t overwritten_records_;
+
+        /// ID of the process written into every event.
+        long process_id_;
+
+    public:
+        /// Constructor.
+        /// Opens the file and starts the list of events.
+        explicit ChromeTraceWriter(const std::string &file_path, long process_id = get_process_id())
+            : buffer_(1 << 16),
+              first_event_(true),
+              fixed_sites_(false),
+              dropped_records_(0),
+              overwritten_records_(0),
+              process_id_(process_id)
+        {
+            file_.rdbuf()->pubsetbuf(buffer_.data(), buffer_.size());
+            file_.open(file_path.c_str());
+            file_ << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        }
+
+        /// Destructor.
+        /// Completes the file.
+        ~ChromeTraceWriter()
+        {
+            close();
+        }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        ChromeTraceWriter(const ChromeTraceWriter &writer) = delete;
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        ChromeTraceWriter &operator=(const ChromeTraceWriter &writer) = delete;
+
+        /// Returns whether the file could be opened.
+        bool is_open() const
+        {
+            return file_.is_open();
+        }
+
+        /// Uses the given sites instead of the ones of the SiteRegistry,
+        /// e.g. the sites stored in a trace file.
+        void set_sites(const std::vector<Site> &sites)
+        {
+            sites_.clear();
+            for (const Site &site : sites)
+                set_site(site);
+            fixed_sites_ = true;
+        }
+
+        /// Adds a checkpoint hit.
+        /// Writes the segment from the previous hit of the same thread to
+        /// this one, unless records were lost in between, as marked by a
+        /// record with TraceRecord::gap_site_id. The time stamp of the
+        /// record is expected in [ns].
+        void add_record(const TraceRecord &record)
+        {
+            if (record.thread_index >= last_records_.size())
+            {
+                last_records_.resize(record.thread_index + 1);
+                has_last_record_.resize(record.thread_index + 1, false);
+            }
+
+            if (has_last_record_[record.thread_index])
+            {
+                const TraceRecord &last_record = last_records_[record.thread_index];
+                if (last_record.site_id != TraceRecord::gap_site_id && record.site_id != TraceRecord::gap_site_id)
+                {
+                    add_segment(record.thread_index,
+                                last_record.site_id, last_record.time_point,
+                                record.site_id, record.time_point);
+                }
+            }
+            else
+            {
+                add_thread_name(record.thread_index);
+                has_last_record_[record.thread_index] = true;
+            }
+
+            last_records_[record.thread_index] = record;
+        }
+
+        /// Writes a complete event for a segment.
+        /// Time stamps are expected in [ns].
+        void add_segment(std::uint32_t thread_index,
+                         std::uint32_t start_site_id, std::int64_t start_time_point,
+                         std::uint32_t end_site_id, std::int64_t end_time_point)
+        {
+            const SiteNames &start = get_site(start_site_id);
+            const SiteNames &end = get_site(end_site_id);
+
+            begin_event();
+            file_ << "{\"name\":\"" << start.function << ':' << start.line
+                  << " -> " << end.function << ':' << end.line
+                  << "\",\"cat\":\"segment\",\"ph\":\"X\",\"ts\":";
+            write_microseconds(start_time_point);
+            file_ << ",\"dur\":";
+            write_microseconds(end_time_point - start_time_point);
+            file_ << ",\"pid\":" << process_id_
+                  << ",\"tid\":" << thread_index
+                  << ",\"args\":{\"start_file\":\"" << start.file
+                  << "\",\"start_function\":\"" << start.function
+                  << "\",\"start_line\":" << start.line
+                  << ",\"end_file\":\"" << end.file
+                  << "\",\"end_function\":\"" << end.function
+                  << "\",\"end_line\":" << end.line
+                  << "}}";
+        }
+
+        /// Adds numbers of records that were lost while tracing.
+        /// The totals are written into the \c otherData of the file.
+        void add_lost_records(std::uint64_t dropped, std::uint64_t overwritten)
+        {
+            dropped_records_ += dropped;
+            overwritten_records_ += overwritten;
+        }
+
+        /// Completes the file. Called by the destructor.
+        void close()
+        {
+            if (!file_.is_open())
+                return;
+
+            file_ << "],\"otherData\":{\"dropped_records\":" << dropped_records_
+                  << ",\"overwritten_records\":" << overwritten_records_ << "}}\n";
+            file_.close();
+        }
+
+        /// Converts a binary trace file written by the Tracer.
+        /// Reads the file twice, first for the site table at its end and
+        /// then for the events, so memory use does not depend on its size.
+        /// Files of the first version, \c TPTRACE1, do not mark where
+        /// records were lost, so segments may span the lost records.
+        /// \return \c false if the binary file could not be read or the JSON
+        /// file could not be written.
+        static bool convert(const std::string &trace_path, const std::string &json_path)
+        {
+            std::ifstream trace(trace_path.c_str(), std::ios::binary);
+            char magic[8];
+            if (!trace.read(magic, sizeof(magic)) ||
+                (std::string(magic, sizeof(magic)) != "TPTRACE1" && std::string(magic, sizeof(magic)) != "TPTRACE2"))
+                return false;
+
+            ChromeTraceWriter writer(json_path);
+            if (!writer.is_open())
+                return false;
+
+            // First pass: read the sites and the numbers of lost records.
+            // The sites refer to the names read, which set_sites() copies.
+            std::vector<Site> sites;
+            std::deque<std::string> names;
+            char tag[4];
+            std::uint32_t count;
+            while (trace.read(tag, sizeof(tag)) && read_value(trace, count))
+            {
+                const std::string chunk(tag, sizeof(tag));
+                if (chunk == "EVTS")
+                {
+                    trace.seekg(static_cast<std::streamoff>(count) * sizeof(TraceRecord), std::ios::cur);
+                }
+                else if (chunk == "LOST")
+                {
+                    for (std::uint32_t i = 0; i < count; i++)
+                    {
+                        std::uint32_t thread_index;
+                        std::uint64_t dropped, overwritten;
+                        read_value(trace, thread_index);
+                        read_value(trace, dropped);
+                        read_value(trace, overwritten);
+                        writer.add_lost_records(dropped, overwritten);
+                    }
+                }
+                else if (chunk == "SITE")
+                {
+                    for (std::uint32_t i = 0; i < count; i++)
+                    {
+                        Site site = Site();
+                        std::int32_t line;
+                        read_value(trace, site.id);
+                        read_value(trace, line);
+                        site.line = line;
+                        names.emplace_back();
+                        read_string(trace, names.back());
+                        site.file = names.back();
+                        names.emplace_back();
+                        read_string(trace, names.back());
+                        site.function = names.back();
+                        sites.push_back(site);
+                    }
+                }
+                else
+                {
+                    return false;
+                }
+            }
+            writer.set_sites(sites);
+
+            // Second pass: stream the events in batches.
+            trace.clear();
+            trace.seekg(sizeof(magic));
+            std::vector<TraceRecord> records;
+            while (trace.read(tag, sizeof(tag)) && read_value(trace, count))
+            {
+                const std::string chunk(tag, sizeof(tag));
+                if (chunk != "EVTS")
+                    break;
+
+                while (count > 0)
+                {
+                    const std::uint32_t batch = std::min<std::uint32_t>(count, 4096);
+                    records.resize(batch);
+                    trace.read(reinterpret_cast<char *>(records.data()), batch * sizeof(TraceRecord));
+                    for (const TraceRecord &record : records)
+                        writer.add_record(record);
+                    count -= batch;
+                }
+            }
+
+            return true;
+        }
+
+        /// Escapes the given string for use in a JSON string.
+        static std::string escape(std::string_view text)
+        {
+            std::string escaped;
+            escaped.reserve(text.size());
+            for (char c : text)
+            {
+                switch (c)
+                {
+                case '"':
+                    escaped += "\\\"";
+                    break;
+                case '\\':
+                    escaped += "\\\\";
+                    break;
+                case '\n':
+                    escaped += "\\n";
+                    break;
+                case '\t':
+                    escaped += "\\t";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20)
+                    {
+                        char code[8];
+                        std::snprintf(code, sizeof(code), "\\u%04x", c);
+                        escaped += code;
+                    }
+                    else
+                    {
+                        escaped += c;
+                    }
+                }
+            }
+
+            return escaped;
+        }
+
+    private:
+        /// Writes the separator between two events.
+        void begin_event()
+        {
+            if (!first_event_)
+                file_ << ",\n";
+            first_event_ = false;
+        }
+
+        /// Writes a metadata event that names the thread with the given index.
+        void add_thread_name(std::uint32_t thread_index)
+        {
+            begin_event();
+            file_ << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << process_id_
+                  << ",\"tid\":" << thread_index
+                  << ",\"args\":{\"name\":\"Thread " << thread_index << "\"}}";
+        }
+
+        /// Writes the given duration in [us] with three decimals.
+        /// Unit of the argument: [ns].
+        void write_microseconds(std::int64_t nanoseconds)
+        {
+            if (nanoseconds < 0)
+            {
+                file_ << '-';
+                nanoseconds = -nanoseconds;
+            }
+            file_ << nanoseconds / 1000 << '.' << std::setfill('0') << std::setw(3) << nanoseconds % 1000;
+        }
+
+        /// Stores the escaped names of the given site.
+        void set_site(const Site &site)
+        {
+            if (site.id >= sites_.size())
+                sites_.resize(site.id + 1, SiteNames{"?", "?", 0});
+
+            sites_[site.id] = SiteNames{escape(site.file), escape(site.name.empty() ? site.function : site.name),
+                                        site.line};
+        }
+
+        /// Returns the escaped names of the site with the given ID.
+        /// Unknown sites are looked up in the SiteRegistry.
+        const SiteNames &get_site(std::uint32_t site_id)
+        {
+            if (site_id >= sites_.size() && !fixed_sites_)
+            {
+                for (const Site &site : SiteRegistry::get_sites())
+                {
+                    if (site.id >= sites_.size())
+                        set_site(site);
+                }
+            }
+
+            if (site_id >= sites_.size())
+                sites_.resize(site_id + 1, SiteNames{"?", "?", 0});
+
+            return sites_[site_id];
+        }
+
+        /// Reads the bytes of a value.
+        template <typename T>
+        static bool read_value(std::istream &stream, T &value)
+        {
+            return static_cast<bool>(stream.read(reinterpret_cast<char *>(&value), sizeof(value)));
+        }
+
+        /// Reads a string stored as its length followed by its characters.
+        static bool read_string(std::istream &stream, std::string &value)
+        {
+            std::uint32_t length;
+            if (!read_value(stream, length))
+                return false;
+
+            value.resize(length);
+            return static_cast<bool>(stream.read(&value[0], length));
+        }
+    };
+
+    /// Background thread that drains the trace rings of all threads into a
+    /// trace file, either binary or in the Chrome Trace Event format.
+    ///
+    /// The file starts with the 8 bytes \c TPTRACE2 followed by chunks in
+    /// native byte order. Each chunk starts with a 4 byte tag and a 4 byte
+    /// number of entries:
+    ///  * \c EVTS: TraceRecord entries with time stamps in [ns]; an entry
+    ///    with TraceRecord::gap_site_id marks where records of its thread
+    ///    were lost,
+    ///  * \c LOST: per thread index, the numbers of dropped and overwritten
+    ///    records as 4 + 8 + 8 bytes,
+    ///  * \c SITE: per site the ID, the line, and the lengths and characters
+    ///    of the file and function names.
+    /// \c LOST and \c SITE are written once, when tracing stops.
+    /// Binary files can be converted by ChromeTraceWriter::convert().
+    class Tracer
+    {
+    private:
+        /// Configuration.
+        TraceOptions options_;
+
+        /// Binary trace file.
+        std::ofstream file_;
+
+        /// Writer of the Chrome Trace Event file, if that format is selected.
+        std::unique_ptr<ChromeTraceWriter> chrome_writer_;
+
+        /// Rings of all threads that are traced.
+        std::vector<TraceRing *> rings_;
+
+        /// Guards rings_ and stop_. Not held while writing the file.
+        std::mutex mutex_;
+
+        /// Wakes up the drain thread when tracing stops.
+        std::condition_variable condition_;
+
+        /// Whether the drain thread shall stop.
+        bool stop_;
+
+        /// Records drained in the current batch.
+        std::vector<TraceRecord> batch_;
+
+        /// Drain thread.
+        std::thread thread_;
+
+        /// Tags of the chunks of the trace file.
+        static constexpr char events_tag[4] = {'E', 'V', 'T', 'S'};
+        static constexpr char lost_tag[4] = {'L', 'O', 'S', 'T'};
+        static constexpr char sites_tag[4] = {'S', 'I', 'T', 'E'};
+
+    public:
+        /// Magic number at the start of a trace file.
+        static constexpr char magic[8] = {'T', 'P', 'T', 'R', 'A', 'C', 'E', '2'};
+
+        /// Constructor.
+        /// Opens the trace file and starts the drain thread.
+        explicit Tracer(const TraceOptions &options)
+            : options_(options),
+              stop_(false)
+        {
+            const bool chrome_json = options_.format == TraceFormat::chrome_json;
+            if (options_.file_path.empty())
+                options_.file_path = Printer::create_file_path("trace", chrome_json ? ".json" : ".trace");
+
+            if (chrome_json)
+            {
+                chrome_writer_.reset(new ChromeTraceWriter(options_.file_path));
+            }
+            else
+            {
+                file_.open(options_.file_path.c_str(), std::ios::binary);
+                file_.write(magic, sizeof(magic));
+            }
+
+            batch_.reserve(options_.ring_capacity);
+            thread_ = std::thread(&Tracer::run, this);
+        }
+
+        /// Destructor.
+        /// Stops the drain thread after a final drain and completes the file.
+        ~Tracer()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            condition_.notify_one();
+            thread_.join();
+
+            if (chrome_writer_)
+            {
+                for (const TraceRing *ring : rings_)
+                    chrome_writer_->add_lost_records(ring->get_dropped(), ring->get_overwritten());
+                chrome_writer_->close();
+                return;
+            }
+
+            write_lost();
+            write_sites();
+            file_.close();
+        }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        Tracer(const Tracer &tracer) = delete;
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        Tracer &operator=(const Tracer &tracer) = delete;
+
+        /// Returns whether the trace file could be opened.
+        bool is_open() const
+        {
+            return chrome_writer_ ? chrome_writer_->is_open() : file_.is_open();
+        }
+
+        /// Returns the path of the trace file.
+        const std::string &get_file_path() const
+        {
+            return options_.file_path;
+        }
+
+        /// Returns the configuration.
+        const TraceOptions &get_options() const
+        {
+            return options_;
+        }
+
+        /// Adds the ring of a thread to the rings that are drained.
+        void add_ring(TraceRing *ring)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            rings_.push_back(ring);
+        }
+
+    private:
+        /// Main loop of the drain thread.
+        /// Drains at least once, so that a session shorter than the flush
+        /// interval leaves no records behind in the rings.
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            bool stop = false;
+            while (!stop)
+            {
+                condition_.wait_for(lock, options_.flush_interval, [this]()
+                                    { return stop_; });
+                stop = stop_;
+
+                const std::vector<TraceRing *> rings(rings_);
+                lock.unlock();
+                drain(rings);
+                lock.lock();
+            }
+        }
+
+        /// Drains the given rings and writes one chunk per ring that held
+        /// records.
+        void drain(const std::vector<TraceRing *> &rings)
+        {
+            for (TraceRing *ring : rings)
+            {
+                batch_.clear();
+                if (ring->drain(batch_) == 0)
+                    continue;
+
+                for (TraceRecord &record : batch_)
+                    record.time_point = Clock::to_nanoseconds(record.time_point);
+
+                if (chrome_writer_)
+                {
+                    for (const TraceRecord &record : batch_)
+                        chrome_writer_->add_record(record);
+                    continue;
+                }
+
+                write_chunk_header(events_tag, batch_.size());
+                file_.write(reinterpret_cast<const char *>(batch_.data()),
+                            batch_.size() * sizeof(TraceRecord));
+            }
+
+            if (!chrome_writer_)
+                file_.flush();
+        }
+
+        /// Writes the numbers of lost records of all rings.
+        void write_lost()
+        {
+            write_chunk_header(lost_tag, rings_.size());
+            for (const TraceRing *ring : rings_)
+            {
+                write_value(ring->get_thread_index());
+                write_value(ring->get_dropped());
+                write_value(ring->get_overwritten());
+            }
+        }
+
+        /// Writes the table of all registered sites.
+        void write_sites()
+        {
+            const std::vector<Site> sites = SiteRegistry::get_sites();
+            write_chunk_header(sites_tag, sites.size());
+            for (const Site &site : sites)
+            {
+                write_value(site.id);
+                write_value(static_cast<std::int32_t>(site.line));
+                write_string(site.file);
+                write_string(site.function);
+            }
+        }
+
+        /// Writes the tag and the number of entries of a chunk.
+        void write_chunk_header(const char (&tag)[4], std::size_t count)
+        {
+            file_.write(tag, sizeof(tag));
+            write_value(static_cast<std::uint32_t>(count));
+        }
+
+        /// Writes a string as its length followed by its characters.
+        void write_string(std::string_view value)
+        {
+            write_value(static_cast<std::uint32_t>(value.size()));
+            file_.write(value.data(), value.size());
+        }
+
+        /// Writes the bytes of a value.
+        template <typename T>
+        void write_value(const T &value)
+        {
+            file_.write(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+    };
+
+    /// How the hits of a site are chosen whose following segment is timed.
+    enum class SamplingMode
+    {
+        /// Every hit is timed.
+        every_hit,
+
+        /// One hit out of SamplingPolicy::period is timed.
+        every_nth,
+
+        /// At most one hit per SamplingPolicy::interval is timed. The clock is
+        /// still read on every hit, but the statistics are not updated.
+        interval,
+
+        /// Like every_nth, but the period doubles while more than
+        /// SamplingPolicy::max_hit_rate hits per second are timed and halves
+        /// again while less than a quarter as many are.
+        adaptive
+    };
+
+    /// Sampling of the segments that start at a site.
+    /// Every hit is counted, but only the segments that start at a timed hit
+    /// are measured. The overall duration of a pair of sites is extrapolated
+    /// from the measured segments.
+    struct SamplingPolicy
+    {
+        SamplingMode mode;
+
+        /// Number of hits per timed hit. Initial and smallest period of the
+        /// adaptive mode.
+        std::uint32_t period;
+
+        /// Minimum time between two timed hits in interval mode.
+        std::chrono::nanoseconds interval;
+
+        /// Timed hits per second above which the adaptive mode backs off.
+        double max_hit_rate;
+
+        /// Largest period of the adaptive mode.
+        std::uint32_t max_period;
+
+        /// Times every hit.
+        static SamplingPolicy every_hit()
+        {
+            return SamplingPolicy{SamplingMode::every_hit, 1, std::chrono::nanoseconds(0), 0.0, 1};
+        }
+
+        /// Times one hit out of the given number.
+        static SamplingPolicy every_nth(std::uint32_t period)
+        {
+            period = std::max<std::uint32_t>(period, 1);
+            return SamplingPolicy{SamplingMode::every_nth, period, std::chrono::nanoseconds(0), 0.0, period};
+        }
+
+        /// Times at most one hit per given interval.
+        static SamplingPolicy every_interval(std::chrono::nanoseconds interval)
+        {
+            return SamplingPolicy{SamplingMode::interval, 1, interval, 0.0, 1};
+        }
+
+        /// Times every hit as long as the site is hit at most the given number
+        /// of times per second. Above, times roughly between a quarter of and
+        /// the given number of hits per second, but at least one hit out of
+        /// max_period.
+        static SamplingPolicy adaptive(double max_hit_rate, std::uint32_t max_period = 1 << 16)
+        {
+            return SamplingPolicy{SamplingMode::adaptive, 1, std::chrono::nanoseconds(0), max_hit_rate,
+                                  std::max<std::uint32_t>(max_period, 1)};
+        }
+    };
+
+    /// Sampling policies of all sites.
+    /// Threads cache the policies and refresh them when the version changes,
+    /// so a hook only reads one relaxed atomic to check for updates.
+    class SamplingConfig
+    {
+    private:
+        /// Guards the policies.
+        std::mutex mutex_;
+
+        /// Policy of the sites without a policy of their own.
+        SamplingPolicy default_policy_;
+
+        /// Policies of single sites, by site ID.
+        std::map<std::uint32_t, SamplingPolicy> site_policies_;
+
+        /// Policy of the sites at a location.
+        struct LocationPolicy
+        {
+            /// End of the path of the file, e.g. its name.
+            std::string file;
+
+            /// Line of the site, or 0 for every line of the file.
+            int line;
+
+            SamplingPolicy policy;
+        };
+
+        /// Policies of the sites at the given locations, which may not be
+        /// registered yet. Later entries take precedence.
+        std::vector<LocationPolicy> location_policies_;
+
+        /// Incremented on every change of the policies.
+        std::atomic<std::uint32_t> version_;
+
+        /// Default constructor.
+        /// Inaccessible from outside the class.
+        SamplingConfig()
+            : default_policy_(SamplingPolicy::every_hit()),
+              version_(0)
+        {
+        }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        SamplingConfig(const SamplingConfig &config);
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        SamplingConfig &operator=(const SamplingConfig &config);
+
+    public:
+        /// Returns the singleton instance of the configuration.
+        static SamplingConfig &get_instance()
+        {
+            static SamplingConfig config;
+            return config;
+        }
+
+        /// Returns the version of the policies.
+        static std::uint32_t get_version()
+        {
+            return get_instance().version_.load(std::memory_order_relaxed);
+        }
+
+        /// Sets the policy of all sites and drops the policies of single sites.
+        static void set_policy(const SamplingPolicy &policy)
+        {
+            SamplingConfig &config = get_instance();
+            std::lock_guard<std::mutex> lock(config.mutex_);
+            config.default_policy_ = policy;
+            config.site_policies_.clear();
+            config.location_policies_.clear();
+            config.version_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// Sets the policy of the site with the given ID.
+        static void set_policy(std::uint32_t site_id, const SamplingPolicy &policy)
+        {
+            SamplingConfig &config = get_instance();
+            std::lock_guard<std::mutex> lock(config.mutex_);
+            config.site_policies_[site_id] = policy;
+            config.version_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// Sets the policy of the sites in the file whose path ends with the
+        /// given string, at the given line or at every line if it is 0.
+        /// Also applies to sites that are registered later.
+        static void set_policy(const std::string &file, int line, const SamplingPolicy &policy)
+        {
+            SamplingConfig &config = get_instance();
+            std::lock_guard<std::mutex> lock(config.mutex_);
+            config.location_policies_.push_back(LocationPolicy{file, line, policy});
+            config.version_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// Returns the policy of the site with the given ID.
+        static SamplingPolicy get_policy(std::uint32_t site_id)
+        {
+            SamplingConfig &config = get_instance();
+            std::lock_guard<std::mutex> lock(config.mutex_);
+            const auto it = config.site_policies_.find(site_id);
+            if (it != config.site_policies_.end())
+                return it->second;
+
+            if (!config.location_policies_.empty())
+            {
+                const Site &site = SiteRegistry::get_site(site_id);
+                for (auto rit = config.location_policies_.rbegin(); rit != config.location_policies_.rend(); ++rit)
+                {
+                    if ((rit->line == 0 || rit->line == site.line) &&
+                        site.file.size() >= rit->file.size() &&
+                        site.file.compare(site.file.size() - rit->file.size(), rit->file.size(), rit->file) == 0)
+                        return rit->policy;
+                }
+            }
+
+            return config.default_policy_;
+        }
+
+        /// Returns whether any site is sampled.
+        static bool is_active()
+        {
+            SamplingConfig &config = get_instance();
+            std::lock_guard<std::mutex> lock(config.mutex_);
+            if (config.default_policy_.mode != SamplingMode::every_hit)
+                return true;
+
+            for (const auto &site_policy : config.site_policies_)
+            {
+                if (site_policy.second.mode != SamplingMode::every_hit)
+                    return true;
+            }
+
+            for (const LocationPolicy &location_policy : config.location_policies_)
+            {
+                if (location_policy.policy.mode != SamplingMode::every_hit)
+                    return true;
+            }
+
+            return false;
+        }
+
+        /// Locks the policies while the process forks, so that the child
+        /// does not inherit them locked.
+        static void lock()
+        {
+            get_instance().mutex_.lock();
+        }
+
+        /// Unlocks the policies after a fork.
+        static void unlock()
+        {
+            get_instance().mutex_.unlock();
+        }
+    };
+
+    /// Category of hook sites, e.g. io or db, which can be switched on and off
+    /// at run time and removed at compile time. Categories are declared as
+    /// constants with a unique bit between 0 and 63:
+    /// \code
+    /// constexpr time_profiler::Category io("io", 0);
+    /// PROFILER_HOOK_CAT(io);
+    /// \endcode
+    struct Category
+    {
+        /// Name of the category, used to switch it.
+        const char *name;
+
+        /// Bit of the category in TIME_PROFILER_CATEGORY_MASK.
+        int bit;
+
+        /// Constructor.
+        constexpr Category(const char *name, int bit)
+            : name(name),
+              bit(bit)
+        {
+        }
+    };
+
+    /// Returns whether the hooks of the given category are compiled in.
+    constexpr bool is_compiled(const Category &category)
+    {
+        return category.bit >= 0 && category.bit < 64 &&
+               ((static_cast<std::uint64_t>(TIME_PROFILER_CATEGORY_MASK) >> category.bit) & 1) != 0;
+    }
+
+    /// Descriptor of a hook site of a category, cached by the site.
+    struct SiteSwitch
+    {
+        /// ID of the site.
+        std::uint32_t site_id;
+
+        /// Whether the site is enabled. Owned by the CategoryConfig.
+        const std::atomic<bool> *enabled;
+    };
+
+    /// Run-time switches of the categories and of single sites.
+    /// Every site of a category has its own switch, which is updated when
+    /// the configuration changes, so a hit only loads a single flag.
+    /// Sites are enabled unless their category or the site itself is
+    /// disabled; switches of single sites take precedence.
+    ///
+    /// The initial configuration is read from the environment variable
+    /// TIME_PROFILER_CATEGORIES, a comma-separated list of categories and
+    /// sites given as file:line. Entries prefixed with '-' are disabled, all
+    /// others enabled. '*' stands for all categories. If the list enables
+    /// any category, all categories it does not enable are disabled, e.g.
+    /// "io,db" enables io and db only, while "-db" or "*,-db" disable db only.
+    class CategoryConfig
+    {
+    private:
+        /// Guards the switches and the configuration.
+        std::mutex mutex_;
+
+        /// Switch of a registered site.
+        struct SiteState
+        {
+            /// Constructor.
+            SiteState(std::uint32_t site_id, const std::string &category)
+                : site_id(site_id),
+                  category(category),
+                  enabled(true)
+            {
+            }
+
+            std::uint32_t site_id;
+            std::string category;
+            std::atomic<bool> enabled;
+        };
+
+        /// Switches of the registered sites.
+        /// A deque keeps the addresses of the flags valid.
+        std::deque<SiteState> sites_;
+
+        /// Maps site IDs to their index in sites_.
+        std::map<std::uint32_t, std::size_t> site_indexes_;
+
+        /// Whether categories without a switch of their own are enabled.
+        bool default_enabled_;
+
+        /// Switches of the categories, by name.
+        std::map<std::string, bool> categories_;
+
+        /// Switch of the sites at a location.
+        struct LocationSwitch
+        {
+            /// End of the path of the file, e.g. its name.
+            std::string file;
+
+            /// Line of the site, or 0 for every line of the file.
+            int line;
+
+            bool enabled;
+        };
+
+        /// Switches of the sites at the given locations, which may not be
+        /// registered yet. Later entries take precedence.
+        std::vector<LocationSwitch> location_switches_;
+
+        /// Default constructor.
+        /// Inaccessible from outside the class.
+        CategoryConfig()
+            : default_enabled_(true)
+        {
+            const char *categories = std::getenv("TIME_PROFILER_CATEGORIES");
+            if (categories != nullptr)
+                parse(categories);
+        }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        CategoryConfig(const CategoryConfig &config);
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        CategoryConfig &operator=(const CategoryConfig &config);
+
+    public:
+        /// Returns the singleton instance of the configuration.
+        static CategoryConfig &get_instance()
+        {
+            static CategoryConfig config;
+            return config;
+        }
+
+        /// Registers the site at the given location with the given category,
+        /// if it is not known yet, and returns its switch.
+        /// Called once per hook site, not on every hit.
+        static SiteSwitch register_site(const std::string &file, int line, const std::string &function,
+                                        const Category &category)
+        {
+            const AllocationSuppressor suppressor;
+            const Site &site = SiteRegistry::register_site(file, line, function);
+
+            CategoryConfig &config = get_instance();
+            std::lock_guard<std::mutex> lock(config.mutex_);
+            auto result = config.site_indexes_.emplace(site.id, config.sites_.size());
+            if (result.second)
+            {
+                config.sites_.emplace_back(site.id, category.name);
+                config.update(config.sites_.back());
+            }
+
+            return SiteSwitch{site.id, &config.sites_[result.first->second].enabled};
+        }
+
+        /// Applies a list of switches in the format of the environment
+        /// variable TIME_PROFILER_CATEGORIES.
+        static void set_switches(const std::string &switches)
+        {
+            CategoryConfig &config = get_instance();
+            std::lock_guard<std::mutex> lock(config.mutex_);
+            config.parse(switches);
+            config.update_all();
+        }
+
+        /// Switches the sites of the given category, or of all categories if
+        /// it is "*", which drops the switches of the single categories.
+        static void set_category_enabled(const std::string &category, bool enabled)
+        {
+            CategoryConfig &config = get_instance();
+            std::lock_guard<std::mutex> lock(config.mutex_);
+            config.set_category(category, enabled);
+            config.update_all();
+        }
+
+        /// Switches the sites in the file whose path ends with the given
+        /// string, at the given line or at every line if it is 0.
+        /// Also applies to sites that are registered later.
+        static void set_site_enabled(const std::string &file, int line, bool enabled)
+        {
+            CategoryConfig &config = get_instance();
+            std::lock_guard<std::mutex> lock(config.mutex_);
+            config.location_switches_.push_back(LocationSwitch{file, line, enabled});
+            config.update_all();
+        }
+
+        /// Returns whether the sites of the given category are enabled,
+        /// unless they are switched on their own.
+        static bool is_category_enabled(const std::string &category)
+        {
+            CategoryConfig &config = get_instance();
+            std::lock_guard<std::mutex> lock(config.mutex_);
+            return config.is_enabled(category);
+        }
+
+        /// Locks the switches while the process forks, so that the child
+        /// does not inherit them locked.
+        static void lock()
+        {
+            get_instance().mutex_.lock();
+        }
+
+        /// Unlocks the switches after a fork.
+        static void unlock()
+        {
+            get_instance().mutex_.unlock();
+        }
+
+    private:
+        /// Switches the given category, or all categories if it is "*".
+        void set_category(const std::string &category, bool enabled)
+        {
+            if (category == "*")
+            {
+                default_enabled_ = enabled;
+                categories_.clear();
+            }
+            else
+            {
+                categories_[category] = enabled;
+            }
+        }
+
+        /// Returns whether the given category is enabled.
+        bool is_enabled(const std::string &category) const
+        {
+            const auto it = categories_.find(category);
+            return it != categories_.end() ? it->second : default_enabled_;
+        }
+
+        /// Parses a comma-separated list of switches.
+        void parse(const std::string &switches)
+        {
+            std::vector<std::pair<std::string, bool>> entries;
+            std::stringstream stream(switches);
+            std::string entry;
+            bool any_enabled = false;
+            while (std::getline(stream, entry, ','))
+            {
+                entry.erase(0, entry.find_first_not_of(" \t"));
+                entry.erase(entry.find_last_not_of(" \t") + 1);
+                if (entry.empty())
+                    continue;
+
+                const bool enabled = entry[0] != '-';
+                if (entry[0] == '-' || entry[0] == '+')
+                    entry.erase(0, 1);
+                entries.emplace_back(entry, enabled);
+                any_enabled = any_enabled || (enabled && entry.find(':') == std::string::npos);
+            }
+
+            if (any_enabled)
+                set_category("*", false);
+
+            for (const auto &switch_entry : entries)
+            {
+                const std::size_t colon = switch_entry.first.rfind(':');
+                if (colon != std::string::npos)
+                {
+                    location_switches_.push_back(LocationSwitch{switch_entry.first.substr(0, colon),
+                                                                std::atoi(switch_entry.first.c_str() + colon + 1),
+                                                                switch_entry.second});
+                }
+                else
+                {
+                    set_category(switch_entry.first, switch_entry.second);
+                }
+            }
+        }
+
+        /// Updates the switch of a site.
+        void update(SiteState &state) const
+        {
+            bool enabled = is_enabled(state.category);
+            if (!location_switches_.empty())
+            {
+                const Site &site = SiteRegistry::get_site(state.site_id);
+                for (auto rit = location_switches_.rbegin(); rit != location_switches_.rend(); ++rit)
+                {
+                    if ((rit->line == 0 || rit->line == site.line) &&
+                        site.file.size() >= rit->file.size() &&
+                        site.file.compare(site.file.size() - rit->file.size(), rit->file.size(), rit->file) == 0)
+                    {
+                        enabled = rit->enabled;
+                        break;
+                    }
+                }
+            }
+
+            state.enabled.store(enabled, std::memory_order_relaxed);
+        }
+
+        /// Updates the switches of all sites.
+        void update_all()
+        {
+            for (SiteState &state : sites_)
+                update(state);
+        }
+    };
+
+    /// Decides which hits of a site are timed, according to its policy.
+    /// Owned by a single thread.
+    class SiteSampler
+    {
+    private:
+        SamplingPolicy policy_;
+
+        /// Current number of hits per timed hit.
+        std::uint32_t period_;
+
+        /// Number of hits until the next timed hit, including it.
+        std::uint32_t countdown_;
+
+        /// Time of the last timed hit.
+        /// Unit: ticks of the profiler's Clock.
+        std::int64_t last_time_point_;
+
+        /// Whether a hit was timed already.
+        bool has_last_time_point_;
+
+    public:
+        /// Constructor.
+        explicit SiteSampler(const SamplingPolicy &policy = SamplingPolicy::every_hit())
+            : policy_(policy),
+              period_(std::max<std::uint32_t>(policy.period, 1)),
+              countdown_(1),
+              last_time_point_(0),
+              has_last_time_point_(false)
+        {
+        }
+
+        /// Returns whether the next hit may be timed, i.e. whether sample()
+        /// needs the current time.
+        bool needs_time() const
+        {
+            return policy_.mode == SamplingMode::every_hit ||
+                   policy_.mode == SamplingMode::interval ||
+                   countdown_ <= 1;
+        }
+
+        /// Decides whether the hit at the given time is timed. The time is
+        /// only used if needs_time() returned true.
+        bool sample(std::int64_t time_point)
+        {
+            switch (policy_.mode)
+            {
+            case SamplingMode::every_hit:
+                return true;
+
+            case SamplingMode::every_nth:
+                if (--countdown_ > 0)
+                    return false;
+                countdown_ = period_;
+                return true;
+
+            case SamplingMode::interval:
+                if (has_last_time_point_ &&
+                    Clock::to_nanoseconds(time_point - last_time_point_) < policy_.interval.count())
+                    return false;
+                break;
+
+            case SamplingMode::adaptive:
+                if (--countdown_ > 0)
+                    return false;
+                if (has_last_time_point_)
+                    adapt_period(Clock::to_nanoseconds(time_point - last_time_point_));
+                countdown_ = period_;
+                break;
+            }
+
+            last_time_point_ = time_point;
+            has_last_time_point_ = true;
+            return true;
+        }
+
+    private:
+        /// Adapts the period to the time since the last timed hit.
+        /// Unit of duration: [ns].
+        void adapt_period(std::int64_t duration)
+        {
+            const double timed_hit_rate = 1e9 / std::max<std::int64_t>(duration, 1);
+            if (timed_hit_rate > policy_.max_hit_rate && period_ < policy_.max_period)
+                period_ = static_cast<std::uint32_t>(
+                    std::min<std::uint64_t>(period_ * std::uint64_t(2), policy_.max_period));
+            else if (timed_hit_rate < policy_.max_hit_rate / 4 && period_ > policy_.period)
+                period_ = std::max(period_ / 2, policy_.period);
+        }
+    };
+
+    /// Statistics of a single thread, captured at a point in time.
+    struct ThreadSnapshot
+    {
+        /// Index of the thread in the order the threads started profiling.
+        std::uint32_t index;
+
+        /// Printable ID of the thread.
+        std::string thread_id;
+
+        /// Whether the thread was still running.
+        bool running;
+
+        /// Statistics of the pairs of checkpoints.
+        std::vector<MultiMeasurement> measurements;
+
+        /// Statistics of the call tree of zones in depth-first order.
+        std::vector<ZoneStatistics> zones;
+
+        /// ID of the process the thread ran in, or 0 if unknown. Set to
+        /// the process of the snapshot when the thread is added to it.
+        long process_id;
+    };
+
+    /// Statistics of all threads over a period of time.
+    /// A snapshot captured by the profiler covers the time since the
+    /// profiler started. Subtracting an earlier snapshot yields the
+    /// statistics of the period between both, and merging the snapshots of
+    /// adjacent periods yields those of the whole period.
+    class Snapshot
+    {
+    private:
+        /// Start of the period.
+        std::chrono::system_clock::time_point start_time_;
+
+        /// End of the period.
+        std::chrono::system_clock::time_point end_time_;
+
+        /// Statistics of the threads that recorded anything, ordered by
+        /// their process and their index.
+        std::vector<ThreadSnapshot> threads_;
+
+        /// ID of the process the statistics were recorded in, or 0 if
+        /// unknown or merged from several processes.
+        long process_id_;
+
+        /// Role of that process, see ProcessRole.
+        std::string role_;
+
+        /// Statistics of the task sites that finished a task, which are
+        /// not bound to a thread.
+        std::vector<TaskStatistics> tasks_;
+
+        /// Latest results of the benchmarks, which are not bound to a
+        /// thread either.
+        std::vector<BenchStatistics> benches_;
+
+        /// Statistics of the types of profiling contexts with contexts that
+        /// ended, which are not bound to a thread either.
+        std::vector<ContextStatistics> contexts_;
+
+        /// Overhead of the profiler per segment, which the reports subtract
+        /// from the durations, or 0 if they are not compensated.
+        /// Unit: [ns].
+        std::int64_t overhead_;
+
+    public:
+        /// Default constructor.
+        /// Creates an empty snapshot of an empty period.
+        Snapshot()
+            : process_id_(0),
+              overhead_(0)
+        {
+        }
+
+        /// Constructor.
+        /// Creates an empty snapshot of the given period.
+        Snapshot(std::chrono::system_clock::time_point start_time, std::chrono::system_clock::time_point end_time)
+            : start_time_(start_time),
+              end_time_(end_time),
+              process_id_(0),
+              overhead_(0)
+        {
+        }
+
+        /// Sets the process the statistics were recorded in. Threads of an
+        /// unknown process are assigned to it.
+        void set_process(long process_id, const std::string &role)
+        {
+            process_id_ = process_id;
+            role_ = role;
+            for (ThreadSnapshot &thread : threads_)
+            {
+                if (thread.process_id == 0)
+                    thread.process_id = process_id;
+            }
+        }
+
+        /// Returns the ID of the process the statistics were recorded in, or
+        /// 0 if unknown or merged from several processes.
+        long get_process_id() const
+        {
+            return process_id_;
+        }
+
+        /// Returns the role of the process the statistics were recorded in.
+        const std::string &get_role() const
+        {
+            return role_;
+        }
+
+        /// Adds the statistics of a thread. Threads must be added in the
+        /// order of their process and their index. A thread of an unknown
+        /// process is assigned to the process of the snapshot.
+        void add_thread(ThreadSnapshot thread)
+        {
+            if (thread.process_id == 0)
+                thread.process_id = process_id_;
+            threads_.push_back(std::move(thread));
+        }
+
+        /// Returns the statistics of the threads, ordered by their process
+        /// and their index.
+        const std::vector<ThreadSnapshot> &get_threads() const
+        {
+            return threads_;
+        }
+
+        /// Sets the statistics of the task sites.
+        void set_tasks(std::vector<TaskStatistics> tasks)
+        {
+            tasks_ = std::move(tasks);
+        }
+
+        /// Returns the statistics of the task sites that finished a task.
+        const std::vector<TaskStatistics> &get_tasks() const
+        {
+            return tasks_;
+        }
+
+        /// Sets the results of the benchmarks.
+        void set_benches(std::vector<BenchStatistics> benches)
+        {
+            benches_ = std::move(benches);
+        }
+
+        /// Returns the latest results of the benchmarks.
+        const std::vector<BenchStatistics> &get_benches() const
+        {
+            return benches_;
+        }
+
+        /// Sets the statistics of the types of profiling contexts.
+        void set_contexts(std::vector<ContextStatistics> contexts)
+        {
+            contexts_ = std::move(contexts);
+        }
+
+        /// Returns the statistics of the types of profiling contexts.
+        const std::vector<ContextStatistics> &get_contexts() const
+        {
+            return contexts_;
+        }
+
+        /// Sets the overhead of the profiler per segment, which the reports
+        /// subtract from the durations. 0 turns the compensation off.
+        /// Unit: [ns].
+        void set_overhead(std::int64_t overhead)
+        {
+            overhead_ = std::max<std::int64_t>(0, overhead);
+        }
+
+        /// Returns the overhead of the profiler per segment, see
+        /// set_overhead().
+        /// Unit: [ns].
+        std::int64_t get_overhead() const
+        {
+            return overhead_;
+        }
+
+        /// Returns whether the snapshot holds no statistics at all.
+        bool is_empty() const
+        {
+            return threads_.empty() && tasks_.empty() && benches_.empty() && contexts_.empty();
+        }
+
+        /// Returns the start of the period.
+        std::chrono::system_clock::time_point get_start_time() const
+        {
+            return start_time_;
+        }
+
+        /// Returns the end of the period.
+        std::chrono::system_clock::time_point get_end_time() const
+        {
+            return end_time_;
+        }
+
+        /// Returns the statistics of the period from the end of the given
+        /// earlier snapshot to the end of this one. Pairs and zones that
+        /// were not hit in that period are left out.
+        Snapshot subtract(const Snapshot &earlier) const
+        {
+            Snapshot difference(earlier.end_time_, end_time_);
+            difference.set_process(process_id_, role_);
+            difference.overhead_ = overhead_;
+            for (const ThreadSnapshot &thread : threads_)
+            {
+                const ThreadSnapshot *earlier_thread = earlier.find_thread(thread.process_id, thread.index);
+                ThreadSnapshot thread_difference{thread.index, thread.thread_id, thread.running,
+                                                 std::vector<MultiMeasurement>(), std::vector<ZoneStatistics>(),
+                                                 thread.process_id};
+
+                // A thread appends new pairs to its table, so the pairs of
+                // the earlier snapshot usually come first in the same order.
+                // The statistics are large, so each is copied only once.
+                thread_difference.measurements.reserve(thread.measurements.size());
+                for (std::size_t i = 0; i < thread.measurements.size(); i++)
+                {
+                    thread_difference.measurements.push_back(thread.measurements[i]);
+                    MultiMeasurement &measurement = thread_difference.measurements.back();
+                    if (earlier_thread != nullptr)
+                    {
+                        const MultiMeasurement *earlier_measurement =
+                            find_measurement(*earlier_thread, i, measurement.get_key());
+                        if (earlier_measurement != nullptr)
+                            measurement.subtract(*earlier_measurement);
+                    }
+
+                    if (measurement.count() <= 0)
+                        thread_difference.measurements.pop_back();
+                }
+
+                ZoneTree zones;
+                zones.merge(thread.zones);
+                if (earlier_thread != nullptr)
+                    zones.subtract(earlier_thread->zones);
+                thread_difference.zones = zones.flatten(true);
+
+                if (!thread_difference.measurements.empty() || !thread_difference.zones.empty())
+                    difference.add_thread(std::move(thread_difference));
+            }
+
+            // The longest task cannot be subtracted; it refers to the whole
+            // time since the profiler started.
+            for (const TaskStatistics &task : tasks_)
+            {
+                TaskStatistics task_difference = task;
+                const TaskStatistics *earlier_task = find_task(earlier.tasks_, task.site_id);
+                if (earlier_task != nullptr)
+                {
+                    task_difference.count -= earlier_task->count;
+                    task_difference.resume_count -= earlier_task->resume_count;
+                    task_difference.duration -= earlier_task->duration;
+                    task_difference.active_duration -= earlier_task->active_duration;
+                    task_difference.suspended_duration -= earlier_task->suspended_duration;
+                }
+
+                if (task_difference.count > 0)
+                    difference.tasks_.push_back(task_difference);
+            }
+
+            // Benchmarks are part of the period if they ran in it.
+            for (const BenchStatistics &bench : benches_)
+            {
+                const BenchStatistics *earlier_bench = find_bench(earlier.benches_, bench.site_id);
+                if (earlier_bench == nullptr || earlier_bench->run_count != bench.run_count)
+                    difference.benches_.push_back(bench);
+            }
+
+            // As for tasks, the longest context refers to the whole time.
+            // The slowest contexts of the period are those that ended in it.
+            const std::int64_t earlier_end_time =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(earlier.end_time_.time_since_epoch()).count();
+            for (const ContextStatistics &context : contexts_)
+            {
+                ContextStatistics context_difference = context;
+                const ContextStatistics *earlier_context = find_context(earlier.contexts_, context.name);
+                if (earlier_context != nullptr)
+                {
+                    context_difference.count -= earlier_context->count;
+                    context_difference.duration -= earlier_context->duration;
+                    context_difference.kept_count -= earlier_context->kept_count;
+                    context_difference.kept_duration -= earlier_context->kept_duration;
+                    subtract_segments(context_difference.segments, earlier_context->segments);
+                    context_difference.slowest.erase(
+                        std::remove_if(context_difference.slowest.begin(), context_difference.slowest.end(),
+                                       [earlier_end_time](const KeptContext &kept)
+                                       { return kept.time <= earlier_end_time; }),
+                        context_difference.slowest.end());
+                }
+
+                if (context_difference.count > 0)
+                    difference.contexts_.push_back(std::move(context_difference));
+            }
+
+            return difference;
+        }
+
+        /// Adds the statistics of another snapshot of the same threads,
+        /// e.g. of an adjacent period. The period is extended to cover both.
+        /// Threads of different processes are kept apart, even if they have
+        /// the same index.
+        void merge(const Snapshot &other)
+        {
+            if (threads_.empty() && start_time_ == end_time_)
+            {
+                start_time_ = other.start_time_;
+                end_time_ = other.end_time_;
+                set_process(other.process_id_, other.role_);
+                overhead_ = other.overhead_;
+            }
+            else
+            {
+                // Rather compensate too little than too much.
+                if (overhead_ == 0 || (other.overhead_ > 0 && other.overhead_ < overhead_))
+                    overhead_ = other.overhead_;
+                start_time_ = std::min(start_time_, other.start_time_);
+                end_time_ = std::max(end_time_, other.end_time_);
+                if (process_id_ != other.process_id_)
+                    process_id_ = 0;
+                if (role_ != other.role_)
+                    role_.clear();
+            }
+
+            for (const ThreadSnapshot &other_thread : other.threads_)
+            {
+                auto thread = std::lower_bound(threads_.begin(), threads_.end(), other_thread,
+                                               [](const ThreadSnapshot &lhs, const ThreadSnapshot &rhs)
+                                               {
+                                                   return lhs.process_id < rhs.process_id ||
+                                                          (lhs.process_id == rhs.process_id && lhs.index < rhs.index);
+                                               });
+                if (thread == threads_.end() || thread->process_id != other_thread.process_id ||
+                    thread->index != other_thread.index)
+                {
+                    threads_.insert(thread, other_thread);
+                    continue;
+                }
+
+                PairTable measurements;
+                for (const MultiMeasurement &measurement : thread->measurements)
+                    measurements.find_or_insert(measurement.get_start_site_id(), measurement.get_end_site_id())
+                        .merge(measurement);
+                for (const MultiMeasurement &measurement : other_thread.measurements)
+                    measurements.find_or_insert(measurement.get_start_site_id(), measurement.get_end_site_id())
+                        .merge(measurement);
+                thread->measurements.assign(measurements.get_measurements().begin(),
+                                            measurements.get_measurements().end());
+
+                ZoneTree zones;
+                zones.merge(thread->zones);
+                zones.merge(other_thread.zones);
+                thread->zones = zones.flatten(true);
+
+                thread->running = other_thread.running;
+            }
+
+            for (const TaskStatistics &other_task : other.tasks_)
+            {
+                auto task = std::find_if(tasks_.begin(), tasks_.end(), [&other_task](const TaskStatistics &lhs)
+                                         { return lhs.site_id == other_task.site_id; });
+                if (task == tasks_.end())
+                {
+                    tasks_.push_back(other_task);
+                    continue;
+                }
+
+                task->count += other_task.count;
+                task->resume_count += other_task.resume_count;
+                task->duration += other_task.duration;
+                task->active_duration += other_task.active_duration;
+                task->suspended_duration += other_task.suspended_duration;
+                task->max_duration = std::max(task->max_duration, other_task.max_duration);
+            }
+
+            // Trials of different runs cannot be combined, so the later run
+            // of a benchmark wins.
+            for (const BenchStatistics &other_bench : other.benches_)
+            {
+                auto bench = std::find_if(benches_.begin(), benches_.end(), [&other_bench](const BenchStatistics &lhs)
+                                          { return lhs.site_id == other_bench.site_id; });
+                if (bench == benches_.end())
+                    benches_.push_back(other_bench);
+                else if (other_bench.run_count >= bench->run_count)
+                    *bench = other_bench;
+            }
+
+            for (const ContextStatistics &other_context : other.contexts_)
+            {
+                auto context = std::find_if(contexts_.begin(), contexts_.end(),
+                                            [&other_context](const ContextStatistics &lhs)
+                                            { return lhs.name == other_context.name; });
+                if (context == contexts_.end())
+                {
+                    contexts_.push_back(other_context);
+                    continue;
+                }
+
+                context->threshold = other_context.threshold;
+                context->count += other_context.count;
+                context->duration += other_context.duration;
+                context->max_duration = std::max(context->max_duration, other_context.max_duration);
+                context->kept_count += other_context.kept_count;
+                context->kept_duration += other_context.kept_duration;
+                ContextBreakdown::merge(context->segments, other_context.segments);
+
+                context->slowest.insert(context->slowest.end(), other_context.slowest.begin(),
+                                        other_context.slowest.end());
+                std::stable_sort(context->slowest.begin(), context->slowest.end(),
+                                 [](const KeptContext &lhs, const KeptContext &rhs)
+                                 { return lhs.duration > rhs.duration; });
+                if (context->slowest.size() > static_cast<std::size_t>(ContextType::max_slowest))
+                    context->slowest.resize(ContextType::max_slowest);
+            }
+        }
+
+    private:
+        /// Returns the statistics of the task site with the given ID among
+        /// the given ones, or \c nullptr if it is not among them.
+        static const TaskStatistics *find_task(const std::vector<TaskStatistics> &tasks, std::uint32_t site_id)
+        {
+            for (const TaskStatistics &task : tasks)
+            {
+                if (task.site_id == site_id)
+                    return &task;
+            }
+
+            return nullptr;
+        }
+
+        /// Returns the result of the benchmark with the given site ID among
+        /// the given ones, or \c nullptr if it is not among them.
+        static const BenchStatistics *find_bench(const std::vector<BenchStatistics> &benches, std::uint32_t site_id)
+        {
+            for (const BenchStatistics &bench : benches)
+            {
+                if (bench.site_id == site_id)
+                    return &bench;
+            }
+
+            return nullptr;
+        }
+
+        /// Returns the statistics of the type of profiling contexts with the
+        /// given name among the given ones, or \c nullptr if it is not among
+        /// them.
+        static const ContextStatistics *find_context(const std::vector<ContextStatistics> &contexts,
+                                                     const std::string &name)
+        {
+            for (const ContextStatistics &context : contexts)
+            {
+                if (context.name == name)
+                    return &context;
+            }
+
+            return nullptr;
+        }
+
+        /// Subtracts the earlier segments of a type of profiling contexts
+        /// from the given ones and drops the segments left empty.
+        static void subtract_segments(std::vector<ContextSegment> &segments,
+                                      const std::vector<ContextSegment> &earlier)
+        {
+            for (ContextSegment &segment : segments)
+            {
+                for (const ContextSegment &earlier_segment : earlier)
+                {
+                    if (earlier_segment.start_site_id == segment.start_site_id &&
+                        earlier_segment.end_site_id == segment.end_site_id)
+                    {
+                        segment.count -= earlier_segment.count;
+                        segment.duration -= earlier_segment.duration;
+                        break;
+                    }
+                }
+            }
+
+            segments.erase(std::remove_if(segments.begin(), segments.end(), [](const ContextSegment &segment)
+                                          { return segment.count <= 0; }),
+                           segments.end());
+        }
+
+        /// Returns the statistics of the thread of the given process with
+        /// the given index, or \c nullptr if the thread did not record
+        /// anything.
+        const ThreadSnapshot *find_thread(long process_id, std::uint32_t index) const
+        {
+            for (const ThreadSnapshot &thread : threads_)
+            {
+                if (thread.process_id == process_id && thread.index == index)
+                    return &thread;
+            }
+
+            return nullptr;
+        }
+
+        /// Returns the statistics of the pair with the given key, which are
+        /// expected at the given position, or \c nullptr if the pair was not
+        /// hit.
+        static const MultiMeasurement *find_measurement(const ThreadSnapshot &thread, std::size_t position,
+                                                        std::uint64_t key)
+        {
+            if (position < thread.measurements.size() && thread.measurements[position].get_key() == key)
+                return &thread.measurements[position];
+
+            for (const MultiMeasurement &measurement : thread.measurements)
+            {
+                if (measurement.get_key() == key)
+                    return &measurement;
+            }
+
+            return nullptr;
+        }
+    };
+
+    /// Configuration of the background reporter.
+    struct ReporterOptions
+    {
+        /// Length of a window.
+        std::chrono::milliseconds interval = std::chrono::seconds(60);
+
+        /// Number of recent windows that are kept.
+        std::size_t window_count = 60;
+
+        /// Called on the reporter's thread with the statistics of every
+        /// window. If empty, the statistics are printed to the console.
+        std::function<void(const Snapshot &)> callback;
+    };
+
+    /// Background thread that captures a snapshot in a fixed interval and
+    /// keeps the statistics of the most recent windows between them.
+    /// Capturing only copies the statistics of each thread, so the threads
+    /// that record are not stalled.
+    class Reporter
+    {
+    private:
+        /// Configuration.
+        ReporterOptions options_;
+
+        /// Captures the statistics since the profiler started.
+        std::function<Snapshot()> capture_;
+
+        /// Snapshot at the end of the last window.
+        Snapshot last_snapshot_;
+
+        /// Statistics of the most recent windows, oldest first.
+        std::deque<Snapshot> windows_;
+
+        /// Guards windows_ and stop_.
+        mutable std::mutex mutex_;
+
+        /// Wakes up the reporter thread when reporting stops.
+        std::condition_variable condition_;
+
+        /// Whether the reporter thread shall stop.
+        bool stop_;
+
+        /// Reporter thread.
+        std::thread thread_;
+
+    public:
+        /// Constructor.
+        /// Captures the start of the first window and starts the reporter
+        /// thread.
+        Reporter(const ReporterOptions &options, const std::function<Snapshot()> &capture)
+            : options_(options),
+              capture_(capture),
+              last_snapshot_(capture()),
+              stop_(false)
+        {
+            thread_ = std::thread(&Reporter::run, this);
+        }
+
+        /// Destructor.
+        /// Reports the last, partial window and stops the reporter thread.
+        ~Reporter()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            condition_.notify_one();
+            thread_.join();
+        }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        Reporter(const Reporter &reporter) = delete;
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        Reporter &operator=(const Reporter &reporter) = delete;
+
+        /// Returns the statistics of the most recent windows, oldest first.
+        std::vector<Snapshot> get_windows() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return std::vector<Snapshot>(windows_.begin(), windows_.end());
+        }
+
+    private:
+        /// Main loop of the reporter thread.
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto deadline = std::chrono::steady_clock::now() + options_.interval;
+            while (true)
+            {
+                const bool stop = condition_.wait_until(lock, deadline, [this]()
+                                                        { return stop_; });
+                lock.unlock();
+                report();
+                lock.lock();
+
+                if (stop)
+                    return;
+
+                deadline += options_.interval;
+            }
+        }
+
+        /// Captures the statistics of the window that ends now and reports
+        /// them.
+        void report()
+        {
+            Snapshot snapshot(capture_());
+            const Snapshot window(snapshot.subtract(last_snapshot_));
+            last_snapshot_ = std::move(snapshot);
+            ExemplarHeap::start_generation();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                windows_.push_back(window);
+                while (windows_.size() > options_.window_count)
+                    windows_.pop_front();
+            }
+
+            if (options_.callback)
+                options_.callback(window);
+        }
+    };
+
+#if defined(__unix__) || defined(__APPLE__)
+    /// Configuration of the export of the statistics into shared memory.
+    struct ExportOptions
+    {
+        /// Name of the shared-memory segment. If empty, it is
+        /// "/time_profiler_<process ID>".
+        std::string name;
+
+        /// Interval in which the statistics are published.
+        std::chrono::milliseconds interval = std::chrono::seconds(1);
+
+        /// Maximum number of pairs that are published. If there are more,
+        /// those with the longest overall durations are published.
+        std::uint32_t capacity = 4096;
+    };
+
+    /// POSIX shared-memory segment that holds the statistics of all pairs of
+    /// checkpoints of a process, merged over its threads, so that other
+    /// processes can watch them live, e.g. time_profiler_top.
+    ///
+    /// The segment starts with a Header, followed by capacity PairRecord
+    /// entries and 2 * capacity SiteRecord entries. The publishing process
+    /// is the only writer and protects every update with a sequence lock:
+    /// the sequence is odd while an update is in progress, and readers
+    /// retry if it changed while they copied the records. All counts are
+    /// cumulative since the profiler started.
+    class SharedStats
+    {
+    public:
+        /// Magic number at the start of the segment.
+        static constexpr char magic[8] = {'T', 'P', 'S', 'H', 'A', 'R', 'E', 'D'};
+
+        /// Version of the layout. Incremented on incompatible changes.
+        static const std::uint32_t version = 2;
+
+        /// Written in native byte order, so that readers can detect a
+        /// segment of another byte order.
+        static const std::uint32_t byte_order_mark = 0x01020304;
+
+        /// Header at the start of the segment.
+        struct Header
+        {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t byte_order_mark;
+            std::uint32_t capacity;
+            std::uint32_t process_id;
+            std::atomic<std::uint64_t> sequence;
+            std::uint64_t pair_count;
+            std::uint64_t site_count;
+            std::uint64_t dropped_pair_count;
+            std::int64_t start_time;
+            std::int64_t update_time;
+            std::int64_t tick_overhead;
+        };
+
+        /// Statistics of a pair of sites. Sites are referred to by their ID
+        /// in the publishing process. Durations are in nanoseconds. The
+        /// minimum, maximum and percentiles exclude the overhead of the
+        /// profiler in Header::tick_overhead. The overall duration includes
+        /// it, so that the difference between two states stays exact when
+        /// the overhead is recalibrated; a reader subtracts tick_overhead
+        /// per counted segment from such a difference.
+        struct PairRecord
+        {
+            std::uint32_t start_site;
+            std::uint32_t end_site;
+            std::int64_t count;
+            std::int64_t timed_count;
+            std::int64_t overall_duration;
+            std::int64_t min_duration;
+            std::int64_t max_duration;
+            std::int64_t p50_duration;
+            std::int64_t p90_duration;
+            std::int64_t p99_duration;
+        };
+
+        /// Site of a pair. File and function are cropped to their last
+        /// characters and null-terminated.
+        struct SiteRecord
+        {
+            std::uint32_t id;
+            std::int32_t line;
+            char file[56];
+            char function[64];
+        };
+
+        static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+                      "The sequence lock requires lock-free 64-bit atomics");
+
+    private:
+        /// Name of the segment.
+        std::string name_;
+
+        /// Mapped segment, \c nullptr if none is open.
+        void *data_;
+
+        /// Size of the mapped segment.
+        std::size_t size_;
+
+        /// Whether this instance created the segment and removes it again.
+        bool owner_;
+
+        /// Description of the last error.
+        std::string error_;
+
+    public:
+        /// Default constructor.
+        SharedStats()
+            : data_(nullptr),
+              size_(0),
+              owner_(false)
+        {
+        }
+
+        /// Destructor.
+        /// Unmaps the segment and removes it if this instance created it.
+        ~SharedStats()
+        {
+            close();
+        }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        SharedStats(const SharedStats &stats) = delete;
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        SharedStats &operator=(const SharedStats &stats) = delete;
+
+        /// Returns the name of the segment of the given process.
+        static std::string get_default_name(long process_id)
+        {
+            return "/time_profiler_" + std::to_string(process_id);
+        }
+
+        /// Creates the segment with room for the given number of pairs. An
+        /// existing segment of the same name is only replaced if it is
+        /// stale, see is_stale().
+        /// \return \c false if the segment could not be created, e.g.
+        /// because another process publishes under the same name.
+        bool create(const std::string &name, std::uint32_t capacity, std::chrono::system_clock::time_point start_time)
+        {
+            close();
+            name_ = name;
+            const std::size_t size = sizeof(Header) + capacity * sizeof(PairRecord) +
+                                     2 * std::size_t(capacity) * sizeof(SiteRecord);
+
+            int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+            if (fd < 0 && errno == EEXIST && is_stale(name))
+            {
+                ::shm_unlink(name.c_str());
+                fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+            }
+            if (fd < 0 && errno == EEXIST)
+                return fail("shared memory " + name + " is in use by another process");
+            if (fd < 0)
+                return fail("cannot create shared memory " + name + ": " + std::strerror(errno));
+
+            void *data = MAP_FAILED;
+            if (::ftruncate(fd, static_cast<off_t>(size)) == 0)
+                data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (data == MAP_FAILED)
+            {
+                ::shm_unlink(name.c_str());
+                return fail("cannot map shared memory " + name + ": " + std::strerror(errno));
+            }
+
+            data_ = data;
+            size_ = size;
+            owner_ = true;
+
+            Header *header = new (data_) Header();
+            std::copy(magic, magic + sizeof(magic), header->magic);
+            header->version = version;
+            header->byte_order_mark = byte_order_mark;
+            header->capacity = capacity;
+            header->process_id = static_cast<std::uint32_t>(get_process_id());
+            header->sequence.store(0, std::memory_order_relaxed);
+            header->pair_count = 0;
+            header->site_count = 0;
+            header->dropped_pair_count = 0;
+            header->start_time = to_nanoseconds(start_time);
+            header->update_time = header->start_time;
+            header->tick_overhead = 0;
+
+            return true;
+        }
+
+        /// Opens an existing segment for reading.
+        /// \return \c false if the segment does not exist or is invalid.
+        bool open(const std::string &name)
+        {
+            close();
+            name_ = name;
+
+            const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+            if (fd < 0)
+                return fail("cannot open shared memory " + name + ": " + std::strerror(errno));
+
+            struct stat status;
+            if (::fstat(fd, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(Header))
+            {
+                ::close(fd);
+                return fail(name + " is not a statistics segment");
+            }
+
+            void *data = ::mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (data == MAP_FAILED)
+                return fail("cannot map shared memory " + name + ": " + std::strerror(errno));
+
+            data_ = data;
+            size_ = static_cast<std::size_t>(status.st_size);
+
+            const Header &header = get_header();
+            if (!std::equal(magic, magic + sizeof(magic), header.magic))
+                return fail(name + " is not a statistics segment");
+            if (header.byte_order_mark != byte_order_mark)
+                return fail(name + " has another byte order");
+            if (header.version != version)
+                return fail("unsupported statistics version " + std::to_string(header.version));
+            if (size_ < sizeof(Header) + header.capacity * sizeof(PairRecord) +
+                            2 * std::size_t(header.capacity) * sizeof(SiteRecord))
+                return fail(name + " is truncated");
+
+            return true;
+        }
+
+        /// Returns whether a segment is open.
+        bool is_open() const
+        {
+            return data_ != nullptr;
+        }
+
+        /// Returns the description of the last error.
+        const std::string &get_error() const
+        {
+            return error_;
+        }
+
+        /// Returns the name of the segment.
+        const std::string &get_name() const
+        {
+            return name_;
+        }
+
+        /// Publishes the given statistics, compensated for the overhead set
+        /// on them, which is the same for all of them. Must only be called by
+        /// the creator of the segment.
+        void publish(const std::vector<MultiMeasurement> &measurements)
+        {
+            if (!owner_)
+                return;
+
+            Header &header = get_header();
+            std::vector<const MultiMeasurement *> published;
+            published.reserve(measurements.size());
+            for (const MultiMeasurement &measurement : measurements)
+                published.push_back(&measurement);
+
+            if (published.size() > header.capacity)
+            {
+                std::partial_sort(published.begin(), published.begin() + header.capacity, published.end(),
+                                  [](const MultiMeasurement *lhs, const MultiMeasurement *rhs)
+                                  { return lhs->get_overall_duration() > rhs->get_overall_duration(); });
+                published.resize(header.capacity);
+            }
+
+            // Prepare the records outside of the critical section, which
+            // only copies them.
+            std::vector<PairRecord> pairs;
+            std::vector<SiteRecord> sites;
+            std::map<std::uint32_t, std::size_t> site_indexes;
+            pairs.reserve(published.size());
+            for (const MultiMeasurement *measurement : published)
+            {
+                // The overall duration, extrapolated to all segments if the
+                // start site is sampled, without compensation.
+                const bool timed = measurement->timed_count() > 0;
+                const std::int64_t measured = measurement->get_measured_duration().count();
+                const std::int64_t overall =
+                    timed && measurement->timed_count() != measurement->count()
+                        ? std::llround(static_cast<double>(measured) * measurement->count() / measurement->timed_count())
+                        : measured;
+                pairs.push_back(PairRecord{measurement->get_start_site_id(), measurement->get_end_site_id(),
+                                           measurement->count(), measurement->timed_count(),
+                                           overall,
+                                           timed ? measurement->get_min_duration().count() : 0,
+                                           timed ? measurement->get_max_duration().count() : 0,
+                                           measurement->get_percentile(0.5).count(),
+                                           measurement->get_percentile(0.9).count(),
+                                           measurement->get_percentile(0.99).count()});
+                for (std::uint32_t site_id : {measurement->get_start_site_id(), measurement->get_end_site_id()})
+                {
+                    if (site_indexes.emplace(site_id, sites.size()).second)
+                        sites.push_back(create_site_record(SiteRegistry::get_site(site_id)));
+                }
+            }
+
+            const std::uint64_t sequence = header.sequence.load(std::memory_order_relaxed);
+            header.sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            std::copy(pairs.begin(), pairs.end(), get_pairs());
+            std::copy(sites.begin(), sites.end(), get_sites());
+            header.pair_count = pairs.size();
+            header.site_count = sites.size();
+            header.dropped_pair_count = measurements.size() - published.size();
+            header.update_time = to_nanoseconds(std::chrono::system_clock::now());
+            header.tick_overhead = measurements.empty() ? 0 : measurements.front().get_overhead();
+
+            header.sequence.store(sequence + 2, std::memory_order_release);
+        }
+
+        /// Copies a consistent state of the statistics. Retries while the
+        /// writer updates them.
+        /// \return \c false if no consistent state could be read.
+        bool read(Header &header, std::vector<PairRecord> &pairs, std::vector<SiteRecord> &sites) const
+        {
+            const Header &shared = get_header();
+            for (int attempt = 0; attempt < 1000; attempt++)
+            {
+                const std::uint64_t sequence = shared.sequence.load(std::memory_order_acquire);
+                if ((sequence & 1) != 0)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                std::memcpy(static_cast<void *>(&header), &shared, sizeof(Header));
+                const std::size_t pair_count = std::min<std::uint64_t>(header.pair_count, shared.capacity);
+                const std::size_t site_count = std::min<std::uint64_t>(header.site_count, 2 * std::uint64_t(shared.capacity));
+                pairs.assign(get_pairs(), get_pairs() + pair_count);
+                sites.assign(get_sites(), get_sites() + site_count);
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (shared.sequence.load(std::memory_order_relaxed) == sequence)
+                    return true;
+            }
+
+            return false;
+        }
+
+        /// Unmaps the segment and removes it if this instance created it.
+        void close()
+        {
+            if (data_ == nullptr)
+                return;
+
+            ::munmap(data_, size_);
+            if (owner_)
+                ::shm_unlink(name_.c_str());
+
+            data_ = nullptr;
+            size_ = 0;
+            owner_ = false;
+        }
+
+    private:
+        /// Returns whether the existing segment of the given name was left
+        /// behind by a process that exited, or by an earlier process with
+        /// the ID of this one, so that it may be replaced. A segment that is
+        /// not a statistics segment is not stale: its creator may still be
+        /// initializing it.
+        static bool is_stale(const std::string &name)
+        {
+            const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+            if (fd < 0)
+                return errno == ENOENT;
+
+            bool valid = false;
+            std::uint32_t process_id = 0;
+            struct stat status;
+            if (::fstat(fd, &status) == 0 && static_cast<std::size_t>(status.st_size) >= sizeof(Header))
+            {
+                void *data = ::mmap(nullptr, sizeof(Header), PROT_READ, MAP_SHARED, fd, 0);
+                if (data != MAP_FAILED)
+                {
+                    // Earlier versions share the fields up to the process ID.
+                    const Header &header = *static_cast<const Header *>(data);
+                    valid = std::equal(magic, magic + sizeof(magic), header.magic) &&
+                            header.byte_order_mark == byte_order_mark;
+                    process_id = header.process_id;
+                    ::munmap(data, sizeof(Header));
+                }
+            }
+            ::close(fd);
+
+            if (!valid)
+                return false;
+            if (static_cast<long>(process_id) == get_process_id())
+                return true;
+
+            return ::kill(static_cast<pid_t>(process_id), 0) != 0 && errno == ESRCH;
+        }
+
+        /// Records the given error and closes the segment.
+        /// \return \c false.
+        bool fail(const std::string &error)
+        {
+            error_ = error;
+            close();
+            return false;
+        }
+
+        Header &get_header() const
+        {
+            return *static_cast<Header *>(data_);
+        }
+
+        PairRecord *get_pairs() const
+        {
+            return reinterpret_cast<PairRecord *>(static_cast<char *>(data_) + sizeof(Header));
+        }
+
+        SiteRecord *get_sites() const
+        {
+            return reinterpret_cast<SiteRecord *>(get_pairs() + get_header().capacity);
+        }
+
+        /// Creates the record of a site, keeping the ends of its names.
+        static SiteRecord create_site_record(const Site &site)
+        {
+            SiteRecord record = {};
+            record.id = site.id;
+            record.line = site.line;
+            copy_tail(site.file, record.file, sizeof(record.file));
+            copy_tail(site.function, record.function, sizeof(record.function));
+            return record;
+        }
+
+        /// Copies as many of the last characters of a string into a buffer
+        /// of the given size as fit besides the terminating null.
+        static void copy_tail(std::string_view string, char *buffer, std::size_t size)
+        {
+            const std::size_t length = std::min(string.size(), size - 1);
+            std::memcpy(buffer, string.data() + string.size() - length, length);
+            buffer[length] = '\0';
+        }
+
+        static std::int64_t to_nanoseconds(std::chrono::system_clock::time_point time_point)
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(time_point.time_since_epoch()).count();
+        }
+    };
+
+    /// Background thread that publishes the statistics of all threads into
+    /// a SharedStats segment in a fixed interval. The threads that record are
+    /// not involved; the statistics are copied as for a snapshot.
+    class StatsExporter
+    {
+    private:
+        /// Configuration.
+        ExportOptions options_;
+
+        /// Captures the statistics since the profiler started, merged over
+        /// all threads, with the overhead of the profiler set on them.
+        std::function<std::vector<MultiMeasurement>()> capture_;
+
+        /// Published segment.
+        SharedStats stats_;
+
+        /// Guards stop_.
+        std::mutex mutex_;
+
+        /// Wakes up the exporter thread when exporting stops.
+        std::condition_variable condition_;
+
+        /// Whether the exporter thread shall stop.
+        bool stop_;
+
+        /// Exporter thread.
+        std::thread thread_;
+
+    public:
+        /// Constructor.
+        /// Creates the segment and starts the exporter thread if it could be
+        /// created.
+        StatsExporter(const ExportOptions &options, std::chrono::system_clock::time_point start_time,
+                      const std::function<std::vector<MultiMeasurement>()> &capture)
+            : options_(options),
+              capture_(capture),
+              stop_(false)
+        {
+            if (options_.name.empty())
+                options_.name = SharedStats::get_default_name(get_process_id());
+
+            if (stats_.create(options_.name, options_.capacity, start_time))
+                thread_ = std::thread(&StatsExporter::run, this);
+        }
+
+        /// Destructor.
+        /// Stops the exporter thread and removes the segment.
+        ~StatsExporter()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            condition_.notify_one();
+            if (thread_.joinable())
+                thread_.join();
+        }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        StatsExporter(const StatsExporter &exporter) = delete;
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        StatsExporter &operator=(const StatsExporter &exporter) = delete;
+
+        /// Returns whether the segment was created.
+        bool is_open() const
+        {
+            return stats_.is_open();
+        }
+
+        /// Returns the name of the segment.
+        const std::string &get_name() const
+        {
+            return options_.name;
+        }
+
+        /// Returns the description of the error if the segment could not be
+        /// created.
+        const std::string &get_error() const
+        {
+            return stats_.get_error();
+        }
+
+    private:
+        /// Main loop of the exporter thread.
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto deadline = std::chrono::steady_clock::now();
+            while (!stop_)
+            {
+                lock.unlock();
+                stats_.publish(capture_());
+                lock.lock();
+
+                deadline += options_.interval;
+                condition_.wait_until(lock, deadline, [this]()
+                                      { return stop_; });
+            }
+        }
+    };
+#endif
+
+    /// Binary profile file, which stores a Snapshot and is read by mapping it
+    /// into memory.
+    ///
+    /// The file starts with a Header followed by the sections it points to.
+    /// All records have a fixed size, are 8 byte aligned and are in native
+    /// byte order:
+    ///  * sites: SiteRecord entries,
+    ///  * threads: ThreadRecord entries,
+    ///  * pairs: PairRecord entries, grouped by thread,
+    ///  * zones: ZoneRecord entries in depth-first order, grouped by thread,
+    ///  * buckets: the range of non-empty buckets of the histogram of each
+    ///    pair as 8 byte counts, if the file has histograms,
+    ///  * strings: null-terminated strings that the records refer to by
+    ///    their offset.
+    /// Readers reject files with another magic number, version or byte order.
+    class ProfileFile
+    {
+    public:
+        /// Magic number at the start of a profile file.
+        static constexpr char magic[8] = {'T', 'P', 'P', 'R', 'O', 'F', 'I', 'L'};
+
+        /// Version of the format. Incremented on incompatible changes.
+        static const std::uint32_t version = 5;
+
+        /// Written in native byte order to detect files of other platforms.
+        static const std::uint32_t byte_order_mark = 0x01020304;
+
+        /// Flag of files that contain histograms.
+        static const std::uint32_t has_histograms = 1;
+
+        /// Flag of a PairRecord: the CPU usage was measured.
+        static const std::uint32_t has_cpu_usage = 1;
+
+        /// Flag of a PairRecord: the heap allocations were counted.
+        static const std::uint32_t has_allocations = 2;
+
+        /// Position and number of entries of a section.
+        struct Section
+        {
+            std::uint64_t offset;
+            std::uint64_t count;
+        };
+
+        /// Header at the start of the file.
+        struct Header
+        {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t byte_order_mark;
+            std::uint32_t flags;
+
+            /// LatencyHistogram::bucket_count of the writer.
+            std::uint32_t bucket_count;
+
+            /// Period of the statistics.
+            /// Unit: [ns] since the epoch of the system clock.
+            std::int64_t start_time;
+            std::int64_t end_time;
+
+            /// ID of the process that recorded the statistics, or 0 if
+            /// they were merged from several processes.
+            std::int64_t process_id;
+
+            /// Role of that process, see ProcessRole.
+            std::uint32_t role;
+
+            /// Overhead of the profiler per segment, see
+            /// Snapshot::set_overhead(). 0 in files of earlier releases.
+            /// Unit: [ns].
+            std::uint32_t tick_overhead;
+
+            /// Size of the whole file in bytes.
+            std::uint64_t file_size;
+
+            Section sites;
+            Section threads;
+            Section pairs;
+            Section zones;
+            Section buckets;
+
+            /// Number of bytes of the string section.
+            Section strings;
+        };
+
+        /// Site. The names are offsets into the string section.
+        struct SiteRecord
+        {
+            std::uint32_t file;
+            std::uint32_t function;
+            std::uint32_t name;
+            std::int32_t line;
+        };
+
+        /// Thread. The ID is an offset into the string section. The thread
+        /// ran in the process of the header, unless process_id is not 0,
+        /// e.g. in statistics merged from several processes.
+        struct ThreadRecord
+        {
+            std::uint32_t index;
+            std::uint32_t running;
+            std::uint32_t thread_id;
+            std::uint32_t process_id;
+        };
+
+        /// Statistics of a pair of sites, see MultiMeasurement.
+        /// Threads and sites are indexes into their sections. The histogram
+        /// consists of bucket_count buckets starting with first_bucket,
+        /// stored at bucket_offset in the bucket section. The counters are
+        /// those of the given CounterSource. The CPU usage and the heap
+        /// allocations are valid if the flags contain has_cpu_usage and
+        /// has_allocations.
+        struct PairRecord
+        {
+            std::uint32_t thread;
+            std::uint32_t start_site;
+            std::uint32_t end_site;
+            std::uint32_t first_bucket;
+            std::uint64_t bucket_offset;
+            std::uint32_t bucket_count;
+            std::uint32_t counter_source;
+            std::int64_t count;
+            std::int64_t timed_count;
+            std::int64_t overall_duration;
+            std::int64_t min_duration;
+            std::int64_t max_duration;
+            std::int64_t shift;
+            double shifted_squares;
+            std::uint64_t counters[counter_count];
+            std::uint32_t flags;
+            std::uint32_t reserved;
+            std::int64_t cpu_duration;
+            std::int64_t voluntary_switches;
+            std::int64_t involuntary_switches;
+            std::int64_t allocations;
+            std::int64_t frees;
+            std::int64_t allocated_bytes;
+        };
+
+        /// Statistics of a zone, see ZoneStatistics.
+        /// Threads and sites are indexes into their sections.
+        struct ZoneRecord
+        {
+            std::uint32_t thread;
+            std::uint32_t site;
+            std::int32_t depth;
+            std::uint32_t reserved;
+            std::int64_t count;
+            std::int64_t inclusive_duration;
+            std::int64_t exclusive_duration;
+        };
+
+    private:
+        /// Contents of the file.
+        const char *data_;
+
+        /// Size of the file in bytes.
+        std::size_t size_;
+
+        /// Whether data_ is mapped, rather than read into buffer_.
+        bool mapped_;
+
+        /// Contents of the file if it cannot be mapped.
+        std::vector<char> buffer_;
+
+        /// Description of the last error.
+        std::string error_;
+
+    public:
+        /// Default constructor.
+        ProfileFile()
+            : data_(nullptr),
+              size_(0),
+              mapped_(false)
+        {
+        }
+
+        /// Destructor.
+        ~ProfileFile()
+        {
+            close();
+        }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        ProfileFile(const ProfileFile &file) = delete;
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        ProfileFile &operator=(const ProfileFile &file) = delete;
+
+        /// Maps the given file into memory and validates it.
+        /// \return \c true on success. Otherwise get_error() describes the
+        /// problem.
+        bool open(const std::string &path)
+        {
+            close();
+
+#if defined(__unix__) || defined(__APPLE__)
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return fail("cannot open " + path);
+
+            struct stat status;
+            if (::fstat(fd, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(Header)))
+            {
+                ::close(fd);
+                return fail(path + " is too small to be a profile");
+            }
+
+            void *data = ::mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (data == MAP_FAILED)
+                return fail("cannot map " + path);
+
+            data_ = static_cast<const char *>(data);
+            size_ = static_cast<std::size_t>(status.st_size);
+            mapped_ = true;
+#else
+            std::ifstream stream(path.c_str(), std::ios::binary);
+            if (!stream)
+                return fail("cannot open " + path);
+
+            buffer_.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+            data_ = buffer_.data();
+            size_ = buffer_.size();
+#endif
+
+            if (!validate())
+            {
+                const std::string error = path + ": " + error_;
+                close();
+                return fail(error);
+            }
+
+            return true;
+        }
+
+        /// Unmaps the file.
+        void close()
+        {
+#if defined(__unix__) || defined(__APPLE__)
+            if (mapped_)
+                ::munmap(const_cast<char *>(data_), size_);
+#endif
+            data_ = nullptr;
+            size_ = 0;
+            mapped_ = false;
+            buffer_.clear();
+        }
+
+        /// Returns the description of the last error.
+        const std::string &get_error() const
+        {
+            return error_;
+        }
+
+        /// Returns the header of the open file.
+        const Header &get_header() const
+        {
+            return *reinterpret_cast<const Header *>(data_);
+        }
+
+        /// Returns the string at the given offset into the string section.
+        const char *get_string(std::uint32_t offset) const
+        {
+            return data_ + get_header().strings.offset + offset;
+        }
+
+        /// Returns the first entry of the given section.
+        template <typename T>
+        const T *get_records(const Section &section) const
+        {
+            return reinterpret_cast<const T *>(data_ + section.offset);
+        }
+
+        /// Returns the statistics stored in the open file. Its sites are
+        /// registered in the SiteRegistry of this process.
+        Snapshot get_snapshot() const
+        {
+            const Header &header = get_header();
+
+            std::vector<std::uint32_t> site_ids;
+            const SiteRecord *sites = get_records<SiteRecord>(header.sites);
+            for (std::uint64_t i = 0; i < header.sites.count; i++)
+            {
+                site_ids.push_back(SiteRegistry::register_site(get_string(sites[i].file), sites[i].line,
+                                                               get_string(sites[i].function),
+                                                               get_string(sites[i].name))
+                                       .id);
+            }
+
+            std::vector<ThreadSnapshot> threads;
+            const ThreadRecord *thread_records = get_records<ThreadRecord>(header.threads);
+            for (std::uint64_t i = 0; i < header.threads.count; i++)
+            {
+                threads.push_back(ThreadSnapshot{thread_records[i].index, get_string(thread_records[i].thread_id),
+                                                 thread_records[i].running != 0,
+                                                 std::vector<MultiMeasurement>(), std::vector<ZoneStatistics>(),
+                                                 static_cast<long>(thread_records[i].process_id)});
+            }
+
+            const PairRecord *pairs = get_records<PairRecord>(header.pairs);
+            const std::uint64_t *buckets = get_records<std::uint64_t>(header.buckets);
+            for (std::uint64_t i = 0; i < header.pairs.count; i++)
+            {
+                const PairRecord &pair = pairs[i];
+                MultiMeasurement measurement(site_ids[pair.start_site], site_ids[pair.end_site]);
+                measurement.restore(pair.count, pair.timed_count, pair.overall_duration, pair.min_duration,
+                                    pair.max_duration, pair.shift, pair.shifted_squares);
+                for (std::uint32_t bucket = 0; bucket < pair.bucket_count; bucket++)
+                    measurement.get_histogram().set_count(pair.first_bucket + bucket, buckets[pair.bucket_offset + bucket]);
+
+                CounterValues counters;
+                std::copy(pair.counters, pair.counters + counter_count, counters.begin());
+                measurement.restore_counters(static_cast<CounterSource>(pair.counter_source), counters);
+                if ((pair.flags & has_cpu_usage) != 0)
+                    measurement.restore_cpu_usage(CpuUsage{pair.cpu_duration, pair.voluntary_switches,
+                                                           pair.involuntary_switches});
+                if ((pair.flags & has_allocations) != 0)
+                    measurement.restore_allocations(AllocationUsage{pair.allocations, pair.frees, pair.allocated_bytes});
+
+                threads[pair.thread].measurements.push_back(measurement);
+            }
+
+            const ZoneRecord *zones = get_records<ZoneRecord>(header.zones);
+            for (std::uint64_t i = 0; i < header.zones.count; i++)
+            {
+                const ZoneRecord &zone = zones[i];
+                threads[zone.thread].zones.push_back(ZoneStatistics{site_ids[zone.site], zone.depth, zone.count,
+                                                                    zone.inclusive_duration, zone.exclusive_duration});
+            }
+
+            Snapshot snapshot(to_time_point(header.start_time), to_time_point(header.end_time));
+            snapshot.set_process(static_cast<long>(header.process_id), get_string(header.role));
+            snapshot.set_overhead(header.tick_overhead);
+            for (ThreadSnapshot &thread : threads)
+                snapshot.add_thread(std::move(thread));
+
+            return snapshot;
+        }
+
+        /// Writes the given statistics to a profile file.
+        /// \param histograms Whether to store the histograms of the pairs.
+        /// Without them, the percentiles read back equal the minimum.
+        /// \return \c true on success.
+        static bool write(const std::string &path, const Snapshot &snapshot, bool histograms = true)
+        {
+            std::vector<char> strings;
+            std::map<std::string, std::uint32_t> string_offsets;
+            auto add_string = [&](std::string_view value)
+            {
+                auto result = string_offsets.emplace(value, static_cast<std::uint32_t>(strings.size()));
+                if (result.second)
+                {
+                    strings.insert(strings.end(), value.begin(), value.end());
+                    strings.push_back('\0');
+                }
+                return result.first->second;
+            };
+
+            std::vector<SiteRecord> sites;
+            std::map<std::uint32_t, std::uint32_t> site_indexes;
+            auto add_site = [&](std::uint32_t site_id)
+            {
+                auto result = site_indexes.emplace(site_id, static_cast<std::uint32_t>(sites.size()));
+                if (result.second)
+                {
+                    const Site site = SiteRegistry::get_site(site_id);
+                    sites.push_back(SiteRecord{add_string(site.file), add_string(site.function),
+                                               add_string(site.name), site.line});
+                }
+                return result.first->second;
+            };
+
+            std::vector<ThreadRecord> threads;
+            std::vector<PairRecord> pairs;
+            std::vector<ZoneRecord> zones;
+            std::vector<std::uint64_t> buckets;
+            for (const ThreadSnapshot &thread : snapshot.get_threads())
+            {
+                const std::uint32_t thread_index = static_cast<std::uint32_t>(threads.size());
+                const long process_id = thread.process_id != snapshot.get_process_id() ? thread.process_id : 0;
+                threads.push_back(ThreadRecord{thread.index, thread.running ? 1u : 0u, add_string(thread.thread_id),
+                                               static_cast<std::uint32_t>(process_id)});
+
+                for (const MultiMeasurement &measurement : thread.measurements)
+                {
+                    PairRecord pair = {};
+                    pair.thread = thread_index;
+                    pair.start_site = add_site(measurement.get_start_site_id());
+                    pair.end_site = add_site(measurement.get_end_site_id());
+                    pair.count = measurement.count();
+                    pair.timed_count = measurement.timed_count();
+                    pair.overall_duration = measurement.get_measured_duration().count();
+                    pair.min_duration = measurement.timed_count() > 0 ? measurement.get_min_duration().count()
+                                                                      : std::numeric_limits<std::int64_t>::max();
+                    pair.max_duration = measurement.timed_count() > 0 ? measurement.get_max_duration().count()
+                                                                      : std::numeric_limits<std::int64_t>::min();
+                    pair.shift = measurement.get_shift();
+                    pair.shifted_squares = measurement.get_shifted_squares();
+                    pair.counter_source = static_cast<std::uint32_t>(measurement.get_counter_source());
+                    for (int i = 0; i < counter_count; i++)
+                        pair.counters[i] = measurement.get_counter(i);
+                    if (measurement.has_cpu_usage())
+                    {
+                        pair.flags |= has_cpu_usage;
+                        pair.cpu_duration = measurement.get_cpu_duration().count();
+                        pair.voluntary_switches = measurement.get_voluntary_switches();
+                        pair.involuntary_switches = measurement.get_involuntary_switches();
+                    }
+                    if (measurement.has_allocations())
+                    {
+                        const AllocationUsage allocations = measurement.get_allocations();
+                        pair.flags |= has_allocations;
+                        pair.allocations = allocations.allocations;
+                        pair.frees = allocations.frees;
+                        pair.allocated_bytes = allocations.bytes;
+                    }
+
+                    const LatencyHistogram &histogram = measurement.get_histogram();
+                    const int first_bucket = histogram.get_first_bucket();
+                    const int last_bucket = histogram.get_last_bucket();
+                    if (histograms && last_bucket >= first_bucket)
+                    {
+                        pair.first_bucket = static_cast<std::uint32_t>(first_bucket);
+                        pair.bucket_offset = buckets.size();
+                        pair.bucket_count = static_cast<std::uint32_t>(last_bucket - first_bucket + 1);
+                        for (int bucket = first_bucket; bucket <= last_bucket; bucket++)
+                            buckets.push_back(histogram.get_count(bucket));
+                    }
+
+                    pairs.push_back(pair);
+                }
+
+                for (const ZoneStatistics &zone : thread.zones)
+                {
+                    zones.push_back(ZoneRecord{thread_index, add_site(zone.site_id), zone.depth, 0, zone.count,
+                                               zone.inclusive_duration, zone.exclusive_duration});
+                }
+            }
+
+            Header header = {};
+            std::memcpy(header.magic, magic, sizeof(magic));
+            header.version = version;
+            header.byte_order_mark = byte_order_mark;
+            header.flags = histograms ? has_histograms : 0;
+            header.bucket_count = LatencyHistogram::bucket_count;
+            header.start_time = to_nanoseconds(snapshot.get_start_time());
+            header.end_time = to_nanoseconds(snapshot.get_end_time());
+            header.process_id = snapshot.get_process_id();
+            header.role = add_string(snapshot.get_role());
+            header.tick_overhead = static_cast<std::uint32_t>(
+                std::min<std::int64_t>(snapshot.get_overhead(), std::numeric_limits<std::uint32_t>::max()));
+
+            std::uint64_t offset = sizeof(Header);
+            header.sites = place(offset, sites);
+            header.threads = place(offset, threads);
+            header.pairs = place(offset, pairs);
+            header.zones = place(offset, zones);
+            header.buckets = place(offset, buckets);
+            header.strings = place(offset, strings);
+            header.file_size = offset;
+
+            std::ofstream file(path.c_str(), std::ios::binary);
+            if (!file)
+                return false;
+
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            write_section(file, header.sites, sites);
+            write_section(file, header.threads, threads);
+            write_section(file, header.pairs, pairs);
+            write_section(file, header.zones, zones);
+            write_section(file, header.buckets, buckets);
+            write_section(file, header.strings, strings);
+            file.close();
+
+            return static_cast<bool>(file);
+        }
+
+    private:
+        /// Records the given error.
+        /// \return \c false.
+        bool fail(const std::string &error)
+        {
+            error_ = error;
+            return false;
+        }
+
+        /// Checks that the header matches this implementation and that all
+        /// records lie within the file and refer to existing entries.
+        bool validate()
+        {
+            if (size_ < sizeof(Header))
+                return fail("not a profile file");
+
+            const Header &header = get_header();
+            if (std::memcmp(header.magic, magic, sizeof(magic)) != 0)
+                return fail("not a profile file");
+            if (header.byte_order_mark != byte_order_mark)
+                return fail("profile file of another byte order");
+            if (header.version != version)
+                return fail("unsupported profile version " + std::to_string(header.version));
+            if ((header.flags & has_histograms) != 0 && header.bucket_count != LatencyHistogram::bucket_count)
+                return fail("histograms with another number of buckets");
+            if (header.file_size != size_)
+                return fail("truncated profile file");
+
+            if (!is_within(header.sites, sizeof(SiteRecord)) || !is_within(header.threads, sizeof(ThreadRecord)) ||
+                !is_within(header.pairs, sizeof(PairRecord)) || !is_within(header.zones, sizeof(ZoneRecord)) ||
+                !is_within(header.buckets, sizeof(std::uint64_t)) || !is_within(header.strings, 1))
+                return fail("section out of bounds");
+            if (header.strings.count > 0 && data_[header.strings.offset + header.strings.count - 1] != '\0')
+                return fail("unterminated string section");
+
+            auto is_string = [&](std::uint32_t offset)
+            { return offset < header.strings.count; };
+
+            if (!is_string(header.role))
+                return fail("invalid role");
+
+            const SiteRecord *sites = get_records<SiteRecord>(header.sites);
+            for (std::uint64_t i = 0; i < header.sites.count; i++)
+            {
+                if (!is_string(sites[i].file) || !is_string(sites[i].function) || !is_string(sites[i].name))
+                    return fail("invalid site");
+            }
+
+            const ThreadRecord *threads = get_records<ThreadRecord>(header.threads);
+            for (std::uint64_t i = 0; i < header.threads.count; i++)
+            {
+                if (!is_string(threads[i].thread_id))
+                    return fail("invalid thread");
+            }
+
+            const PairRecord *pairs = get_records<PairRecord>(header.pairs);
+            for (std::uint64_t i = 0; i < header.pairs.count; i++)
+            {
+                const PairRecord &pair = pairs[i];
+                if (pair.thread >= header.threads.count || pair.start_site >= header.sites.count ||
+                    pair.end_site >= header.sites.count ||
+                    pair.first_bucket + std::uint64_t(pair.bucket_count) > LatencyHistogram::bucket_count ||
+                    pair.bucket_offset + pair.bucket_count > header.buckets.count ||
+                    pair.counter_source > static_cast<std::uint32_t>(CounterSource::software))
+                    return fail("invalid pair");
+            }
+
+            const ZoneRecord *zones = get_records<ZoneRecord>(header.zones);
+            for (std::uint64_t i = 0; i < header.zones.count; i++)
+            {
+                if (zones[i].thread >= header.threads.count || zones[i].site >= header.sites.count ||
+                    zones[i].depth < 0)
+                    return fail("invalid zone");
+            }
+
+            return true;
+        }
+
+        /// Returns whether the given section of entries of the given size
+        /// is aligned and lies within the file.
+        bool is_within(const Section &section, std::size_t entry_size) const
+        {
+            return section.offset % 8 == 0 && section.offset <= size_ &&
+                   section.count <= (size_ - section.offset) / entry_size;
+        }
+
+        /// Places a section with the given entries at the given offset and
+        /// advances the offset to the next aligned position after it.
+        template <typename T>
+        static Section place(std::uint64_t &offset, const std::vector<T> &entries)
+        {
+            const Section section{offset, entries.size()};
+            offset = (offset + entries.size() * sizeof(T) + 7) / 8 * 8;
+            return section;
+        }
+
+        /// Writes the entries of a section followed by the padding to the
+        /// next aligned position.
+        template <typename T>
+        static void write_section(std::ofstream &file, const Section &section, const std::vector<T> &entries)
+        {
+            const std::size_t size = entries.size() * sizeof(T);
+            file.write(reinterpret_cast<const char *>(entries.data()), size);
+
+            const char padding[8] = {};
+            file.write(padding, (8 - (section.offset + size) % 8) % 8);
+        }
+
+        /// Converts a time point of the system clock to [ns] since its epoch.
+        static std::int64_t to_nanoseconds(std::chrono::system_clock::time_point time_point)
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(time_point.time_since_epoch()).count();
+        }
+
+        /// Converts [ns] since the epoch of the system clock to a time point.
+        static std::chrono::system_clock::time_point to_time_point(std::int64_t nanoseconds)
+        {
+            return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::nanoseconds(nanoseconds)));
+        }
+    };
+
+    /// Measurements recorded by a single thread.
+    /// Only the owning thread adds measurements, other threads may read them
+    /// while printing. Statistics are updated through relaxed atomics and new
+    /// pairs of checkpoints are inserted under a mutex that is only contended
+    /// by readers, so ticking a known pair never locks.
+    class ThreadProfile
+    {
+    private:
+        /// Index of the thread in the order the threads started profiling.
+        std::uint32_t index_;
+
+        /// Printable ID of the thread.
+        std::string thread_id_;
+
+        /// Most recent checkpoint, start of the next measurement.
+        Checkpoint last_checkpoint_;
+
+        /// Whether last_checkpoint_ holds a checkpoint that was hit.
+        bool has_last_checkpoint_;
+
+        /// Whether the segment that starts at last_checkpoint_ is timed.
+        bool last_checkpoint_timed_;
+
+#if TIME_PROFILER_COUNTERS
+        /// Performance counters of the thread.
+        PerfCounters counters_;
+
+        /// Values of the counters at last_checkpoint_.
+        CounterValues last_counters_;
+#endif
+
+#if TIME_PROFILER_CPU_TIME
+        /// CPU usage of the thread at last_checkpoint_.
+        CpuUsage last_cpu_usage_;
+#endif
+
+#if TIME_PROFILER_ALLOCATIONS
+        /// Heap allocations of the thread at last_checkpoint_.
+        AllocationUsage last_allocation_usage_;
+#endif
+
+        /// Tag the slowest segments are recorded with, see
+        /// PROFILER_EXEMPLAR_TAG().
+        std::uint64_t exemplar_tag_;
+
+        /// Breakdown of the profiling context that is active on this
+        /// thread, or \c nullptr if none is.
+        ContextBreakdown *context_;
+
+        /// Breakdown of the profiling context that was active when
+        /// last_checkpoint_ was hit. Only segments that start and end within
+        /// the same activation of a context are added to it.
+        ContextBreakdown *last_checkpoint_context_;
+
+        /// Version of the sampling policies cached in samplers_.
+        std::uint32_t sampling_version_;
+
+        /// Whether any site is sampled.
+        bool sampling_active_;
+
+        /// Samplers of the sites hit by this thread, by site ID. Only used
+        /// while sampling is active.
+        std::vector<SiteSampler> samplers_;
+
+        /// Statistics of the pairs of checkpoints hit by this thread.
+        PairTable pair_table_;
+
+        /// Call tree of the zones entered by this thread.
+        ZoneTree zone_tree_;
+
+        /// Zone entered on the stack of zones.
+        struct ZoneFrame
+        {
+            /// Node of the zone in the call tree.
+            std::uint32_t node;
+
+            /// Time the zone was entered.
+            /// Unit: ticks of the profiler's Clock.
+            std::int64_t time_point;
+        };
+
+        /// Zones that were entered but not exited yet, innermost last.
+        std::vector<ZoneFrame> zone_stack_;
+
+        /// Node of the innermost zone that was entered but not exited yet.
+        std::uint32_t current_zone_;
+
+        /// Guards insertions into pair_table_ and zone_tree_ against
+        /// concurrent readers.
+        mutable std::mutex mutex_;
+
+        /// Whether the thread is still running.
+        std::atomic<bool> running_;
+
+        /// Ring the checkpoints are traced into, or \c nullptr if tracing is
+        /// off. Set by the thread that starts or stops tracing.
+        std::atomic<TraceRing *> trace_ring_;
+
+        /// Storage of the trace ring. Allocated when tracing starts for the
+        /// first time and kept until the profile is destroyed, so that the
+        /// owning thread may still push to it while tracing stops.
+        std::unique_ptr<TraceRing> trace_ring_storage_;
+
+        /// Refreshes the cached sampling policies after they changed.
+        void update_sampling()
+        {
+            sampling_version_ = SamplingConfig::get_version();
+            sampling_active_ = SamplingConfig::is_active();
+            samplers_.clear();
+        }
+
+        /// Returns the sampler of the site with the given ID.
+        SiteSampler &get_sampler(std::uint32_t site_id)
+        {
+            if (site_id >= samplers_.size())
+            {
+                const std::size_t first_site_id = samplers_.size();
+                samplers_.resize(site_id + 1);
+                for (std::size_t id = first_site_id; id <= site_id; id++)
+                    samplers_[id] = SiteSampler(SamplingConfig::get_policy(static_cast<std::uint32_t>(id)));
+            }
+
+            return samplers_[site_id];
+        }
+
+        /// Returns a consistent copy of every measurement.
+        /// Must be called with mutex_ locked.
+        std::vector<MultiMeasurement> copy_measurements() const
+        {
+            std::vector<MultiMeasurement> measurements;
+            measurements.reserve(pair_table_.get_measurements().size());
+            for (const MultiMeasurement &measurement : pair_table_.get_measurements())
+                measurements.push_back(measurement.get_copy());
+
+            return measurements;
+        }
+
+    public:
+        /// Constructor.
+        /// Must be called from the thread that will own the profile.
+        explicit ThreadProfile(std::uint32_t index)
+            : index_(index),
+              has_last_checkpoint_(false),
+              last_checkpoint_timed_(false),
+#if TIME_PROFILER_COUNTERS
+              last_counters_(),
+#endif
+#if TIME_PROFILER_CPU_TIME
+              last_cpu_usage_(),
+#endif
+#if TIME_PROFILER_ALLOCATIONS
+              last_allocation_usage_(),
+#endif
+              exemplar_tag_(0),
+              context_(nullptr),
+              last_checkpoint_context_(nullptr),
+              sampling_version_(0),
+              sampling_active_(false),
+              current_zone_(ZoneTree::root),
+              running_(true),
+              trace_ring_(nullptr)
+        {
+            std::stringstream stream;
+            stream << std::this_thread::get_id();
+            thread_id_ = stream.str();
+
+            zone_stack_.reserve(64);
+        }
+
+        /// Enters the zone opened at the site with the given ID, nested in
+        /// the current zone.
+        void enter_zone(std::uint32_t site_id)
+        {
+            std::uint32_t node = zone_tree_.find_child(current_zone_, site_id);
+            if (node == ZoneTree::no_node)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                node = zone_tree_.add_child(current_zone_, site_id);
+            }
+
+            current_zone_ = node;
+            zone_stack_.push_back(ZoneFrame{node, Clock::now()});
+        }
+
+        /// Exits the current zone and adds the time since it was entered.
+        void exit_zone()
+        {
+            const std::int64_t time_point = Clock::now();
+            if (zone_stack_.empty())
+                return;
+
+            const ZoneFrame frame = zone_stack_.back();
+            zone_stack_.pop_back();
+
+            zone_tree_.add(frame.node, Clock::to_nanoseconds(time_point - frame.time_point));
+            current_zone_ = zone_tree_.get_parent(frame.node);
+        }
+
+        /// Adds a checkpoint at the site with the given ID and measures the
+        /// time since the previous checkpoint of this thread.
+        /// While sampling is active, every hit is counted, but the clock is
+        /// only read if the segment that ends here or the one that starts
+        /// here is timed, or if tracing is on.
+        void tick(std::uint32_t site_id)
+        {
+            if (sampling_version_ != SamplingConfig::get_version())
+                update_sampling();
+
+            TraceRing *trace_ring = trace_ring_.load(std::memory_order_acquire);
+            SiteSampler *sampler = sampling_active_ ? &get_sampler(site_id) : nullptr;
+
+            const bool needs_time = sampler == nullptr || last_checkpoint_timed_ ||
+                                    trace_ring != nullptr || sampler->needs_time();
+            const Checkpoint checkpoint(site_id, needs_time ? Clock::now() : 0);
+#if TIME_PROFILER_COUNTERS
+            CounterValues counters = last_counters_;
+            if (needs_time && counters_.get_source() != CounterSource::none)
+                counters_.read(counters);
+#endif
+#if TIME_PROFILER_CPU_TIME
+            const CpuUsage cpu_usage = needs_time ? CpuUsage::now() : last_cpu_usage_;
+#endif
+#if TIME_PROFILER_ALLOCATIONS
+            const AllocationUsage allocation_usage = AllocationCounter::now();
+#endif
+
+            if (trace_ring != nullptr)
+                trace_ring->push(checkpoint.get_time_point(), site_id);
+
+            if (has_last_checkpoint_)
+            {
+                SingleMeasurement measurement(last_checkpoint_, checkpoint);
+
+                MultiMeasurement *statistics = pair_table_.find(measurement.get_key());
+                if (statistics == nullptr)
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    statistics = &pair_table_.insert(last_checkpoint_.get_site_id(), site_id);
+                }
+
+                statistics->begin_update();
+                if (last_checkpoint_timed_)
+                {
+                    statistics->add(measurement);
+                    if (context_ != nullptr && context_ == last_checkpoint_context_)
+                        context_->add(last_checkpoint_.get_site_id(), site_id, measurement.get_duration().count());
+#if TIME_PROFILER_EXEMPLARS > 0
+                    statistics->add_exemplar(measurement.get_duration().count(), index_, exemplar_tag_);
+#endif
+#if TIME_PROFILER_COUNTERS
+                    if (counters_.get_source() != CounterSource::none)
+                    {
+                        CounterValues differences;
+                        for (int i = 0; i < counter_count; i++)
+                            differences[i] = counters[i] - last_counters_[i];
+                        statistics->add_counters(counters_.get_source(), differences);
+                    }
+#endif
+#if TIME_PROFILER_CPU_TIME
+                    statistics->add_cpu_usage(cpu_usage - last_cpu_usage_);
+#endif
+#if TIME_PROFILER_ALLOCATIONS
+                    statistics->add_allocations(allocation_usage - last_allocation_usage_);
+#endif
+                }
+                else
+                {
+                    statistics->add_untimed();
+                }
+                statistics->end_update();
+            }
+
+#if TIME_PROFILER_COUNTERS
+            last_counters_ = counters;
+#endif
+#if TIME_PROFILER_CPU_TIME
+            last_cpu_usage_ = cpu_usage;
+#endif
+#if TIME_PROFILER_ALLOCATIONS
+            last_allocation_usage_ = allocation_usage;
+#endif
+            last_checkpoint_ = checkpoint;
+            last_checkpoint_context_ = context_;
+            last_checkpoint_timed_ = sampler == nullptr || sampler->sample(checkpoint.get_time_point());
+            has_last_checkpoint_ = true;
+        }
+
+        /// Starts tracing the checkpoints of this thread.
+        /// The ring is allocated on the first call; later calls start a new
+        /// session of it and ignore the given options.
+        /// Must be called with the profiler's mutex locked.
+        /// \return The ring the checkpoints are traced into.
+        TraceRing *start_tracing(const TraceOptions &options)
+        {
+            if (!trace_ring_storage_)
+                trace_ring_storage_.reset(new TraceRing(options.ring_capacity, options.ring_full_policy, index_));
+            trace_ring_storage_->start_session();
+
+            trace_ring_.store(trace_ring_storage_.get(), std::memory_order_release);
+            return trace_ring_storage_.get();
+        }
+
+        /// Stops tracing the checkpoints of this thread.
+        void stop_tracing()
+        {
+            trace_ring_.store(nullptr, std::memory_order_release);
+        }
+
+        /// Marks the thread as exited. Its measurements are kept.
+        void finish()
+        {
+            running_ = false;
+        }
+
+        /// Returns whether the thread is still running.
+        bool is_running() const
+        {
+            return running_;
+        }
+
+        /// Sets the tag the slowest segments of this thread are recorded
+        /// with, 0 for none.
+        void set_exemplar_tag(std::uint64_t tag)
+        {
+            exemplar_tag_ = tag;
+        }
+
+        /// Returns the tag the slowest segments of this thread are recorded
+        /// with.
+        std::uint64_t get_exemplar_tag() const
+        {
+            return exemplar_tag_;
+        }
+
+        /// Activates the breakdown of the given profiling context on this
+        /// thread, or deactivates the active one if it is \c nullptr.
+        /// \return The breakdown that was active before.
+        ContextBreakdown *set_context(ContextBreakdown *context)
+        {
+            // The segment from the last checkpoint belongs to no context,
+            // even if a context at the same address was active then.
+            ContextBreakdown *previous = context_;
+            context_ = context;
+            last_checkpoint_context_ = nullptr;
+            return previous;
+        }
+
+        /// Returns the index of the thread in the order the threads started
+        /// profiling.
+        std::uint32_t get_index() const
+        {
+            return index_;
+        }
+
+        /// Returns the printable ID of the thread.
+        const std::string &get_thread_id() const
+        {
+            return thread_id_;
+        }
+
+        /// Returns the statistics of the call tree of zones in depth-first
+        /// order. May be called from any thread.
+        std::vector<ZoneStatistics> get_zones() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return zone_tree_.flatten();
+        }
+
+        /// Returns a copy of the measurements collected so far.
+        /// May be called from any thread.
+        std::vector<MultiMeasurement> get_measurements() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return copy_measurements();
+        }
+
+        /// Returns a copy of the measurements and zones collected so far.
+        /// The measurements are in the order their pairs were first hit.
+        /// Each one is copied consistently, see MultiMeasurement::get_copy(),
+        /// but different ones may be copied at slightly different times.
+        /// Every copy holds a histogram of about 5 KB, of which only the
+        /// buckets in use are copied.
+        /// May be called from any thread. Only blocks the owning thread if
+        /// it hits a new pair or zone meanwhile.
+        ThreadSnapshot get_snapshot() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return ThreadSnapshot{index_, thread_id_, is_running(), copy_measurements(), zone_tree_.flatten(), 0};
+        }
+
+        /// Forgets the most recent checkpoint, so that the next checkpoint
+        /// starts a new segment instead of ending one. Called when the code
+        /// running on the thread switches to another task, e.g. when a
+        /// coroutine suspends or resumes.
+        void forget_checkpoint()
+        {
+            has_last_checkpoint_ = false;
+            last_checkpoint_timed_ = false;
+        }
+
+        /// Makes the calling thread the owner of the profile, whose
+        /// performance counters are reopened for it. Must not be called
+        /// while another thread records into the profile.
+        void adopt_calling_thread()
+        {
+            forget_checkpoint();
+#if TIME_PROFILER_COUNTERS
+            counters_.reopen();
+            last_counters_ = CounterValues();
+#endif
+        }
+
+        /// Locks the profile while the process forks, so that the child
+        /// does not inherit it locked.
+        void lock() const
+        {
+            mutex_.lock();
+        }
+
+        /// Unlocks the profile after a fork.
+        void unlock() const
+        {
+            mutex_.unlock();
+        }
+
+        /// Drops everything recorded before the process forked, so that the
+        /// child starts with an empty profile and no segment spans the fork.
+        /// Called in the child, whose only thread is the one that owns the
+        /// profile.
+        void reset_after_fork()
+        {
+            index_ = 0;
+            has_last_checkpoint_ = false;
+            last_checkpoint_timed_ = false;
+#if TIME_PROFILER_COUNTERS
+            counters_.reopen();
+            last_counters_ = CounterValues();
+#endif
+            sampling_version_ = 0;
+            sampling_active_ = false;
+            samplers_.clear();
+            pair_table_.clear();
+            zone_tree_ = ZoneTree();
+            zone_stack_.clear();
+            current_zone_ = ZoneTree::root;
+            trace_ring_.store(nullptr, std::memory_order_release);
+        }
+    };
+
+    /// Overhead of the profiler per segment: the time a segment measures
+    /// even if nothing happens between its checkpoints, i.e. the part of a
+    /// checkpoint after reading the clock plus the part of the next one
+    /// before reading it.
+    /// Estimated by a calibration loop of empty segments through the public
+    /// tick path of PROFILER_HOOK(), i.e. the thread-local lookup, the
+    /// AllocationSuppressor and ThreadProfile::tick(), on a private
+    /// ThreadProfile, so it includes the configured counters, CPU time and
+    /// allocation counting. The median of the loop is used, which is robust
+    /// to interrupts and rather low than high, since the caches are warm.
+    /// The cost changes with the CPU frequency and the load, so it is
+    /// recalibrated when statistics are captured after
+    /// recalibration_interval.
+    class TickOverhead
+    {
+    private:
+        /// Most recent estimate.
+        /// Unit: [ns].
+        std::atomic<std::int64_t> overhead_;
+
+        /// Time of the most recent calibration, or 0 before the first one.
+        /// Unit: ticks of the profiler's Clock.
+        std::atomic<std::int64_t> calibration_time_;
+
+        /// Whether the reports subtract the overhead from the durations.
+        std::atomic<bool> compensated_;
+
+        /// Serializes the calibrations.
+        std::mutex mutex_;
+
+        /// Number of empty segments per calibration.
+        static const int calibration_ticks = 10000;
+
+        /// Default constructor.
+        /// Inaccessible from outside the class.
+        TickOverhead()
+            : overhead_(0),
+              calibration_time_(0),
+              compensated_(true)
+        {
+        }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        TickOverhead(const TickOverhead &overhead);
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        TickOverhead &operator=(const TickOverhead &overhead);
+
+        /// Runs the calibration loop and returns the median duration of an
+        /// empty segment. Defined after TimeProfiler, whose tick path it
+        /// times.
+        /// Must be called with mutex_ locked.
+        /// Unit: [ns].
+        static std::int64_t measure();
+
+    public:
+        /// Interval after which capturing statistics recalibrates.
+        static constexpr std::chrono::seconds recalibration_interval{10};
+
+        /// Returns the singleton instance.
+        static TickOverhead &get_instance()
+        {
+            static TickOverhead overhead;
+            return overhead;
+        }
+
+        /// Measures the overhead, blocking concurrent calibrations.
+        /// \return The new estimate.
+        /// Unit: [ns].
+        static std::int64_t calibrate()
+        {
+            TickOverhead &instance = get_instance();
+            std::lock_guard<std::mutex> lock(instance.mutex_);
+            const std::int64_t overhead = measure();
+            instance.overhead_.store(overhead);
+            instance.calibration_time_.store(Clock::now());
+            return overhead;
+        }
+
+        /// Recalibrates if the last calibration is older than
+        /// recalibration_interval.
+        static void calibrate_if_due()
+        {
+            const std::int64_t calibration_time = get_instance().calibration_time_.load();
+            if (calibration_time == 0 ||
+                Clock::to_nanoseconds(Clock::now() - calibration_time) >=
+                    std::chrono::nanoseconds(recalibration_interval).count())
+                calibrate();
+        }
+
+        /// Returns the most recent estimate, or 0 before the first
+        /// calibration.
+        /// Unit: [ns].
+        static std::int64_t get()
+        {
+            return get_instance().overhead_.load();
+        }
+
+        /// Sets whether the reports subtract the overhead from the
+        /// durations.
+        static void set_compensated(bool compensated)
+        {
+            get_instance().compensated_.store(compensated);
+        }
+
+        /// Returns whether the reports subtract the overhead from the
+        /// durations.
+        static bool is_compensated()
+        {
+            return get_instance().compensated_.load();
+        }
+
+        /// Locks the calibration while the process forks, so that the child
+        /// does not inherit it locked.
+        static void lock()
+        {
+            get_instance().mutex_.lock();
+        }
+
+        /// Unlocks the calibration after a fork.
+        static void unlock()
+        {
+            get_instance().mutex_.unlock();
+        }
+    };
+
+    /// Simple CPU execution time profiler.
+    ///
+    /// Measurement points are added by inserting \c PROFILER_HOOK() in the code.
+    /// The profiler prints its statistics on the console when being destroyed.
+    /// The statistics can also be printed by calling TimeProfiler::print_statistics().
+    ///
+    /// \note Profiling is enabled by default. It can be globally disabled
+    /// by simply adding
+    /// \code
+    /// #define USE_PROFILER 0
+    /// \endcode
+    /// to the source file before including \c TimeProfiler.h.
+    /// \code
+    /// #define USE_PROFILER 1
+    /// \endcode enables profiling again.
+    ///
+    /// \note This class is thread-safe. Every thread records its checkpoints
+    /// into its own ThreadProfile without locking. The statistics merge all
+    /// threads, including those that already exited.
+    class TimeProfiler
+    {
+    private:
+        /// Profiles of all threads that hit a checkpoint, in the order of
+        /// their first checkpoint.
+        std::vector<std::shared_ptr<ThreadProfile>> thread_profiles_;
+
+        /// Guards thread_profiles_, tracer_, reporter_, exporter_ and
+        /// report_options_.
+        mutable std::mutex mutex_;
+
+        /// Times the tick path with the cached profile of the calling thread
+        /// replaced.
+        friend class TickOverhead;
+
+        /// Selection and format of the pairs in the reports that
+        /// print_statistics() and save_log() create.
+        ReportOptions report_options_;
+
+        /// Drains the trace rings while tracing, \c nullptr otherwise.
+        std::unique_ptr<Tracer> tracer_;
+
+        /// Reports the statistics in an interval while reporting, \c nullptr
+        /// otherwise. Guarded by mutex_.
+        std::unique_ptr<Reporter> reporter_;
+
+#if defined(__unix__) || defined(__APPLE__)
+        /// Publishes the statistics into shared memory while exporting,
+        /// \c nullptr otherwise. Guarded by mutex_.
+        std::unique_ptr<StatsExporter> exporter_;
+#endif
+
+        /// Time the profiler started.
+        std::chrono::system_clock::time_point start_time_;
+
+        /// Snapshot taken at the last reset. The statistics that are printed
+        /// cover the time since then.
+        Snapshot baseline_;
+
+        /// Guards baseline_. Held while a snapshot is captured, so that
+        /// resets are atomic.
+        std::mutex baseline_mutex_;
+
+        /// Keeps the profile of a thread alive and marks it as finished
+        /// when the thread exits.
+        class ThreadProfileHandle
+        {
+        private:
+            std::shared_ptr<ThreadProfile> profile_;
+
+        public:
+            explicit ThreadProfileHandle(const std::shared_ptr<ThreadProfile> &profile)
+                : profile_(profile)
+            {
+            }
+
+            ~ThreadProfileHandle()
+            {
+                profile_->finish();
+            }
+
+            ThreadProfile &get() const
+            {
+                return *profile_;
+            }
+        };
+
+    private:
+        /// Default constructor.
+        /// Inaccessible from outside the class.
+        /// Makes sure the site registry outlives the profiler, so that the
+        /// statistics printed on destruction can resolve the site names.
+        TimeProfiler()
+            : start_time_(std::chrono::system_clock::now()),
+              baseline_(start_time_, start_time_)
+        {
+            SiteRegistry::get_instance();
+            LabelRegistry::get_instance();
+            SamplingConfig::get_instance();
+            CategoryConfig::get_instance();
+            ProcessRole::get_instance();
+            TaskTable::get_instance();
+            BenchTable::get_instance();
+            ContextRegistry::get_instance();
+            TickOverhead::get_instance();
+#if TIME_PROFILER_CLOCK == TIME_PROFILER_TSC_CLOCK
+            TscClock::calibrate();
+#endif
+#if USE_PROFILER
+            TickOverhead::calibrate();
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+            static std::once_flag fork_handlers;
+            std::call_once(fork_handlers, []()
+                           { ::pthread_atfork(&TimeProfiler::prepare_fork, &TimeProfiler::parent_after_fork,
+                                              &TimeProfiler::child_after_fork); });
+#endif
+            is_alive().store(true);
+        }
+
+        /// Destructor.
+        /// Computes and prints the collected statistics and saves them to a
+        /// log file in \c $HOME/.TimeProfiler/log and a profile file in
+        /// \c $HOME/.TimeProfiler/profile.
+        ~TimeProfiler()
+        {
+            is_alive().store(false);
+            stop_export();
+            stop_reporter();
+            stop_tracing();
+
+            // All reports share one snapshot, so that the statistics are
+            // only copied once.
+#if USE_PROFILER
+            const Snapshot snapshot = take_snapshot();
+            print_statistics(snapshot);
+            save_log(snapshot);
+            save_profile(snapshot);
+#endif
+        }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        TimeProfiler(const TimeProfiler &TimeProfiler);
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        TimeProfiler &operator=(const TimeProfiler &TimeProfiler);
+
+        /// Returns the singleton instance of the profiler.
+        static TimeProfiler &get_instance()
+        {
+            // Create the single instance of this class.
+            static TimeProfiler TimeProfiler;
+            return TimeProfiler;
+        }
+
+        /// Returns the profile of the calling thread.
+        /// The profile is created on the first call of each thread.
+        static ThreadProfile &get_thread_profile()
+        {
+            ThreadProfile *&profile = get_cached_thread_profile();
+            if (profile == nullptr)
+                profile = &register_thread();
+
+            return *profile;
+        }
+
+        /// Returns the cached profile of the calling thread, \c nullptr
+        /// before its first checkpoint.
+        static ThreadProfile *&get_cached_thread_profile()
+        {
+            thread_local ThreadProfile *profile = nullptr;
+            return profile;
+        }
+
+        /// Creates the profile of the calling thread and adds it to the
+        /// profiler.
+        static ThreadProfile &register_thread()
+        {
+            thread_local ThreadProfileHandle handle(get_instance().add_thread_profile());
+            return handle.get();
+        }
+
+        /// Creates a new thread profile and adds it to the list of profiles.
+        std::shared_ptr<ThreadProfile> add_thread_profile()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            thread_profiles_.push_back(std::make_shared<ThreadProfile>(
+                static_cast<std::uint32_t>(thread_profiles_.size())));
+
+            if (tracer_)
+                tracer_->add_ring(thread_profiles_.back()->start_tracing(tracer_->get_options()));
+
+            return thread_profiles_.back();
+        }
+
+        /// Returns a copy of the list of thread profiles.
+        static std::vector<std::shared_ptr<ThreadProfile>> get_thread_profiles()
+        {
+            TimeProfiler &profiler = get_instance();
+            std::lock_guard<std::mutex> lock(profiler.mutex_);
+            return profiler.thread_profiles_;
+        }
+
+        /// Returns whether the given site matches the file and function
+        /// filters of the given options. The function filter also matches
+        /// the labels of named checkpoints.
+        static bool matches_filters(const Site &site, const ReportOptions &options)
+        {
+            return (options.file_filter.empty() || site.file.find(options.file_filter) != std::string::npos) &&
+                   (options.function_filter.empty() || site.function.find(options.function_filter) != std::string::npos ||
+                    site.name.find(options.function_filter) != std::string::npos);
+        }
+
+        /// Returns the given measurements that the given options select,
+        /// sorted with respect to the overall execution time in descending
+        /// order. Their percentages refer to the overall execution time of
+        /// all given measurements. The given overhead of the profiler per
+        /// segment is excluded from all durations.
+        /// The measurements are large, so they are selected and sorted by
+        /// reference and only the selected ones are copied. With a limit on
+        /// the number of measurements, only as many are sorted.
+        template <typename Measurements>
+        static std::vector<MultiMeasurement> select_measurements(const Measurements &measurements,
+                                                                 const ReportOptions &options,
+                                                                 std::int64_t overhead = 0)
+        {
+            // The overhead is subtracted from every hit that was extrapolated
+            // into the overall duration.
+            const auto get_duration = [overhead](const MultiMeasurement &measurement)
+            {
+                return std::max<std::int64_t>(
+                    0, measurement.get_overall_duration().count() - overhead * measurement.count());
+            };
+
+            std::int64_t total_duration = 0;
+            for (const MultiMeasurement &measurement : measurements)
+                total_duration += get_duration(measurement);
+            const double total_nanoseconds = static_cast<double>(total_duration);
+            const auto get_share = [total_nanoseconds, &get_duration](const MultiMeasurement &measurement)
+            {
+                return total_nanoseconds > 0.0 ? get_duration(measurement) / total_nanoseconds : 0.0;
+            };
+
+            const bool filtered = !options.file_filter.empty() || !options.function_filter.empty();
+            std::vector<const MultiMeasurement *> selection;
+            selection.reserve(measurements.size());
+            for (const MultiMeasurement &measurement : measurements)
+            {
+                if (get_share(measurement) * 100 < options.min_percent)
+                    continue;
+                if (filtered && !matches_filters(SiteRegistry::get_site(measurement.get_start_site_id()), options) &&
+                    !matches_filters(SiteRegistry::get_site(measurement.get_end_site_id()), options))
+                    continue;
+
+                selection.push_back(&measurement);
+            }
+
+            // Sort the measurements based on their overall execution times,
+            // starting with the largest value.
+            const auto longer = [&get_duration](const MultiMeasurement *lhs, const MultiMeasurement *rhs)
+            { return get_duration(*rhs) < get_duration(*lhs); };
+            if (options.top_n > 0 && options.top_n < selection.size())
+            {
+                std::partial_sort(selection.begin(), selection.begin() + options.top_n, selection.end(), longer);
+                selection.resize(options.top_n);
+            }
+            else
+            {
+                std::stable_sort(selection.begin(), selection.end(), longer);
+            }
+
+            std::vector<MultiMeasurement> selected;
+            selected.reserve(selection.size());
+            for (const MultiMeasurement *measurement : selection)
+            {
+                selected.push_back(*measurement);
+                selected.back().set_percent(get_share(*measurement));
+                selected.back().set_overhead(overhead);
+            }
+
+            return selected;
+        }
+
+        /// Merges the measurements of the given threads pair by pair.
+        static std::vector<MultiMeasurement> merge_measurements(
+            const std::vector<std::vector<MultiMeasurement>> &thread_measurements)
+        {
+            PairTable merged_table;
+            for (const auto &measurements : thread_measurements)
+            {
+                for (const auto &measurement : measurements)
+                {
+                    merged_table.find_or_insert(measurement.get_start_site_id(), measurement.get_end_site_id())
+                        .merge(measurement);
+                }
+            }
+
+            return std::vector<MultiMeasurement>(merged_table.get_measurements().begin(),
+                                                 merged_table.get_measurements().end());
+        }
+
+        /// Captures the statistics of all threads since the profiler started.
+        static Snapshot capture()
+        {
+            const AllocationSuppressor suppressor;
+            Snapshot snapshot(get_instance().start_time_, std::chrono::system_clock::now());
+            snapshot.set_process(get_process_id(), ProcessRole::get());
+            for (const auto &thread_profile : get_thread_profiles())
+                snapshot.add_thread(thread_profile->get_snapshot());
+            snapshot.set_tasks(TaskTable::get_statistics());
+            snapshot.set_benches(BenchTable::get_statistics());
+            snapshot.set_contexts(ContextRegistry::get_statistics());
+            if (TickOverhead::is_compensated())
+            {
+                TickOverhead::calibrate_if_due();
+                snapshot.set_overhead(TickOverhead::get());
+            }
+
+            return snapshot;
+        }
+
+        /// Returns whether the profiler exists. The fork handlers cannot be
+        /// unregistered, so they do nothing once it was destroyed.
+        static std::atomic<bool> &is_alive()
+        {
+            static std::atomic<bool> alive(false);
+            return alive;
+        }
+
+#if defined(__unix__) || defined(__APPLE__)
+        /// Locks everything a child process needs before the process forks,
+        /// so that the child does not inherit a mutex that another thread
+        /// held at the time of the fork.
+        static void prepare_fork()
+        {
+            if (!is_alive().load())
+                return;
+
+            TimeProfiler &profiler = get_instance();
+            TickOverhead::lock();
+            CategoryConfig::lock();
+            SamplingConfig::lock();
+            profiler.baseline_mutex_.lock();
+            profiler.mutex_.lock();
+            for (const auto &thread_profile : profiler.thread_profiles_)
+                thread_profile->lock();
+            LabelRegistry::lock();
+            SiteRegistry::lock();
+            TaskTable::lock();
+            BenchTable::lock();
+            ContextRegistry::lock();
+            ProcessRole::lock();
+        }
+
+        /// Unlocks everything locked by prepare_fork() in the parent.
+        static void parent_after_fork()
+        {
+            if (!is_alive().load())
+                return;
+
+            TimeProfiler &profiler = get_instance();
+            ProcessRole::unlock(false);
+            ContextRegistry::unlock(false);
+            BenchTable::unlock(false);
+            TaskTable::unlock(false);
+            SiteRegistry::unlock();
+            LabelRegistry::unlock();
+            for (const auto &thread_profile : profiler.thread_profiles_)
+                thread_profile->unlock();
+            profiler.mutex_.unlock();
+            profiler.baseline_mutex_.unlock();
+            SamplingConfig::unlock();
+            CategoryConfig::unlock();
+            TickOverhead::unlock();
+        }
+
+        /// Unlocks everything locked by prepare_fork() in the child and
+        /// starts its statistics from scratch. The child takes the child
+        /// role and keeps only the profile of the forking thread, its only
+        /// thread, reset so that no segment spans the fork. The background
+        /// threads of the parent do not exist in the child; their state is
+        /// abandoned rather than destroyed, so that the child neither joins
+        /// them nor removes the parent's shared-memory segment.
+        static void child_after_fork()
+        {
+            if (!is_alive().load())
+                return;
+
+            TimeProfiler &profiler = get_instance();
+            ThreadProfile *own_profile = get_cached_thread_profile();
+            std::vector<std::shared_ptr<ThreadProfile>> thread_profiles;
+            for (const auto &thread_profile : profiler.thread_profiles_)
+            {
+                thread_profile->unlock();
+                if (thread_profile.get() == own_profile)
+                {
+                    own_profile->reset_after_fork();
+                    thread_profiles.push_back(thread_profile);
+                }
+            }
+            profiler.thread_profiles_.swap(thread_profiles);
+
+            profiler.tracer_.release();
+            profiler.reporter_.release();
+            profiler.exporter_.release();
+            profiler.start_time_ = std::chrono::system_clock::now();
+            profiler.baseline_ = Snapshot(profiler.start_time_, profiler.start_time_);
+
+            ProcessRole::unlock(true);
+            ContextRegistry::unlock(true);
+            BenchTable::unlock(true);
+            TaskTable::unlock(true);
+            SiteRegistry::unlock();
+            LabelRegistry::unlock();
+            profiler.mutex_.unlock();
+            profiler.baseline_mutex_.unlock();
+            SamplingConfig::unlock();
+            CategoryConfig::unlock();
+            TickOverhead::unlock();
+        }
+#endif
+
+        /// Captures the statistics since the profiler started, merged over
+        /// all threads, with the overhead of the profiler set on them if the
+        /// reports compensate it.
+        static std::vector<MultiMeasurement> capture_merged()
+        {
+            std::vector<std::vector<MultiMeasurement>> thread_measurements;
+            for (const auto &thread_profile : get_thread_profiles())
+                thread_measurements.push_back(thread_profile->get_snapshot().measurements);
+
+            std::vector<MultiMeasurement> measurements = merge_measurements(thread_measurements);
+            if (TickOverhead::is_compensated())
+            {
+                TickOverhead::calibrate_if_due();
+                for (MultiMeasurement &measurement : measurements)
+                    measurement.set_overhead(TickOverhead::get());
+            }
+
+            return measurements;
+        }
+
+    public:
+        /// Creates one printer per thread that recorded measurements in the
+        /// given snapshot and one printer for all threads combined.
+        /// If only a single thread recorded measurements, only one untitled
+        /// printer is returned.
+        /// The given options select the measurements of every printer.
+        static std::vector<Printer> create_printers(const Snapshot &snapshot,
+                                                    const ReportOptions &options = ReportOptions())
+        {
+            std::vector<const ThreadSnapshot *> threads;
+            for (const ThreadSnapshot &thread : snapshot.get_threads())
+            {
+                if (!thread.measurements.empty() || !thread.zones.empty())
+                    threads.push_back(&thread);
+            }
+
+            std::vector<Printer> printers;
+            printers.reserve(threads.size() + 1);
+            PairTable combined_table;
+            ZoneTree combined_zones;
+            for (const ThreadSnapshot *thread : threads)
+            {
+                std::stringstream title;
+                title << "Thread " << thread->index;
+                if (thread->process_id != snapshot.get_process_id())
+                    title << " of process " << thread->process_id;
+                title << " (ID " << thread->thread_id
+                      << (thread->running ? "" : ", exited") << ")";
+
+                Printer printer;
+                printer.set_title(title.str());
+                printer.add(select_measurements(thread->measurements, options, snapshot.get_overhead()));
+                printer.add(thread->zones);
+                printers.push_back(std::move(printer));
+
+                // A single thread is its own combination.
+                if (threads.size() <= 1)
+                    break;
+
+                for (const MultiMeasurement &measurement : thread->measurements)
+                {
+                    combined_table.find_or_insert(measurement.get_start_site_id(), measurement.get_end_site_id())
+                        .merge(measurement);
+                }
+                combined_zones.merge(thread->zones);
+            }
+
+            // Tasks, benchmarks and contexts are not bound to a thread, so
+            // they are only part of the combination.
+            if (threads.size() == 1)
+            {
+                printers.front().set_title(std::string());
+                printers.front().add(snapshot.get_tasks());
+                printers.front().add(snapshot.get_benches());
+                printers.front().add(snapshot.get_contexts(), snapshot.get_overhead());
+                return printers;
+            }
+
+            Printer combined_printer;
+            combined_printer.add(select_measurements(combined_table.get_measurements(), options,
+                                                     snapshot.get_overhead()));
+            combined_printer.add(combined_zones.flatten());
+            combined_printer.add(snapshot.get_tasks());
+            combined_printer.add(snapshot.get_benches());
+            combined_printer.add(snapshot.get_contexts(), snapshot.get_overhead());
+            if (threads.empty())
+                return std::vector<Printer>(1, combined_printer);
+
+            combined_printer.set_title("All threads");
+            printers.push_back(std::move(combined_printer));
+
+            return printers;
+        }
+
+        /// Adds a measurement at the site with the given ID.
+        /// Only the site ID and the time stamp are stored; names are looked
+        /// up when the statistics are printed.
+        static void tick(std::uint32_t site_id)
+        {
+#if USE_PROFILER
+            const AllocationSuppressor suppressor;
+            get_thread_profile().tick(site_id);
+#endif
+        }
+
+        /// Sets the tag, e.g. a request ID, that the slowest segments of the
+        /// calling thread are recorded with, 0 for none. Prefer
+        /// PROFILER_EXEMPLAR_TAG().
+        static void set_exemplar_tag(std::uint64_t tag)
+        {
+#if USE_PROFILER
+            const AllocationSuppressor suppressor;
+            get_thread_profile().set_exemplar_tag(tag);
+#else
+            (void)tag;
+#endif
+        }
+
+        /// Returns the tag the slowest segments of the calling thread are
+        /// recorded with.
+        static std::uint64_t get_exemplar_tag()
+        {
+#if USE_PROFILER
+            const AllocationSuppressor suppressor;
+            return get_thread_profile().get_exemplar_tag();
+#else
+            return 0;
+#endif
+        }
+
+        /// Activates the breakdown of a profiling context on the calling
+        /// thread, or deactivates the active one if it is \c nullptr.
+        /// Prefer ProfilingContext.
+        /// \return The breakdown that was active before.
+        static ContextBreakdown *set_context(ContextBreakdown *context)
+        {
+#if USE_PROFILER
+            const AllocationSuppressor suppressor;
+            return get_thread_profile().set_context(context);
+#else
+            (void)context;
+            return nullptr;
+#endif
+        }
+
+        /// Keeps the contexts of the type with the given name that take at
+        /// least the given duration from now on, all of them if it is 0.
+        /// \return \c false if no such type is registered.
+        static bool set_context_threshold(const std::string &name, std::chrono::nanoseconds threshold)
+        {
+#if USE_PROFILER
+            return ContextRegistry::set_threshold(name, threshold);
+#else
+            (void)name;
+            (void)threshold;
+            return false;
+#endif
+        }
+
+        /// Forgets the most recent checkpoint of the calling thread, so that
+        /// no pair of checkpoints spans a switch to another task. See
+        /// TaskSpan.
+        static void forget_checkpoint()
+        {
+#if USE_PROFILER
+            const AllocationSuppressor suppressor;
+            get_thread_profile().forget_checkpoint();
+#endif
+        }
+
+        /// Enters the zone opened at the site with the given ID.
+        /// Zones entered while another zone is open are nested in it.
+        /// Prefer PROFILER_SCOPE().
+        static void enter_zone(std::uint32_t site_id)
+        {
+#if USE_PROFILER
+            const AllocationSuppressor suppressor;
+            get_thread_profile().enter_zone(site_id);
+#endif
+        }
+
+        /// Exits the zone entered last by the calling thread.
+        static void exit_zone()
+        {
+#if USE_PROFILER
+            const AllocationSuppressor suppressor;
+            get_thread_profile().exit_zone();
+#endif
+        }
+
+        /// Adds a measurement at the given location.
+        /// Slower than tick(std::uint32_t), since the site is looked up on
+        /// every call. Prefer PROFILER_HOOK().
+        static void tick(
+            const std::string &file, int line, const std::string &function)
+        {
+#if USE_PROFILER
+            tick(SiteRegistry::register_site(file, line, function).id);
+#endif
+        }
+
+        /// Records the result of a run of a benchmark, which replaces the
+        /// result of its previous run. Prefer PROFILER_BENCH().
+        static void add_bench(const BenchStatistics &statistics)
+        {
+#if USE_PROFILER
+            // The profiler reports the result when it is destroyed, and
+            // handles forks from now on.
+            get_instance();
+            BenchTable::add(statistics);
+#else
+            (void)statistics;
+#endif
+        }
+
+        /// Sets the warmup trials, the measured trials and the rejection of
+        /// outliers of the benchmarks that start from now on, see
+        /// PROFILER_BENCH().
+        static void set_bench_options(const BenchOptions &options)
+        {
+#if USE_PROFILER
+            BenchTable::set_options(options);
+#else
+            (void)options;
+#endif
+        }
+
+        /// Samples the segments that start at any site, and drops the
+        /// policies set for single sites. Every hit is still counted; the
+        /// durations of the segments that are not timed are extrapolated.
+        static void set_sampling(const SamplingPolicy &policy)
+        {
+#if USE_PROFILER
+            SamplingConfig::set_policy(policy);
+#endif
+        }
+
+        /// Samples the segments that start at the site with the given ID.
+        static void set_sampling(std::uint32_t site_id, const SamplingPolicy &policy)
+        {
+#if USE_PROFILER
+            SamplingConfig::set_policy(site_id, policy);
+#endif
+        }
+
+        /// Samples the segments that start at the sites in the file whose
+        /// path ends with the given string, at the given line or at every
+        /// line if it is 0.
+        static void set_sampling(const std::string &file, int line, const SamplingPolicy &policy)
+        {
+#if USE_PROFILER
+            SamplingConfig::set_policy(file, line, policy);
+#endif
+        }
+
+        /// Enables or disables the sites of the given category, or of all
+        /// categories if it is "*". See CategoryConfig.
+        static void set_category_enabled(const std::string &category, bool enabled)
+        {
+#if USE_PROFILER
+            CategoryConfig::set_category_enabled(category, enabled);
+#endif
+        }
+
+        /// Enables or disables the sites of a category in the file whose
+        /// path ends with the given string, at the given line or at every
+        /// line if it is 0, regardless of their category.
+        static void set_site_enabled(const std::string &file, int line, bool enabled)
+        {
+#if USE_PROFILER
+            CategoryConfig::set_site_enabled(file, line, enabled);
+#endif
+        }
+
+        /// Applies a comma-separated list of switches of categories and
+        /// sites, e.g. "io,db" or "*,-db,parser.cpp:120". See CategoryConfig.
+        static void set_category_switches(const std::string &switches)
+        {
+#if USE_PROFILER
+            CategoryConfig::set_switches(switches);
+#endif
+        }
+
+        /// Sets the role of this process, e.g. "master" or "worker", which
+        /// tags the names of its files and its profiles.
+        static void set_role(const std::string &role)
+        {
+#if USE_PROFILER
+            ProcessRole::set(role);
+#endif
+        }
+
+        /// Sets the role that child processes forked by this process take,
+        /// "child" by default. Children start with empty statistics.
+        static void set_child_role(const std::string &role)
+        {
+#if USE_PROFILER
+            ProcessRole::set_child(role);
+#endif
+        }
+
+        /// Starts tracing every checkpoint hit into a binary trace file.
+        /// Each thread pushes its hits into a preallocated ring, which a
+        /// background thread drains into the file. See Tracer for the format.
+        /// Restarts tracing if it is already running.
+        /// \return The path of the trace file, or an empty string if the file
+        /// could not be opened.
+        static std::string start_tracing(const TraceOptions &options = TraceOptions())
+        {
+#if USE_PROFILER
+            stop_tracing();
+
+            TimeProfiler &profiler = get_instance();
+            std::unique_ptr<Tracer> tracer(new Tracer(options));
+            if (!tracer->is_open())
+                return std::string();
+
+            std::lock_guard<std::mutex> lock(profiler.mutex_);
+            for (const auto &thread_profile : profiler.thread_profiles_)
+                tracer->add_ring(thread_profile->start_tracing(options));
+
+            profiler.tracer_ = std::move(tracer);
+            return profiler.tracer_->get_file_path();
+#else
+            return std::string();
+#endif
+        }
+
+        /// Stops tracing and completes the trace file.
+        static void stop_tracing()
+        {
+#if USE_PROFILER
+            TimeProfiler &profiler = get_instance();
+            std::unique_ptr<Tracer> tracer;
+            {
+                std::lock_guard<std::mutex> lock(profiler.mutex_);
+                for (const auto &thread_profile : profiler.thread_profiles_)
+                    thread_profile->stop_tracing();
+
+                tracer = std::move(profiler.tracer_);
+            }
+#endif
+        }
+
+        /// Returns the statistics since the profiler started or since the
+        /// last reset. Recording threads are not stalled.
+        static Snapshot take_snapshot()
+        {
+#if USE_PROFILER
+            TimeProfiler &profiler = get_instance();
+            std::lock_guard<std::mutex> lock(profiler.baseline_mutex_);
+            return capture().subtract(profiler.baseline_);
+#else
+            return Snapshot();
+#endif
+        }
+
+        /// Returns the statistics since the profiler started or since the
+        /// last reset, and resets them. Every measurement is either part of
+        /// the returned statistics or of the following ones.
+        static Snapshot snapshot_and_reset()
+        {
+#if USE_PROFILER
+            TimeProfiler &profiler = get_instance();
+            std::lock_guard<std::mutex> lock(profiler.baseline_mutex_);
+            Snapshot snapshot(capture());
+            Snapshot difference(snapshot.subtract(profiler.baseline_));
+            profiler.baseline_ = std::move(snapshot);
+            ExemplarHeap::start_generation();
+            return difference;
+#else
+            return Snapshot();
+#endif
+        }
+
+        /// Resets the statistics that are printed.
+        /// The statistics of the background reporter are not affected.
+        static void reset()
+        {
+            snapshot_and_reset();
+        }
+
+        /// Starts a background thread that reports the statistics of every
+        /// interval and keeps those of the most recent intervals.
+        /// Restarts reporting if it is already running.
+        static void start_reporter(ReporterOptions options = ReporterOptions())
+        {
+#if USE_PROFILER
+            stop_reporter();
+
+            if (!options.callback)
+            {
+                options.callback = [](const Snapshot &window)
+                {
+                    std::cerr << "Statistics of the window from " << format_time(window.get_start_time())
+                              << " to " << format_time(window.get_end_time()) << std::endl;
+                    print_statistics(window);
+                };
+            }
+
+            std::unique_ptr<Reporter> reporter(new Reporter(options, &TimeProfiler::capture));
+            TimeProfiler &profiler = get_instance();
+            std::lock_guard<std::mutex> lock(profiler.mutex_);
+            profiler.reporter_ = std::move(reporter);
+#endif
+        }
+
+        /// Stops the background reporter after reporting the last, partial
+        /// window.
+        static void stop_reporter()
+        {
+#if USE_PROFILER
+            TimeProfiler &profiler = get_instance();
+            std::unique_ptr<Reporter> reporter;
+            {
+                std::lock_guard<std::mutex> lock(profiler.mutex_);
+                reporter = std::move(profiler.reporter_);
+            }
+#endif
+        }
+
+        /// Starts a background thread that publishes the statistics of all
+        /// threads into a POSIX shared-memory segment in an interval, so that
+        /// time_profiler_top can watch them. Restarts exporting if it is
+        /// already running. Not available on Windows.
+        /// \return The name of the segment, or an empty string if it could
+        /// not be created.
+        static std::string start_export(const ExportOptions &options = ExportOptions())
+        {
+#if USE_PROFILER && (defined(__unix__) || defined(__APPLE__))
+            stop_export();
+
+            std::unique_ptr<StatsExporter> exporter(
+                new StatsExporter(options, get_instance().start_time_, &TimeProfiler::capture_merged));
+            if (!exporter->is_open())
+                return std::string();
+
+            const std::string name = exporter->get_name();
+            TimeProfiler &profiler = get_instance();
+            std::lock_guard<std::mutex> lock(profiler.mutex_);
+            profiler.exporter_ = std::move(exporter);
+            return name;
+#else
+            (void)options;
+            return std::string();
+#endif
+        }
+
+        /// Stops publishing the statistics and removes the shared-memory
+        /// segment.
+        static void stop_export()
+        {
+#if USE_PROFILER && (defined(__unix__) || defined(__APPLE__))
+            TimeProfiler &profiler = get_instance();
+            std::unique_ptr<StatsExporter> exporter;
+            {
+                std::lock_guard<std::mutex> lock(profiler.mutex_);
+                exporter = std::move(profiler.exporter_);
+            }
+#endif
+        }
+
+        /// Returns the statistics of the most recent windows of the
+        /// background reporter, oldest first.
+        static std::vector<Snapshot> get_windows()
+        {
+#if USE_PROFILER
+            TimeProfiler &profiler = get_instance();
+            std::lock_guard<std::mutex> lock(profiler.mutex_);
+            if (profiler.reporter_)
+                return profiler.reporter_->get_windows();
+#endif
+            return std::vector<Snapshot>();
+        }
+
+        /// Merges the windows of the background reporter that ended within
+        /// the given period before the end of the most recent one, e.g. to
+        /// compare the last minute with the last hour.
+        static Snapshot get_recent_statistics(std::chrono::nanoseconds period)
+        {
+            const std::vector<Snapshot> windows = get_windows();
+            Snapshot recent;
+            for (auto window = windows.rbegin(); window != windows.rend(); ++window)
+            {
+                if (window->get_end_time() + period <= windows.back().get_end_time())
+                    break;
+
+                recent.merge(*window);
+            }
+
+            return recent;
+        }
+
+        /// Prints the statistics of every thread and of all threads combined.
+        static void print_statistics()
+        {
+#if USE_PROFILER
+            print_statistics(take_snapshot());
+#endif
+        }
+
+        /// Prints the given statistics of every thread and of all threads
+        /// combined.
+        static void print_statistics(const Snapshot &snapshot)
+        {
+            const AllocationSuppressor suppressor;
+            ReportBuffer buffer(std::cerr.rdbuf());
+            std::ostream stream(&buffer);
+            write_report(stream, snapshot, get_report_options());
+        }
+
+        /// Writes a report of the given statistics of every thread and of
+        /// all threads combined to the given stream. The rows are written
+        /// one by one, so the report is never held in memory as a whole.
+        /// The stream should be buffered, e.g. a file stream.
+        static void write_report(std::ostream &stream, const Snapshot &snapshot,
+                                 const ReportOptions &options = ReportOptions())
+        {
+            const AllocationSuppressor suppressor;
+            const std::vector<Printer> printers = create_printers(snapshot, options);
+            switch (options.format)
+            {
+            case ReportFormat::table:
+                for (const auto &printer : printers)
+                    printer.write(stream);
+                break;
+
+            case ReportFormat::csv:
+                Printer::write_csv_header(stream);
+                for (const auto &printer : printers)
+                    printer.write_csv(stream);
+                break;
+
+            case ReportFormat::json:
+                stream << "{\"process_id\": " << snapshot.get_process_id()
+                       << ", \"role\": ";
+                Printer::write_json_string(stream, snapshot.get_role());
+                stream << ", \"start_time_ns\": "
+                       << std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              snapshot.get_start_time().time_since_epoch())
+                              .count()
+                       << ", \"end_time_ns\": "
+                       << std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              snapshot.get_end_time().time_since_epoch())
+                              .count()
+                       << ", \"overhead_ns\": " << snapshot.get_overhead()
+                       << ", \"tables\": [\n";
+                for (std::size_t i = 0; i < printers.size(); i++)
+                {
+                    stream << (i > 0 ? ",\n" : "");
+                    printers[i].write_json(stream);
+                }
+                stream << "\n]}\n";
+                break;
+            }
+        }
+
+        /// Sets the selection and the format of the pairs in the reports that
+        /// print_statistics(), save_log() and the destructor create, e.g. to
+        /// limit the reports of a program with many pairs to the slowest
+        /// ones.
+        static void set_report_options(const ReportOptions &options)
+        {
+            TimeProfiler &profiler = get_instance();
+            std::lock_guard<std::mutex> lock(profiler.mutex_);
+            profiler.report_options_ = options;
+        }
+
+        /// Returns the selection and the format of the pairs in the reports
+        /// that print_statistics() and save_log() create.
+        static ReportOptions get_report_options()
+        {
+            TimeProfiler &profiler = get_instance();
+            std::lock_guard<std::mutex> lock(profiler.mutex_);
+            return profiler.report_options_;
+        }
+
+        /// Sets whether the reports subtract the overhead of the profiler
+        /// per segment from the durations, which is the default. See
+        /// TickOverhead.
+        static void set_overhead_compensation(bool compensated)
+        {
+            TickOverhead::set_compensated(compensated);
+        }
+
+        /// Measures the overhead of the profiler per segment now, e.g. after
+        /// changing the sampling policies or the CPU frequency. The profiler
+        /// calibrates on its own when it starts and when it captures
+        /// statistics after TickOverhead::recalibration_interval.
+        /// \return The overhead.
+        /// Unit: [ns].
+        static std::int64_t calibrate_overhead()
+        {
+#if USE_PROFILER
+            get_instance();
+            return TickOverhead::calibrate();
+#else
+            return 0;
+#endif
+        }
+
+        /// Saves a log file with the statistics under \c $HOME/.TimeProfiler/log.
+        static void save_log()
+        {
+#if USE_PROFILER
+            save_log(take_snapshot());
+#endif
+        }
+
+        /// Saves a log file with the given statistics under
+        /// \c $HOME/.TimeProfiler/log. The extension of the file follows the
+        /// format of the report options. No file is created if the
+        /// statistics are empty.
+        static void save_log(const Snapshot &snapshot)
+        {
+            if (snapshot.is_empty())
+                return;
+
+            const AllocationSuppressor suppressor;
+            const ReportOptions options = get_report_options();
+            const char *const extensions[] = {".log", ".csv", ".json"};
+            std::ofstream logfile(Printer::create_file_path("log", extensions[static_cast<int>(options.format)]));
+            write_report(logfile, snapshot, options);
+        }
+
+        /// Saves the statistics to a binary profile file, which
+        /// \c time_profiler_analyze can print, merge and compare. See
+        /// ProfileFile for the format.
+        /// \param file_path Path of the file. If empty, a new file is
+        /// created in \c $HOME/.TimeProfiler/profile.
+        /// \param histograms Whether to store the histograms of the pairs.
+        /// \return The path of the file, or an empty string if nothing was
+        /// recorded or the file could not be written.
+        static std::string save_profile(const std::string &file_path = std::string(), bool histograms = true)
+        {
+#if USE_PROFILER
+            return save_profile(take_snapshot(), file_path, histograms);
+#else
+            return std::string();
+#endif
+        }
+
+        /// Saves the given statistics to a binary profile file, see
+        /// save_profile(const std::string &, bool).
+        static std::string save_profile(const Snapshot &snapshot, const std::string &file_path = std::string(),
+                                        bool histograms = true)
+        {
+            if (snapshot.get_threads().empty())
+                return std::string();
+
+            const AllocationSuppressor suppressor;
+            const std::string path = file_path.empty() ? Printer::create_file_path("profile", ".tpprof") : file_path;
+            if (ProfileFile::write(path, snapshot, histograms))
+                return path;
+
+            return std::string();
+        }
+
+    private:
+        /// Formats the given time as local date and time.
+        static std::string format_time(std::chrono::system_clock::time_point time)
+        {
+            const std::time_t time_t = std::chrono::system_clock::to_time_t(time);
+            std::stringstream stream;
+            stream << std::put_time(std::localtime(&time_t), "%Y-%m-%d %H:%M:%S");
+            return stream.str();
+        }
+    };
+
+    inline std::int64_t TickOverhead::measure()
+    {
+        static const std::uint32_t site_id =
+            SiteRegistry::register_site(__FILE__, __LINE__, "TickOverhead::measure").id;
+
+        // The calling thread records into a private profile while the loop
+        // runs, so that its own statistics are unchanged. The profile is
+        // kept, so that its counters are only opened again when another
+        // thread or a forked child calibrates; otherwise they would count
+        // the previous thread and be read with read() instead of rdpmc.
+        static ThreadProfile profile(0);
+        static std::thread::id owner_thread = std::this_thread::get_id();
+        static long owner_process = get_process_id();
+        if (owner_thread != std::this_thread::get_id() || owner_process != get_process_id())
+        {
+            owner_thread = std::this_thread::get_id();
+            owner_process = get_process_id();
+            profile.adopt_calling_thread();
+        }
+        else
+        {
+            profile.forget_checkpoint();
+        }
+        MultiMeasurement before;
+        for (const MultiMeasurement &measurement : profile.get_snapshot().measurements)
+            before = measurement;
+
+        ThreadProfile *&cached_profile = TimeProfiler::get_cached_thread_profile();
+        ThreadProfile *const own_profile = cached_profile;
+        cached_profile = &profile;
+        for (int i = 0; i <= calibration_ticks; i++)
+            TimeProfiler::tick(site_id);
+        cached_profile = own_profile;
+
+        for (MultiMeasurement &measurement : profile.get_snapshot().measurements)
+        {
+            measurement.subtract(before);
+            if (measurement.timed_count() > 0)
+                return measurement.get_percentile(0.5).count();
+        }
+
+        return 0;
+    }
+
+    /// Zone that is measured from its construction to its destruction.
+    /// Zones constructed while another zone exists on the same thread are
+    /// nested in it. Created by PROFILER_SCOPE().
+    class ScopedZone
+    {
+    public:
+        /// Constructor.
+        /// Enters the zone opened at the site with the given ID.
+        explicit ScopedZone(std::uint32_t site_id)
+        {
+            TimeProfiler::enter_zone(site_id);
+        }
+
+        /// Destructor.
+        /// Exits the zone.
+        ~ScopedZone()
+        {
+            TimeProfiler::exit_zone();
+        }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        ScopedZone(const ScopedZone &zone) = delete;
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        ScopedZone &operator=(const ScopedZone &zone) = delete;
+    };
+
+    /// Tag that the slowest segments of the calling thread are recorded
+    /// with during its lifetime. The previous tag is restored on
+    /// destruction. Created by PROFILER_EXEMPLAR_TAG().
+    class ScopedExemplarTag
+    {
+    private:
+        /// Tag before this one was set.
+        std::uint64_t previous_tag_;
+
+    public:
+        /// Constructor.
+        /// Sets the given tag.
+        explicit ScopedExemplarTag(std::uint64_t tag)
+            : previous_tag_(TimeProfiler::get_exemplar_tag())
+        {
+            TimeProfiler::set_exemplar_tag(tag);
+        }
+
+        /// Destructor.
+        /// Restores the previous tag.
+        ~ScopedExemplarTag()
+        {
+            TimeProfiler::set_exemplar_tag(previous_tag_);
+        }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        ScopedExemplarTag(const ScopedExemplarTag &tag) = delete;
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        ScopedExemplarTag &operator=(const ScopedExemplarTag &tag) = delete;
+    };
+
+    /// Profiling context of a unit of work, e.g. a request, that is timed
+    /// from its construction to finish() or its destruction and breaks its
+    /// time down into the pairs of checkpoints hit while it is active.
+    /// Prefer PROFILER_CONTEXT() for work that runs within one scope.
+    ///
+    /// A context is active on at most one thread at a time: activate() it
+    /// on the thread that works on it and deactivate() it before the work
+    /// moves on, e.g. around every callback of an asynchronous request.
+    /// Only segments that start and end while the context is active on the
+    /// thread are added to it. When the context ends, its type counts it;
+    /// only contexts that took at least the threshold of their type keep
+    /// their breakdown, so fast contexts cost no storage.
+    class ProfilingContext
+    {
+    private:
+        /// Type of the context.
+        ContextType &type_;
+
+        /// Time spent between the pairs of checkpoints hit while active.
+        ContextBreakdown breakdown_;
+
+        /// Time the context started.
+        /// Unit: ticks of the profiler's Clock.
+        std::int64_t start_time_;
+
+        /// Tag of the context, 0 if none was set.
+        std::uint64_t tag_;
+
+        /// Breakdown that was active on the thread before this context
+        /// was activated.
+        ContextBreakdown *previous_;
+
+        /// Whether the context is active.
+        bool active_;
+
+        /// Whether the context ended.
+        bool finished_;
+
+    public:
+        /// Constructor.
+        /// Starts a context of the given type, active on the calling thread
+        /// if requested.
+        explicit ProfilingContext(ContextType &type, bool activate_now = false)
+            : type_(type),
+              start_time_(Clock::now()),
+              tag_(0),
+              previous_(nullptr),
+              active_(false),
+              finished_(false)
+        {
+            if (activate_now)
+                activate();
+        }
+
+        /// Destructor.
+        /// Ends the context unless it ended before.
+        ~ProfilingContext()
+        {
+            finish();
+        }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        ProfilingContext(const ProfilingContext &context) = delete;
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        ProfilingContext &operator=(const ProfilingContext &context) = delete;
+
+        /// Activates the context on the calling thread.
+        void activate()
+        {
+            if (active_ || finished_)
+                return;
+
+            previous_ = TimeProfiler::set_context(&breakdown_);
+            active_ = true;
+        }
+
+        /// Deactivates the context on the calling thread, which must be the
+        /// one it was activated on. The context that was active before is
+        /// active again.
+        void deactivate()
+        {
+            if (!active_)
+                return;
+
+            TimeProfiler::set_context(previous_);
+            active_ = false;
+        }
+
+        /// Sets the tag of the context, e.g. a request ID, which the kept
+        /// contexts are reported with.
+        void set_tag(std::uint64_t tag)
+        {
+            tag_ = tag;
+        }
+
+        /// Ends the context: deactivates it and adds it to its type.
+        /// \return The duration of the context.
+        std::chrono::nanoseconds finish()
+        {
+            const std::int64_t duration = Clock::to_nanoseconds(Clock::now() - start_time_);
+            if (finished_)
+                return std::chrono::nanoseconds(0);
+
+            deactivate();
+            finished_ = true;
+#if USE_PROFILER
+            if (type_.add(duration))
+            {
+                const AllocationSuppressor suppressor;
+                std::lock_guard<std::mutex> lock(ContextRegistry::get_mutex());
+                type_.keep(duration, tag_, breakdown_);
+            }
+#endif
+            return std::chrono::nanoseconds(duration);
+        }
+    };
+
+    /// Logical task, e.g. a coroutine, that is timed from its start to its
+    /// end across suspensions, which may resume it on another thread.
+    /// Prefer PROFILER_TASK() and PROFILER_CO_AWAIT().
+    ///
+    /// The task reports the time it was running, the time it was suspended
+    /// and the number of resumptions to the TaskTable when it ends. Pairs of
+    /// checkpoints are measured per thread, so a suspension and a
+    /// resumption make the thread forget its most recent checkpoint: no pair
+    /// spans a switch between tasks, and the checkpoints of a task are never
+    /// paired with those of a task that runs on the same thread meanwhile.
+    ///
+    /// The span must be told about suspensions, either by awaiting through
+    /// wrap() or by calling suspend() and resume(), e.g. around a callback.
+    class TaskSpan
+    {
+    private:
+        /// Counters of the site that started the task.
+        TaskTable::Counters &counters_;
+
+        /// Time the task started.
+        /// Unit: ticks of the profiler's Clock.
+        std::int64_t start_time_;
+
+        /// Time of the most recent start, suspension or resumption.
+        /// Unit: ticks of the profiler's Clock.
+        std::int64_t transition_time_;
+
+        /// Time the task was running so far.
+        /// Unit: ticks of the profiler's Clock.
+        std::int64_t active_time_;
+
+        /// Time the task was suspended so far.
+        /// Unit: ticks of the profiler's Clock.
+        std::int64_t suspended_time_;
+
+        /// Number of resumptions so far.
+        std::int64_t resume_count_;
+
+        /// Whether the task is suspended.
+        bool suspended_;
+
+    public:
+        /// Constructor.
+        /// Starts the task of the site with the given counters.
+        explicit TaskSpan(TaskTable::Counters &counters)
+            : counters_(counters),
+              start_time_(Clock::now()),
+              transition_time_(start_time_),
+              active_time_(0),
+              suspended_time_(0),
+              resume_count_(0),
+              suspended_(false)
+        {
+        }
+
+        /// Destructor.
+        /// Ends the task and adds it to the statistics of its site. A task
+        /// that is destroyed while suspended, e.g. a cancelled coroutine,
+        /// counts the time until then as suspended.
+        ~TaskSpan()
+        {
+            const std::int64_t now = Clock::now();
+            if (suspended_)
+                suspended_time_ += now - transition_time_;
+            else
+                active_time_ += now - transition_time_;
+
+            counters_.add(resume_count_, Clock::to_nanoseconds(now - start_time_),
+                          Clock::to_nanoseconds(active_time_), Clock::to_nanoseconds(suspended_time_));
+        }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        TaskSpan(const TaskSpan &span) = delete;
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        TaskSpan &operator=(const TaskSpan &span) = delete;
+
+        /// Marks the task as suspended. Must be called on the thread that
+        /// ran the task, before anything may resume it.
+        void suspend()
+        {
+            if (suspended_)
+                return;
+
+            const std::int64_t now = Clock::now();
+            active_time_ += now - transition_time_;
+            transition_time_ = now;
+            suspended_ = true;
+            TimeProfiler::forget_checkpoint();
+        }
+
+        /// Marks the task as running again, on the calling thread.
+        void resume()
+        {
+            if (!suspended_)
+                return;
+
+            const std::int64_t now = Clock::now();
+            suspended_time_ += now - transition_time_;
+            transition_time_ = now;
+            suspended_ = false;
+            resume_count_++;
+            TimeProfiler::forget_checkpoint();
+        }
+
+        /// Returns whether the task is suspended.
+        bool is_suspended() const
+        {
+            return suspended_;
+        }
+
+#if TIME_PROFILER_COROUTINES
+        /// Awaits the given awaitable and tracks the suspension, if any.
+        /// The result is that of the awaitable. Prefer PROFILER_CO_AWAIT().
+        template <typename Awaitable>
+        auto wrap(Awaitable &&awaitable)
+        {
+            using Awaiter = decltype(get_awaiter(std::forward<Awaitable>(awaitable)));
+            return TaskAwaiter<Awaiter>(*this, get_awaiter(std::forward<Awaitable>(awaitable)));
+        }
+
+    private:
+        /// Awaiter that forwards to the awaiter of another awaitable and
+        /// marks the task as suspended while it is.
+        /// The inner awaiter is held by reference if it is a temporary of
+        /// the co_await expression, which lives until the task resumed.
+        template <typename Awaiter>
+        class TaskAwaiter
+        {
+        private:
+            /// Task that awaits.
+            TaskSpan &span_;
+
+            /// Awaiter of the awaited awaitable.
+            Awaiter awaiter_;
+
+            /// Whether the task was suspended by await_suspend().
+            bool suspended_;
+
+            /// Returns the awaiter of the awaited awaitable.
+            std::remove_reference_t<Awaiter> &get()
+            {
+                return awaiter_;
+            }
+
+        public:
+            /// Constructor.
+            TaskAwaiter(TaskSpan &span, Awaiter &&awaiter)
+                : span_(span), awaiter_(std::forward<Awaiter>(awaiter)), suspended_(false)
+            {
+            }
+
+            /// Returns whether the result is available without suspending.
+            bool await_ready()
+            {
+                return get().await_ready();
+            }
+
+            /// Marks the task as suspended and suspends it as the awaited
+            /// awaiter does. Once that awaiter received the handle, another
+            /// thread may already resume or destroy the task, so the span is
+            /// only touched afterwards if the task did not suspend after all.
+            template <typename Promise>
+            auto await_suspend(std::coroutine_handle<Promise> handle)
+            {
+                using Result = decltype(get().await_suspend(handle));
+                suspended_ = true;
+                span_.suspend();
+                if constexpr (std::is_void_v<Result>)
+                {
+                    get().await_suspend(handle);
+                }
+                else if constexpr (std::is_same_v<Result, bool>)
+                {
+                    const bool suspends = get().await_suspend(handle);
+                    if (!suspends)
+                        cancel_suspension();
+                    return suspends;
+                }
+                else
+                {
+                    const auto next = get().await_suspend(handle);
+                    if (next.address() == handle.address())
+                        cancel_suspension();
+                    return next;
+                }
+            }
+
+            /// Marks the task as running and returns the result of the
+            /// awaited awaiter.
+            decltype(auto) await_resume()
+            {
+                if (suspended_)
+                {
+                    suspended_ = false;
+                    span_.resume();
+                }
+                return get().await_resume();
+            }
+
+        private:
+            /// Undoes the suspension if the awaited awaiter decided not to
+            /// suspend. The task counts as running all along.
+            void cancel_suspension()
+            {
+                suspended_ = false;
+                span_.resumed_immediately();
+            }
+        };
+
+        /// Returns the awaiter of the given awaitable: the result of its
+        /// operator co_await, if any, or the awaitable itself.
+        template <typename Awaitable>
+        static decltype(auto) get_awaiter(Awaitable &&awaitable)
+        {
+            if constexpr (requires { std::forward<Awaitable>(awaitable).operator co_await(); })
+                return std::forward<Awaitable>(awaitable).operator co_await();
+            else if constexpr (requires { operator co_await(std::forward<Awaitable>(awaitable)); })
+                return operator co_await(std::forward<Awaitable>(awaitable));
+            else
+                return std::forward<Awaitable>(awaitable);
+        }
+
+        /// Marks the task as running again after a suspension that did not
+        /// happen, without counting a resumption.
+        void resumed_immediately()
+        {
+            const std::int64_t now = Clock::now();
+            active_time_ += now - transition_time_;
+            transition_time_ = now;
+            suspended_ = false;
+        }
+#endif
+    };
+
+    /// Benchmark of a region of code, which runs a fixed number of
+    /// iterations per trial: first the warmup trials, then the measured
+    /// ones. Prefer PROFILER_BENCH() and PROFILER_BENCH_VS(), which run the
+    /// following statement or block as long as next() returns \c true.
+    ///
+    /// Each measured trial is timed as a whole with the profiler's Clock, so
+    /// an iteration only costs a decrement and a comparison. Trials further
+    /// from the median than BenchOptions::outlier_threshold times the
+    /// scaled median absolute deviation are rejected, e.g. those
+    /// interrupted by the scheduler. When the run ends, its statistics
+    /// replace those of the previous run of the same benchmark in the
+    /// BenchTable, which the reports show. A run left early, e.g. by
+    /// \c break, is not recorded.
+    class BenchRun
+    {
+    private:
+        /// ID of the site of the benchmark.
+        std::uint32_t site_id_;
+
+        /// Name of the benchmark this one is compared with, empty if none.
+        std::string baseline_;
+
+        /// Number of iterations per trial.
+        std::int64_t iterations_;
+
+        /// Options the benchmark runs with.
+        BenchOptions options_;
+
+        /// Number of iterations left in the current trial.
+        std::int64_t remaining_;
+
+        /// Index of the current trial, counting the warmup trials. -1
+        /// before the first trial.
+        int trial_;
+
+        /// Time the current trial started.
+        /// Unit: ticks of the profiler's Clock.
+        std::int64_t trial_start_;
+
+        /// Durations per iteration of the measured trials.
+        /// Unit: [ns].
+        std::vector<double> samples_;
+
+        /// Ends the current trial and starts the next one.
+        /// \return \c false if the run is over.
+        bool next_trial()
+        {
+            const std::int64_t now = Clock::now();
+            if (trial_ >= options_.warmup_trials)
+                samples_.push_back(static_cast<double>(Clock::to_nanoseconds(now - trial_start_)) /
+                                   static_cast<double>(iterations_));
+
+            trial_++;
+            if (trial_ >= options_.warmup_trials + options_.trials)
+            {
+                TimeProfiler::add_bench(evaluate());
+                return false;
+            }
+
+            remaining_ = iterations_ - 1;
+            trial_start_ = Clock::now();
+            return true;
+        }
+
+        /// Returns the median of the given sorted values.
+        static double get_median(const std::vector<double> &sorted)
+        {
+            const std::size_t middle = sorted.size() / 2;
+            return sorted.size() % 2 > 0 ? sorted[middle] : (sorted[middle - 1] + sorted[middle]) / 2.0;
+        }
+
+        /// Computes the statistics of the measured trials without the
+        /// outliers.
+        BenchStatistics evaluate() const
+        {
+            const AllocationSuppressor suppressor;
+            std::vector<double> samples = samples_;
+            std::sort(samples.begin(), samples.end());
+            const double median = get_median(samples);
+
+            // The median absolute deviation, scaled to estimate the standard
+            // deviation of a normal distribution. Trials within 1% of the
+            // median are never rejected, so that a very steady benchmark
+            // keeps its trials that differ by clock resolution only.
+            std::vector<double> deviations;
+            deviations.reserve(samples.size());
+            for (double sample : samples)
+                deviations.push_back(std::fabs(sample - median));
+            std::sort(deviations.begin(), deviations.end());
+            const double limit = options_.outlier_threshold > 0.0
+                                     ? std::max(options_.outlier_threshold * 1.4826 * get_median(deviations),
+                                                0.01 * median)
+                                     : 0.0;
+
+            std::vector<double> kept;
+            kept.reserve(samples.size());
+            for (double sample : samples)
+            {
+                if (limit <= 0.0 || std::fabs(sample - median) <= limit)
+                    kept.push_back(sample);
+            }
+
+            // A small threshold may reject every trial, e.g. if the median
+            // lies between the two middle trials. All of them are kept then.
+            if (kept.empty())
+                kept = samples;
+
+            const double count = static_cast<double>(kept.size());
+            double sum = 0.0;
+            for (double sample : kept)
+                sum += sample;
+            const double mean = sum / count;
+
+            double squares = 0.0;
+            for (double sample : kept)
+                squares += (sample - mean) * (sample - mean);
+            const double standard_deviation = kept.size() > 1 ? std::sqrt(squares / (count - 1.0)) : 0.0;
+
+            return BenchStatistics{site_id_,
+                                   baseline_,
+                                   0,
+                                   iterations_,
+                                   static_cast<int>(kept.size()),
+                                   static_cast<int>(samples.size() - kept.size()),
+                                   mean,
+                                   get_median(kept),
+                                   standard_deviation,
+                                   kept.size() > 1 ? get_t_quantile(count - 1.0) * standard_deviation / std::sqrt(count)
+                                                   : 0.0,
+                                   kept.front(),
+                                   kept.back()};
+        }
+
+    public:
+        /// Constructor.
+        /// Registers the benchmark of the given name at the site in the
+        /// given file, line and function, to be compared with the benchmark
+        /// of the given name unless it is empty.
+        BenchRun(const std::string &file, int line, const std::string &function, const std::string &name,
+                 const std::string &baseline, std::int64_t iterations)
+            : iterations_(std::max<std::int64_t>(1, iterations)),
+              options_(BenchTable::get_options()),
+              remaining_(0),
+              trial_(-1),
+              trial_start_(0)
+        {
+            const AllocationSuppressor suppressor;
+            site_id_ = SiteRegistry::register_site(file, line, function, name).id;
+            baseline_ = baseline;
+            options_.warmup_trials = std::max(0, options_.warmup_trials);
+            options_.trials = std::max(1, options_.trials);
+            samples_.reserve(options_.trials);
+        }
+
+        /// Starts the next iteration.
+        /// \return \c false if the run is over.
+        bool next()
+        {
+            if (remaining_ > 0)
+            {
+                remaining_--;
+                return true;
+            }
+
+            return next_trial();
+        }
+
+        /// Copy constructor.
+        /// Inaccessible from outside the class.
+        BenchRun(const BenchRun &run) = delete;
+
+        /// Assignment operator.
+        /// Inaccessible from outside the class.
+        BenchRun &operator=(const BenchRun &run) = delete;
+    };
+
+} // namespace time_profiler
+
+#ifdef TIME_PROFILER_DEFINE_ALLOCATION_HOOKS
+// Replacements of the global allocation functions that count the heap
+// allocations of every thread for TIME_PROFILER_ALLOCATIONS. On glibc, malloc
+// and its relatives, including the aligned ones whose blocks free() releases,
+// are replaced as well, so that the allocations of C code are counted too and
+// every counted deallocation has a counted allocation; operator new then
+// allocates with the functions of glibc directly, so that every allocation is
+// counted once. Must be defined in the executable, not in a shared library,
+// whose thread-local variables may themselves be allocated on first access.
+#if defined(__GLIBC__)
+extern "C"
+{
+    void *__libc_malloc(std::size_t size);
+    void *__libc_calloc(std::size_t count, std::size_t size);
+    void *__libc_realloc(void *pointer, std::size_t size);
+    void *__libc_memalign(std::size_t alignment, std::size_t size);
+    void *__libc_valloc(std::size_t size);
+    void *__libc_pvalloc(std::size_t size);
+    void __libc_free(void *pointer);
+
+    void *malloc(std::size_t size) noexcept
+    {
+        void *pointer = __libc_malloc(size);
+        if (pointer != nullptr)
+            ::time_profiler::AllocationCounter::count_allocation(size);
+        return pointer;
+    }
+
+    void *calloc(std::size_t count, std::size_t size) noexcept
+    {
+        void *pointer = __libc_calloc(count, size);
+        if (pointer != nullptr)
+            ::time_profiler::AllocationCounter::count_allocation(count * size);
+        return pointer;
+    }
+
+    // Counts a reallocation as a deallocation and a new allocation, as it
+    // usually moves the block.
+    void *realloc(void *pointer, std::size_t size) noexcept
+    {
+        void *new_pointer = __libc_realloc(pointer, size);
+        if (pointer != nullptr && (new_pointer != nullptr || size == 0))
+            ::time_profiler::AllocationCounter::count_free();
+        if (new_pointer != nullptr)
+            ::time_profiler::AllocationCounter::count_allocation(size);
+        return new_pointer;
+    }
+
+    void *memalign(std::size_t alignment, std::size_t size) noexcept
+    {
+        void *pointer = __libc_memalign(alignment, size);
+        if (pointer != nullptr)
+            ::time_profiler::AllocationCounter::count_allocation(size);
+        return pointer;
+    }
+
+    void *aligned_alloc(std::size_t alignment, std::size_t size) noexcept
+    {
+        return memalign(alignment, size);
+    }
+
+    int posix_memalign(void **pointer, std::size_t alignment, std::size_t size) noexcept
+    {
+        if (alignment == 0 || alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+            return EINVAL;
+
+        void *new_pointer = memalign(alignment, size);
+        if (new_pointer == nullptr)
+            return ENOMEM;
+
+        *pointer = new_pointer;
+        return 0;
+    }
+
+    void *valloc(std::size_t size) noexcept
+    {
+        void *pointer = __libc_valloc(size);
+        if (pointer != nullptr)
+            ::time_profiler::AllocationCounter::count_allocation(size);
+        return pointer;
+    }
+
+    void *pvalloc(std::size_t size) noexcept
+    {
+        void *pointer = __libc_pvalloc(size);
+        if (pointer != nullptr)
+            ::time_profiler::AllocationCounter::count_allocation(size);
+        return pointer;
+    }
+
+    void free(void *pointer) noexcept
+    {
+        if (pointer != nullptr)
+            ::time_profiler::AllocationCounter::count_free();
+        __libc_free(pointer);
+    }
+}
+#endif
+
+namespace time_profiler
+{
+    /// Allocates memory for the replaced operator new without counting it.
+    /// \return \c nullptr if no memory is available.
+    inline void *allocate_uncounted(std::size_t size, std::size_t alignment) noexcept
+    {
+#if defined(__GLIBC__)
+        return alignment > alignof(std::max_align_t) ? __libc_memalign(alignment, size) : __libc_malloc(size);
+#else
+        if (alignment > alignof(std::max_align_t))
+            return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+        return std::malloc(size);
+#endif
+    }
+
+    /// Frees memory of allocate_uncounted() without counting it.
+    inline void free_uncounted(void *pointer) noexcept
+    {
+#if defined(__GLIBC__)
+        __libc_free(pointer);
+#else
+        std::free(pointer);
+#endif
+    }
+
+    /// Allocates and counts memory for the replaced operator new, calling
+    /// the new handler until enough memory is available.
+    inline void *allocate_counted(std::size_t size, std::size_t alignment)
+    {
+        if (size == 0)
+            size = 1;
+
+        while (true)
+        {
+            if (void *pointer = allocate_uncounted(size, alignment))
+            {
+                AllocationCounter::count_allocation(size);
+                return pointer;
+            }
+
+            const std::new_handler handler = std::get_new_handler();
+            if (handler == nullptr)
+                throw std::bad_alloc();
+            handler();
+        }
+    }
+
+    /// Frees and counts memory of allocate_counted().
+    inline void free_counted(void *pointer) noexcept
+    {
+        if (pointer == nullptr)
+            return;
+
+        AllocationCounter::count_free();
+        free_uncounted(pointer);
+    }
 } // namespace time_profiler
+
+void *operator new(std::size_t size)
+{
+    return ::time_profiler::allocate_counted(size, alignof(std::max_align_t));
+}
+
+void *operator new[](std::size_t size)
+{
+    return ::time_profiler::allocate_counted(size, alignof(std::max_align_t));
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    return ::time_profiler::allocate_counted(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return ::time_profiler::allocate_counted(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    try
+    {
+        return ::time_profiler::allocate_counted(size, alignof(std::max_align_t));
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    try
+    {
+        return ::time_profiler::allocate_counted(size, alignof(std::max_align_t));
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    try
+    {
+        return ::time_profiler::allocate_counted(size, static_cast<std::size_t>(alignment));
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    try
+    {
+        return ::time_profiler::allocate_counted(size, static_cast<std::size_t>(alignment));
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+void operator delete(void *pointer) noexcept
+{
+    ::time_profiler::free_counted(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+    ::time_profiler::free_counted(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+    ::time_profiler::free_counted(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept
+{
+    ::time_profiler::free_counted(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t) noexcept
+{
+    ::time_profiler::free_counted(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t) noexcept
+{
+    ::time_profiler::free_counted(pointer);
+}
+
+void operator delete(void *pointer, std::size_t, std::align_val_t) noexcept
+{
+    ::time_profiler::free_counted(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t, std::align_val_t) noexcept
+{
+    ::time_profiler::free_counted(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept
+{
+    ::time_profiler::free_counted(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept
+{
+    ::time_profiler::free_counted(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    ::time_profiler::free_counted(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    ::time_profiler::free_counted(pointer);
+}
+#endif
+
 #endif // #define TIME_PROFILER_H_
\ No newline at end of file
@@ -0,0 +1,571 @@
+#include "time_profiler.h"
+
+#include <cstdio>
+#include <cstring>
+
+// Offline analyzer of profile files written by TimeProfiler::save_profile().
+// Merges any number of profiles and prints the same tables as the profiler,
+// compares the merged profiles of a baseline run with those of a candidate
+// run pair by pair, or shows how the pairs differ between the processes
+// that wrote the profiles.
+
+namespace
+{
+    using time_profiler::MultiMeasurement;
+    using time_profiler::Snapshot;
+
+    /// Prints the comparison of the pairs of checkpoints of two runs.
+    class DiffPrinter : public time_profiler::Printer
+    {
+    private:
+        /// Statistics of a pair in both runs. Either may be empty.
+        struct Entry
+        {
+            MultiMeasurement baseline;
+            MultiMeasurement candidate;
+        };
+
+        /// Compared pairs, sorted by the overall duration in the candidate.
+        std::vector<Entry> entries_;
+
+        static const int line_width = 220;
+        static const int file_col_width = 30;
+        static const int function_col_width = 40;
+        static const int line_col_width = 5;
+        static const int count_col_width = 12;
+        static const int duration_col_width = 14;
+        static const int speedup_col_width = 9;
+        static const int verdict_col_width = 9;
+
+        /// Relative change of the average below which a pair is reported as
+        /// unchanged, even if the change is significant.
+        static constexpr double min_change = 0.01;
+
+    public:
+        /// Constructor.
+        /// Matches the pairs of both runs by their sites.
+        DiffPrinter(const std::vector<MultiMeasurement> &baseline, const std::vector<MultiMeasurement> &candidate)
+        {
+            std::map<std::uint64_t, Entry> entries;
+            for (const MultiMeasurement &measurement : baseline)
+            {
+                Entry &entry = get_entry(entries, measurement);
+                entry.baseline = measurement;
+            }
+            for (const MultiMeasurement &measurement : candidate)
+            {
+                Entry &entry = get_entry(entries, measurement);
+                entry.candidate = measurement;
+            }
+
+            for (auto &entry : entries)
+                entries_.push_back(entry.second);
+
+            std::stable_sort(entries_.begin(), entries_.end(), [](const Entry &lhs, const Entry &rhs)
+                             { return std::max(lhs.candidate.get_overall_duration(), lhs.baseline.get_overall_duration()) >
+                                      std::max(rhs.candidate.get_overall_duration(), rhs.baseline.get_overall_duration()); });
+        }
+
+        /// Prints the comparison.
+        void print() const
+        {
+            std::cout << create_table();
+        }
+
+        /// Creates a table that compares both runs.
+        std::string create_table() const
+        {
+            std::stringstream stream;
+            stream << create_hline('=', line_width)
+                   << std::setfill(' ')
+                   << std::setw(file_col_width) << std::left << "File"
+                   << "|" << std::setw(function_col_width) << std::left << "Function"
+                   << "|" << std::setw(line_col_width) << std::right << "Line "
+                   << "|" << std::setw(count_col_width) << std::right << "Count A "
+                   << "|" << std::setw(count_col_width) << std::right << "Count B "
+                   << "|" << std::setw(duration_col_width) << std::right << "Average A [ns]"
+                   << "|" << std::setw(duration_col_width) << std::right << "Average B [ns]"
+                   << "|" << std::setw(speedup_col_width) << std::right << "Speedup "
+                   << "|" << std::setw(duration_col_width) << std::right << "P99 A [ns]"
+                   << "|" << std::setw(duration_col_width) << std::right << "P99 B [ns]"
+                   << "|" << std::setw(duration_col_width) << std::right << "Overall A [us]"
+                   << "|" << std::setw(duration_col_width) << std::right << "Overall B [us]"
+                   << "|" << std::setw(verdict_col_width) << std::right << "Verdict"
+                   << std::endl
+                   << create_hline('=', line_width);
+
+            for (std::size_t i = 0; i < entries_.size(); i++)
+            {
+                stream << create_entry(entries_[i]);
+                stream << create_hline(i + 1 < entries_.size() ? '-' : '=', line_width);
+            }
+
+            stream << "A: baseline, B: candidate. Speedup is the average of A divided by the average of B. "
+                      "Verdicts are given if Welch's t-test rejects equal averages at the 95% level and the "
+                      "averages differ by more than 1%."
+                   << std::endl;
+
+            return stream.str();
+        }
+
+    private:
+        /// Returns the entry of the pair of the given measurement.
+        static Entry &get_entry(std::map<std::uint64_t, Entry> &entries, const MultiMeasurement &measurement)
+        {
+            auto result = entries.emplace(measurement.get_key(), Entry());
+            if (result.second)
+            {
+                result.first->second.baseline = MultiMeasurement(measurement.get_start_site_id(),
+                                                                  measurement.get_end_site_id());
+                result.first->second.candidate = result.first->second.baseline;
+            }
+
+            return result.first->second;
+        }
+
+        /// Formats a duration, or a dash if the pair did not occur.
+        static std::string format_duration(const MultiMeasurement &measurement, std::chrono::nanoseconds duration)
+        {
+            return measurement.timed_count() > 0 ? insert_separators(duration.count()) : "-";
+        }
+
+        /// Returns the average duration of the timed measurements with the
+        /// overhead of the profiler excluded, like get_average_duration(),
+        /// but not rounded. The speedup and the verdict both compare it.
+        /// Unit: [ns].
+        static double get_average(const MultiMeasurement &measurement)
+        {
+            const double average = static_cast<double>(measurement.get_measured_duration().count()) /
+                                   static_cast<double>(measurement.timed_count());
+            return std::max(0.0, average - static_cast<double>(measurement.get_overhead()));
+        }
+
+        /// Compares the averages of both runs.
+        static std::string get_verdict(const Entry &entry)
+        {
+            const std::int64_t baseline_count = entry.baseline.timed_count();
+            const std::int64_t candidate_count = entry.candidate.timed_count();
+            if (baseline_count == 0)
+                return "new";
+            if (candidate_count == 0)
+                return "gone";
+
+            const double baseline_average = get_average(entry.baseline);
+            const double candidate_average = get_average(entry.candidate);
+            const double difference = candidate_average - baseline_average;
+            const double standard_error = std::sqrt(
+                entry.baseline.get_variance() / static_cast<double>(baseline_count) +
+                entry.candidate.get_variance() / static_cast<double>(candidate_count));
+
+            const bool significant = standard_error > 0.0 ? std::fabs(difference) > 1.96 * standard_error
+                                                          : difference != 0.0;
+            if (!significant || std::fabs(difference) <= min_change * baseline_average)
+                return "~";
+
+            return difference < 0.0 ? "faster" : "slower";
+        }
+
+        /// Generates the two lines of the comparison of a pair.
+        static std::string create_entry(const Entry &entry)
+        {
+            const MultiMeasurement &sites = entry.baseline;
+            const std::string file_start(crop_path(sites.get_start_file()));
+            std::string file_end(crop_path(sites.get_end_file()));
+            if (file_start == file_end)
+                file_end.clear();
+
+            std::stringstream speedup;
+            if (entry.baseline.timed_count() > 0 && entry.candidate.timed_count() > 0 &&
+                get_average(entry.candidate) > 0.0)
+            {
+                speedup << std::fixed << std::setprecision(2)
+                        << get_average(entry.baseline) / get_average(entry.candidate) << "x";
+            }
+            else
+            {
+                speedup << "-";
+            }
+
+            std::stringstream stream;
+            stream << std::setfill(' ')
+                   << std::setw(file_col_width) << std::left << file_start
+                   << "|" << std::setw(function_col_width) << std::left << sites.get_start_name()
+                   << "|" << std::setw(line_col_width) << std::right << sites.get_start_line()
+                   << "|" << std::endl;
+
+            stream << std::setw(file_col_width) << std::left << file_end
+                   << "|" << std::setw(function_col_width) << std::left << sites.get_end_name()
+                   << "|" << std::setw(line_col_width) << std::right << sites.get_end_line()
+                   << "|" << std::setw(count_col_width) << std::right << insert_separators(entry.baseline.count())
+                   << "|" << std::setw(count_col_width) << std::right << insert_separators(entry.candidate.count())
+                   << "|" << std::setw(duration_col_width) << std::right
+                   << format_duration(entry.baseline, entry.baseline.get_average_duration())
+                   << "|" << std::setw(duration_col_width) << std::right
+                   << format_duration(entry.candidate, entry.candidate.get_average_duration())
+                   << "|" << std::setw(speedup_col_width) << std::right << speedup.str()
+                   << "|" << std::setw(duration_col_width) << std::right
+                   << format_duration(entry.baseline, entry.baseline.get_percentile(0.99))
+                   << "|" << std::setw(duration_col_width) << std::right
+                   << format_duration(entry.candidate, entry.candidate.get_percentile(0.99))
+                   << "|" << std::setw(duration_col_width) << std::right
+                   << insert_separators(std::chrono::duration_cast<std::chrono::microseconds>(
+                                            entry.baseline.get_overall_duration())
+                                            .count())
+                   << "|" << std::setw(duration_col_width) << std::right
+                   << insert_separators(std::chrono::duration_cast<std::chrono::microseconds>(
+                                            entry.candidate.get_overall_duration())
+                                            .count())
+                   << "|" << std::setw(verdict_col_width) << std::right << get_verdict(entry)
+                   << std::endl;
+
+            return stream.str();
+        }
+    };
+
+    /// Prints the statistics of the pairs of checkpoints merged over several
+    /// processes, e.g. pre-forked workers, and the spread of their averages
+    /// between the processes.
+    class SpreadPrinter : public time_profiler::Printer
+    {
+    private:
+        /// Statistics of a pair, merged and per process.
+        struct Entry
+        {
+            MultiMeasurement total;
+            std::vector<std::pair<std::size_t, MultiMeasurement>> processes;
+        };
+
+        /// Labels of the processes.
+        std::vector<std::string> labels_;
+
+        /// Pairs, sorted by their overall duration over all processes.
+        std::vector<Entry> entries_;
+
+        static const int line_width = 197;
+        static const int file_col_width = 30;
+        static const int function_col_width = 40;
+        static const int line_col_width = 5;
+        static const int process_col_width = 6;
+        static const int count_col_width = 12;
+        static const int duration_col_width = 14;
+        static const int spread_col_width = 8;
+        static const int slowest_col_width = 30;
+
+    public:
+        /// Constructor.
+        /// Matches the pairs of all processes by their sites.
+        SpreadPrinter(const std::vector<std::string> &labels,
+                      const std::vector<std::vector<MultiMeasurement>> &processes)
+            : labels_(labels)
+        {
+            std::map<std::uint64_t, Entry> entries;
+            for (std::size_t i = 0; i < processes.size(); i++)
+            {
+                for (const MultiMeasurement &measurement : processes[i])
+                {
+                    auto result = entries.emplace(measurement.get_key(), Entry());
+                    MultiMeasurement &total = result.first->second.total;
+                    if (result.second)
+                    {
+                        total = MultiMeasurement(measurement.get_start_site_id(), measurement.get_end_site_id());
+                        total.set_overhead(measurement.get_overhead());
+                    }
+                    total.merge(measurement);
+
+                    // Rather compensate too little than too much, as in
+                    // Snapshot::merge().
+                    if (measurement.get_overhead() < total.get_overhead())
+                        total.set_overhead(measurement.get_overhead());
+                    result.first->second.processes.emplace_back(i, measurement);
+                }
+            }
+
+            for (auto &entry : entries)
+                entries_.push_back(entry.second);
+
+            std::stable_sort(entries_.begin(), entries_.end(), [](const Entry &lhs, const Entry &rhs)
+                             { return lhs.total.get_overall_duration() > rhs.total.get_overall_duration(); });
+        }
+
+        /// Prints the table.
+        void print() const
+        {
+            std::cout << create_table();
+        }
+
+        /// Creates a table of the pairs and their spread between processes.
+        std::string create_table() const
+        {
+            std::stringstream stream;
+            stream << create_hline('=', line_width)
+                   << std::setfill(' ')
+                   << std::setw(file_col_width) << std::left << "File"
+                   << "|" << std::setw(function_col_width) << std::left << "Function"
+                   << "|" << std::setw(line_col_width) << std::right << "Line "
+                   << "|" << std::setw(process_col_width) << std::right << "Procs"
+                   << "|" << std::setw(count_col_width) << std::right << "Count "
+                   << "|" << std::setw(duration_col_width) << std::right << "Average [ns]"
+                   << "|" << std::setw(duration_col_width) << std::right << "Min avg [ns]"
+                   << "|" << std::setw(duration_col_width) << std::right << "Med avg [ns]"
+                   << "|" << std::setw(duration_col_width) << std::right << "Max avg [ns]"
+                   << "|" << std::setw(spread_col_width) << std::right << "Spread"
+                   << "|" << std::setw(slowest_col_width) << std::left << "Slowest process"
+                   << std::endl
+                   << create_hline('=', line_width);
+
+            for (std::size_t i = 0; i < entries_.size(); i++)
+            {
+                stream << create_entry(entries_[i]);
+                stream << create_hline(i + 1 < entries_.size() ? '-' : '=', line_width);
+            }
+
+            stream << "Averages are compared between the processes that timed the pair. Spread is the "
+                      "largest average divided by the smallest."
+                   << std::endl
+                   << "Processes:";
+            for (const std::string &label : labels_)
+                stream << " " << label << ";";
+            stream << std::endl;
+
+            return stream.str();
+        }
+
+    private:
+        /// Generates the two lines of a pair.
+        std::string create_entry(const Entry &entry) const
+        {
+            // Averages of the processes that timed the pair, ascending.
+            std::vector<std::pair<std::int64_t, std::size_t>> averages;
+            for (const auto &process : entry.processes)
+            {
+                if (process.second.timed_count() > 0)
+                    averages.emplace_back(process.second.get_average_duration().count(), process.first);
+            }
+            std::sort(averages.begin(), averages.end());
+
+            std::string minimum("-"), median("-"), maximum("-"), spread("-"), slowest;
+            if (!averages.empty())
+            {
+                minimum = insert_separators(averages.front().first);
+                median = insert_separators(averages[averages.size() / 2].first);
+                maximum = insert_separators(averages.back().first);
+                slowest = labels_[averages.back().second];
+                if (averages.front().first > 0)
+                {
+                    std::stringstream ratio;
+                    ratio << std::fixed << std::setprecision(2)
+                          << static_cast<double>(averages.back().first) / static_cast<double>(averages.front().first)
+                          << "x";
+                    spread = ratio.str();
+                }
+            }
+
+            const MultiMeasurement &total = entry.total;
+            const std::string file_start(crop_path(total.get_start_file()));
+            std::string file_end(crop_path(total.get_end_file()));
+            if (file_start == file_end)
+                file_end.clear();
+
+            std::stringstream stream;
+            stream << std::setfill(' ')
+                   << std::setw(file_col_width) << std::left << file_start
+                   << "|" << std::setw(function_col_width) << std::left << total.get_start_name()
+                   << "|" << std::setw(line_col_width) << std::right << total.get_start_line()
+                   << "|" << std::endl;
+
+            stream << std::setw(file_col_width) << std::left << file_end
+                   << "|" << std::setw(function_col_width) << std::left << total.get_end_name()
+                   << "|" << std::setw(line_col_width) << std::right << total.get_end_line()
+                   << "|" << std::setw(process_col_width) << std::right << entry.processes.size()
+                   << "|" << std::setw(count_col_width) << std::right << insert_separators(total.count())
+                   << "|" << std::setw(duration_col_width) << std::right
+                   << insert_separators(total.get_average_duration().count())
+                   << "|" << std::setw(duration_col_width) << std::right << minimum
+                   << "|" << std::setw(duration_col_width) << std::right << median
+                   << "|" << std::setw(duration_col_width) << std::right << maximum
+                   << "|" << std::setw(spread_col_width) << std::right << spread
+                   << "|" << std::setw(slowest_col_width) << std::left << slowest
+                   << std::endl;
+
+            return stream.str();
+        }
+    };
+
+    /// Returns the label of the process that wrote a profile.
+    std::string get_process_label(const Snapshot &snapshot)
+    {
+        std::string label = std::to_string(snapshot.get_process_id());
+        if (!snapshot.get_role().empty())
+            label += " " + snapshot.get_role();
+        return label;
+    }
+
+    /// Reads and merges the given profile files.
+    /// \return \c false if a file could not be read.
+    bool read_profiles(const std::vector<std::string> &paths, Snapshot &snapshot)
+    {
+        for (const std::string &path : paths)
+        {
+            time_profiler::ProfileFile file;
+            if (!file.open(path))
+            {
+                std::fprintf(stderr, "time_profiler_analyze: %s\n", file.get_error().c_str());
+                return false;
+            }
+
+            snapshot.merge(file.get_snapshot());
+        }
+
+        return true;
+    }
+
+    /// Merges the pairs of all threads of the given snapshot. The
+    /// durations exclude the overhead of the profiler stored with the
+    /// snapshot, as in the tables of the profiler.
+    std::vector<MultiMeasurement> merge_threads(const Snapshot &snapshot)
+    {
+        time_profiler::PairTable table;
+        for (const time_profiler::ThreadSnapshot &thread : snapshot.get_threads())
+        {
+            for (const MultiMeasurement &measurement : thread.measurements)
+                table.find_or_insert(measurement.get_start_site_id(), measurement.get_end_site_id()).merge(measurement);
+        }
+
+        std::vector<MultiMeasurement> measurements(table.get_measurements().begin(), table.get_measurements().end());
+        for (MultiMeasurement &measurement : measurements)
+            measurement.set_overhead(snapshot.get_overhead());
+
+        return measurements;
+    }
+
+    void print_usage()
+    {
+        std::fprintf(stderr,
+                     "Usage: time_profiler_analyze [--baseline FILE]... [--per-process]\n"
+                     "                             [--top N] [--file TEXT] [--function TEXT]\n"
+                     "                             [--min-percent P] [--format table|csv|json] FILE...\n"
+                     "\n"
+                     "Merges the given profile files and prints their statistics per thread\n"
+                     "and for all threads combined. --top keeps the N pairs of checkpoints that\n"
+                     "took the most time, --file and --function the pairs with a checkpoint in a\n"
+                     "matching file or function, --min-percent the pairs that took at least P %%\n"
+                     "of the time of their table. --format writes CSV or JSON instead of tables.\n"
+                     "With --baseline, merges the baseline files and the other files separately\n"
+                     "and compares the pairs of checkpoints of both runs instead.\n"
+                     "With --per-process, merges the files of each process separately and shows\n"
+                     "the spread of the averages of every pair between the processes, e.g. to\n"
+                     "find a slow worker of a pre-forked server.\n");
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> baseline_paths;
+    std::vector<std::string> paths;
+    bool per_process = false;
+    time_profiler::ReportOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+        {
+            baseline_paths.push_back(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--top") == 0 && i + 1 < argc)
+        {
+            options.top_n = static_cast<std::size_t>(std::max(0L, std::atol(argv[++i])));
+        }
+        else if (std::strcmp(argv[i], "--file") == 0 && i + 1 < argc)
+        {
+            options.file_filter = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--function") == 0 && i + 1 < argc)
+        {
+            options.function_filter = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--min-percent") == 0 && i + 1 < argc)
+        {
+            options.min_percent = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+        {
+            const std::string format = argv[++i];
+            if (format == "csv")
+                options.format = time_profiler::ReportFormat::csv;
+            else if (format == "json")
+                options.format = time_profiler::ReportFormat::json;
+            else if (format != "table")
+            {
+                print_usage();
+                return 2;
+            }
+        }
+        else if (std::strcmp(argv[i], "--per-process") == 0)
+        {
+            per_process = true;
+        }
+        else if (argv[i][0] == '-')
+        {
+            print_usage();
+            return std::strcmp(argv[i], "--help") == 0 ? 0 : 2;
+        }
+        else
+        {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    if (paths.empty())
+    {
+        print_usage();
+        return 2;
+    }
+
+    if (per_process)
+    {
+        // Files of the same process, e.g. saved periodically, are merged.
+        std::vector<std::string> labels;
+        std::vector<Snapshot> processes;
+        for (const std::string &path : paths)
+        {
+            Snapshot snapshot;
+            if (!read_profiles(std::vector<std::string>(1, path), snapshot))
+                return 1;
+
+            const std::string label = get_process_label(snapshot);
+            const auto it = std::find(labels.begin(), labels.end(), label);
+            if (it != labels.end())
+            {
+                processes[it - labels.begin()].merge(snapshot);
+            }
+            else
+            {
+                labels.push_back(label);
+                processes.push_back(snapshot);
+            }
+        }
+
+        std::vector<std::vector<MultiMeasurement>> measurements;
+        for (const Snapshot &process : processes)
+            measurements.push_back(merge_threads(process));
+
+        SpreadPrinter(labels, measurements).print();
+        return 0;
+    }
+
+    Snapshot candidate;
+    if (!read_profiles(paths, candidate))
+        return 1;
+
+    if (baseline_paths.empty())
+    {
+        time_profiler::TimeProfiler::write_report(std::cout, candidate, options);
+        return 0;
+    }
+
+    Snapshot baseline;
+    if (!read_profiles(baseline_paths, baseline))
+        return 1;
+
+    DiffPrinter(merge_threads(baseline), merge_threads(candidate)).print();
+    return 0;
+}
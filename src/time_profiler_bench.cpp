@@ -0,0 +1,257 @@
+#ifndef USE_PROFILER
+#define USE_PROFILER 1
+#endif
+
+// Count every allocation of the program, including those of the profiler,
+// which TIME_PROFILER_ALLOCATIONS would exclude.
+#define TIME_PROFILER_DEFINE_ALLOCATION_HOOKS
+#include "time_profiler.h"
+
+#include <atomic>
+#include <cstdio>
+#include <streambuf>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Benchmarks of the overhead of the profiler itself.
+// Prints one JSON object per benchmark to stdout, so that results can be
+// compared between releases. The statistics the profiler prints on exit are
+// suppressed.
+
+namespace
+{
+    /// Stream buffer that discards everything.
+    class NullBuffer : public std::streambuf
+    {
+    protected:
+        int overflow(int c) override
+        {
+            return c;
+        }
+    };
+
+    /// Replaces the buffer of std::cerr. Constructed before the profiler, so
+    /// it outlives the report printed when the profiler is destroyed.
+    NullBuffer null_buffer;
+
+    /// Category of the hooks that are switched off.
+    constexpr time_profiler::Category bench_category("bench", 0);
+
+    /// Counts the last level cache misses of the calling thread, if the
+    /// kernel permits it.
+    class CacheMissCounter
+    {
+    private:
+        int fd_;
+
+    public:
+        CacheMissCounter()
+            : fd_(-1)
+        {
+#if defined(__linux__)
+            perf_event_attr attr = {};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+        }
+
+        ~CacheMissCounter()
+        {
+#if defined(__linux__)
+            if (fd_ >= 0)
+                close(fd_);
+#endif
+        }
+
+        bool is_available() const
+        {
+            return fd_ >= 0;
+        }
+
+        void start()
+        {
+#if defined(__linux__)
+            if (fd_ >= 0)
+            {
+                ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        }
+
+        std::uint64_t stop()
+        {
+            std::uint64_t count = 0;
+#if defined(__linux__)
+            if (fd_ >= 0)
+            {
+                ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fd_, &count, sizeof(count)) != sizeof(count))
+                    count = 0;
+            }
+#endif
+            return count;
+        }
+    };
+
+    /// Result of a benchmark.
+    struct Result
+    {
+        std::string name;
+        int sites;
+        std::uint64_t operations;
+        double nanoseconds;
+        std::uint64_t allocations;
+        bool has_cache_misses;
+        std::uint64_t cache_misses;
+    };
+
+    /// Measures the given function, which performs the given number of
+    /// operations, on a new thread, so that it starts with an empty thread
+    /// profile.
+    template <typename Function>
+    Result measure(const std::string &name, int sites, std::uint64_t operations, Function function)
+    {
+        Result result{name, sites, operations, 0.0, 0, false, 0};
+        std::thread thread([&]()
+                           {
+                               // Warm up: registers the thread and the pairs of sites.
+                               function();
+
+                               CacheMissCounter cache_misses;
+                               const std::int64_t allocations = time_profiler::AllocationCounter::now().allocations;
+                               cache_misses.start();
+                               const auto start = std::chrono::steady_clock::now();
+                               function();
+                               const auto end = std::chrono::steady_clock::now();
+                               result.cache_misses = cache_misses.stop();
+                               result.has_cache_misses = cache_misses.is_available();
+                               result.allocations = static_cast<std::uint64_t>(
+                                   time_profiler::AllocationCounter::now().allocations - allocations);
+                               result.nanoseconds = std::chrono::duration<double, std::nano>(end - start).count(); });
+        thread.join();
+
+        return result;
+    }
+
+    /// Prints the result as a JSON object.
+    void print(const Result &result, bool last)
+    {
+        std::printf("  {\"benchmark\": \"%s\", \"sites\": %d, \"operations\": %llu, "
+                    "\"ns_per_op\": %.3f, \"allocations_per_op\": %.6f, \"cache_misses_per_op\": ",
+                    result.name.c_str(), result.sites,
+                    static_cast<unsigned long long>(result.operations),
+                    result.nanoseconds / result.operations,
+                    static_cast<double>(result.allocations) / result.operations);
+        if (result.has_cache_misses)
+            std::printf("%.6f", static_cast<double>(result.cache_misses) / result.operations);
+        else
+            std::printf("null");
+        std::printf("}%s\n", last ? "" : ",");
+    }
+
+    /// Registers the given number of distinct sites.
+    std::vector<std::uint32_t> register_sites(int count)
+    {
+        std::vector<std::uint32_t> site_ids;
+        for (int line = 1; line <= count; line++)
+            site_ids.push_back(time_profiler::SiteRegistry::register_site("bench_sites.cpp", line, "bench").id);
+
+        return site_ids;
+    }
+} // namespace
+
+int main()
+{
+    using time_profiler::TimeProfiler;
+
+    std::cerr.rdbuf(&null_buffer);
+
+    const std::uint64_t hits = 10000000;
+    std::vector<Result> results;
+
+    // Loop without hooks. This is what a hook costs when compiled with
+    // USE_PROFILER 0, since the macro expands to nothing.
+    results.push_back(measure("disabled", 1, hits, [&]()
+                              {
+                                  for (std::uint64_t i = 0; i < hits; i++)
+                                  {
+                                      std::atomic_signal_fence(std::memory_order_seq_cst);
+                                  } }));
+
+    // A single hook in a loop, i.e. always the same pair of checkpoints.
+    results.push_back(measure("tick", 1, hits, [&]()
+                              {
+                                  for (std::uint64_t i = 0; i < hits; i++)
+                                  {
+                                      PROFILER_HOOK();
+                                  } }));
+
+    // The same hook, timing one hit out of 100.
+    TimeProfiler::set_sampling(time_profiler::SamplingPolicy::every_nth(100));
+    results.push_back(measure("tick_sampled", 1, hits, [&]()
+                              {
+                                  for (std::uint64_t i = 0; i < hits; i++)
+                                  {
+                                      PROFILER_HOOK();
+                                  } }));
+    TimeProfiler::set_sampling(time_profiler::SamplingPolicy::every_hit());
+
+    // A hook of a category that is switched off at run time.
+    TimeProfiler::set_category_enabled("bench", false);
+    results.push_back(measure("category_disabled", 1, hits, [&]()
+                              {
+                                  for (std::uint64_t i = 0; i < hits; i++)
+                                  {
+                                      PROFILER_HOOK_CAT(bench_category);
+                                  } }));
+    TimeProfiler::set_category_enabled("bench", true);
+
+    // A named hook with a few labels, which are looked up on every hit.
+    const char *const labels[] = {"get", "put", "delete", "scan"};
+    results.push_back(measure("tick_named", 4, hits, [&]()
+                              {
+                                  for (std::uint64_t i = 0; i < hits; i++)
+                                  {
+                                      PROFILER_HOOK_NAMED(labels[i % 4]);
+                                  } }));
+
+    // Many distinct sites hit round robin, i.e. as many distinct pairs.
+    for (int sites : {100, 10000})
+    {
+        const std::vector<std::uint32_t> site_ids = register_sites(sites);
+        results.push_back(measure("tick", sites, hits, [&]()
+                                  {
+                                      for (std::uint64_t i = 0; i < hits; i++)
+                                          TimeProfiler::tick(site_ids[i % site_ids.size()]); }));
+    }
+
+    // Generating the report of all pairs recorded so far.
+    results.push_back(measure("report", 10000, 1, []()
+                              { TimeProfiler::print_statistics(); }));
+
+    // The same report, limited to the 20 pairs that took the most time.
+    time_profiler::ReportOptions report_options;
+    report_options.top_n = 20;
+    TimeProfiler::set_report_options(report_options);
+    results.push_back(measure("report_top", 10000, 1, []()
+                              { TimeProfiler::print_statistics(); }));
+    TimeProfiler::set_report_options(time_profiler::ReportOptions());
+
+    std::printf("{\"clock\": \"%s\", \"results\": [\n", time_profiler::Clock::name());
+    for (std::size_t i = 0; i < results.size(); i++)
+        print(results[i], i + 1 == results.size());
+    std::printf("]}\n");
+
+    return 0;
+}
@@ -0,0 +1,258 @@
+#ifndef USE_PROFILER
+#define USE_PROFILER 1
+#endif
+
+#include "time_profiler.h"
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+// Checks of the snapshots and profile files, run by CTest:
+// - a profile file written and read again yields the same statistics,
+// - merging snapshots keeps the threads of different processes apart,
+// - subtracting an earlier snapshot leaves the segments recorded since then,
+// - copies of the statistics taken while a thread records are consistent.
+// Prints every failed check and exits with 1 if any failed.
+
+namespace
+{
+    using time_profiler::MultiMeasurement;
+    using time_profiler::Snapshot;
+    using time_profiler::ThreadSnapshot;
+    using time_profiler::TimeProfiler;
+
+    /// Number of failed checks.
+    int failure_count = 0;
+
+    /// Counts and prints a failed check.
+    void check(bool condition, const char *check_name, const std::string &detail = std::string())
+    {
+        if (condition)
+            return;
+
+        failure_count++;
+        std::fprintf(stderr, "FAILED: %s%s%s\n", check_name, detail.empty() ? "" : ": ", detail.c_str());
+    }
+
+    /// Returns the sum of the counts of all measurements of a thread.
+    std::int64_t get_count(const ThreadSnapshot &thread)
+    {
+        std::int64_t count = 0;
+        for (const MultiMeasurement &measurement : thread.measurements)
+            count += measurement.count();
+
+        return count;
+    }
+
+    /// Returns the thread of the given process with the given index, or
+    /// \c nullptr.
+    const ThreadSnapshot *find_thread(const Snapshot &snapshot, long process_id, std::uint32_t index)
+    {
+        for (const ThreadSnapshot &thread : snapshot.get_threads())
+        {
+            if (thread.process_id == process_id && thread.index == index)
+                return &thread;
+        }
+
+        return nullptr;
+    }
+
+    /// Returns the measurement of the given pair of a thread, or \c nullptr.
+    const MultiMeasurement *find_measurement(const ThreadSnapshot &thread, const MultiMeasurement &pair)
+    {
+        for (const MultiMeasurement &measurement : thread.measurements)
+        {
+            if (measurement.get_start_site_id() == pair.get_start_site_id() &&
+                measurement.get_end_site_id() == pair.get_end_site_id())
+                return &measurement;
+        }
+
+        return nullptr;
+    }
+
+    /// Hits a pair of checkpoints the given number of times.
+    void record(int hits)
+    {
+        volatile int work = 0;
+        for (int i = 0; i < hits; i++)
+        {
+            PROFILER_HOOK();
+            for (int k = 0; k < i % 100; k++)
+                work = work + k;
+            PROFILER_HOOK();
+        }
+    }
+
+    /// Writes the given snapshot to a profile file, reads it again and
+    /// compares the statistics of every pair of checkpoints.
+    void check_round_trip(const Snapshot &snapshot, const std::string &path)
+    {
+        check(time_profiler::ProfileFile::write(path, snapshot), "profile file written", path);
+
+        time_profiler::ProfileFile file;
+        if (!file.open(path))
+        {
+            check(false, "profile file opened", file.get_error());
+            return;
+        }
+
+        const Snapshot read = file.get_snapshot();
+        std::remove(path.c_str());
+        check(read.get_process_id() == snapshot.get_process_id(), "process kept");
+        check(read.get_overhead() == snapshot.get_overhead(), "overhead kept");
+        check(read.get_threads().size() == snapshot.get_threads().size(), "threads kept");
+        for (const ThreadSnapshot &thread : snapshot.get_threads())
+        {
+            const ThreadSnapshot *read_thread = find_thread(read, thread.process_id, thread.index);
+            if (read_thread == nullptr)
+            {
+                check(false, "thread kept", std::to_string(thread.index));
+                continue;
+            }
+
+            check(read_thread->measurements.size() == thread.measurements.size(), "pairs kept");
+            for (const MultiMeasurement &measurement : thread.measurements)
+            {
+                const MultiMeasurement *read_measurement = find_measurement(*read_thread, measurement);
+                if (read_measurement == nullptr)
+                {
+                    check(false, "pair kept");
+                    continue;
+                }
+
+                check(read_measurement->count() == measurement.count(), "count kept");
+                check(read_measurement->timed_count() == measurement.timed_count(), "timed count kept");
+                check(read_measurement->get_measured_duration() == measurement.get_measured_duration(),
+                      "duration kept");
+                check(read_measurement->get_min_duration() == measurement.get_min_duration(), "minimum kept");
+                check(read_measurement->get_max_duration() == measurement.get_max_duration(), "maximum kept");
+                check(read_measurement->get_histogram().get_total_count() ==
+                          measurement.get_histogram().get_total_count(),
+                      "histogram kept");
+                check(read_measurement->get_percentile(0.9) == measurement.get_percentile(0.9), "percentile kept");
+            }
+        }
+    }
+
+    /// Merges a snapshot with itself and with a copy of it from another
+    /// process.
+    void check_merge(const Snapshot &snapshot)
+    {
+        Snapshot doubled(snapshot);
+        doubled.merge(snapshot);
+        check(doubled.get_threads().size() == snapshot.get_threads().size(), "threads of a process merged");
+        for (const ThreadSnapshot &thread : snapshot.get_threads())
+        {
+            const ThreadSnapshot *merged = find_thread(doubled, thread.process_id, thread.index);
+            check(merged != nullptr && get_count(*merged) == 2 * get_count(thread), "counts of a process added");
+        }
+
+        const long other_process_id = snapshot.get_process_id() + 1;
+        Snapshot other(snapshot.get_start_time(), snapshot.get_end_time());
+        other.set_process(other_process_id, "other");
+        for (ThreadSnapshot thread : snapshot.get_threads())
+        {
+            thread.process_id = 0;
+            other.add_thread(thread);
+        }
+
+        Snapshot combined(snapshot);
+        combined.merge(other);
+        check(combined.get_process_id() == 0, "merged processes unknown");
+        check(combined.get_threads().size() == 2 * snapshot.get_threads().size(), "threads of processes apart");
+        for (const ThreadSnapshot &thread : snapshot.get_threads())
+        {
+            const ThreadSnapshot *own = find_thread(combined, thread.process_id, thread.index);
+            const ThreadSnapshot *foreign = find_thread(combined, other_process_id, thread.index);
+            check(own != nullptr && get_count(*own) == get_count(thread), "counts of a process kept");
+            check(foreign != nullptr && get_count(*foreign) == get_count(thread), "counts of another process kept");
+        }
+    }
+
+    /// Subtracts an earlier snapshot from a later one.
+    void check_subtract(const Snapshot &earlier, const Snapshot &later, long hits)
+    {
+        const Snapshot difference = later.subtract(earlier);
+        const ThreadSnapshot *thread = find_thread(difference, earlier.get_process_id(), 0);
+        check(thread != nullptr, "thread in difference");
+        if (thread == nullptr)
+            return;
+
+        // The pair of the loop and the pair from its end back to its start.
+        std::int64_t loop_count = 0;
+        for (const MultiMeasurement &measurement : thread->measurements)
+            loop_count = std::max(loop_count, measurement.count());
+        check(loop_count == hits, "difference of counts", std::to_string(loop_count));
+    }
+
+    /// Copies the statistics while another thread records and checks that
+    /// the histogram of every copy matches its count.
+    void check_copies()
+    {
+        std::atomic<bool> stop(false);
+        std::thread recorder([&stop]()
+                             {
+                                 while (!stop.load())
+                                     record(100); });
+
+        const int snapshot_count = 2000;
+        std::int64_t copy_count = 0;
+        std::int64_t torn_count = 0;
+        for (int i = 0; i < snapshot_count; i++)
+        {
+            const Snapshot snapshot = TimeProfiler::take_snapshot();
+            for (const ThreadSnapshot &thread : snapshot.get_threads())
+            {
+                // Only the recorder changes its statistics meanwhile.
+                if (!thread.running || thread.index == 0)
+                    continue;
+
+                for (const MultiMeasurement &measurement : thread.measurements)
+                {
+                    copy_count++;
+                    if (static_cast<std::int64_t>(measurement.get_histogram().get_total_count()) !=
+                        measurement.timed_count())
+                        torn_count++;
+                }
+            }
+        }
+
+        stop.store(true);
+        recorder.join();
+
+        // An update that keeps overlapping every retry is still copied, so a
+        // few torn copies are tolerated.
+        check(torn_count * 100 <= copy_count, "consistent copies",
+              std::to_string(torn_count) + " of " + std::to_string(copy_count) + " torn");
+    }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const std::string path = argc > 1 ? argv[1] : "time_profiler_check.tpprof";
+
+    record(1000);
+    std::thread([]()
+                { record(500); })
+        .join();
+
+    const Snapshot snapshot = TimeProfiler::take_snapshot();
+    check(snapshot.get_threads().size() == 2, "threads recorded");
+    check_round_trip(snapshot, path);
+    check_merge(snapshot);
+
+    record(300);
+    check_subtract(snapshot, TimeProfiler::take_snapshot(), 300);
+
+    check_copies();
+
+    if (failure_count > 0)
+    {
+        std::fprintf(stderr, "%d checks failed\n", failure_count);
+        return 1;
+    }
+
+    std::printf("All checks passed\n");
+    return 0;
+}
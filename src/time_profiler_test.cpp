@@ -7,6 +7,7 @@
 // Example function.
 double function()
 {
+    PROFILER_SCOPE("function");
     double c = 1.2e24;
     PROFILER_HOOK();
     for (int x = 0; x < 1e8; ++x)
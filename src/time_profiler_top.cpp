@@ -0,0 +1,294 @@
+#include "time_profiler.h"
+
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+
+// Live viewer of the statistics a process publishes with
+// TimeProfiler::start_export(). Attaches to the shared-memory segment and
+// refreshes a table of the pairs of checkpoints, sorted by the time they
+// took during the last interval.
+
+namespace
+{
+    using time_profiler::SharedStats;
+
+    /// Prints the live view of the published statistics.
+    class TopPrinter : public time_profiler::Printer
+    {
+    private:
+        /// Statistics of a pair in the current and in the previous state.
+        /// A pair that is new since the previous state has no changes: its
+        /// totals may have been recorded over any time before it was
+        /// published.
+        struct Entry
+        {
+            const SharedStats::PairRecord *current;
+            SharedStats::PairRecord previous;
+            bool is_new;
+        };
+
+        static const int line_width = 186;
+        static const int site_col_width = 40;
+        static const int rate_col_width = 12;
+        static const int percent_col_width = 9;
+        static const int count_col_width = 14;
+        static const int duration_col_width = 12;
+
+        /// Sites of the current state, by ID.
+        std::map<std::uint32_t, SharedStats::SiteRecord> sites_;
+
+        /// Pairs sorted by the time they took since the previous state.
+        std::vector<Entry> entries_;
+
+        /// Length of the interval since the previous state.
+        /// Unit: [s].
+        double interval_;
+
+        /// Header of the current state.
+        SharedStats::Header header_;
+
+    public:
+        /// Constructor.
+        /// Computes the changes of the pairs between both states.
+        TopPrinter(const SharedStats::Header &header, const std::vector<SharedStats::PairRecord> &pairs,
+                   const std::vector<SharedStats::SiteRecord> &sites,
+                   const std::map<std::uint64_t, SharedStats::PairRecord> &previous, std::int64_t previous_time)
+            : interval_(std::max(1e-9, static_cast<double>(header.update_time - previous_time) * 1e-9))
+        {
+            std::memcpy(static_cast<void *>(&header_), &header, sizeof(header_));
+            for (const SharedStats::SiteRecord &site : sites)
+                sites_[site.id] = site;
+
+            // Without a previous state, the changes are those since the
+            // process started.
+            for (const SharedStats::PairRecord &pair : pairs)
+            {
+                const auto it = previous.find(get_key(pair));
+                if (it != previous.end())
+                    entries_.push_back(Entry{&pair, it->second, false});
+                else
+                    entries_.push_back(Entry{&pair, SharedStats::PairRecord{}, !previous.empty()});
+            }
+
+            std::stable_sort(entries_.begin(), entries_.end(), [this](const Entry &lhs, const Entry &rhs)
+                             { return get_duration(lhs) > get_duration(rhs); });
+        }
+
+        /// Returns the key of a pair, as in time_profiler::MultiMeasurement.
+        static std::uint64_t get_key(const SharedStats::PairRecord &pair)
+        {
+            return (static_cast<std::uint64_t>(pair.start_site) << 32) | pair.end_site;
+        }
+
+        /// Creates the view, limited to the given number of pairs.
+        std::string create_view(std::size_t rows) const
+        {
+            const auto now = std::chrono::system_clock::now().time_since_epoch();
+            const double uptime = static_cast<double>(header_.update_time - header_.start_time) * 1e-9;
+            const double age = static_cast<double>(
+                                   std::chrono::duration_cast<std::chrono::nanoseconds>(now).count() - header_.update_time) *
+                               1e-9;
+
+            std::stringstream stream;
+            stream << "Process " << header_.process_id << ", up " << std::fixed << std::setprecision(1) << uptime
+                   << " s, " << header_.pair_count << " pairs";
+            if (header_.dropped_pair_count > 0)
+                stream << " (" << header_.dropped_pair_count << " not published)";
+            stream << ", updated " << std::setprecision(1) << age << " s ago, interval " << std::setprecision(2)
+                   << interval_ << " s" << std::endl;
+
+            stream << create_hline('=', line_width)
+                   << std::setfill(' ')
+                   << std::setw(site_col_width) << std::left << "Start"
+                   << "|" << std::setw(site_col_width) << std::left << "End"
+                   << "|" << std::setw(rate_col_width) << std::right << "Hits/s"
+                   << "|" << std::setw(percent_col_width) << std::right << "Time %"
+                   << "|" << std::setw(duration_col_width) << std::right << "Avg [ns]"
+                   << "|" << std::setw(count_col_width) << std::right << "Count"
+                   << "|" << std::setw(duration_col_width) << std::right << "p50 [ns]"
+                   << "|" << std::setw(duration_col_width) << std::right << "p99 [ns]"
+                   << "|" << std::setw(duration_col_width) << std::right << "Max [ns]"
+                   << std::endl
+                   << create_hline('=', line_width);
+
+            for (std::size_t i = 0; i < entries_.size() && i < rows; i++)
+                stream << create_entry(entries_[i]);
+
+            stream << create_hline('=', line_width)
+                   << "Hits/s, Time % and Avg refer to the last interval; Time % is the share of the wall time, "
+                      "summed over all threads. The other columns cover the whole run. Pairs published for "
+                      "the first time are marked new until the next interval."
+                   << std::endl;
+            if (header_.tick_overhead > 0)
+                stream << "Overhead: the profiler's own cost of " << header_.tick_overhead
+                       << " ns per segment is subtracted from all durations." << std::endl;
+
+            return stream.str();
+        }
+
+    private:
+        /// Returns the time the pair took since the previous state, without
+        /// the overhead of the profiler per segment.
+        /// Unit: [ns].
+        std::int64_t get_duration(const Entry &entry) const
+        {
+            if (entry.is_new)
+                return 0;
+
+            const std::int64_t count = entry.current->count - entry.previous.count;
+            const std::int64_t duration = entry.current->overall_duration - entry.previous.overall_duration;
+            return std::max<std::int64_t>(0, duration - header_.tick_overhead * count);
+        }
+
+        /// Formats a site as file:line function.
+        std::string format_site(std::uint32_t site_id) const
+        {
+            const auto it = sites_.find(site_id);
+            if (it == sites_.end())
+                return "?";
+
+            return crop_path(it->second.file) + ":" + std::to_string(it->second.line) + " " + it->second.function;
+        }
+
+        /// Generates the line of a pair.
+        std::string create_entry(const Entry &entry) const
+        {
+            const SharedStats::PairRecord &pair = *entry.current;
+            const std::int64_t count = pair.count - entry.previous.count;
+            const std::int64_t duration = get_duration(entry);
+
+            std::string start = format_site(pair.start_site);
+            std::string end = format_site(pair.end_site);
+            start.resize(std::min<std::size_t>(start.size(), site_col_width));
+            end.resize(std::min<std::size_t>(end.size(), site_col_width));
+
+            std::stringstream stream;
+            stream << std::setfill(' ')
+                   << std::setw(site_col_width) << std::left << start
+                   << "|" << std::setw(site_col_width) << std::left << end;
+            if (entry.is_new)
+            {
+                stream << "|" << std::setw(rate_col_width) << std::right << "new"
+                       << "|" << std::setw(percent_col_width) << std::right << "-"
+                       << "|" << std::setw(duration_col_width) << std::right << "-";
+            }
+            else
+            {
+                stream << "|" << std::setw(rate_col_width) << std::right
+                       << insert_separators(std::llround(static_cast<double>(count) / interval_))
+                       << "|" << std::setw(percent_col_width) << std::right << std::fixed << std::setprecision(2)
+                       << static_cast<double>(duration) * 1e-7 / interval_
+                       << "|" << std::setw(duration_col_width) << std::right
+                       << (count > 0 ? insert_separators(duration / count) : std::string("-"));
+            }
+            stream << "|" << std::setw(count_col_width) << std::right << insert_separators(pair.count)
+                   << "|" << std::setw(duration_col_width) << std::right << insert_separators(pair.p50_duration)
+                   << "|" << std::setw(duration_col_width) << std::right << insert_separators(pair.p99_duration)
+                   << "|" << std::setw(duration_col_width) << std::right << insert_separators(pair.max_duration)
+                   << std::endl;
+
+            return stream.str();
+        }
+    };
+
+    /// Whether the viewer was interrupted.
+    volatile std::sig_atomic_t interrupted = 0;
+
+    void print_usage()
+    {
+        std::fprintf(stderr,
+                     "Usage: time_profiler_top [--interval MS] [--rows N] [--iterations N] PID|NAME\n"
+                     "\n"
+                     "Attaches to the statistics a process publishes with TimeProfiler::start_export()\n"
+                     "and refreshes the pairs of checkpoints that took the most time in every\n"
+                     "interval, 1000 ms by default. NAME is the name of the shared-memory segment,\n"
+                     "\"/time_profiler_<PID>\" by default. Runs until interrupted, or for the given\n"
+                     "number of iterations.\n");
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    long interval = 1000;
+    std::size_t rows = 40;
+    long iterations = 0;
+    std::string name;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--interval") == 0 && i + 1 < argc)
+        {
+            interval = std::max(10L, std::atol(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--rows") == 0 && i + 1 < argc)
+        {
+            rows = static_cast<std::size_t>(std::max(1L, std::atol(argv[++i])));
+        }
+        else if (std::strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+        {
+            iterations = std::atol(argv[++i]);
+        }
+        else if (argv[i][0] == '-' || !name.empty())
+        {
+            print_usage();
+            return std::strcmp(argv[i], "--help") == 0 ? 0 : 2;
+        }
+        else
+        {
+            name = argv[i];
+        }
+    }
+
+    if (name.empty())
+    {
+        print_usage();
+        return 2;
+    }
+    if (name.find_first_not_of("0123456789") == std::string::npos)
+        name = SharedStats::get_default_name(std::atol(name.c_str()));
+
+    SharedStats stats;
+    if (!stats.open(name))
+    {
+        std::fprintf(stderr, "time_profiler_top: %s\n", stats.get_error().c_str());
+        return 1;
+    }
+
+    std::signal(SIGINT, [](int)
+                { interrupted = 1; });
+    const bool terminal = isatty(STDOUT_FILENO) != 0;
+
+    // Start with the averages since the process started.
+    std::map<std::uint64_t, SharedStats::PairRecord> previous;
+    std::int64_t previous_time = 0;
+    SharedStats::Header header;
+    std::vector<SharedStats::PairRecord> pairs;
+    std::vector<SharedStats::SiteRecord> sites;
+    for (long iteration = 0; !interrupted && (iterations <= 0 || iteration < iterations); iteration++)
+    {
+        if (iteration > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+
+        if (!stats.read(header, pairs, sites))
+            continue;
+        if (::kill(static_cast<pid_t>(header.process_id), 0) != 0 && errno == ESRCH)
+        {
+            std::fprintf(stderr, "time_profiler_top: process %u exited\n", header.process_id);
+            return 0;
+        }
+        if (iteration == 0)
+            previous_time = header.start_time;
+        if (header.update_time == previous_time && iteration > 0)
+            continue;
+
+        const TopPrinter printer(header, pairs, sites, previous, previous_time);
+        std::cout << (terminal ? "\033[H\033[J" : "") << printer.create_view(rows) << std::flush;
+
+        previous.clear();
+        for (const SharedStats::PairRecord &pair : pairs)
+            previous[TopPrinter::get_key(pair)] = pair;
+        previous_time = header.update_time;
+    }
+
+    return 0;
+}